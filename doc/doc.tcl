@@ -16,6 +16,8 @@ namespace eval iocp {
 
         * The `iocp_inet` package implements communication channels over TCP/IP.
 
+        * The `iocp_udp` package implements UDP datagram channels.
+
         * The `iocp_bt` package implements Bluetooth channels (currently client-only)
         along with supporting commands for device and service discovery.
 
@@ -58,21 +60,203 @@ namespace eval iocp::inet {
         # The only functional enhancement offered by this command is
         # significantly improved performance with reduced CPU load.
         #
+        # The command accepts the following options in addition to those of
+        # the Tcl `socket` command.
+        #
+        #  -connecttimeout MS - If non-zero, the connect fails with a timeout
+        #    error if it has not completed within this many milliseconds,
+        #    including the time taken to resolve the host name and to try
+        #    each of its addresses. For `-async` sockets the failure is
+        #    reported through the `-error` option as for other connect
+        #    failures. Client sockets only. Defaults to 0 (no timeout).
+        #  -rio BOOL - If true, data transfer on the socket uses Winsock
+        #    Registered I/O which reduces per-operation overhead. For
+        #    server sockets it applies to all accepted connections. The
+        #    option is silently ignored on systems where Registered I/O is
+        #    not available (Windows 7 and earlier). Defaults to false.
+        #  -threadinit SCRIPT - Script evaluated in the interpreter of each
+        #    worker thread created with `-threads` before any connections are
+        #    handed to it. This is where the procedures used by the accept
+        #    script should be defined. An error in the script fails the
+        #    `socket` command. Server sockets only.
+        #  -threads COUNT - If greater than 0, COUNT worker threads are
+        #    created, each with its own interpreter. Every accepted connection
+        #    is handed to the worker with the fewest open connections and the
+        #    accept callback is run in that worker's interpreter. The channel
+        #    is created directly in the worker thread, so it does not have to
+        #    be transferred between threads. Workers exit after the listening
+        #    socket is closed and all their connections have been closed.
+        #    Server sockets only. Defaults to 0, which runs the accept
+        #    callback in the calling thread.
+        #  -tls OPTS - Secures the connection with TLS using the Windows
+        #    Schannel provider. OPTS is a list of option value pairs which
+        #    may be empty. The `-servername NAME` option sets the name sent
+        #    to the server and checked against its certificate and defaults
+        #    to the host argument. The `-verify BOOL` option controls
+        #    whether the server certificate is validated and defaults to
+        #    true. Records are encrypted and decrypted directly in the
+        #    socket buffers and sessions are resumed on reconnects to the
+        #    same server. Client sockets only. Cannot be combined with
+        #    `-rio`.
+        #
+        # The TLS handshake is completed before a blocking `socket` command
+        # returns. For `-async` sockets it is carried out in the background
+        # once the connection completes, the channel becoming writable when
+        # the handshake finishes. Handshake failures are reported as
+        # connection failures. Renegotiation is not supported. TLS sockets
+        # do not support [sendfile].
+        #
+        # With `-async`, the remote host name is resolved on a system thread
+        # pool thread and the command returns without waiting for the
+        # lookup. Resolution failures are then reported through the
+        # `-error` option once the channel becomes writable. Resolved
+        # remote addresses may be cached for a period set with the
+        # `-dnscachettl` option of `iocp::configure` (milliseconds,
+        # default 0 which disables caching).
+        #
+        # The addresses returned by the `-peername` and `-sockname`
+        # configuration options are retrieved once per connection. The
+        # reverse lookup of the host name is done on a thread pool thread
+        # when first requested. The options never wait for it. The numeric
+        # address is returned in place of the host name until the lookup
+        # completes, so the first query on a connection usually returns
+        # it unless the name is cached, and later ones do too if the
+        # lookup fails. When `::tcl::unsupported::noReverseDNS` is set, no
+        # lookup is started and the numeric address is always returned.
+        # Host names are kept for the life of the connection and, when
+        # `-dnscachettl` is set, cached across connections as well.
+        #
+        # When a host name resolves to more than one address, client
+        # connects race the addresses as described in RFC 8305 for both
+        # blocking and `-async` sockets. An attempt to the next address,
+        # alternating between IPv6 and IPv4, is started if the previous
+        # attempt has neither succeeded nor failed within the delay set
+        # with the `-connectdelay` option of `iocp::configure`
+        # (milliseconds, default 250). The first connection to succeed is
+        # kept and the others are closed. A delay of 0 tries addresses one
+        # after another instead.
+        #
         # In addition to the standard configuration options supported
         # by the Tcl `socket` command, the following additional configuration
         # options are supported through the Tcl `fconfigure` and
         # `chan configure` commands. They can be read as well as set.
         #
+        #  -acceptreadsize BYTES - If non-zero, incoming connections on a
+        #    listening socket are only accepted once the client has sent
+        #    data and up to this many bytes of it are received along with
+        #    the connection. This saves a round trip through the event loop
+        #    for protocols, like HTTP, where the client speaks first. It
+        #    must not be used for protocols where the server speaks first
+        #    as such connections would never be accepted. Listening socket
+        #    only. Defaults to 0.
+        #  -connecttimeout MS - Connect timeout of the socket. Setting it
+        #    while an `-async` connect is in progress restarts the timeout
+        #    from the current time and 0 cancels it. Has no effect once
+        #    connected. See the `socket` option of the same name.
+        #  -idletimeout MS - Number of milliseconds without incoming data
+        #    after which a socket in `auto` read mode switches to zero-byte
+        #    reads. When set on a listening socket, it applies to
+        #    subsequently accepted connections. Defaults to 30000. This
+        #    does not close or fail idle connections. Use `-readtimeout`
+        #    for that.
+        #  -inlinecompletion BOOL - If true, I/O operations that complete
+        #    immediately are processed in the calling thread without going
+        #    through the completion port. This lowers latency for
+        #    request-response traffic. Once enabled on a connected socket it
+        #    cannot be disabled. When set on a listening socket, it applies to
+        #    subsequently accepted connections. Defaults to false.
         #  -keepalive BOOL - Controls the socket `SO_KEEPALIVE` option.
+        #  -maxinputbytes BYTES - Number of bytes of received data waiting to
+        #    be read by the application beyond which no further receives are
+        #    posted on the socket. TCP flow control then slows down the
+        #    sender. Receives resume once the queued data drains to half this
+        #    value. Receives are also held back while the data queued across
+        #    all sockets exceeds the limit set with
+        #    `iocp::configure -maxinputbytes`. 0 disables the limit. Defaults
+        #    to 1048576.
         #  -maxpendingaccepts COUNT - Maximum number of pending accepts to post
-        #    on the socket (listening socket only).
+        #    on the socket (listening socket only). The number of accepts kept
+        #    outstanding adapts to the rate of incoming connections between
+        #    `-minpendingaccepts` and this value. Defaults to 64.
         #  -maxpendingreads COUNT - Maximum number of pending reads to post
         #    on the socket.
-        #  -maxpendingwrites COUNT - Maximum number of pending writes to post
-        #    on the socket.
+        #  -maxpendingwrites COUNT - Maximum number of sends outstanding on
+        #    the socket. Further writes are queued up to `-writehighwater`.
+        #  -maxspinwait USECS - Upper limit in microseconds on the time a
+        #    blocking read, write or connect busy-waits for the operation to
+        #    complete before the thread sleeps. The time actually spent
+        #    spinning adapts to how long recent waits on the socket took and
+        #    no spinning is done once waits routinely exceed the limit. 0
+        #    disables spinning. Defaults to 50 on multiprocessor systems and
+        #    0 otherwise.
+        #  -minpendingaccepts COUNT - Minimum number of pending accepts to
+        #    keep posted on the socket (listening socket only). Setting one of
+        #    `-minpendingaccepts` and `-maxpendingaccepts` past the other also
+        #    changes the other. Defaults to 5.
         #  -nagle BOOL - Controls the socket `TCL_NODELAY` option
+        #  -readbuffersize BYTES - Size of the buffers posted to receive
+        #    data. If 0 (default), the size and the number of reads kept
+        #    posted (up to `-maxpendingreads`) are adapted to the traffic,
+        #    growing for bulk transfers and shrinking for idle connections.
+        #    Reading the option returns the size currently in use. Not
+        #    applicable to sockets using registered I/O.
+        #  -readmode MODE - How data is received. In `buffered` mode
+        #    (default), buffers are kept posted to the socket for the data
+        #    to be received into. In `zerobyte` mode, only a zero-byte
+        #    read is posted and the data is received once it completes.
+        #    This holds no memory for idle connections at the cost of an
+        #    additional system call per burst of incoming data. The `auto`
+        #    mode uses buffered reads and switches to zero-byte reads once
+        #    the socket has been idle for `-idletimeout`, switching back
+        #    when data arrives. When set on a listening socket, it applies
+        #    to subsequently accepted connections. Only `buffered` is
+        #    supported for sockets using registered I/O.
+        #  -readtimeout MS - If non-zero, a read posted on the socket that
+        #    has received no data for this many milliseconds is cancelled
+        #    and the channel becomes readable with a timeout error
+        #    (`ETIMEDOUT`) which is also reported through `-error`. The
+        #    timeout then restarts, whether or not writes are in progress.
+        #    This also serves as the idle timeout of connections. When set
+        #    on a listening socket, it applies to subsequently accepted
+        #    connections. Also applies to UDP sockets. Not supported for
+        #    sockets using registered I/O. Defaults to 0 (no timeout).
+        #  -recyclepoolsize COUNT - Maximum number of sockets of closed
+        #    connections kept for reuse by subsequent accepts (listening
+        #    socket only). Closing an accepted connection then disconnects
+        #    its socket for reuse instead of closing it, saving the cost
+        #    of socket creation and setup. Reuse may be delayed for
+        #    connections that are closed by the server first. Sockets of
+        #    connections that are still open when the listening socket is
+        #    closed are not kept. Hit rates are reported by `iocp::stats`.
+        #    Not supported with registered I/O. Defaults to 0 (disabled).
         #  -sorcvbuf BUFSIZE - Size of Winsock socket receive buffer.
         #  -sosndbuf BUFSIZE - Size of Winsock socket send buffer.
+        #  -stats - Read-only. Returns a dictionary of counters for the
+        #    channel: `BytesRead`, `BytesWritten`, `ReadOps` and `WriteOps`
+        #    (completed reads and writes), `PendingReads` and
+        #    `PendingWrites` (currently outstanding), `Accepts` (listening
+        #    sockets only), `InputWouldBlock` and `OutputWouldBlock` (reads
+        #    and writes that could not proceed without blocking) and
+        #    `ConnectRetries` (failed connect attempts when multiple
+        #    addresses were tried), `InputBytes` (received data not yet
+        #    read), `InputThrottled` (whether receives are currently held
+        #    back because of `-maxinputbytes`), `InputThrottles` (times
+        #    receives were held back), `SpinWaits` and `SleepWaits`
+        #    (blocking waits satisfied while spinning and by sleeping),
+        #    `SpinMisses` (spins that ended without the operation completing)
+        #    and `SpinWaitEstimate` (the current estimate of the wait time in
+        #    microseconds used to size spins). Process-wide totals are
+        #    returned by `iocp::stats`.
+        #  -tls - Read-only. For sockets opened with `-tls`, returns a
+        #    dictionary with keys `Protocol` (the negotiated TLS version),
+        #    `CipherStrength` (in bits), `Resumed` (whether a previous
+        #    session was resumed) and `ServerName`. Empty for other sockets
+        #    and before the handshake completes.
+        #  -writehighwater BYTES - Number of bytes of written data queued
+        #    or in transit on the socket beyond which further writes block
+        #    (or return with `EAGAIN` for non-blocking sockets). Small writes
+        #    made while sends are outstanding are coalesced and submitted
+        #    together. Defaults to 65536.
         #
         # It is recommended these be left at their default values except
         # in cases where performance needs to be fine tuned for specific
@@ -82,6 +266,129 @@ namespace eval iocp::inet {
         # The returned channel must be closed with the Tcl `close`
         # or `chan close` command.
     }
+
+    proc sendfile {args} {
+        # Sends the contents of a file on a socket.
+        #   -header DATA - Binary data to send before the file contents.
+        #   -trailer DATA - Binary data to send after the file contents.
+        #   sock - Client socket returned by [socket].
+        #   file - Channel for a file opened for reading.
+        #   offset - Offset in the file of the data to send. Defaults to the
+        #     current access position of $file.
+        #   length - Number of bytes to send from the file. 0 (default)
+        #     sends up to the end of the file.
+        #
+        # The data is sent by the system directly from the file with the
+        # Windows `TransmitFile` call. This avoids the copying of file
+        # data through Tcl buffers incurred by `fcopy` and is the
+        # preferred method for serving static content. Any data written
+        # to $sock before the call is sent first. The access position of
+        # $file is not changed and $file may be closed as soon as the
+        # command returns.
+        #
+        # If $sock is blocking, the command returns after the data is sent.
+        # For non-blocking sockets, the command returns once the data is
+        # queued. As for other writes, the data counts towards the
+        # `-writehighwater` limit and writable events are generated once
+        # room is available. At most 2147483646 bytes may be sent in one
+        # call. The command is not supported for sockets using
+        # registered I/O or TLS.
+        #
+        # Returns the number of bytes sent or queued, including the
+        # header and trailer data.
+    }
+}
+
+namespace eval iocp::udp {
+    # Dummy procs to document C commands
+
+    variable _ruff_preamble {
+        The `iocp::udp` namespace implements UDP datagram channels. The
+        package is loaded as
+
+            package require iocp_udp
+
+        Many receives are kept outstanding on each socket so datagrams
+        arriving in bursts are not dropped by the system while the
+        application is busy. Each receive holds one datagram up to
+        `-readbuffersize` bytes (default 2048). Datagrams that are too
+        large, that arrive while more than `-maxinputbytes` of input is
+        waiting to be read, or whose receive failed with an ICMP error
+        caused by an earlier send are dropped. These drops are counted in
+        the `UdpTruncatedDrops`, `UdpOverflowDrops` and `UdpErrorDrops`
+        statistics returned by [::iocp::stats]. Empty datagrams are
+        dropped and counted in `UdpEmptyDrops`.
+
+        The channels may be read and written with the standard Tcl
+        commands, each `puts` sending one datagram and each read returning
+        the payload of received datagrams. The [recv] command additionally
+        returns the source of each datagram and [send] sends multiple
+        datagrams in a single call.
+
+        The `-maxpendingreads` option may be set up to 256 and defaults to
+        16. The `-readbuffersize` option must be between 1024 and 65527.
+        TCP specific options are not supported.
+    }
+
+    proc socket args {
+        # Returns a UDP channel.
+        #   -myaddr ADDR - local address to bind to. Defaults to the
+        #     wildcard address.
+        #   -myport PORT - local port to bind to. Defaults to a port chosen
+        #     by the system.
+        #   host - remote host to which the socket is connected.
+        #   port - remote port to which the socket is connected.
+        #
+        # The command syntax is
+        #
+        #     iocp::udp::socket ?-myaddr ADDR? ?-myport PORT? ?HOST PORT?
+        #
+        # If HOST and PORT are specified, the socket only receives
+        # datagrams from that peer which is also the destination of
+        # datagrams written to the channel. Otherwise, datagrams must be
+        # sent with the `-to` option of [send].
+        #
+        # The channel is configured for binary translation and no
+        # buffering.
+    }
+
+    proc send args {
+        # Sends one or more datagrams.
+        #   -to ADDRESS - destination as a list of host and port. Defaults
+        #     to the connected peer.
+        #   sock - UDP channel returned by [socket].
+        #   datagram - binary payload of a datagram.
+        #
+        # The command syntax is
+        #
+        #     iocp::udp::send ?-to ADDRESS? SOCK DATAGRAM ?DATAGRAM ...?
+        #
+        # All datagrams are posted to the system in one call. If more than
+        # `-writehighwater` bytes are in transit, blocking sockets wait
+        # for earlier datagrams to be sent while non-blocking sockets
+        # return without sending the remaining datagrams.
+        #
+        # An error is raised only if no datagram could be sent.
+        #
+        # Returns the number of datagrams sent.
+    }
+
+    proc recv args {
+        # Returns received datagrams along with their sources.
+        #   sock - UDP channel returned by [socket].
+        #   maxcount - maximum number of datagrams to return. Defaults to 1.
+        #
+        # The command syntax is
+        #
+        #     iocp::udp::recv SOCK ?MAXCOUNT?
+        #
+        # Blocking sockets wait for at least one datagram to arrive.
+        # Non-blocking sockets return an empty list if no datagram is
+        # available.
+        #
+        # Returns a list of at most $maxcount elements, each a list of the
+        # datagram payload, the numeric source address and the source port.
+    }
 }
 
 namespace eval iocp::bt {
@@ -120,6 +427,11 @@ namespace eval iocp::bt {
         devices will not be discovered. The [device printn] command will print
         the information related to each device in human-readable form.
 
+        Device discovery with `-inquire` can take ten seconds or more. The
+        `-command` option runs the discovery in the background and reports
+        each device through a callback as it is found so the event loop is
+        not blocked.
+
         Bluetooth radios on the local system can be enumerated with the
         [radios] command. There is however rarely a need to do this as it
         is not required for a establishing a Bluetooth connection.
@@ -137,6 +449,15 @@ namespace eval iocp::bt {
         [names::print] command will print the list of mnemonics
         and the corresponding UUID's.
 
+        Service discovery requires a round trip to the remote device. The
+        [device port], [device services] and [device service_references]
+        commands accept a `-command` option to carry out the lookup in the
+        background. Service records retrieved from a device can also be
+        cached for a configurable period with the `-servicecachettl` option
+        of the [configure] command. Subsequent lookups for the same device
+        and service class, including port resolution by [socket], are then
+        satisfied without querying the device.
+
         ## Connection establishment
 
         Establishing a Bluetooth connection involves the following steps.
@@ -186,6 +507,11 @@ namespace eval iocp::bt {
         #
         # where `device` is the Bluetooth hardware address of the
         # remote device and `port` is the RFCOMM port (channel).
+        # `port` may also be the UUID of a service class on the device
+        # in which case it is resolved as for [device port]. The
+        # resolution is done synchronously, even with `-async`, unless
+        # the device's service records are in the cache configured
+        # with [configure].
         # The `-async` option has the same effect as in the Tcl
         # [socket](http://www.tcl-lang.org/man/tcl8.6/TclCmd/socket.htm)
         # command. It returns immediately without waiting for the
@@ -218,6 +544,18 @@ namespace eval iocp::bt::sdr {
         set service_classes [iocp::bt::sdr::service_classes $sdr]
         ``````
     }
+
+    proc decode {binsdr} {
+        # Decodes a binary service discovery record
+        # binsdr - a raw Bluetooth service discovery record in binary
+        #       form.
+        #
+        # The returned value should be treated as opaque. The attributes
+        # stored in the record should be accessed with the commands in
+        # the `sdr` namespace.
+        #
+        # Returns a container of attributes stored in the record.
+    }
 }
 
 namespace eval iocp::bt::names {
@@ -240,7 +578,7 @@ proc iocp::Document {outfile args} {
     variable _preamble
 
     set ns [namespace current]
-    set namespaces [list ${ns}::inet ${ns}::bt ${ns}::bt::sdr ${ns}::bt::names]
+    set namespaces [list ${ns}::inet ${ns}::udp ${ns}::bt ${ns}::bt::sdr ${ns}::bt::names]
     ruff::document $namespaces -autopunctuate 1 -excludeprocs {^[_A-Z]} \
         -recurse 0 -preamble $_preamble -pagesplit namespace \
         -navigation fixed -output $outfile -includesource 1 \
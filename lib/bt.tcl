@@ -214,6 +214,7 @@ proc iocp::bt::radio::devices {radio args} {
 proc iocp::bt::devices {args} {
     # Discover Bluetooth devices.
     # -authenticated - filter for authenticated devices
+    # -command CMDPREFIX - run the discovery in the background. See below.
     # -connected     - filter for connected devices
     # -inquire       - issue a new inquiry. Without this option, devices that are
     #                  not already known to the system will not be discovered.
@@ -242,7 +243,29 @@ proc iocp::bt::devices {args} {
     # The filtering options may be specified to limit the devices
     # returned. If none are specified, all devices are returned.
     #
-    # Returns a list of device information dictionaries.
+    # If the `-command` option is specified, the command returns right
+    # away and the discovery, including any inquiry, is carried out in the
+    # background. `CMDPREFIX` is then invoked from the event loop with two
+    # additional arguments, `device` and the device information dictionary,
+    # for each device as it is found. Once discovery completes, it is
+    # invoked with the single additional argument `done` or, if discovery
+    # failed, with the additional arguments `error` and the error message.
+    # No further callbacks are made if `CMDPREFIX` returns a `break` or
+    # raises an error.
+    #
+    # Returns a list of device information dictionaries or an empty
+    # string if `-command` is specified.
+
+    set i [lsearch -exact $args -command]
+    if {$i >= 0} {
+        if {$i == [llength $args]-1} {
+            error "no argument given for -command option"
+        }
+        set cmdprefix [lindex $args $i+1]
+        FindDevicesAsync [list [namespace current]::DevicesCallback $cmdprefix] \
+            {*}[lreplace $args $i $i+1]
+        return
+    }
 
     set pair [FindFirstDevice {*}$args]
     if {[llength $pair] == 0} {
@@ -284,42 +307,46 @@ proc iocp::bt::device::address {name args} {
     return $addresses
 }
 
-proc iocp::bt::device::port {device service_class} {
+proc iocp::bt::device::port {device service_class args} {
     # Resolve the port for a Bluetooth service running over RFCOMM.
     #  device - Bluetooth address or name of a device. If specified as a name,
     #           it must resolve to a single address.
     #  service_class - UUID or name of service class of interest. Note the
     #           service **name** cannot be used for lookup.
+    #  -command CMDPREFIX - Resolve the port in the background. See below.
+    #  -flushcache - Query the device even if its service records are
+    #           in the cache configured with [::iocp::bt::configure].
     #
     # In case multiple services of the same service class are available on the
     # device, the port for the first one discovered is returned.
     #
+    # If the `-command` option is specified, the command returns right away
+    # and the lookup is carried out in the background. `CMDPREFIX` is then
+    # invoked from the event loop with the additional arguments `port` and
+    # the port number, or `error` and the error message.
+    #
     # Returns the port number for the service or raises an error if it
-    # cannot be resolved.
+    # cannot be resolved. If `-command` is specified, an empty string is
+    # returned.
 
     #TBD - maybe use device::services and loop through so we can match service_class
     #against service name as well
 
-    set h [LookupServiceBegin \
-               [ResolveDeviceUnique $device] \
-               [names::service_class_uuid $service_class]]
-    try {
-        while {1} {
-            # 0x100 -> LUP_RETURN_ADDR
-            set rec [LookupServiceNext $h 0x100]
-            puts $rec
-            if {[dict exists $rec RemoteAddress] &&
-                [dict get $rec RemoteAddress AddressFamily] == 32} {
-                # 32 -> AF_BTH (Bluetooth)
-                # Further we are looking for RFCOMM (protocol 3)
-                if {[dict exists $rec Protocol] &&
-                    [dict get $rec Protocol] == 3} {
-                    return [dict get $rec RemoteAddress Port]
-                }
-            }
+    lassign [ParseLookupOptions $args] flush cmdprefix
+    set device [ResolveDeviceUnique $device]
+    set uuid [names::service_class_uuid $service_class]
+    if {[llength $cmdprefix]} {
+        # 0x100 -> LUP_RETURN_ADDR
+        LookupServiceAsync {*}$flush \
+            [list [namespace parent]::PortCallback $cmdprefix $device $service_class] \
+            $device $uuid 0x100
+        return
+    }
+    foreach rec [LookupService {*}$flush $device $uuid 0x100] {
+        set port [RfcommPort $rec]
+        if {$port >= 0} {
+            return $port
         }
-    } finally {
-        LookupServiceEnd $h
     }
     error "Could not resolve service \"$service_class\" to a port on device \"$device\"."
 }
@@ -332,38 +359,53 @@ proc iocp::bt::device::remove {device} {
     RemoveDevice [ResolveDeviceUnique $device]
 }
 
-proc iocp::bt::device::service_references {device service} {
+proc iocp::bt::device::service_references {device service args} {
     # Retrieve service discovery records that refer to a specified service.
     #  device - Bluetooth address or name of a device. If specified as a name,
     #           it must resolve to a single address.
     #  service - the UUID of a service or service class or its mnemonic.
+    #  -command CMDPREFIX - Retrieve the records in the background. See below.
+    #  -flushcache - Query the device even if its service records are
+    #           in the cache configured with [::iocp::bt::configure].
     # The command will return all service discovery records that contain
     # an attribute referring to the specified service.
     # The returned service discovery records should be treated as
     # opaque and accessed through the service record decoding commands.
     #
-    # Returns a list of service discovery records.
-
-    set h [LookupServiceBegin \
-               [ResolveDeviceUnique $device] \
-               [names::to_uuid $service]]
-    set recs {}
-    try {
-        while {1} {
-            # 0x0200 -> LUP_RETURN_BLOB. Returns {Blob BINDATA}
-            lappend recs [lindex [LookupServiceNext $h 0x200] 1]
-        }
-    } finally {
-        LookupServiceEnd $h
+    # If the `-command` option is specified, the command returns right away
+    # and the records are retrieved in the background. `CMDPREFIX` is then
+    # invoked from the event loop with the additional arguments `record`
+    # and the service discovery record for each record retrieved. Once all
+    # are retrieved, it is invoked with the single additional argument
+    # `done` or, on failure, with the additional arguments `error` and the
+    # error message. No further callbacks are made if `CMDPREFIX` returns a
+    # `break` or raises an error.
+    #
+    # Returns a list of service discovery records or an empty string
+    # if `-command` is specified.
+
+    lassign [ParseLookupOptions $args] flush cmdprefix
+    set device [ResolveDeviceUnique $device]
+    set uuid [names::to_uuid $service]
+    # 0x0200 -> LUP_RETURN_BLOB. Returns {Blob BINDATA}
+    if {[llength $cmdprefix]} {
+        LookupServiceAsync {*}$flush \
+            [list [namespace parent]::ReferencesCallback $cmdprefix] \
+            $device $uuid 0x200
+        return
     }
-    return $recs
+    return [lmap rec [LookupService {*}$flush $device $uuid 0x200] {
+        dict get $rec Blob
+    }]
 }
 
-proc iocp::bt::device::services {device} {
+proc iocp::bt::device::services {device args} {
     # Retrieve the service discovery records for top level services
     # advertised by a device.
     #  device - Bluetooth address or name of a device. If specified as a name,
     #           it must resolve to a single address.
+    #  args - Options `-command` and `-flushcache` as for
+    #           [service_references].
     #
     # The command will return all service discovery records that reference
     # the `PublicBrowseRoot` service class. This is not necessarily all the
@@ -378,7 +420,7 @@ proc iocp::bt::device::services {device} {
     # TBD - add a browse group parameter
     # TBD - perhaps check that the sdr acually refernces browse group in
     # the appropriate attribute
-    return [service_references $device 00001002-0000-1000-8000-00805f9b34fb]
+    return [service_references $device 00001002-0000-1000-8000-00805f9b34fb {*}$args]
 }
 
 # TBD - is this needed? Less functional version of services
@@ -657,6 +699,120 @@ proc DeviceClass {class} {
                 DeviceClasses $service_class]
 }
 
+proc iocp::bt::configure {args} {
+    # Gets or sets Bluetooth settings.
+    #  -servicecachettl MS - Milliseconds for which service discovery
+    #      records retrieved from a device are cached. Port and service
+    #      lookups, including those done by [socket] for a service class,
+    #      are satisfied from the cache while it holds the device's records
+    #      for the service class and do not query the device. 0 (default)
+    #      disables the cache and discards cached records.
+    #
+    # If no arguments are given to the command, it returns the current
+    # values of all options in the form of a dictionary. If exactly one
+    # argument is given, it must be the name of an option and the command
+    # returns its value. Otherwise, the arguments must be a list of option
+    # names and values and the command sets them.
+    #
+    # Returns an option value, a dictionary of options and values, or an
+    # empty string.
+
+    if {[llength $args] == 0} {
+        return [list -servicecachettl [ServiceCacheTtl]]
+    } elseif {[llength $args] == 1} {
+        return [switch -exact -- [lindex $args 0] {
+            -servicecachettl {ServiceCacheTtl}
+            default { error "Unknown option \"[lindex $args 0]\"."}
+        }]
+    }
+    if {[llength $args] % 2} {
+        error "Missing value for option \"[lindex $args end]\"."
+    }
+    foreach {opt val} $args {
+        switch -exact -- $opt {
+            -servicecachettl {ServiceCacheTtl $val}
+            default { error "Unknown option \"$opt\"."}
+        }
+    }
+    return
+}
+
+proc iocp::bt::ParseLookupOptions {optlist} {
+    # Returns a pair consisting of the flush option (or empty) and the
+    # callback command prefix (or empty) for service lookups.
+    set flush {}
+    set cmdprefix {}
+    while {[llength $optlist]} {
+        set optlist [lassign $optlist opt]
+        switch -exact -- $opt {
+            -flushcache { set flush -flushcache }
+            -command {
+                if {[llength $optlist] == 0} {
+                    error "no argument given for -command option"
+                }
+                set optlist [lassign $optlist cmdprefix]
+            }
+            default {
+                error "bad option \"$opt\": must be -command or -flushcache"
+            }
+        }
+    }
+    return [list $flush $cmdprefix]
+}
+
+proc iocp::bt::RfcommPort {rec} {
+    # Returns the RFCOMM port from a service lookup record or -1 if the
+    # record is not for a RFCOMM service.
+    # 32 -> AF_BTH (Bluetooth). 3 -> RFCOMM.
+    if {[dict exists $rec RemoteAddress] &&
+        [dict get $rec RemoteAddress AddressFamily] == 32 &&
+        [dict exists $rec Protocol] &&
+        [dict get $rec Protocol] == 3} {
+        return [dict get $rec RemoteAddress Port]
+    }
+    return -1
+}
+
+proc iocp::bt::DevicesCallback {cmdprefix event args} {
+    # Callback for background device discovery. Adds the class names
+    # to device information before passing it on.
+    if {$event eq "device"} {
+        set device [lindex $args 0]
+        set args [list [dict merge $device [DeviceClass [dict get $device Class]]]]
+    }
+    tailcall {*}$cmdprefix $event {*}$args
+}
+
+proc iocp::bt::PortCallback {cmdprefix device service_class event args} {
+    # Callback for background port resolution. Passes on the first RFCOMM
+    # port found and stops the lookup.
+    switch -exact -- $event {
+        record {
+            set port [RfcommPort [lindex $args 0]]
+            if {$port < 0} {
+                return
+            }
+            {*}$cmdprefix port $port
+            return -code break
+        }
+        done {
+            tailcall {*}$cmdprefix error "Could not resolve service \"$service_class\" to a port on device \"$device\"."
+        }
+        default {
+            tailcall {*}$cmdprefix $event {*}$args
+        }
+    }
+}
+
+proc iocp::bt::ReferencesCallback {cmdprefix event args} {
+    # Callback for background service record retrieval. Passes on only
+    # the service discovery record.
+    if {$event eq "record"} {
+        set args [list [dict get [lindex $args 0] Blob]]
+    }
+    tailcall {*}$cmdprefix $event {*}$args
+}
+
 proc iocp::bt::ResolveDeviceUnique {device} {
     if {[IsAddress $device]} {
         return $device
@@ -15,32 +15,6 @@ namespace eval iocp::bt::sdr {
     }
 }
 
-proc iocp::bt::sdr::decode {binsdr} {
-    # Decodes a binary service discovery record
-    # binsdr - a raw Bluetooth service discovery record in binary
-    #       form.
-    #
-    # The returned value should be treated as opaque. The attributes
-    # stored in the record should be accessed with the commands in
-    # the `sdr` namespace.
-    #
-    # Returns a container of attributes stored in the record.
-
-    # A SDR record is a single data element which is a sequence
-    # containing nested data elements.
-    # {{sequence {nested data elements}}}
-    set rec [lindex [DecodeElements $binsdr] 0 1]
-
-    # $rec contains alternating attribute value pairs. The result
-    # is built as a list as its faster to do that and shimmer
-    # to a dict on access than to build a dictionary to begin with.
-    set sdr {}
-    foreach {attr val} $rec {
-        lappend sdr [lindex $attr 1] $val
-    }
-    return $sdr
-}
-
 proc iocp::bt::sdr::attribute::exists {sdr attr_id {varname {}}} {
     # Checks if an attribute exists in a service discovery record
     # sdr - a decoded service discovery record in the form returned by
@@ -572,167 +546,6 @@ proc iocp::bt::sdr::TextAttribute {sdr attr_offset lang {varname {}}} {
     }
 }
 
-proc iocp::bt::sdr::DecodeElements {delem} {
-    # Decodes a Data Element as defined in the Bluetooth specification.
-    #  delem - Data element in binary format
-
-    set decoded {}
-    while {[string length $delem]} {
-        lassign [ExtractFirstElement $delem] type value delem
-        switch -exact -- $type {
-            sequence { lappend decoded [list sequence [DecodeElements $value]]}
-            selection { lappend decoded [list selection [DecodeElements $value]]}
-            default {
-                lappend decoded [list $type $value]
-            }
-        }
-    }
-    return $decoded
-}
-
-proc iocp::bt::sdr::ExtractFirstElement {bin} {
-    # Extracts leading element from an SDP record.
-    # bin - tail of SDP record
-    # Returns a pair consisting of the extracted element and
-    # the remaining part of $bin.
-
-    set binlen [string length $bin]
-    if {$binlen == 0} {
-        return {}
-    }
-    binary scan $bin c header
-    set type [expr {($header >> 3) & 0xff}]
-    set lenbits [expr {$header & 0x7}]
-
-    # The nil type is formatted slightly differently. Treat as a special case.
-    if {$type == 0} {
-        if {$lenbits != 0} {
-            error "Invalid non-0 length for nil type."
-        }
-        return [list nil "" [string range $bin 1 end]]
-    }
-
-    if {$lenbits < 5} {
-        set len [expr {1 << $lenbits}]
-        set dataoffset 1
-    } else {
-        if {$lenbits == 5} {
-            set dataoffset 2
-            set fmt c
-            set mask 0xff
-        } elseif {$lenbits == 6} {
-            set dataoffset 3
-            set fmt S
-            set mask 0xffff
-        } else {
-            # lenbits == 7
-            set dataoffset 5
-            set fmt I
-            set mask 0xffffffff
-        }
-        # Ensure input length enough for at least length field
-        if {$binlen < $dataoffset} {
-            error "Truncated binary header."
-        }
-        binary scan $bin @1$fmt len
-        set len [expr {$len & $mask}]; # Since binary scan is signed
-    }
-    if {$binlen < ($dataoffset+$len)} {
-        error "Truncated binary data."
-    }
-    set elem [string range $bin $dataoffset [expr {$dataoffset+$len-1}]]
-    switch -exact $type {
-        1 {
-            set type uint
-            if {$len == 1} {
-                binary scan $elem cu elem
-            } elseif {$len == 2} {
-                binary scan $elem Su elem
-            } elseif {$len == 4} {
-                binary scan $elem Iu elem
-            } elseif {$len == 8} {
-                binary scan $elem Wu elem
-            } elseif {$len == 16} {
-                binary scan $elem WuWu hi lo
-                # TBD - check this
-                # (2**64)*hi + lo
-                set elem [expr {(18446744073709551616 * $hi) + $lo}]
-            } else {
-                error "Invalid integer width."
-            }
-        }
-        2 {
-            set type int
-            if {$len == 1} {
-                binary scan $elem c elem
-            } elseif {$len == 2} {
-                binary scan $elem S elem
-            } elseif {$len == 4} {
-                binary scan $elem I elem
-            } elseif {$len == 8} {
-                binary scan $elem W elem
-            } elseif {$len == 16} {
-                # Note hi is signed, lo unsigned
-                binary scan $elem WWu hi lo
-                # TBD - check this
-                # (2**64)*hi + lo
-                set elem [expr {(18446744073709551616 * $hi) + $lo}]
-            } else {
-                error "Invalid integer width."
-            }
-        }
-        3 {
-            set type uuid
-            if {$len == 2} {
-                set elem [binary encode hex $elem]
-                set elem "0000$elem-0000-1000-8000-00805f9b34fb"
-            } elseif {$len == 4} {
-                set elem [binary encode hex $elem]
-                set elem "$elem-0000-1000-8000-00805f9b34fb"
-            } elseif {$len == 16} {
-                set hex [binary encode hex $elem]
-                set elem [string range $hex 0 7]
-                append elem - [string range $hex 8 11]
-                append elem - [string range $hex 12 15]
-                append elem - [string range $hex 16 19]
-                append elem - [string range $hex 20 end]
-            } else {
-                error "Invalid length $len for UUID."
-            }
-        }
-        4 {
-            set type text
-            # TBD - keep elem as binary as we do not know encoding
-        }
-        5 {
-            set type boolean
-            if {$len != 1} {
-                error "Invalid length for boolean type."
-            }
-            binary scan $elem c elem
-            set elem [expr {!!$elem}] ; # Convert to 0/1
-        }
-        6 {
-            set type sequence
-            # elem remains the same. Caller will have to recurse to parse
-        }
-        7 {
-            set type selection
-            # elem remains the same. Caller will have to recurse to parse
-        }
-        8 {
-            set type url
-            # elem remains same. Encoding unknown. TBD
-        }
-        default {
-            set type unknown
-            # elem remains same
-        }
-    }
-
-    return [list $type $elem [string range $bin $dataoffset+$len end]]
-}
-
 proc iocp::bt::sdr::printn {recs {attrfilter *}} {
     # Prints a SDP record to a more human readable form.
     # recs - a list of binary SDP records in the form returned by
@@ -63,6 +63,24 @@ proc help {} {
         -print detail|summary - Print summary of results or details (summary)
         -nbwrites true|false - If true, writes are non-blocking event driven
                        otherwise blocking (false).
+        -mode throughput|connections|pingpong - The type of test (throughput).
+                       The throughput mode measures one-way transfer rate
+                       over a single data connection. The connections mode
+                       opens -connections concurrent connections each of
+                       which sends -writesize bytes every -thinktime
+                       milliseconds and waits for the server to echo them.
+                       The pingpong mode sends -writesize bytes back to
+                       back on each of -connections connections as soon as
+                       the previous echo is received. Both report round
+                       trip latency percentiles in microseconds, and the
+                       memory per connection and iocp::stats counters
+                       sampled from client and server before and after
+                       the test.
+        -connections N - Number of concurrent connections for the
+                       connections (1000) and pingpong (1) modes.
+        -thinktime MS - Milliseconds between requests on each connection
+                       in connections mode (1000). If 0, the connections
+                       stay idle after being established.
 
         In addition, the following socket options may be specified for all
         providers:
@@ -73,7 +91,9 @@ proc help {} {
 
         Further, for the iocp provider only, the following options may
         be specified:
-           -maxpendingreads, -maxpendingwrites, -sosndbuf, -sorcvbuf
+           -maxpendingreads, -maxpendingwrites, -sosndbuf, -sorcvbuf,
+           -inlinecompletion, -writehighwater, -readbuffersize,
+           -readmode, -idletimeout
 
         The batch command accepts an additional option:
         -script FILE - Path of file from which to read test configurations.
@@ -98,6 +118,22 @@ proc help {} {
             -provider tcl -writesize 1 -buffering full
             -provider iocp -writesize 1000 -duration 2
             -count 1000 -readsize 4000 
+
+        Script comparing buffered and zero-byte reads:
+            -provider iocp -readmode buffered -writesize 100
+            -provider iocp -readmode zerobyte -writesize 100
+            -provider iocp -readmode buffered -writesize 65536
+            -provider iocp -readmode zerobyte -writesize 65536
+
+        Script comparing 10000 mostly idle connections and request latency:
+            -mode connections -provider tcl -connections 10000 -writesize 64
+            -mode connections -provider iocp -connections 10000 -writesize 64
+            -mode pingpong -provider tcl -writesize 64
+            -mode pingpong -provider iocp -writesize 64
+
+        More than about 15000 connections from one client address need the
+        ephemeral port range to be widened (netsh int ipv4 set dynamicport)
+        or multiple client machines.
     }
     puts $help
 }
@@ -116,6 +152,64 @@ proc socket_command {provider} {
     }
 }
 
+proc working_set {} {
+    # Returns the working set of this process in bytes or "" if unknown
+    if {![catch {uplevel #0 package require twapi}]} {
+        return [twapi::get_process_info [pid] -workingset]
+    }
+    if {[catch {
+        exec tasklist /FI "PID eq [pid]" /FO CSV /NH
+    } line]} {
+        return ""
+    }
+    # "tclsh.exe","1234","Console","1","12,345 K"
+    regsub -all {[^0-9]} [lindex [split [string trim $line] \"] end-1] {} kb
+    if {$kb eq ""} {
+        return ""
+    }
+    return [expr {$kb * 1024}]
+}
+
+proc sample_process {} {
+    # Returns the working set and iocp statistics for this process
+    set sample [dict create WorkingSet [working_set] Iocp {}]
+    if {[llength [info commands ::iocp::stats]]} {
+        dict set sample Iocp [iocp::stats]
+    }
+    return $sample
+}
+
+proc stats_delta {before after} {
+    # Returns the change in each integer valued statistic
+    set delta [dict create]
+    dict for {key value} $after {
+        if {[dict exists $before $key] &&
+            [string is wide -strict $value] &&
+            [string is wide -strict [dict get $before $key]]} {
+            dict set delta $key [expr {$value - [dict get $before $key]}]
+        }
+    }
+    return $delta
+}
+
+proc sample_delta {before after nconns} {
+    # Summarizes the change between two process samples
+    #  nconns - number of connections to attribute memory to
+    set before_ws [dict get $before WorkingSet]
+    set after_ws  [dict get $after WorkingSet]
+    if {$before_ws eq "" || $after_ws eq ""} {
+        set memory ""
+        set per_conn ""
+    } else {
+        set memory [expr {$after_ws - $before_ws}]
+        set per_conn [expr {$nconns ? $memory / $nconns : 0}]
+    }
+    return [dict create \
+                WorkingSetDelta $memory \
+                BytesPerConnection $per_conn \
+                Iocp [stats_delta [dict get $before Iocp] [dict get $after Iocp]]]
+}
+
 ################################################################
 # Client implementation
 
@@ -162,6 +256,10 @@ namespace eval client {
     # Nested dictionary, first level text/binary, second level data and size
     variable payload
     set payload [dict create]
+
+    # State for the connections and pingpong modes
+    variable echo
+    array set echo {}
 }
 
 proc client::payload {type} {
@@ -323,6 +421,213 @@ proc client::bench {local_provider remote_provider} {
                 Socket $configuration]
 }
 
+proc client::echo_open {} {
+    # Opens connections until the target number have been attempted while
+    # limiting the number of connects in progress.
+    variable echo
+    while {$echo(pending) < $echo(maxpending) &&
+           $echo(opened) < $echo(target)} {
+        incr echo(opened)
+        if {[catch {$echo(socommand) -async $echo(addr) $echo(port)} so]} {
+            incr echo(failed)
+            continue
+        }
+        incr echo(pending)
+        fileevent $so writable [list [namespace current]::echo_connected $so]
+    }
+    if {$echo(pending) == 0 && $echo(opened) >= $echo(target)} {
+        set echo(gate) connected
+    }
+}
+
+proc client::echo_connected {so} {
+    variable echo
+    variable sooptions
+    incr echo(pending) -1
+    if {[catch {fconfigure $so -error} error] || $error ne ""} {
+        incr echo(failed)
+        catch {close $so}
+    } else {
+        fileevent $so writable {}
+        fconfigure $so {*}[array get sooptions] -blocking 0
+        fileevent $so readable [list [namespace current]::echo_read $so]
+        lappend echo(sockets) $so
+    }
+    echo_open
+}
+
+proc client::echo_close {so} {
+    variable echo
+    if {[info exists echo(timer,$so)]} {
+        after cancel $echo(timer,$so)
+    }
+    catch {close $so}
+    array unset echo *,$so
+}
+
+proc client::echo_send {so} {
+    variable echo
+    unset -nocomplain echo(timer,$so)
+    if {$echo(done)} {
+        return
+    }
+    set echo(remaining,$so) $echo(size)
+    set echo(start,$so) [clock microseconds]
+    # Do not use $echo(payload) in any way other than writing as that
+    # would shimmer it.
+    if {[catch {
+        puts -nonewline $so $echo(payload)
+        flush $so
+    }]} {
+        incr echo(errors)
+        echo_close $so
+    }
+}
+
+proc client::echo_read {so} {
+    variable echo
+    if {[catch {read $so} data]} {
+        incr echo(errors)
+        echo_close $so
+        return
+    }
+    set len [string length $data]
+    if {$len == 0} {
+        if {[eof $so]} {
+            incr echo(errors)
+            echo_close $so
+        }
+        return
+    }
+    if {![info exists echo(remaining,$so)]} {
+        return;                 # Echo trailing after end of test
+    }
+    if {[incr echo(remaining,$so) -$len] > 0} {
+        return
+    }
+    unset echo(remaining,$so)
+    if {$echo(done)} {
+        return
+    }
+    lappend echo(latencies) [expr {[clock microseconds] - $echo(start,$so)}]
+    incr echo(roundtrips)
+    if {$echo(thinktime)} {
+        set echo(timer,$so) [after $echo(thinktime) [list [namespace current]::echo_send $so]]
+    } else {
+        echo_send $so
+    }
+}
+
+proc client::percentiles {values} {
+    # Returns a dictionary of latency percentiles of a list of values
+    set n [llength $values]
+    if {$n == 0} {
+        return [dict create Samples 0 Mean 0 P50 0 P90 0 P99 0 P999 0 Max 0]
+    }
+    set values [lsort -integer $values]
+    set sum 0
+    foreach value $values {
+        incr sum $value
+    }
+    set result [dict create Samples $n Mean [expr {$sum / $n}]]
+    foreach {key permille} {P50 500 P90 900 P99 990 P999 999} {
+        # Nearest rank
+        set rank [expr {($n * $permille + 999) / 1000}]
+        dict set result $key [lindex $values [expr {$rank > 0 ? $rank-1 : 0}]]
+    }
+    dict set result Max [lindex $values end]
+    return $result
+}
+
+proc client::server_sample {} {
+    variable control
+    puts $control(so) STATS
+    lassign [gets $control(so)] status sample
+    if {$status ne "OK"} {
+        error "Server failure: $status $sample"
+    }
+    return $sample
+}
+
+proc client::bench_echo {local_provider remote_provider} {
+    # Runs the connections and pingpong modes
+    variable options
+    variable control
+    variable server
+    variable echo
+
+    array unset echo
+    array set echo [list \
+                        socommand [socket_command $local_provider] \
+                        addr $server(-addr) \
+                        port [dict get $control(dataports) $remote_provider] \
+                        payload [payload $options(-payload)] \
+                        size $options(-writesize) \
+                        target $options(-connections) \
+                        thinktime $options(-thinktime) \
+                        maxpending 100 \
+                        pending 0 \
+                        opened 0 \
+                        failed 0 \
+                        errors 0 \
+                        roundtrips 0 \
+                        latencies {} \
+                        sockets {} \
+                        done 0]
+    if {$options(-mode) eq "pingpong"} {
+        set echo(thinktime) 0
+    }
+
+    set client_before [sample_process]
+    set server_before [server_sample]
+
+    set setup_start [clock microseconds]
+    echo_open
+    if {$echo(opened) < $echo(target) || $echo(pending)} {
+        vwait [namespace current]::echo(gate)
+    }
+    set setup_end [clock microseconds]
+    set established [llength $echo(sockets)]
+
+    set start [clock microseconds]
+    if {$options(-mode) eq "pingpong" || $echo(thinktime) > 0} {
+        foreach so $echo(sockets) {
+            if {$echo(thinktime)} {
+                # Spread requests over the think time
+                set echo(timer,$so) [after [expr {int(rand() * $echo(thinktime))}] \
+                                         [list [namespace current]::echo_send $so]]
+            } else {
+                echo_send $so
+            }
+        }
+    }
+    after [expr {$options(-duration) * 1000}] [list set [namespace current]::echo(gate) done]
+    vwait [namespace current]::echo(gate)
+    set echo(done) 1
+    set end [clock microseconds]
+
+    set client_after [sample_process]
+    set server_after [server_sample]
+
+    foreach so $echo(sockets) {
+        echo_close $so
+    }
+
+    return [list \
+                Mode $options(-mode) \
+                Connections $echo(target) \
+                Established $established \
+                ConnectFailures $echo(failed) \
+                SetupTime [expr {$setup_end - $setup_start}] \
+                Start $start \
+                End $end \
+                RoundTrips $echo(roundtrips) \
+                Errors $echo(errors) \
+                Latency [percentiles $echo(latencies)] \
+                Client [sample_delta $client_before $client_after $established] \
+                Server [sample_delta $server_before $server_after $established]]
+}
+
 proc client::connect {args} {
     # Creates a control connection to the server
     # Stores the socket and data ports in the control namespace variable.
@@ -359,6 +664,7 @@ proc client::runtest {args} {
         -writesize 4096
         -readsize 4096
         -nbwrites 0
+        -mode throughput
     } $args]
 
     if {[info exists opts(-translation)]} {
@@ -379,7 +685,9 @@ proc client::runtest {args} {
     }
 
     foreach opt {-buffering -buffersize -encoding -eofchar -translation
-        -maxpendingreads -maxpendingwrites -sosndbuf -sorcvbuf} {
+        -maxpendingreads -maxpendingwrites -sosndbuf -sorcvbuf
+        -inlinecompletion -writehighwater -readbuffersize
+        -readmode -idletimeout} {
         if {[info exists opts($opt)]} {
             set sooptions($opt) $opts($opt)
             unset opts($opt)
@@ -416,6 +724,38 @@ proc client::runtest {args} {
         }
     }
 
+    switch -exact -- $options(-mode) {
+        throughput {}
+        connections {
+            if {![info exists options(-connections)]} {
+                set options(-connections) 1000
+            }
+            if {![info exists options(-thinktime)]} {
+                set options(-thinktime) 1000
+            }
+        }
+        pingpong {
+            if {![info exists options(-connections)]} {
+                set options(-connections) 1
+            }
+            set options(-thinktime) 0
+        }
+        default {
+            error "Invalid -mode value \"$options(-mode)\"."
+        }
+    }
+    if {$options(-mode) ne "throughput"} {
+        if {[info exists options(-count)]} {
+            error "Option -count cannot be used with -mode $options(-mode)."
+        }
+        foreach opt {-connections -thinktime} {
+            if {![string is integer -strict $options($opt)] ||
+                $options($opt) < 0} {
+                error "Invalid $opt value \"$options($opt)\"."
+            }
+        }
+    }
+
     if {[info exists options(-count)]} {
         if {[info exists options(-duration)]} {
             error "Options -count and -duration must not be specified together."
@@ -432,7 +772,7 @@ proc client::runtest {args} {
         error "Server failure: $line"
     }
 
-    puts $control(so) [list IOSIZE [list -readsize $options(-readsize) -writesize $opts(-writesize)]]
+    puts $control(so) [list IOSIZE [list -readsize $options(-readsize) -writesize $opts(-writesize) -mode $options(-mode)]]
     gets $control(so) line
     if {$line ne "OK"} {
         error "Server failure: $line"
@@ -448,6 +788,10 @@ proc client::runtest {args} {
         error "Server does not support $remote_provider."
     }
 
+    if {$options(-mode) ne "throughput"} {
+        return [bench_echo $local_provider $remote_provider]
+    }
+
     if {$options(-nbwrites)} {
         set client_result [bench_nonblocking $local_provider $remote_provider]
     } else {
@@ -518,8 +862,71 @@ proc client::print_2cols {d {indent {    }}} {
     }
 }
 
+proc client::print_echo {result level} {
+    variable options
+    dict with result {
+        set duration [expr {$End - $Start}]
+        set rate [format %.1f [expr {$RoundTrips * 1000000.0 / $duration}]]
+        set latency $Latency
+        set client_mem [dict get $Client BytesPerConnection]
+        set server_mem [dict get $Server BytesPerConnection]
+    }
+    foreach var {client_mem server_mem} {
+        if {[set $var] eq ""} {
+            set $var n/a
+        }
+    }
+    # Completion packets per round trip summed over client and server
+    set completions ""
+    foreach side {Client Server} {
+        set delta [dict get $result $side Iocp]
+        if {[dict exists $delta CompletionPackets]} {
+            incr completions [dict get $delta CompletionPackets]
+        }
+    }
+    if {$completions ne "" && [dict get $result RoundTrips]} {
+        set completions [format %.2f [expr {double($completions) / [dict get $result RoundTrips]}]]
+    } else {
+        set completions n/a
+    }
+    if {$level eq "detail"} {
+        puts "CONFIG:"
+        print_2cols [array get options] "        "
+        dict with result {
+            puts "CONNECTIONS: $Established of $Connections established\
+                  in [format_duration $SetupTime] secs ($ConnectFailures failed)"
+            puts "ROUNDTRIPS: $rate/sec ($RoundTrips in [format_duration $duration]\
+                  secs, $Errors errors)"
+        }
+        puts "LATENCY (usecs):"
+        print_2cols $latency "        "
+        foreach side {Client Server} {
+            set delta [dict get $result $side]
+            puts "[string toupper $side]: WorkingSetDelta\
+                  [dict get $delta WorkingSetDelta] bytes,\
+                  BytesPerConnection [dict get $delta BytesPerConnection]"
+            if {[dict size [dict get $delta Iocp]]} {
+                print_2cols [dict get $delta Iocp] "        "
+            }
+        }
+    } else {
+        puts [format "%s %d/%d conns %ss setup %s rt/s p50 %s p99 %s p999 %s max %s usecs mem/conn %s %s completions/rt %s %s" \
+                  $options(-mode) \
+                  [dict get $result Established] [dict get $result Connections] \
+                  [format_duration [dict get $result SetupTime]] \
+                  $rate \
+                  [dict get $latency P50] [dict get $latency P99] \
+                  [dict get $latency P999] [dict get $latency Max] \
+                  $client_mem $server_mem $completions [join $options(-provider) ->]]
+    }
+}
+
 proc client::print {result {level summary}} {
     variable options
+    if {[dict exists $result Mode]} {
+        print_echo $result $level
+        return
+    }
     lassign [dict get $result Server] server_status server_result
     set client_result [dict get $result Client]
     if {$server_status eq "OK"} {
@@ -583,7 +990,7 @@ proc client::client {args} {
     } else {
         set print_level summary
     }
-    connect $args
+    connect {*}$args
     for {set i 0} {$i < $repeat} {incr i} {
         print [runtest {*}$args] $print_level
     }
@@ -605,7 +1012,7 @@ proc client::batch {args} {
         set nrepeats 1
     }
     
-    connect $args
+    connect {*}$args
     if {[dict exists $args -script]} {
         set inchan [open [dict get $args -script]]
     } else {
@@ -745,6 +1152,9 @@ proc server::read_control {so} {
                     array set options $opts
                     puts $so OK
                 }
+                STATS {
+                    puts $so [list OK [sample_process]]
+                }
                 FINISH {
                     variable sockets
                     variable clients
@@ -777,9 +1187,16 @@ proc server::accept_data {so addr port} {
     variable soconfig
     variable sockets
     variable clients
+    variable options
 
     set opts [array get soconfig]
     lappend opts -blocking 0
+    if {[info exists options(-mode)] && $options(-mode) ne "throughput"} {
+        # Too many connections to log each one
+        fconfigure $so {*}$opts
+        fileevent $so readable [list [namespace current]::echo_data $so]
+        return
+    }
     puts stdout "Data connection from $addr/$port. Setting socket to $opts."
     fconfigure $so {*}$opts
 
@@ -788,6 +1205,21 @@ proc server::accept_data {so addr port} {
     dict set clients $addr $port $so
 }
 
+proc server::echo_data {so} {
+    if {[catch {
+        set data [read $so]
+        if {[string length $data]} {
+            puts -nonewline $so $data
+            flush $so
+        } elseif {[eof $so]} {
+            close $so
+        }
+    } err]} {
+        puts stderr "Echo error: $err"
+        catch {close $so}
+    }
+}
+
 proc server::read_data {so} {
     variable sockets
     variable options
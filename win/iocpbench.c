@@ -0,0 +1,895 @@
+/*
+ * iocpbench.c --
+ *
+ *	Native benchmark harness for the iocp package. The iocp extension is
+ *	loaded into an embedded Tcl interpreter but all I/O is done through
+ *	the Tcl C channel API from C channel handlers so no script is
+ *	evaluated in the measured paths. Results are printed as JSON or CSV
+ *	for comparison across builds and releases.
+ *
+ *	Build with "nmake /f makefile.vc bench" and run with
+ *	"nmake /f makefile.vc runbench BENCHFLAGS=..." or directly as
+ *	    iocpbench -dll PATH_TO_IOCP_DLL ?OPTIONS?
+ *	See BenchUsage for the options.
+ *
+ * Copyright (c) 2020 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include <winsock2.h>
+#include <windows.h>
+#include <psapi.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcl.h"
+
+/* Scenarios. Must match order of benchScenarioNames. */
+enum BenchScenario {
+    BENCH_ECHO,                 /* Request/response round trips */
+    BENCH_BULK,                 /* One way stream */
+    BENCH_CONNECT,              /* Connect, accept and close */
+    BENCH_IDLE                  /* Round trips amongst many idle connections */
+};
+static const char *benchScenarioNames[] = {
+    "echo", "bulk", "connect", "idle", NULL
+};
+
+typedef struct BenchConfig {
+    enum BenchScenario scenario;
+    const char *dllPath;        /* Path to iocp DLL or NULL to package require */
+    const char *host;           /* Address to listen on and connect to */
+    const char *readMode;       /* -readmode option or NULL for default */
+    const char *format;         /* "json" or "csv" */
+    int         size;           /* Message or write size */
+    int         connections;    /* Concurrent (echo, bulk, connect) or total
+                                 * (idle) connections */
+    int         active;         /* Active connections for idle scenario */
+    int         duration;       /* Seconds to run */
+    int         maxPendingReads;/* -maxpendingreads or 0 for default */
+    int         completionThreads; /* iocp::configure -completionthreads or
+                                    * 0 for default */
+    int         header;         /* Whether to print the CSV header */
+} BenchConfig;
+
+/* Latency samples in performance counter ticks */
+typedef struct BenchSamples {
+    LONG64 *ticks;
+    size_t  count;
+    size_t  capacity;
+} BenchSamples;
+
+typedef struct Bench Bench;
+
+/* Per connection state for both client and server ends */
+typedef struct BenchConn {
+    Bench      *benchPtr;
+    Tcl_Channel chan;
+    LONG64      startedAt;      /* When the current message or connect was
+                                 * started */
+    int         expected;       /* Bytes of echo still expected */
+    int         closed;         /* Channel has been closed */
+    struct BenchConn *nextPtr;  /* Links all connections in the Bench */
+} BenchConn;
+
+struct Bench {
+    BenchConfig  config;
+    Tcl_Interp  *interp;
+    const char  *version;       /* Version of loaded iocp package */
+    Tcl_Channel  listener;
+    int          port;          /* Port listener is bound to */
+    char        *buffer;        /* Payload and receive area */
+    int          bufferSize;
+    BenchConn   *connsPtr;      /* All connections */
+    BenchSamples samples;
+    Tcl_WideInt  ops;           /* Completed messages, reads or connects */
+    Tcl_WideInt  bytes;         /* Payload bytes transferred */
+    Tcl_WideInt  accepts;       /* Connections accepted by the listener */
+    Tcl_WideInt  errors;        /* Failed operations */
+    int          connecting;    /* Connects in progress */
+    LONG64       startTicks;    /* Start of measured interval */
+    LONG64       endTicks;      /* End of measured interval */
+    double       setupSeconds;  /* Time to establish idle connections */
+    SIZE_T       memoryBytes;   /* Private bytes used by idle connections */
+    int          done;          /* Measured interval is over */
+};
+
+static LONG64 benchFrequency;   /* Performance counter ticks per second */
+
+static void BenchClientReadable(ClientData clientData, int mask);
+static void BenchServerReadable(ClientData clientData, int mask);
+static void BenchBulkWritable(ClientData clientData, int mask);
+static void BenchConnectWritable(ClientData clientData, int mask);
+
+static LONG64
+BenchNow(void)
+{
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+static void
+BenchFatal(Tcl_Interp *interp, const char *msg)
+{
+    fprintf(stderr, "iocpbench: %s%s%s\n", msg,
+            interp ? ": " : "", interp ? Tcl_GetStringResult(interp) : "");
+    exit(1);
+}
+
+static void
+BenchSampleAdd(BenchSamples *samplesPtr, LONG64 ticks)
+{
+    if (samplesPtr->count == samplesPtr->capacity) {
+        size_t capacity = samplesPtr->capacity ? 2 * samplesPtr->capacity : 65536;
+        LONG64 *newPtr = realloc(samplesPtr->ticks, capacity * sizeof(LONG64));
+        if (newPtr == NULL)
+            return;             /* Drop the sample rather than the run */
+        samplesPtr->ticks    = newPtr;
+        samplesPtr->capacity = capacity;
+    }
+    samplesPtr->ticks[samplesPtr->count++] = ticks;
+}
+
+static int
+BenchCompareTicks(const void *aPtr, const void *bPtr)
+{
+    LONG64 a = *(const LONG64 *)aPtr;
+    LONG64 b = *(const LONG64 *)bPtr;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+/* Returns the sample at a percentile (in thousandths) in microseconds
+ * using the nearest rank. Samples must have been sorted. */
+static double
+BenchPercentile(const BenchSamples *samplesPtr, int permille)
+{
+    size_t rank;
+    if (samplesPtr->count == 0)
+        return 0;
+    rank = (samplesPtr->count * permille + 999) / 1000;
+    if (rank == 0)
+        rank = 1;
+    return (samplesPtr->ticks[rank-1] * 1e6) / benchFrequency;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchEval --
+ *
+ *    Evaluates a script built from a format string. Only used for setup,
+ *    never in measured paths.
+ *
+ * Results:
+ *    The interpreter result. Exits on error.
+ *
+ * Side effects:
+ *    Whatever the script does.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+BenchEval(Bench *benchPtr, const char *format, ...)
+{
+    char    script[1024];
+    va_list args;
+
+    va_start(args, format);
+    _vsnprintf_s(script, sizeof(script), _TRUNCATE, format, args);
+    va_end(args);
+    if (Tcl_EvalEx(benchPtr->interp, script, -1, TCL_EVAL_GLOBAL) != TCL_OK)
+        BenchFatal(benchPtr->interp, script);
+    return Tcl_GetObjResult(benchPtr->interp);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchConnNew --
+ *
+ *    Configures a socket channel for benchmarking and allocates its
+ *    connection state.
+ *
+ * Results:
+ *    Pointer to the connection state. Exits on error.
+ *
+ * Side effects:
+ *    The channel is made non-blocking and binary.
+ *
+ *------------------------------------------------------------------------
+ */
+static BenchConn *
+BenchConnNew(Bench *benchPtr, Tcl_Channel chan)
+{
+    Tcl_Interp *interp = benchPtr->interp;
+    BenchConn  *connPtr;
+    char        value[TCL_INTEGER_SPACE];
+
+    if (Tcl_SetChannelOption(interp, chan, "-blocking", "0") != TCL_OK ||
+        Tcl_SetChannelOption(interp, chan, "-buffering", "none") != TCL_OK ||
+        Tcl_SetChannelOption(interp, chan, "-translation", "binary") != TCL_OK)
+        BenchFatal(interp, "could not configure socket");
+    if (benchPtr->config.maxPendingReads) {
+        sprintf_s(value, sizeof(value), "%d", benchPtr->config.maxPendingReads);
+        if (Tcl_SetChannelOption(interp, chan, "-maxpendingreads", value) != TCL_OK)
+            BenchFatal(interp, "could not set -maxpendingreads");
+    }
+    if (benchPtr->config.readMode &&
+        Tcl_SetChannelOption(interp, chan, "-readmode",
+                             benchPtr->config.readMode) != TCL_OK)
+        BenchFatal(interp, "could not set -readmode");
+
+    connPtr = calloc(1, sizeof(*connPtr));
+    if (connPtr == NULL)
+        BenchFatal(NULL, "out of memory");
+    connPtr->benchPtr = benchPtr;
+    connPtr->chan     = chan;
+    connPtr->nextPtr  = benchPtr->connsPtr;
+    benchPtr->connsPtr = connPtr;
+    return connPtr;
+}
+
+static void
+BenchConnClose(BenchConn *connPtr)
+{
+    if (! connPtr->closed) {
+        connPtr->closed = 1;
+        Tcl_UnregisterChannel(connPtr->benchPtr->interp, connPtr->chan);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchConnect --
+ *
+ *    Opens a client connection to the benchmark listener.
+ *
+ * Results:
+ *    Pointer to the connection state. Exits on error.
+ *
+ * Side effects:
+ *    A socket channel is created in the interpreter.
+ *
+ *------------------------------------------------------------------------
+ */
+static BenchConn *
+BenchConnect(Bench *benchPtr, int async)
+{
+    Tcl_Obj    *resultObj;
+    Tcl_Channel chan;
+
+    resultObj = BenchEval(benchPtr, "iocp::inet::socket %s %s %d",
+                          async ? "-async" : "",
+                          benchPtr->config.host, benchPtr->port);
+    chan = Tcl_GetChannel(benchPtr->interp, Tcl_GetString(resultObj), NULL);
+    if (chan == NULL)
+        BenchFatal(benchPtr->interp, "could not get client channel");
+    return BenchConnNew(benchPtr, chan);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchAcceptObjCmd --
+ *
+ *    Accept callback for the listener, invoked as
+ *        iocpbench::accept CHANNEL ADDRESS PORT
+ *
+ * Results:
+ *    TCL_OK or TCL_ERROR.
+ *
+ * Side effects:
+ *    The accepted connection is set up as per the scenario.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+BenchAcceptObjCmd(
+    ClientData clientData,
+    Tcl_Interp *interp,
+    int objc,
+    Tcl_Obj *const objv[])
+{
+    Bench      *benchPtr = (Bench *) clientData;
+    Tcl_Channel chan;
+    BenchConn  *connPtr;
+
+    if (objc != 4) {
+        Tcl_WrongNumArgs(interp, 1, objv, "CHANNEL ADDRESS PORT");
+        return TCL_ERROR;
+    }
+    chan = Tcl_GetChannel(interp, Tcl_GetString(objv[1]), NULL);
+    if (chan == NULL)
+        return TCL_ERROR;
+    benchPtr->accepts++;
+    if (benchPtr->config.scenario == BENCH_CONNECT) {
+        Tcl_UnregisterChannel(interp, chan);
+        return TCL_OK;
+    }
+    connPtr = BenchConnNew(benchPtr, chan);
+    Tcl_CreateChannelHandler(chan, TCL_READABLE, BenchServerReadable, connPtr);
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchServerReadable --
+ *
+ *    Readable handler for accepted connections. Echoes data back in the
+ *    echo and idle scenarios and discards it in the bulk scenario.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Data is read and possibly written back.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BenchServerReadable(ClientData clientData, int mask)
+{
+    BenchConn *connPtr  = (BenchConn *) clientData;
+    Bench     *benchPtr = connPtr->benchPtr;
+    int        nread;
+
+    nread = Tcl_Read(connPtr->chan, benchPtr->buffer, benchPtr->bufferSize);
+    if (nread < 0 || (nread == 0 && Tcl_Eof(connPtr->chan))) {
+        if (nread < 0)
+            benchPtr->errors++;
+        BenchConnClose(connPtr);
+        return;
+    }
+    if (benchPtr->config.scenario == BENCH_BULK) {
+        if (! benchPtr->done) {
+            benchPtr->ops   += 1;
+            benchPtr->bytes += nread;
+        }
+        return;
+    }
+    if (nread > 0 && Tcl_Write(connPtr->chan, benchPtr->buffer, nread) < 0) {
+        benchPtr->errors++;
+        BenchConnClose(connPtr);
+    }
+}
+
+/* Sends the next echo request on a client connection */
+static void
+BenchSendRequest(BenchConn *connPtr)
+{
+    Bench *benchPtr = connPtr->benchPtr;
+
+    connPtr->expected  = benchPtr->config.size;
+    connPtr->startedAt = BenchNow();
+    if (Tcl_Write(connPtr->chan, benchPtr->buffer, benchPtr->config.size) < 0) {
+        benchPtr->errors++;
+        BenchConnClose(connPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchClientReadable --
+ *
+ *    Readable handler for client connections in the echo and idle
+ *    scenarios. Records the round trip time once the whole echo has been
+ *    received and sends the next request.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    A latency sample is recorded.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BenchClientReadable(ClientData clientData, int mask)
+{
+    BenchConn *connPtr  = (BenchConn *) clientData;
+    Bench     *benchPtr = connPtr->benchPtr;
+    int        nread;
+
+    nread = Tcl_Read(connPtr->chan, benchPtr->buffer, connPtr->expected);
+    if (nread < 0 || (nread == 0 && Tcl_Eof(connPtr->chan))) {
+        benchPtr->errors++;
+        BenchConnClose(connPtr);
+        return;
+    }
+    connPtr->expected -= nread;
+    if (connPtr->expected > 0)
+        return;
+    if (benchPtr->done)
+        return;                 /* Stop sending so connections go quiet */
+    BenchSampleAdd(&benchPtr->samples, BenchNow() - connPtr->startedAt);
+    benchPtr->ops   += 1;
+    benchPtr->bytes += benchPtr->config.size;
+    BenchSendRequest(connPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchBulkWritable --
+ *
+ *    Writable handler for client connections in the bulk scenario. Tcl
+ *    does not report a non-blocking channel writable while it has output
+ *    queued so this writes as fast as the connection drains.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Data is written.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BenchBulkWritable(ClientData clientData, int mask)
+{
+    BenchConn *connPtr  = (BenchConn *) clientData;
+    Bench     *benchPtr = connPtr->benchPtr;
+
+    if (benchPtr->done) {
+        Tcl_DeleteChannelHandler(connPtr->chan, BenchBulkWritable, connPtr);
+        return;
+    }
+    if (Tcl_Write(connPtr->chan, benchPtr->buffer, benchPtr->config.size) < 0) {
+        benchPtr->errors++;
+        Tcl_DeleteChannelHandler(connPtr->chan, BenchBulkWritable, connPtr);
+    }
+}
+
+/* Starts an asynchronous connect in the connect scenario */
+static void
+BenchStartConnect(Bench *benchPtr)
+{
+    BenchConn *connPtr = BenchConnect(benchPtr, 1);
+    connPtr->startedAt = BenchNow();
+    benchPtr->connecting++;
+    Tcl_CreateChannelHandler(connPtr->chan, TCL_WRITABLE,
+                             BenchConnectWritable, connPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchConnectWritable --
+ *
+ *    Writable handler for asynchronous connects. Records the connect time,
+ *    closes the connection and starts another connect.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    A latency sample is recorded.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BenchConnectWritable(ClientData clientData, int mask)
+{
+    BenchConn  *connPtr  = (BenchConn *) clientData;
+    Bench      *benchPtr = connPtr->benchPtr;
+    Tcl_DString ds;
+    LONG64      elapsed = BenchNow() - connPtr->startedAt;
+
+    Tcl_DStringInit(&ds);
+    if (Tcl_GetChannelOption(NULL, connPtr->chan, "-error", &ds) != TCL_OK ||
+        Tcl_DStringLength(&ds) != 0) {
+        benchPtr->errors++;
+    }
+    else if (! benchPtr->done) {
+        BenchSampleAdd(&benchPtr->samples, elapsed);
+        benchPtr->ops += 1;
+    }
+    Tcl_DStringFree(&ds);
+    benchPtr->connecting--;
+    BenchConnClose(connPtr);
+    if (! benchPtr->done)
+        BenchStartConnect(benchPtr);
+}
+
+static void
+BenchTimerExpired(ClientData clientData)
+{
+    Bench *benchPtr = (Bench *) clientData;
+    benchPtr->endTicks = BenchNow();
+    benchPtr->done     = 1;
+}
+
+/* Processes events without blocking until there are none pending. */
+static void
+BenchDrainEvents(void)
+{
+    while (Tcl_DoOneEvent(TCL_ALL_EVENTS | TCL_DONT_WAIT))
+        ;
+}
+
+/* Waits for the listener to accept count connections, exiting on timeout */
+static void
+BenchAwaitAccepts(Bench *benchPtr, Tcl_WideInt count)
+{
+    LONG64 deadline = BenchNow() + 30 * benchFrequency;
+    while (benchPtr->accepts < count) {
+        if (BenchNow() > deadline)
+            BenchFatal(NULL, "timed out waiting for connections to be accepted");
+        Tcl_DoOneEvent(TCL_ALL_EVENTS | TCL_DONT_WAIT);
+    }
+}
+
+/* Runs the event loop for the configured duration */
+static void
+BenchRunTimed(Bench *benchPtr)
+{
+    benchPtr->done = 0;
+    Tcl_CreateTimerHandler(benchPtr->config.duration * 1000,
+                           BenchTimerExpired, benchPtr);
+    benchPtr->startTicks = BenchNow();
+    while (! benchPtr->done)
+        Tcl_DoOneEvent(TCL_ALL_EVENTS);
+}
+
+/* Starts echo requests on the first nconns client connections */
+static void
+BenchStartEcho(Bench *benchPtr, BenchConn **clientsPtr, int nconns)
+{
+    int i;
+    for (i = 0; i < nconns; ++i) {
+        Tcl_CreateChannelHandler(clientsPtr[i]->chan, TCL_READABLE,
+                                 BenchClientReadable, clientsPtr[i]);
+        BenchSendRequest(clientsPtr[i]);
+    }
+}
+
+/* Returns private bytes committed by the process */
+static SIZE_T
+BenchPrivateBytes(void)
+{
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    memset(&pmc, 0, sizeof(pmc));
+    pmc.cb = sizeof(pmc);
+    if (! GetProcessMemoryInfo(GetCurrentProcess(),
+                               (PROCESS_MEMORY_COUNTERS *) &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.PrivateUsage;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BenchRun --
+ *
+ *    Runs the configured scenario.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Results are stored in *benchPtr.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BenchRun(Bench *benchPtr)
+{
+    BenchConfig *configPtr = &benchPtr->config;
+    BenchConn  **clients;
+    Tcl_Obj     *resultObj;
+    Tcl_Obj     *portObj;
+    Tcl_DString  ds;
+    int          i;
+    SIZE_T       memoryBefore;
+    LONG64       setupStart;
+
+    resultObj = BenchEval(benchPtr,
+                          "iocp::inet::socket -server iocpbench::accept -myaddr %s 0",
+                          configPtr->host);
+    benchPtr->listener = Tcl_GetChannel(benchPtr->interp,
+                                        Tcl_GetString(resultObj), NULL);
+    if (benchPtr->listener == NULL)
+        BenchFatal(benchPtr->interp, "could not get listening channel");
+    Tcl_DStringInit(&ds);
+    if (Tcl_GetChannelOption(benchPtr->interp, benchPtr->listener,
+                             "-sockname", &ds) != TCL_OK)
+        BenchFatal(benchPtr->interp, "could not get listening port");
+    resultObj = Tcl_NewStringObj(Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+    Tcl_IncrRefCount(resultObj);
+    if (Tcl_ListObjIndex(benchPtr->interp, resultObj, 2, &portObj) != TCL_OK ||
+        portObj == NULL ||
+        Tcl_GetIntFromObj(benchPtr->interp, portObj, &benchPtr->port) != TCL_OK)
+        BenchFatal(benchPtr->interp, "could not parse listening port");
+    Tcl_DecrRefCount(resultObj);
+    Tcl_DStringFree(&ds);
+
+    switch (configPtr->scenario) {
+    case BENCH_ECHO:
+    case BENCH_BULK:
+    case BENCH_IDLE:
+        clients = calloc(configPtr->connections, sizeof(*clients));
+        if (clients == NULL)
+            BenchFatal(NULL, "out of memory");
+        memoryBefore = BenchPrivateBytes();
+        setupStart   = BenchNow();
+        for (i = 0; i < configPtr->connections; ++i) {
+            clients[i] = BenchConnect(benchPtr, 0);
+            /* Keep up with accepts so the listen backlog does not fill */
+            BenchDrainEvents();
+        }
+        BenchAwaitAccepts(benchPtr, configPtr->connections);
+        benchPtr->setupSeconds =
+            (double) (BenchNow() - setupStart) / benchFrequency;
+        benchPtr->memoryBytes = BenchPrivateBytes() - memoryBefore;
+
+        if (configPtr->scenario == BENCH_BULK) {
+            for (i = 0; i < configPtr->connections; ++i)
+                Tcl_CreateChannelHandler(clients[i]->chan, TCL_WRITABLE,
+                                         BenchBulkWritable, clients[i]);
+        }
+        else {
+            BenchStartEcho(benchPtr, clients,
+                           configPtr->scenario == BENCH_IDLE ?
+                           configPtr->active : configPtr->connections);
+        }
+        BenchRunTimed(benchPtr);
+        free(clients);
+        break;
+
+    case BENCH_CONNECT:
+        for (i = 0; i < configPtr->connections; ++i)
+            BenchStartConnect(benchPtr);
+        BenchRunTimed(benchPtr);
+        /* Let outstanding connects finish before closing the listener */
+        while (benchPtr->connecting > 0)
+            Tcl_DoOneEvent(TCL_ALL_EVENTS);
+        break;
+    }
+}
+
+static void
+BenchReport(Bench *benchPtr)
+{
+    BenchConfig  *configPtr  = &benchPtr->config;
+    BenchSamples *samplesPtr = &benchPtr->samples;
+    double seconds, mean = 0, max = 0;
+    size_t i;
+    static const char *csvHeader =
+        "version,scenario,size,connections,active,duration,maxpendingreads,"
+        "completionthreads,readmode,ops,ops_per_sec,bytes,bytes_per_sec,"
+        "latency_samples,latency_mean_us,latency_p50_us,latency_p99_us,"
+        "latency_p999_us,latency_max_us,setup_sec,memory_bytes,errors";
+
+    seconds = (double) (benchPtr->endTicks - benchPtr->startTicks) / benchFrequency;
+    if (seconds <= 0)
+        seconds = 1e-9;
+    if (samplesPtr->count) {
+        LONG64 sum = 0;
+        qsort(samplesPtr->ticks, samplesPtr->count, sizeof(LONG64),
+              BenchCompareTicks);
+        for (i = 0; i < samplesPtr->count; ++i)
+            sum += samplesPtr->ticks[i];
+        mean = (sum * 1e6) / benchFrequency / samplesPtr->count;
+        max  = (samplesPtr->ticks[samplesPtr->count-1] * 1e6) / benchFrequency;
+    }
+
+    if (strcmp(configPtr->format, "csv") == 0) {
+        if (configPtr->header)
+            printf("%s\n", csvHeader);
+        printf("%s,%s,%d,%d,%d,%.3f,%d,%d,%s,%" TCL_LL_MODIFIER "d,%.1f,"
+               "%" TCL_LL_MODIFIER "d,%.1f,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f,"
+               "%Iu,%" TCL_LL_MODIFIER "d\n",
+               benchPtr->version, benchScenarioNames[configPtr->scenario],
+               configPtr->size, configPtr->connections,
+               configPtr->scenario == BENCH_IDLE ? configPtr->active : configPtr->connections,
+               seconds, configPtr->maxPendingReads,
+               configPtr->completionThreads,
+               configPtr->readMode ? configPtr->readMode : "",
+               benchPtr->ops, benchPtr->ops / seconds,
+               benchPtr->bytes, benchPtr->bytes / seconds,
+               (unsigned int) samplesPtr->count, mean,
+               BenchPercentile(samplesPtr, 500),
+               BenchPercentile(samplesPtr, 990),
+               BenchPercentile(samplesPtr, 999), max,
+               benchPtr->setupSeconds, benchPtr->memoryBytes,
+               benchPtr->errors);
+    }
+    else {
+        printf("{\"version\": \"%s\", \"scenario\": \"%s\", \"size\": %d, "
+               "\"connections\": %d, \"active\": %d, \"duration\": %.3f, "
+               "\"maxpendingreads\": %d, \"completionthreads\": %d, "
+               "\"readmode\": \"%s\", \"ops\": %" TCL_LL_MODIFIER "d, "
+               "\"ops_per_sec\": %.1f, \"bytes\": %" TCL_LL_MODIFIER "d, "
+               "\"bytes_per_sec\": %.1f, \"latency_us\": {\"samples\": %u, "
+               "\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+               "\"max\": %.1f}, \"setup_sec\": %.3f, \"memory_bytes\": %Iu, "
+               "\"errors\": %" TCL_LL_MODIFIER "d}\n",
+               benchPtr->version, benchScenarioNames[configPtr->scenario],
+               configPtr->size, configPtr->connections,
+               configPtr->scenario == BENCH_IDLE ? configPtr->active : configPtr->connections,
+               seconds, configPtr->maxPendingReads,
+               configPtr->completionThreads,
+               configPtr->readMode ? configPtr->readMode : "",
+               benchPtr->ops, benchPtr->ops / seconds,
+               benchPtr->bytes, benchPtr->bytes / seconds,
+               (unsigned int) samplesPtr->count, mean,
+               BenchPercentile(samplesPtr, 500),
+               BenchPercentile(samplesPtr, 990),
+               BenchPercentile(samplesPtr, 999), max,
+               benchPtr->setupSeconds, benchPtr->memoryBytes,
+               benchPtr->errors);
+    }
+    fflush(stdout);
+}
+
+static void
+BenchUsage(void)
+{
+    fprintf(stderr,
+            "Usage: iocpbench ?OPTIONS?\n"
+            "  -dll PATH        iocp DLL to load (default: package require iocp)\n"
+            "  -scenario NAME   echo, bulk, connect or idle (echo)\n"
+            "  -size N          Message size for echo and idle, write size for\n"
+            "                   bulk (64, bulk 65536)\n"
+            "  -connections N   Concurrent connections for echo, bulk and\n"
+            "                   connect, total connections for idle (1, connect 16,\n"
+            "                   idle 1000)\n"
+            "  -active N        Active connections for idle (1)\n"
+            "  -duration SECS   Measured interval (5)\n"
+            "  -maxpendingreads N   Socket -maxpendingreads option\n"
+            "  -readmode MODE   Socket -readmode option\n"
+            "  -threads N       Completion threads (iocp::configure\n"
+            "                   -completionthreads)\n"
+            "  -host ADDR       Loopback address to use (127.0.0.1)\n"
+            "  -format json|csv Output format (json)\n"
+            "  -header BOOL     Print CSV header line (1)\n");
+    exit(1);
+}
+
+static int
+BenchIntArg(const char *opt, const char *value, int min)
+{
+    char *endPtr;
+    long  n = strtol(value, &endPtr, 10);
+    if (*value == '\0' || *endPtr != '\0' || n < min || n > INT_MAX) {
+        fprintf(stderr, "iocpbench: invalid value \"%s\" for %s\n", value, opt);
+        exit(1);
+    }
+    return (int) n;
+}
+
+int
+main(int argc, char **argv)
+{
+    Bench         bench;
+    BenchConfig  *configPtr = &bench.config;
+    LARGE_INTEGER frequency;
+    int           i, scenario;
+    int           size = 0, connections = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    configPtr->scenario = BENCH_ECHO;
+    configPtr->host     = "127.0.0.1";
+    configPtr->format   = "json";
+    configPtr->active   = 1;
+    configPtr->duration = 5;
+    configPtr->header   = 1;
+
+    for (i = 1; i < argc; i += 2) {
+        const char *opt = argv[i];
+        const char *value;
+        if (i + 1 >= argc)
+            BenchUsage();
+        value = argv[i+1];
+        if (strcmp(opt, "-dll") == 0)
+            configPtr->dllPath = value;
+        else if (strcmp(opt, "-scenario") == 0) {
+            for (scenario = 0; benchScenarioNames[scenario]; ++scenario) {
+                if (strcmp(value, benchScenarioNames[scenario]) == 0)
+                    break;
+            }
+            if (benchScenarioNames[scenario] == NULL)
+                BenchUsage();
+            configPtr->scenario = (enum BenchScenario) scenario;
+        }
+        else if (strcmp(opt, "-size") == 0)
+            size = BenchIntArg(opt, value, 1);
+        else if (strcmp(opt, "-connections") == 0)
+            connections = BenchIntArg(opt, value, 1);
+        else if (strcmp(opt, "-active") == 0)
+            configPtr->active = BenchIntArg(opt, value, 0);
+        else if (strcmp(opt, "-duration") == 0)
+            configPtr->duration = BenchIntArg(opt, value, 1);
+        else if (strcmp(opt, "-maxpendingreads") == 0)
+            configPtr->maxPendingReads = BenchIntArg(opt, value, 1);
+        else if (strcmp(opt, "-readmode") == 0)
+            configPtr->readMode = value;
+        else if (strcmp(opt, "-threads") == 0)
+            configPtr->completionThreads = BenchIntArg(opt, value, 1);
+        else if (strcmp(opt, "-host") == 0)
+            configPtr->host = value;
+        else if (strcmp(opt, "-format") == 0) {
+            if (strcmp(value, "json") && strcmp(value, "csv"))
+                BenchUsage();
+            configPtr->format = value;
+        }
+        else if (strcmp(opt, "-header") == 0)
+            configPtr->header = BenchIntArg(opt, value, 0);
+        else
+            BenchUsage();
+    }
+    configPtr->size = size ? size :
+        (configPtr->scenario == BENCH_BULK ? 65536 : 64);
+    if (connections)
+        configPtr->connections = connections;
+    else if (configPtr->scenario == BENCH_CONNECT)
+        configPtr->connections = 16;
+    else if (configPtr->scenario == BENCH_IDLE)
+        configPtr->connections = 1000;
+    else
+        configPtr->connections = 1;
+    if (configPtr->active > configPtr->connections)
+        configPtr->active = configPtr->connections;
+
+    QueryPerformanceFrequency(&frequency);
+    benchFrequency = frequency.QuadPart;
+
+    bench.bufferSize = configPtr->size > 65536 ? configPtr->size : 65536;
+    bench.buffer     = malloc(bench.bufferSize);
+    if (bench.buffer == NULL)
+        BenchFatal(NULL, "out of memory");
+    memset(bench.buffer, 'x', bench.bufferSize);
+
+    Tcl_FindExecutable(argv[0]);
+    bench.interp = Tcl_CreateInterp();
+    if (configPtr->dllPath) {
+        Tcl_Obj *objs[3];
+        objs[0] = Tcl_NewStringObj("load", -1);
+        objs[1] = Tcl_NewStringObj(configPtr->dllPath, -1);
+        objs[2] = Tcl_NewStringObj("iocp", -1);
+        for (i = 0; i < 3; ++i)
+            Tcl_IncrRefCount(objs[i]);
+        if (Tcl_EvalObjv(bench.interp, 3, objs, TCL_EVAL_GLOBAL) != TCL_OK)
+            BenchFatal(bench.interp, "could not load iocp");
+        for (i = 0; i < 3; ++i)
+            Tcl_DecrRefCount(objs[i]);
+    }
+    else {
+        if (Tcl_Init(bench.interp) != TCL_OK)
+            BenchFatal(bench.interp, "could not initialize Tcl");
+        BenchEval(&bench, "package require iocp");
+    }
+    bench.version = _strdup(Tcl_GetString(BenchEval(&bench, "package present iocp")));
+    if (configPtr->completionThreads)
+        BenchEval(&bench, "iocp::configure -completionthreads %d",
+                  configPtr->completionThreads);
+    else
+        configPtr->completionThreads =
+            BenchIntArg("-threads", Tcl_GetString(BenchEval(&bench, "iocp::configure -completionthreads")), 1);
+
+    Tcl_CreateObjCommand(bench.interp, "iocpbench::accept",
+                         BenchAcceptObjCmd, &bench, NULL);
+
+    BenchRun(&bench);
+    BenchReport(&bench);
+
+    while (bench.connsPtr) {
+        BenchConn *connPtr = bench.connsPtr;
+        bench.connsPtr = connPtr->nextPtr;
+        BenchConnClose(connPtr);
+        free(connPtr);
+    }
+    Tcl_UnregisterChannel(bench.interp, bench.listener);
+    Tcl_DeleteInterp(bench.interp);
+    free(bench.samples.ticks);
+    free(bench.buffer);
+    return bench.errors ? 2 : 0;
+}
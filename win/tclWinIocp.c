@@ -15,10 +15,21 @@ static int  IocpEventHandler(Tcl_Event *evPtr, int flags);
 static int IocpChannelFileEventMask(IocpChannel *lockedChanPtr);
 static void IocpChannelConnectionStep(IocpChannel *lockedChanPtr, int blockable);
 static void IocpChannelExitConnectedState(IocpChannel *lockedChanPtr);
+static void IocpChannelExitHandshakingState(IocpChannel *lockedChanPtr,
+                                            IocpWinError winError);
 static void IocpChannelAwaitConnectCompletion(IocpChannel *lockedChanPtr);
+static DWORD WINAPI IocpCompletionThread(LPVOID lpParam);
+static IocpTimerProc IocpChannelTimerExpired;
+static Tcl_EventSetupProc IocpEventSetupProc;
+static Tcl_EventCheckProc IocpEventCheckProc;
+static IocpReadyQueue *IocpReadyQueueGet(void);
+static void IocpReadyQueueDrop(IocpReadyQueue *queuePtr);
+static void IocpReadyQueueRemove(IocpChannel *lockedChanPtr);
+static void IocpThreadAlert(Tcl_ThreadId threadId);
 
 Tcl_ObjCmdProc	Iocp_DebugOutObjCmd;
 Tcl_ObjCmdProc	Iocp_StatsObjCmd;
+Tcl_ObjCmdProc	Iocp_ConfigureObjCmd;
 
 /*
  * Static data
@@ -29,11 +40,15 @@ IocpSubSystem iocpModuleState;
 
 /* Statistics */
 IocpStats iocpStats;
+IocpCounterSlot iocpCounters[IOCP_COUNTER_SLOTS];
+
+/* Limit on unconsumed input across all channels */
+IocpInputBudget iocpInputBudget = {0, IOCP_INPUT_BUDGET_MAX_BYTES_DEFAULT};
 
 /* Enable/disable tracing */
 int iocpEnableTrace;
 
-#ifdef IOCP_ENABLE_TRACE
+#if defined(IOCP_ENABLE_TRACE) || defined(IOCP_ENABLE_ETW)
 /*
  * GUID format for traceview
  * 3a674e76-fe96-4450-b634-24fc587b2828
@@ -64,7 +79,7 @@ char *IocpDataBufferInit(IocpDataBuffer *dataBuf, int capacity)
         if (dataBuf->bytes == NULL)
             dataBuf->capacity = 0;
         else {
-            IOCP_STATS_INCR(IocpDataBufferAllocs);
+            IOCP_COUNTER_INCR(IocpDataBufferAllocs);
         }
     } else
         dataBuf->bytes = NULL;
@@ -80,7 +95,7 @@ char *IocpDataBufferInit(IocpDataBuffer *dataBuf, int capacity)
 void IocpDataBufferFini(IocpDataBuffer *dataBufPtr)
 {
     if (dataBufPtr->bytes) {
-        IOCP_STATS_INCR(IocpDataBufferFrees);
+        IOCP_COUNTER_INCR(IocpDataBufferFrees);
         ckfree(dataBufPtr->bytes);
     }
 }
@@ -105,6 +120,530 @@ int IocpDataBufferMoveOut(IocpDataBuffer *dataBuf, char *outPtr, int len)
     return numCopied;
 }
 
+/*
+ * Buffer pool.
+ *
+ * Every posted read, write, accept and connect requires an IocpBuffer and
+ * (except for connects) a data area. Rather than going to the heap for every
+ * operation, released buffers are recycled along with their data areas.
+ * Buffers are binned into size classes based on the capacity of their data
+ * area. Each thread (Tcl threads as well as the completion thread) keeps a
+ * small unlocked cache per size class. When a thread cache for a class
+ * overflows, half of it is moved to a process-wide pool and when it is
+ * empty, it is refilled from that pool. This matters because the buffer
+ * flow is not symmetric - e.g. write buffers are allocated in Tcl threads
+ * but released in the completion thread.
+ *
+ * The memory held in the shared pool is capped by iocpBufferPool.maxBytes
+ * (configurable with iocp::configure -maxcachedbytes). A cap of 0 disables
+ * pooling completely. Thread caches are bounded by IOCP_BUFFER_CACHE_BYTES
+ * worth of data per size class.
+ *
+ * Since thread caches are only touched by their owning thread, changing the
+ * cap cannot release their buffers directly. Instead the change bumps
+ * iocpBufferPool.generation and each thread spills its cache into the
+ * shared pool (subject to the new cap) on its next buffer operation or on
+ * exit, whichever comes first.
+ */
+#define IOCP_BUFFER_POOL_MIN_SHIFT   9 /* Smallest pooled data area 512 bytes */
+#define IOCP_BUFFER_POOL_MAX_SHIFT  16 /* Largest pooled data area 64K */
+#define IOCP_BUFFER_POOL_NUM_CLASSES \
+    (IOCP_BUFFER_POOL_MAX_SHIFT - IOCP_BUFFER_POOL_MIN_SHIFT + 2) /* +1 for no data */
+#define IOCP_BUFFER_POOL_MAX_BYTES_DEFAULT (8*1024*1024)
+#define IOCP_BUFFER_CACHE_BYTES    65536 /* Thread cache limit per size class */
+#define IOCP_BUFFER_CACHE_MIN_DEPTH    2 /* ...but at least these many */
+#define IOCP_BUFFER_CACHE_MAX_DEPTH   32 /* ...and at most these many */
+
+/*
+ * Per-thread buffer cache. Only accessed from the owning thread except for
+ * the statistics counters which are read (without locking) when reporting
+ * statistics.
+ */
+struct IocpBufferCache {
+    IocpLink    link;     /* Links all thread caches in iocpBufferPool */
+    IocpList    freeLists[IOCP_BUFFER_POOL_NUM_CLASSES];
+    int         counts[IOCP_BUFFER_POOL_NUM_CLASSES];
+    LONG        generation; /* iocpBufferPool.generation when last synced */
+    Tcl_WideInt hits;     /* Allocations satisfied from a pool */
+    Tcl_WideInt misses;   /* Allocations that went to the heap */
+};
+
+static struct IocpBufferPool {
+    IocpLock    lock;        /* Protects all fields below */
+    IocpList    freeLists[IOCP_BUFFER_POOL_NUM_CLASSES];
+    int         counts[IOCP_BUFFER_POOL_NUM_CLASSES];
+    IocpList    caches;      /* Thread caches currently in use */
+    Tcl_WideInt hits;        /* Accumulated from exited threads */
+    Tcl_WideInt misses;      /* Accumulated from exited threads */
+    IocpSizeT   cachedBytes; /* Memory held in the shared pool */
+    IocpSizeT   maxBytes;    /* Limit on cachedBytes */
+    volatile LONG generation; /* Incremented when maxBytes changes. Read
+                                 without the lock by thread caches */
+    int         initialized;
+} iocpBufferPool;
+
+static Tcl_ThreadDataKey iocpTsdKey;
+
+/*
+ * Returns the size class for a data area with the specified capacity or -1
+ * if the size is too large to be pooled. If exact is non-0, the capacity
+ * must exactly match the size class, else -1 is returned.
+ */
+IOCP_INLINE int IocpBufferPoolClass(int capacity, int exact)
+{
+    int cls;
+    if (capacity == 0)
+        return 0;
+    for (cls = 1; cls < IOCP_BUFFER_POOL_NUM_CLASSES; ++cls) {
+        int classSize = 1 << (IOCP_BUFFER_POOL_MIN_SHIFT + cls - 1);
+        if (capacity <= classSize)
+            return (exact && capacity != classSize) ? -1 : cls;
+    }
+    return -1;
+}
+IOCP_INLINE int IocpBufferPoolClassSize(int cls) {
+    return cls == 0 ? 0 : (1 << (IOCP_BUFFER_POOL_MIN_SHIFT + cls - 1));
+}
+IOCP_INLINE int IocpBufferPoolClassFootprint(int cls) {
+    return sizeof(IocpBuffer) + IocpBufferPoolClassSize(cls);
+}
+IOCP_INLINE int IocpBufferCacheDepth(int cls) {
+    int depth = cls == 0 ? IOCP_BUFFER_CACHE_MAX_DEPTH :
+        IOCP_BUFFER_CACHE_BYTES / IocpBufferPoolClassSize(cls);
+    if (depth < IOCP_BUFFER_CACHE_MIN_DEPTH)
+        return IOCP_BUFFER_CACHE_MIN_DEPTH;
+    if (depth > IOCP_BUFFER_CACHE_MAX_DEPTH)
+        return IOCP_BUFFER_CACHE_MAX_DEPTH;
+    return depth;
+}
+
+/*
+ * Frees the memory for a IocpBuffer and its data area. Unlike IocpBufferFree
+ * never returns it to the pool.
+ */
+static void IocpBufferRelease(IocpBuffer *bufPtr)
+{
+    IocpDataBufferFini(&bufPtr->data);
+    IOCP_COUNTER_INCR(IocpBufferFrees);
+    ckfree(bufPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolInit --
+ *
+ *    Initializes the process-wide buffer pool. Must be called exactly once
+ *    as part of process initialization.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Initializes the pool.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferPoolInit(void)
+{
+    int cls;
+    IocpLockInit(&iocpBufferPool.lock);
+    for (cls = 0; cls < IOCP_BUFFER_POOL_NUM_CLASSES; ++cls) {
+        IocpListInit(&iocpBufferPool.freeLists[cls]);
+        iocpBufferPool.counts[cls] = 0;
+    }
+    IocpListInit(&iocpBufferPool.caches);
+    iocpBufferPool.cachedBytes = 0;
+    iocpBufferPool.maxBytes    = IOCP_BUFFER_POOL_MAX_BYTES_DEFAULT;
+    iocpBufferPool.generation  = 0;
+    iocpBufferPool.initialized = 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolTrim --
+ *
+ *    Releases buffers from the shared pool until the memory held is within
+ *    the specified limit. Caller must be holding the pool lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Memory is freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferPoolTrim(IocpSizeT limit)
+{
+    int cls;
+    /* Free from the largest size classes first */
+    for (cls = IOCP_BUFFER_POOL_NUM_CLASSES - 1;
+         cls >= 0 && iocpBufferPool.cachedBytes > limit;
+         --cls) {
+        IocpLink *linkPtr;
+        while (iocpBufferPool.cachedBytes > limit &&
+               (linkPtr = IocpListPopFront(&iocpBufferPool.freeLists[cls])) != NULL) {
+            iocpBufferPool.counts[cls] -= 1;
+            iocpBufferPool.cachedBytes -= IocpBufferPoolClassFootprint(cls);
+            IocpBufferRelease(CONTAINING_RECORD(linkPtr, IocpBuffer, link));
+        }
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolFinalize --
+ *
+ *    Releases all memory held in the shared buffer pool. Thread caches that
+ *    are released after this point will free their buffers to the heap.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Memory is freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferPoolFinalize(void)
+{
+    IocpLockAcquireExclusive(&iocpBufferPool.lock);
+    IocpBufferPoolTrim(0);
+    iocpBufferPool.maxBytes    = 0;
+    iocpBufferPool.initialized = 0;
+    IocpLockReleaseExclusive(&iocpBufferPool.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferCacheSpill --
+ *
+ *    Moves all buffers in a thread cache to the shared pool, freeing those
+ *    that would exceed the pool limit. Caller must be holding the pool lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The thread cache is emptied.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferCacheSpill(IocpBufferCache *cachePtr)
+{
+    int cls;
+    for (cls = 0; cls < IOCP_BUFFER_POOL_NUM_CLASSES; ++cls) {
+        IocpLink *linkPtr;
+        while ((linkPtr = IocpListPopFront(&cachePtr->freeLists[cls])) != NULL) {
+            if ((iocpBufferPool.cachedBytes + IocpBufferPoolClassFootprint(cls))
+                <= iocpBufferPool.maxBytes) {
+                IocpListPrepend(&iocpBufferPool.freeLists[cls], linkPtr);
+                iocpBufferPool.counts[cls] += 1;
+                iocpBufferPool.cachedBytes += IocpBufferPoolClassFootprint(cls);
+            }
+            else {
+                IocpBufferRelease(CONTAINING_RECORD(linkPtr, IocpBuffer, link));
+            }
+        }
+        cachePtr->counts[cls] = 0;
+    }
+    cachePtr->generation = iocpBufferPool.generation;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferCacheSync --
+ *
+ *    Spills a thread cache to the shared pool if the pool limit has been
+ *    changed since the cache was last synced.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Buffers may be moved to the shared pool or freed.
+ *
+ *------------------------------------------------------------------------
+ */
+IOCP_INLINE void IocpBufferCacheSync(IocpBufferCache *cachePtr)
+{
+    if (cachePtr->generation != iocpBufferPool.generation) {
+        IocpLockAcquireExclusive(&iocpBufferPool.lock);
+        IocpBufferCacheSpill(cachePtr);
+        IocpLockReleaseExclusive(&iocpBufferPool.lock);
+    }
+}
+
+/*
+ * Syncs the current thread's cache, if it has one, without allocating one.
+ * Used on paths that bypass the pool when pooling is disabled.
+ */
+static void IocpBufferCacheSyncCurrent(void)
+{
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    if (tsdPtr->bufferCachePtr)
+        IocpBufferCacheSync(tsdPtr->bufferCachePtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferCacheRelease --
+ *
+ *    Releases the current thread's buffer cache, moving its buffers to the
+ *    shared pool (within the pool limits). Called from the thread exit
+ *    handler for Tcl threads and explicitly by the completion thread.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The thread cache is freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferCacheRelease(ClientData notUsed)
+{
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    IocpBufferCache *cachePtr = tsdPtr->bufferCachePtr;
+
+    if (cachePtr == NULL)
+        return;
+    tsdPtr->bufferCachePtr = NULL;
+
+    IocpLockAcquireExclusive(&iocpBufferPool.lock);
+    IocpListRemove(&iocpBufferPool.caches, &cachePtr->link);
+    iocpBufferPool.hits   += cachePtr->hits;
+    iocpBufferPool.misses += cachePtr->misses;
+    IocpBufferCacheSpill(cachePtr);
+    IocpLockReleaseExclusive(&iocpBufferPool.lock);
+    ckfree(cachePtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferCacheGet --
+ *
+ *    Returns the buffer cache for the current thread, allocating it if
+ *    necessary. An existing cache is first synced with the pool limit.
+ *
+ * Results:
+ *    Pointer to the thread's IocpBufferCache.
+ *
+ * Side effects:
+ *    May allocate a cache and register a thread exit handler to release it.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpBufferCache *IocpBufferCacheGet(void)
+{
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    IocpBufferCache *cachePtr = tsdPtr->bufferCachePtr;
+    int cls;
+
+    if (cachePtr != NULL) {
+        IocpBufferCacheSync(cachePtr);
+        return cachePtr;
+    }
+
+    cachePtr = ckalloc(sizeof(*cachePtr));
+    IocpLinkInit(&cachePtr->link);
+    for (cls = 0; cls < IOCP_BUFFER_POOL_NUM_CLASSES; ++cls) {
+        IocpListInit(&cachePtr->freeLists[cls]);
+        cachePtr->counts[cls] = 0;
+    }
+    cachePtr->hits   = 0;
+    cachePtr->misses = 0;
+
+    IocpLockAcquireExclusive(&iocpBufferPool.lock);
+    cachePtr->generation = iocpBufferPool.generation;
+    IocpListAppend(&iocpBufferPool.caches, &cachePtr->link);
+    IocpLockReleaseExclusive(&iocpBufferPool.lock);
+
+    tsdPtr->bufferCachePtr = cachePtr;
+    Tcl_CreateThreadExitHandler(IocpBufferCacheRelease, NULL);
+    return cachePtr;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolGetStats --
+ *
+ *    Retrieves buffer pool statistics. The counters and buffer counts of
+ *    thread caches are read without synchronization so the values are
+ *    only a snapshot.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Stores the statistics in the passed locations.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferPoolGetStats(
+    Tcl_WideInt *hitsPtr,   /* Allocations satisfied from pool */
+    Tcl_WideInt *missesPtr, /* Allocations from the heap */
+    Tcl_WideInt *bytesPtr,  /* Memory held in shared pool */
+    Tcl_WideInt *countPtr,  /* Number of buffers in shared pool */
+    Tcl_WideInt *threadBytesPtr) /* Memory held in thread caches */
+{
+    IocpLink *linkPtr;
+    int cls;
+
+    IocpLockAcquireExclusive(&iocpBufferPool.lock);
+    *hitsPtr   = iocpBufferPool.hits;
+    *missesPtr = iocpBufferPool.misses;
+    *threadBytesPtr = 0;
+    for (linkPtr = iocpBufferPool.caches.headPtr; linkPtr; linkPtr = linkPtr->nextPtr) {
+        IocpBufferCache *cachePtr = CONTAINING_RECORD(linkPtr, IocpBufferCache, link);
+        *hitsPtr   += cachePtr->hits;
+        *missesPtr += cachePtr->misses;
+        for (cls = 0; cls < IOCP_BUFFER_POOL_NUM_CLASSES; ++cls) {
+            *threadBytesPtr += (Tcl_WideInt) cachePtr->counts[cls]
+                             * IocpBufferPoolClassFootprint(cls);
+        }
+    }
+    *bytesPtr = iocpBufferPool.cachedBytes;
+    *countPtr = 0;
+    for (cls = 0; cls < IOCP_BUFFER_POOL_NUM_CLASSES; ++cls)
+        *countPtr += iocpBufferPool.counts[cls];
+    IocpLockReleaseExclusive(&iocpBufferPool.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolSetMaxBytes --
+ *
+ *    Sets the limit on the memory held in the shared buffer pool.
+ *    A limit of 0 disables buffer pooling.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Buffers in excess of the new limit are freed. The current thread's
+ *    cache is spilled immediately, other threads' caches on their next
+ *    buffer operation.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferPoolSetMaxBytes(IocpSizeT maxBytes)
+{
+    IocpLockAcquireExclusive(&iocpBufferPool.lock);
+    iocpBufferPool.maxBytes = maxBytes;
+    InterlockedIncrement(&iocpBufferPool.generation);
+    IocpBufferPoolTrim(maxBytes);
+    IocpLockReleaseExclusive(&iocpBufferPool.lock);
+    IocpBufferCacheSyncCurrent();
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolGet --
+ *
+ *    Retrieves a buffer of the specified size class from the current
+ *    thread's cache, refilling the cache from the shared pool if empty.
+ *
+ * Results:
+ *    Pointer to a IocpBuffer or NULL if the pool is empty.
+ *
+ * Side effects:
+ *    Buffers may be moved from the shared pool into the thread cache.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpBuffer *IocpBufferPoolGet(int cls)
+{
+    IocpBufferCache *cachePtr = IocpBufferCacheGet();
+    IocpLink *linkPtr;
+
+    linkPtr = IocpListPopFront(&cachePtr->freeLists[cls]);
+    if (linkPtr == NULL && iocpBufferPool.counts[cls] > 0) {
+        /* Unlocked check above is only a hint. Refill half a cache worth. */
+        int more = IocpBufferCacheDepth(cls) / 2;
+        IocpLockAcquireExclusive(&iocpBufferPool.lock);
+        while (more-- &&
+               (linkPtr = IocpListPopFront(&iocpBufferPool.freeLists[cls])) != NULL) {
+            iocpBufferPool.counts[cls] -= 1;
+            iocpBufferPool.cachedBytes -= IocpBufferPoolClassFootprint(cls);
+            IocpListPrepend(&cachePtr->freeLists[cls], linkPtr);
+            cachePtr->counts[cls] += 1;
+        }
+        IocpLockReleaseExclusive(&iocpBufferPool.lock);
+        linkPtr = IocpListPopFront(&cachePtr->freeLists[cls]);
+    }
+    if (linkPtr == NULL) {
+        cachePtr->misses += 1;
+        return NULL;
+    }
+    cachePtr->counts[cls] -= 1;
+    cachePtr->hits += 1;
+    return CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferPoolPut --
+ *
+ *    Returns a buffer of the specified size class to the current thread's
+ *    cache, spilling half the cache to the shared pool if it is full.
+ *
+ * Results:
+ *    Returns 1 if the buffer was taken by the pool, else 0 in which case
+ *    the caller is responsible for freeing it.
+ *
+ * Side effects:
+ *    Buffers may be moved from the thread cache into the shared pool or
+ *    freed if the pool is full.
+ *
+ *------------------------------------------------------------------------
+ */
+static int IocpBufferPoolPut(IocpBuffer *bufPtr, int cls)
+{
+    IocpBufferCache *cachePtr;
+    int depth;
+
+    if (iocpBufferPool.maxBytes == 0) {
+        IocpBufferCacheSyncCurrent(); /* Release anything cached earlier */
+        return 0;               /* Pooling disabled */
+    }
+
+    cachePtr = IocpBufferCacheGet();
+    IocpListPrepend(&cachePtr->freeLists[cls], &bufPtr->link);
+    cachePtr->counts[cls] += 1;
+
+    depth = IocpBufferCacheDepth(cls);
+    if (cachePtr->counts[cls] > depth) {
+        IocpLink *linkPtr;
+        int footprint = IocpBufferPoolClassFootprint(cls);
+        IocpLockAcquireExclusive(&iocpBufferPool.lock);
+        while (cachePtr->counts[cls] > depth / 2) {
+            linkPtr = IocpListPopFront(&cachePtr->freeLists[cls]);
+            cachePtr->counts[cls] -= 1;
+            if ((iocpBufferPool.cachedBytes + footprint) <= iocpBufferPool.maxBytes) {
+                IocpListPrepend(&iocpBufferPool.freeLists[cls], linkPtr);
+                iocpBufferPool.counts[cls] += 1;
+                iocpBufferPool.cachedBytes += footprint;
+            } else {
+                IocpBufferRelease(CONTAINING_RECORD(linkPtr, IocpBuffer, link));
+            }
+        }
+        IocpLockReleaseExclusive(&iocpBufferPool.lock);
+    }
+    return 1;
+}
+
 /*
  * Allocates and initializes an IocpBuffer associated with a channel and of
  * a specified capacity.
@@ -112,10 +651,13 @@ int IocpDataBufferMoveOut(IocpDataBuffer *dataBuf, char *outPtr, int len)
  *               Its reference count is incremented. May be NULL.
  *  capacity   - the capacity of the data buffer
  *
- * The reference count of the returned IocpBuffer is 1.
+ * The buffer is retrieved from the buffer pool if possible. In that case,
+ * as well as when newly allocated buffers whose size falls within the
+ * pooled size classes, the capacity of the returned buffer is rounded up
+ * to the size class.
  *
  * On success, returns a pointer that should be freed by calling
- * IocpBufferDrop. On failure, returns NULL.
+ * IocpBufferFree. On failure, returns NULL.
  */
 IocpBuffer *IocpBufferNew(
     int          capacity,        /* Capacity requested */
@@ -124,10 +666,33 @@ IocpBuffer *IocpBufferNew(
                                   *  otherwise Overlap header */
     )
 {
-    IocpBuffer *bufPtr = attemptckalloc(sizeof(*bufPtr));
-    if (bufPtr == NULL)
-        return NULL;
-    IOCP_STATS_INCR(IocpBufferAllocs);
+    IocpBuffer *bufPtr;
+    int cls;
+
+    cls = IocpBufferPoolClass(capacity, 0);
+    if (cls < 0)
+        bufPtr = NULL;
+    else if (iocpBufferPool.maxBytes == 0) {
+        IocpBufferCacheSyncCurrent(); /* Release anything cached earlier */
+        bufPtr = NULL;
+    } else
+        bufPtr = IocpBufferPoolGet(cls);
+    if (bufPtr) {
+        bufPtr->data.begin = 0;
+        bufPtr->data.len   = 0;
+    }
+    else {
+        bufPtr = attemptckalloc(sizeof(*bufPtr));
+        if (bufPtr == NULL)
+            return NULL;
+        IOCP_COUNTER_INCR(IocpBufferAllocs);
+        if (cls >= 0)
+            capacity = IocpBufferPoolClassSize(cls);
+        if (IocpDataBufferInit(&bufPtr->data, capacity) == NULL && capacity != 0) {
+            ckfree(bufPtr);
+            return NULL;
+        }
+    }
 
     memset(&bufPtr->u, 0, sizeof(bufPtr->u));
 
@@ -136,12 +701,11 @@ IocpBuffer *IocpBufferNew(
     bufPtr->winError  = 0;
     bufPtr->operation = op;
     bufPtr->flags     = flags;
+    bufPtr->postedAt  = 0;
+    bufPtr->completedAt = 0;
     IocpLinkInit(&bufPtr->link);
+    IOCP_ETW_BUFFER("BufferAlloc", bufPtr, NULL, bufPtr->data.capacity, 0);
 
-    if (IocpDataBufferInit(&bufPtr->data, capacity) == NULL && capacity != 0) {
-        ckfree(bufPtr);
-        return NULL;
-    }
     return bufPtr;
 }
 
@@ -156,16 +720,22 @@ IocpBuffer *IocpBufferNew(
  *    None.
  *
  * Side effects:
- *    The underlying data buffer is also freed.
+ *    The buffer is returned to the buffer pool if possible. Otherwise, it
+ *    and the underlying data buffer are freed.
  *
  *------------------------------------------------------------------------
  */
 void IocpBufferFree(IocpBuffer *bufPtr)
 {
+    int cls;
     IOCP_ASSERT(bufPtr->chanPtr == NULL);
-    IocpDataBufferFini(&bufPtr->data);
-    IOCP_STATS_INCR(IocpBufferFrees);
-    ckfree(bufPtr);
+    IOCP_ETW_BUFFER("BufferFree", bufPtr, NULL, bufPtr->data.len, bufPtr->winError);
+    if (bufPtr->flags & IOCP_BUFFER_F_RIO)
+        IocpRioBufferDetach(bufPtr); /* Leaves a buffer with no data area */
+    cls = IocpBufferPoolClass(bufPtr->data.capacity, 1);
+    if (cls >= 0 && IocpBufferPoolPut(bufPtr, cls))
+        return;
+    IocpBufferRelease(bufPtr);
 }
 
 /*
@@ -190,17 +760,42 @@ IocpChannel *IocpChannelNew(
 {
     IocpChannel *chanPtr;
     chanPtr          = ckalloc(vtblPtr->allocationSize);
-    IOCP_STATS_INCR(IocpChannelAllocs);
+    IOCP_COUNTER_INCR(IocpChannelAllocs);
     IocpListInit(&chanPtr->inputBuffers);
+    IocpHandoffQueueInit(&chanPtr->handoffBuffers);
+    IocpListInit(&chanPtr->reorderBuffers);
+    IocpListInit(&chanPtr->postedReads);
+    chanPtr->readSeqPosted = 0;
+    chanPtr->readSeqQueued = 0;
     chanPtr->owningThread  = 0;
+    chanPtr->readyQueuePtr = NULL;
+    IocpLinkInit(&chanPtr->readyLink);
     chanPtr->channel  = NULL;
     chanPtr->state    = IOCP_STATE_INIT;
     chanPtr->flags    = 0;
     chanPtr->winError = 0;
+    chanPtr->inlineDepth = 0;
+    memset(&chanPtr->stats, 0, sizeof(chanPtr->stats));
+    IocpTimerInit(&chanPtr->timer, chanPtr, IocpChannelTimerExpired);
+    chanPtr->connectDeadline  = 0;
+    chanPtr->lastInputTick    = 0;
+    chanPtr->connectTimeout   = 0;
+    chanPtr->readTimeout      = 0;
     chanPtr->pendingReads     = 0;
     chanPtr->pendingWrites    = 0;
     chanPtr->maxPendingReads  = IOCP_MAX_PENDING_READS_DEFAULT;
     chanPtr->maxPendingWrites = IOCP_MAX_PENDING_WRITES_DEFAULT;
+    chanPtr->readBufferSize   = 0;
+    chanPtr->autoReadSize     = IOCP_BUFFER_DEFAULT_SIZE;
+    chanPtr->autoPendingReads = IOCP_MAX_PENDING_READS_DEFAULT;
+    chanPtr->readFillScore    = 0;
+    chanPtr->inputBytes       = 0;
+    chanPtr->maxInputBytes    = IOCP_MAX_INPUT_BYTES_DEFAULT;
+    chanPtr->maxSpinWait      = iocpModuleState.default_max_spin_wait;
+    chanPtr->spinWaitEstimate = chanPtr->maxSpinWait / 2;
+    IocpListInit(&chanPtr->outputBuffers);
+    chanPtr->outputBytes      = 0;
+    chanPtr->maxOutputBytes   = IOCP_MAX_OUTPUT_BYTES_DEFAULT;
     chanPtr->numRefs = 1;
     chanPtr->vtblPtr = vtblPtr;
     InitializeConditionVariable(&chanPtr->cv);
@@ -235,6 +830,10 @@ void IocpChannelDrop(
     if (--lockedChanPtr->numRefs <= 0) {
         IocpLink *linkPtr;
 
+        /* Before finalize as the wheel may otherwise fire on freed memory */
+        IocpTimerCancel(&lockedChanPtr->timer);
+        /* No other thread can be consuming input at this point. */
+        (void) IocpChannelTakeInput(lockedChanPtr);
         if (lockedChanPtr->vtblPtr->finalize)
             lockedChanPtr->vtblPtr->finalize(lockedChanPtr);
 
@@ -243,10 +842,25 @@ void IocpChannelDrop(
             IocpBuffer  *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
             IocpBufferFree(bufPtr);
         }
+        /* Return unconsumed input to the process-wide budget */
+        IocpChannelAddInputBytes(lockedChanPtr, -lockedChanPtr->inputBytes);
+        while ((linkPtr = IocpListPopFront(&lockedChanPtr->reorderBuffers)) != NULL) {
+            IocpBuffer  *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+            IocpBufferFree(bufPtr);
+        }
+        while ((linkPtr = IocpListPopFront(&lockedChanPtr->outputBuffers)) != NULL) {
+            IocpBuffer  *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+            IocpBufferFree(bufPtr);
+        }
+
+        /* Cannot be on the ready queue as that holds a reference */
+        IOCP_ASSERT((lockedChanPtr->flags & IOCP_CHAN_F_ON_EVENTQ) == 0);
+        if (lockedChanPtr->readyQueuePtr)
+            IocpReadyQueueDrop(lockedChanPtr->readyQueuePtr);
 
         IocpChannelUnlock(lockedChanPtr);
         IocpLockDelete(&lockedChanPtr->lock);
-        IOCP_STATS_INCR(IocpChannelFrees);
+        IOCP_COUNTER_INCR(IocpChannelFrees);
         ckfree(lockedChanPtr);
     }
     else {
@@ -257,19 +871,94 @@ void IocpChannelDrop(
 /*
  *------------------------------------------------------------------------
  *
- * IocpChannelConnectionStep --
+ * IocpChannelSetState --
  *
- *    Executes one step in a async connection. lockedChanPtr must be in one
- *    of the connecting states, CONNECTING, CONNECT_RETRY or CONNECTED.
+ *    Transitions a IocpChannel to a new state. All state changes after
+ *    allocation go through here so they can be traced.
  *
- *    If the blockable parameter is true, the function will return when the
- *    connection is open or fails completely. The channel will then be in OPEN,
- *    CONNECT_FAILED or DISCONNECTED states.
+ * Results:
+ *    None.
  *
- *    If blockable is false, the function will transition the channel to
- *    the next appropriate state if possible or remain in the same state.
- *    A CONNECTING state will remain as is as it indicates a connection attempt
- *    is still in progress and we just need to wait for it to complete. A
+ * Side effects:
+ *    Sets the channel state and logs an ETW event.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpChannelSetState(
+    IocpChannel   *lockedChanPtr, /* Must be locked */
+    enum IocpState newState)      /* IOCP_STATE_* */
+{
+    IOCP_ETW_CHANNEL("ChannelState", lockedChanPtr, newState, "NewState");
+    lockedChanPtr->state = newState;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelGetStats --
+ *
+ *    Appends the channel's I/O counters to a Tcl_DString as a dictionary.
+ *    Used to implement the -stats channel option.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The dictionary elements are appended to dsPtr.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpChannelGetStats(
+    IocpChannel *lockedChanPtr,  /* Must be locked */
+    Tcl_DString *dsPtr)          /* Where to store the dictionary */
+{
+    char buf[32];
+    const IocpChannelStats *statsPtr = &lockedChanPtr->stats;
+#define APPENDSTAT(name_, value_) do { \
+    Tcl_DStringAppendElement(dsPtr, name_); \
+    _snprintf_s(buf, _countof(buf), _TRUNCATE, "%I64d", (Tcl_WideInt) (value_)); \
+    Tcl_DStringAppendElement(dsPtr, buf); \
+} while (0)
+
+    APPENDSTAT("BytesRead", statsPtr->bytesRead);
+    APPENDSTAT("BytesWritten", statsPtr->bytesWritten);
+    APPENDSTAT("ReadOps", statsPtr->readOps);
+    APPENDSTAT("WriteOps", statsPtr->writeOps);
+    APPENDSTAT("PendingReads", lockedChanPtr->pendingReads);
+    APPENDSTAT("PendingWrites", lockedChanPtr->pendingWrites);
+    APPENDSTAT("Accepts", statsPtr->accepts);
+    APPENDSTAT("InputWouldBlock", statsPtr->inputWouldBlock);
+    APPENDSTAT("OutputWouldBlock", statsPtr->outputWouldBlock);
+    APPENDSTAT("ConnectRetries", statsPtr->connectRetries);
+    APPENDSTAT("InputBytes", lockedChanPtr->inputBytes);
+    APPENDSTAT("InputThrottled",
+               (lockedChanPtr->flags & IOCP_CHAN_F_INPUT_THROTTLED) != 0);
+    APPENDSTAT("InputThrottles", statsPtr->inputThrottles);
+    APPENDSTAT("SpinWaits", statsPtr->spinWaits);
+    APPENDSTAT("SpinMisses", statsPtr->spinMisses);
+    APPENDSTAT("SleepWaits", statsPtr->sleepWaits);
+    APPENDSTAT("SpinWaitEstimate", lockedChanPtr->spinWaitEstimate);
+#undef APPENDSTAT
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelConnectionStep --
+ *
+ *    Executes one step in a async connection. lockedChanPtr must be in one
+ *    of the connecting states, RESOLVING, CONNECTING, CONNECT_RETRY or
+ *    CONNECTED.
+ *
+ *    If the blockable parameter is true, the function will return when the
+ *    connection is open or fails completely. The channel will then be in OPEN,
+ *    CONNECT_FAILED or DISCONNECTED states.
+ *
+ *    If blockable is false, the function will transition the channel to
+ *    the next appropriate state if possible or remain in the same state.
+ *    A RESOLVING state will remain as is until the lookup thread posts the
+ *    connect or marks the channel as CONNECT_FAILED. A CONNECTING state will remain as is as it indicates a connection attempt
+ *    is still in progress and we just need to wait for it to complete. A
  *    CONNECT_RETRY state indicates the completion thread signalled the previous
  *    attempt failed. In this case, a new attempt is initiated if there are
  *    additional addresses to try and the channel is transitioned to CONNECTING.
@@ -297,10 +986,33 @@ static void IocpChannelConnectionStep(
     IOCP_TRACE(("IocpChannelConnectionStep Enter: lockedChanPtr=%p, blockable=%d, state=0x%x\n", lockedChanPtr, blockable, lockedChanPtr->state));
 
     switch (lockedChanPtr->state) {
+    case IOCP_STATE_RESOLVING:
+        /*
+         * The lookup thread moves the channel on to CONNECTING or
+         * CONNECT_FAILED. If blockable, wait for that and then carry on
+         * with the connect.
+         */
+        if (blockable) {
+            while (lockedChanPtr->state == IOCP_STATE_RESOLVING)
+                IocpChannelAwaitCompletion(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT);
+            if (IocpStateConnectionInProgress(lockedChanPtr->state))
+                IocpChannelConnectionStep(lockedChanPtr, blockable);
+            else
+                IocpNotifyChannel(lockedChanPtr);
+        }
+        break;
     case IOCP_STATE_CONNECTED:
         /* IOCP thread has already signalled completion, transition to OPEN */
         IocpChannelExitConnectedState(lockedChanPtr);
         break;
+    case IOCP_STATE_HANDSHAKING:
+        /*
+         * The handshake is driven by completions and the IOCP thread moves
+         * the channel on. If blockable, wait for that.
+         */
+        if (blockable)
+            (void) IocpChannelAwaitHandshake(lockedChanPtr);
+        break;
     case IOCP_STATE_CONNECTING:
         /*
          * If blockable we just wait for connection to complete. If non-blockable,
@@ -312,7 +1024,13 @@ static void IocpChannelConnectionStep(
         }
         break;
     case IOCP_STATE_CONNECT_RETRY:
-        if (blockable) {
+        if (lockedChanPtr->flags & IOCP_CHAN_F_CONNECT_TIMEDOUT) {
+            /* No retries once the connect timeout expires */
+            IocpChannelSetState(lockedChanPtr, IOCP_STATE_CONNECT_FAILED);
+            lockedChanPtr->winError = WSAETIMEDOUT;
+            lockedChanPtr->flags |= IOCP_CHAN_F_REMOTE_EOF;
+            IocpNotifyChannel(lockedChanPtr);
+        } else if (blockable) {
             if (lockedChanPtr->vtblPtr->blockingconnect) {
                 lockedChanPtr->vtblPtr->blockingconnect(lockedChanPtr);
                 /* Don't care about success. Caller responsible to check state */
@@ -322,13 +1040,13 @@ static void IocpChannelConnectionStep(
             if (lockedChanPtr->vtblPtr->connectfailed  == NULL ||
                 lockedChanPtr->vtblPtr->connectfailed(lockedChanPtr) != 0) {
                 /* No means to retry or retry failed. lockedChanPtr->winError is error */
-                lockedChanPtr->state = IOCP_STATE_CONNECT_FAILED;
+                IocpChannelSetState(lockedChanPtr, IOCP_STATE_CONNECT_FAILED);
                 lockedChanPtr->flags |= IOCP_CHAN_F_REMOTE_EOF;
                 IocpNotifyChannel(lockedChanPtr);
             }
             else {
                 /* Revert to CONNECTING state when retry ongoing */
-                lockedChanPtr->state = IOCP_STATE_CONNECTING;
+                IocpChannelSetState(lockedChanPtr, IOCP_STATE_CONNECTING);
             }
         }
         break;
@@ -349,6 +1067,8 @@ static void IocpChannelConnectionStep(
  *    handler and depending on its return value, transitions into OPEN
  *    or DISCONNECTED state. If channel event notifications are registered,
  *    the callbacks may further change state before this connection returns.
+ *    If the handler started a handshake, the channel is left in HANDSHAKING
+ *    state and IocpCompleteConnect completes the transition.
  *
  *    In the case Tcl has to be notified, lockedChanPtr has to be unlocked.
  *    before Tcl_NotifyChannel is called. It is then relocked before returning.
@@ -367,11 +1087,16 @@ static void IocpChannelExitConnectedState(
     IocpChannel *lockedChanPtr
     )
 {
-    if (lockedChanPtr->vtblPtr->connected &&
-        lockedChanPtr->vtblPtr->connected(lockedChanPtr) != 0) {
-        lockedChanPtr->state = IOCP_STATE_DISCONNECTED;
+    IocpWinError winError = ERROR_SUCCESS;
+
+    if (lockedChanPtr->vtblPtr->connected)
+        winError = lockedChanPtr->vtblPtr->connected(lockedChanPtr);
+    if (winError == ERROR_IO_PENDING)
+        return;                 /* Handshaking. Nothing to notify yet. */
+    if (winError != ERROR_SUCCESS) {
+        IocpChannelSetState(lockedChanPtr, IOCP_STATE_DISCONNECTED);
     } else {
-        lockedChanPtr->state    = IOCP_STATE_OPEN;
+        IocpChannelSetState(lockedChanPtr, IOCP_STATE_OPEN);
         /* Clear any errors stored while cycling through address list */
         lockedChanPtr->winError = ERROR_SUCCESS;
         IocpChannelPostReads(lockedChanPtr);
@@ -380,6 +1105,74 @@ static void IocpChannelExitConnectedState(
     IocpNotifyChannel(lockedChanPtr);
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelExitHandshakingState --
+ *
+ *    Called from the completion thread when the driver reports the end of
+ *    a handshake. Transitions into OPEN or DISCONNECTED state as for
+ *    IocpChannelExitConnectedState but, not being in the Tcl thread, the
+ *    thread is only nudged to notify the channel.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Reads are posted on success. The Tcl thread is notified via the event
+ *    queue or woken up if blocked.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpChannelExitHandshakingState(
+    IocpChannel *lockedChanPtr, /* Must be locked */
+    IocpWinError winError)      /* Outcome of the handshake */
+{
+    if (winError == ERROR_SUCCESS) {
+        IocpChannelSetState(lockedChanPtr, IOCP_STATE_OPEN);
+        lockedChanPtr->winError = ERROR_SUCCESS;
+        IocpChannelPostReads(lockedChanPtr);
+    } else {
+        IocpChannelSetState(lockedChanPtr, IOCP_STATE_DISCONNECTED);
+        lockedChanPtr->winError =
+            (lockedChanPtr->flags & IOCP_CHAN_F_CONNECT_TIMEDOUT) ? WSAETIMEDOUT
+                                                                  : winError;
+    }
+    lockedChanPtr->flags |= IOCP_CHAN_F_WRITE_DONE; /* In case registered file event */
+    /* As for connect completions, force a notification. */
+    IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT, 1);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelAwaitHandshake --
+ *
+ *    Waits for a handshake started by the connected() driver function to
+ *    finish. Must be called only on a blocking connect as the function
+ *    will block. The locked channel will be unlocked while waiting.
+ *
+ * Results:
+ *    0 if the channel is OPEN, otherwise the Windows error code that
+ *    failed the handshake.
+ *
+ * Side effects:
+ *    The channel moves out of HANDSHAKING state.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError IocpChannelAwaitHandshake(
+    IocpChannel *lockedChanPtr) /* Must be locked on entry and will be locked
+                                 * on return. But may be unlocked and changed
+                                 * state in between. */
+{
+    while (lockedChanPtr->state == IOCP_STATE_HANDSHAKING)
+        IocpChannelAwaitCompletion(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT);
+    if (lockedChanPtr->state == IOCP_STATE_OPEN)
+        return ERROR_SUCCESS;
+    return lockedChanPtr->winError ? lockedChanPtr->winError : WSAECONNABORTED;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -411,7 +1204,8 @@ static void IocpChannelAwaitConnectCompletion(
 
     IocpChannelAwaitCompletion(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT);
 
-    if (lockedChanPtr->state == IOCP_STATE_CONNECT_RETRY) {
+    if (lockedChanPtr->state == IOCP_STATE_CONNECT_RETRY &&
+        (lockedChanPtr->flags & IOCP_CHAN_F_CONNECT_TIMEDOUT) == 0) {
         /* Retry connecting in blocking mode if possible */
         if (lockedChanPtr->vtblPtr->blockingconnect) {
             lockedChanPtr->vtblPtr->blockingconnect(lockedChanPtr);
@@ -421,6 +1215,38 @@ static void IocpChannelAwaitConnectCompletion(
     if (lockedChanPtr->state == IOCP_STATE_CONNECTED) {
         IocpChannelExitConnectedState(lockedChanPtr);
     }
+    if (lockedChanPtr->state == IOCP_STATE_HANDSHAKING) {
+        (void) IocpChannelAwaitHandshake(lockedChanPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelSpinLimit --
+ *
+ *    Returns how long to spin waiting for a completion before sleeping.
+ *    This is a little over the recent typical wait. Spinning is skipped
+ *    when waits are typically longer than the channel's limit since the
+ *    spin would then mostly be wasted.
+ *
+ * Results:
+ *    Microseconds to spin. 0 if the thread should sleep right away.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static int IocpChannelSpinLimit(
+    const IocpChannel *lockedChanPtr) /* Must be locked */
+{
+    int maxSpin  = lockedChanPtr->maxSpinWait;
+    int estimate = lockedChanPtr->spinWaitEstimate;
+
+    if (maxSpin == 0 || estimate > maxSpin)
+        return 0;
+    return 2 * estimate < maxSpin ? 2 * estimate + 1 : maxSpin;
 }
 
 /*
@@ -431,6 +1257,12 @@ static void IocpChannelAwaitConnectCompletion(
  *    Releases the lock on a IocpChannel and then blocks until an I/O
  *    completion is signaled. On returning the IocpChannel lock is reacquired.
  *
+ *    When completions have recently been arriving quickly, the thread
+ *    first spins for a while watching for the blocked flag to be cleared
+ *    by IocpChannelWakeAfterCompletion. This saves the two context switches
+ *    of sleeping and being woken. The duration of each wait is fed back
+ *    into the estimate that sizes the spin.
+ *
  * Results:
  *    None.
  *
@@ -444,10 +1276,50 @@ void IocpChannelAwaitCompletion(
     IocpChannel *lockedChanPtr,    /* Must be locked on entry */
     int          blockType)        /* Exactly one of IOCP_CHAN_F_BLOCKED_* values  */
 {
+    LONG64 start;
+    LONG64 elapsed;
+    int    spinLimit;
+
     IOCP_TRACE(("IocpChannelAwaitCompletion Enter: lockedChanPtr=%p, blockType=%d\n", lockedChanPtr, blockType));
     lockedChanPtr->flags &= ~ IOCP_CHAN_F_BLOCKED_MASK;
     lockedChanPtr->flags |= blockType;
-    IocpChannelCVWait(lockedChanPtr);
+
+    start     = IocpLatencyTimestamp();
+    spinLimit = IocpChannelSpinLimit(lockedChanPtr);
+    if (spinLimit > 0) {
+        volatile int *flagsPtr = &lockedChanPtr->flags;
+        LONG64 deadline =
+            start + (spinLimit * iocpModuleState.perf_frequency) / 1000000;
+        int polls = 0;
+        /* Completion thread needs the lock to deliver the completion */
+        IocpChannelUnlock(lockedChanPtr);
+        while (*flagsPtr & blockType) {
+            YieldProcessor();
+            if ((++polls & 0x3f) == 0 && IocpLatencyTimestamp() >= deadline)
+                break;
+        }
+        IocpChannelLock(lockedChanPtr);
+    }
+
+    if (lockedChanPtr->flags & blockType) {
+        if (spinLimit > 0) {
+            IOCP_COUNTER_INCR(IocpSpinMisses);
+            lockedChanPtr->stats.spinMisses++;
+        }
+        IOCP_COUNTER_INCR(IocpSleepWaits);
+        lockedChanPtr->stats.sleepWaits++;
+        IocpChannelCVWait(lockedChanPtr);
+    } else {
+        IOCP_COUNTER_INCR(IocpSpinWaits);
+        lockedChanPtr->stats.spinWaits++;
+    }
+
+    /* Long waits are clamped so a run of short ones soon re-enables spinning */
+    elapsed = ((IocpLatencyTimestamp() - start) * 1000000) / iocpModuleState.perf_frequency;
+    if (elapsed > 2 * IOCP_MAX_SPIN_WAIT_LIMIT)
+        elapsed = 2 * IOCP_MAX_SPIN_WAIT_LIMIT;
+    lockedChanPtr->spinWaitEstimate =
+        (7 * lockedChanPtr->spinWaitEstimate + (int) elapsed + 4) / 8;
     IOCP_TRACE(("IocpChannelAwaitCompletion Leave: lockedChanPtr=%p, blockType=%d\n", lockedChanPtr, blockType));
 }
 
@@ -491,8 +1363,8 @@ int IocpChannelWakeAfterCompletion(
  *
  * IocpChannelEnqueueEvent --
  *
- *    Enqueues a event on Tcl's event queue to notify the thread owning a
- *    channel.
+ *    Adds a channel to the ready queue of its owning thread so that
+ *    thread's event source will process it.
  *
  * Results:
  *    None.
@@ -509,31 +1381,252 @@ void IocpChannelEnqueueEvent(
     IocpChannel *lockedChanPtr,  /* Must be locked and caller holding a reference
                                   * to ensure it does not go away even if unlocked */
     enum IocpEventReason reason, /* Indicates reason for notification */
-    int          force           /* If true, queue even if already queued. */
+    int          force           /* Historical. A channel is never on the
+                                  * ready queue more than once and will be
+                                  * processed anyways if already present. */
     )
 {
+    IocpReadyQueue *queuePtr = lockedChanPtr->readyQueuePtr;
+    Tcl_ThreadId    threadId;
+
     IOCP_TRACE(("IocpChannelEnqueueEvent Enter: lockedChanPtr=%p, reason=%d, force=%d, lockedChanPtr->owningThread=%d\n", lockedChanPtr, reason, force, lockedChanPtr->owningThread));
-    if (lockedChanPtr->owningThread != 0) {
-        /* Unless forced, only add to thread's event queue if not present. */
-        if (force || (lockedChanPtr->flags & IOCP_CHAN_F_ON_EVENTQ) == 0) {
-            IocpTclEvent *evPtr = ckalloc(sizeof(*evPtr));
-            evPtr->event.proc = IocpEventHandler;
-            evPtr->chanPtr    = lockedChanPtr;
-            evPtr->reason     = reason;
-            lockedChanPtr->numRefs++; /* Corresponding to above,
-                                         reversed by IocpEventHandler */
-            /* Optimization if enqueuing to current thread */
-            if (Tcl_GetCurrentThread() == lockedChanPtr->owningThread) {
-                IOCP_TRACE(("IocpChannelEnqueueEvent: queuing to current thread\n"));
-                Tcl_QueueEvent((Tcl_Event *) evPtr, TCL_QUEUE_TAIL);
-            }
-            else {
-                IOCP_TRACE(("IocpChannelEnqueueEvent: queuing to another thread\n"));
-                Tcl_ThreadQueueEvent(lockedChanPtr->owningThread,
-                                     (Tcl_Event *)evPtr, TCL_QUEUE_TAIL);
-                Tcl_ThreadAlert(lockedChanPtr->owningThread);
-            }
-        }
+    if (lockedChanPtr->owningThread == 0 || queuePtr == NULL)
+        return;
+
+    /* Only add to thread's ready queue if not present. */
+    if (lockedChanPtr->flags & IOCP_CHAN_F_ON_EVENTQ)
+        return;
+
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    threadId = queuePtr->threadId;
+    if (threadId == 0) {
+        /* Thread has exited. No one to drain the queue. */
+        IocpLockReleaseExclusive(&queuePtr->lock);
+        return;
+    }
+    IocpListAppend(&queuePtr->channels, &lockedChanPtr->readyLink);
+    IocpLockReleaseExclusive(&queuePtr->lock);
+    IOCP_COUNTER_INCR(IocpEventsQueued);
+    IOCP_ETW_CHANNEL("ChannelEnqueue", lockedChanPtr, reason, "Reason");
+    lockedChanPtr->flags |= IOCP_CHAN_F_ON_EVENTQ;
+    lockedChanPtr->numRefs++; /* Reversed when removed from ready queue */
+
+    /*
+     * No need to alert current thread. The event source setup proc will
+     * see the queued channel before the thread next blocks.
+     */
+    if (threadId != Tcl_GetCurrentThread()) {
+        IOCP_TRACE(("IocpChannelEnqueueEvent: alerting another thread\n"));
+        IocpThreadAlert(threadId);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReadyQueueDrop --
+ *
+ *    Releases a reference to a ready queue, freeing it if there are no
+ *    more references.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The ready queue may be freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpReadyQueueDrop(IocpReadyQueue *queuePtr)
+{
+    int numRefs;
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    numRefs = --queuePtr->numRefs;
+    IocpLockReleaseExclusive(&queuePtr->lock);
+    if (numRefs <= 0) {
+        IOCP_ASSERT(queuePtr->channels.headPtr == NULL);
+        IocpLockDelete(&queuePtr->lock);
+        ckfree(queuePtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReadyQueueRemove --
+ *
+ *    Removes a channel from its thread's ready queue if present.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The reference to the channel from the queue is released but since
+ *    the caller is required to hold a reference, the channel is not freed
+ *    and stays locked.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpReadyQueueRemove(
+    IocpChannel *lockedChanPtr) /* Locked and referenced by caller */
+{
+    IocpReadyQueue *queuePtr = lockedChanPtr->readyQueuePtr;
+
+    if ((lockedChanPtr->flags & IOCP_CHAN_F_ON_EVENTQ) == 0)
+        return;
+    IOCP_ASSERT(queuePtr);
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    IocpListRemove(&queuePtr->channels, &lockedChanPtr->readyLink);
+    IocpLockReleaseExclusive(&queuePtr->lock);
+    IOCP_COUNTER_INCR(IocpEventsDequeued);
+    IocpLinkInit(&lockedChanPtr->readyLink);
+    lockedChanPtr->flags &= ~IOCP_CHAN_F_ON_EVENTQ;
+    IOCP_ASSERT(lockedChanPtr->numRefs > 1);
+    lockedChanPtr->numRefs--;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReadyQueueThreadExit --
+ *
+ *    Thread exit handler for Tcl threads owning a ready queue.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The event source is deleted and the queue is marked so no further
+ *    channels are added to it. The thread's reference to the queue is
+ *    released. Any channels still on the queue are removed when they are
+ *    detached from the thread on closing.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpReadyQueueThreadExit(ClientData clientData)
+{
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    IocpReadyQueue *queuePtr = (IocpReadyQueue *) clientData;
+
+    Tcl_DeleteEventSource(IocpEventSetupProc, IocpEventCheckProc, queuePtr);
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    queuePtr->threadId = 0;
+    IocpLockReleaseExclusive(&queuePtr->lock);
+    if (tsdPtr->readyQueuePtr == queuePtr)
+        tsdPtr->readyQueuePtr = NULL;
+    IocpReadyQueueDrop(queuePtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReadyQueueGet --
+ *
+ *    Returns the ready queue for the current Tcl thread, creating it and
+ *    registering the event source if necessary.
+ *
+ * Results:
+ *    Pointer to the thread's ready queue with its reference count
+ *    incremented. Caller must release it with IocpReadyQueueDrop.
+ *
+ * Side effects:
+ *    May create a ready queue and register an event source.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpReadyQueue *IocpReadyQueueGet(void)
+{
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    IocpReadyQueue *queuePtr = tsdPtr->readyQueuePtr;
+
+    if (queuePtr == NULL) {
+        queuePtr = ckalloc(sizeof(*queuePtr));
+        IocpLockInit(&queuePtr->lock);
+        IocpListInit(&queuePtr->channels);
+        queuePtr->threadId    = Tcl_GetCurrentThread();
+        queuePtr->numRefs     = 1; /* For the owning thread */
+        queuePtr->drainQueued = 0;
+        tsdPtr->readyQueuePtr = queuePtr;
+        Tcl_CreateEventSource(IocpEventSetupProc, IocpEventCheckProc, queuePtr);
+        Tcl_CreateThreadExitHandler(IocpReadyQueueThreadExit, queuePtr);
+    }
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    queuePtr->numRefs++;
+    IocpLockReleaseExclusive(&queuePtr->lock);
+    return queuePtr;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpEventSetupProc --
+ *
+ *    Event source setup procedure. Ensures the notifier does not block if
+ *    there are channels on the ready queue.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Maximum block time may be set to 0.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpEventSetupProc(
+    ClientData clientData,      /* IocpReadyQueue */
+    int        flags)           /* Event flags */
+{
+    IocpReadyQueue *queuePtr = (IocpReadyQueue *) clientData;
+
+    if (!(flags & TCL_FILE_EVENTS))
+        return;
+    /*
+     * Unlocked read is fine. A channel queued after this check will
+     * be accompanied by a Tcl_ThreadAlert that wakes the notifier.
+     */
+    if (queuePtr->channels.headPtr != NULL) {
+        Tcl_Time blockTime = {0, 0};
+        Tcl_SetMaxBlockTime(&blockTime);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpEventCheckProc --
+ *
+ *    Event source check procedure. Queues a single Tcl event that will
+ *    drain the ready queue if it is not empty.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    A drain event may be queued.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpEventCheckProc(
+    ClientData clientData,      /* IocpReadyQueue */
+    int        flags)           /* Event flags */
+{
+    IocpReadyQueue *queuePtr = (IocpReadyQueue *) clientData;
+    int queueDrain = 0;
+
+    if (!(flags & TCL_FILE_EVENTS))
+        return;
+
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    if (queuePtr->channels.headPtr != NULL && ! queuePtr->drainQueued) {
+        queuePtr->drainQueued = 1;
+        queueDrain = 1;
+    }
+    IocpLockReleaseExclusive(&queuePtr->lock);
+
+    if (queueDrain) {
+        Tcl_Event *evPtr = ckalloc(sizeof(*evPtr));
+        evPtr->proc = IocpEventHandler;
+        Tcl_QueueEvent(evPtr, TCL_QUEUE_TAIL);
     }
 }
 
@@ -584,312 +1677,898 @@ void IocpChannelNudgeThread(
     }
 }
 
+/*
+ * Releases the reference to a channel held by a completed IocpBuffer. The
+ * completion thread holds its own reference while processing a batch of
+ * completions for a channel so this never frees the channel and the
+ * channel stays locked.
+ */
+IOCP_INLINE void IocpChannelReleaseBufferReference(IocpChannel *lockedChanPtr) {
+    IOCP_ASSERT(lockedChanPtr->numRefs > 1);
+    lockedChanPtr->numRefs -= 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpCompleteConnect --
+ *
+ *    Handles completion of connect operations from IOCP.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The channel state is changed to OPEN or CONNECT_RETRY depending
+ *    on buffer status. In HANDSHAKING state, the completion is passed to
+ *    the driver and the state changed to OPEN or DISCONNECTED once the
+ *    handshake is done. The passed bufPtr is freed and the buffer reference
+ *    to lockedChanPtr released. The Tcl thread is notified via the event queue or woken
+ *    up if blocked.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpCompleteConnect(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by caller */
+    IocpBuffer *bufPtr)         /* I/O completion buffer */
+{
+    IocpWinError winError;
+
+    switch (lockedChanPtr->state) {
+    case IOCP_STATE_CONNECTING:
+        if (bufPtr->winError != ERROR_SUCCESS) {
+            IOCP_COUNTER_INCR(IocpConnectRetries);
+            lockedChanPtr->stats.connectRetries++;
+        }
+        if (lockedChanPtr->vtblPtr->connectcompleted &&
+            lockedChanPtr->vtblPtr->connectcompleted(lockedChanPtr, bufPtr)
+            == ERROR_IO_PENDING) {
+            break;              /* Driver has consumed the completion */
+        }
+        lockedChanPtr->winError = bufPtr->winError;
+        lockedChanPtr->state = bufPtr->winError == 0 ? IOCP_STATE_CONNECTED : IOCP_STATE_CONNECT_RETRY;
+        /*
+         * Note last param is 1, forcing a thread to be notified even if no
+         * WATCH flags are set. This is for async connects where Tcl thread
+         * does not do a gets/read but only fconfigure -error.
+         */
+        IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT, 1);
+        break;
+
+    case IOCP_STATE_HANDSHAKING:
+        /* Handshake I/O posted by the driver. See connected() */
+        winError = lockedChanPtr->vtblPtr->connectcompleted(lockedChanPtr, bufPtr);
+        if (winError != ERROR_IO_PENDING)
+            IocpChannelExitHandshakingState(lockedChanPtr, winError);
+        break;
+
+    case IOCP_STATE_CLOSED: /* Ignore, nothing to be done */
+        break;
+
+    default: /* TBD - should not happen. How to report logic error */
+        break;
+    }
+
+    bufPtr->chanPtr = NULL;
+    IocpChannelReleaseBufferReference(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
+    IocpBufferFree(bufPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpCompleteDisconnect --
+ *
+ *    Handles completion of disconnect operations from IOCP.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The associated socket is closed, the passed bufPtr is freed
+ *    and the buffer reference
+ *    to lockedChanPtr released. The Tcl thread is notified via the event queue or woken
+ *    up if blocked.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpCompleteDisconnect(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by caller */
+    IocpBuffer *bufPtr)         /* I/O completion buffer */
+{
+    if (lockedChanPtr->vtblPtr->disconnected) {
+        lockedChanPtr->vtblPtr->disconnected(lockedChanPtr, bufPtr->winError);
+    }
+    bufPtr->chanPtr = NULL;
+    IocpChannelReleaseBufferReference(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
+    IocpBufferFree(bufPtr);
+}
+
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpCompleteAccept --
+ *
+ *    Handles completion of connection accept operations from IOCP.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The passed bufPtr is freed or enqueued on the owning IocpChannel. Its
+ *    reference to lockedChanPtr is released and the Tcl thread notified via the event loop.
+ *    If the Tcl thread is blocked on this channel, it is woken up.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpCompleteAccept(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by caller */
+    IocpBuffer *bufPtr)         /* I/O completion buffer */
+{
+    IOCP_TRACE(("IocpCompleteAccept Enter: lockedChanPtr=%p. state=0x%x\n", lockedChanPtr, lockedChanPtr->state));
+
+    IOCP_COUNTER_INCR(IocpAcceptOps);
+    lockedChanPtr->stats.accepts++;
+
+    /*
+     * Reminder: unlike reads/writes, the count of pending accept operations
+     * is on a per listening socket basis, not per channel. Since we don't
+     * deal with channel-type specific operations here, the count is
+     * decremented in the channel-specific code in the Tcl thread.
+     *
+     * So also, deal with the channel states in the Tcl thread. Don't
+     * bother with them here.
+     *
+     * TBD - may be make reads/writes the same for consistency?
+     */
+
+    /*
+     * Add the buffer to the input queue which also doubles as the accept queue
+     * since listeners are disabled for read and write at the channel level.
+     * Then if the channel was blocked, awaken the sleeping thread. Otherwise
+     * send it a Tcl event notification.
+     */
+    IocpHandoffQueuePush(&lockedChanPtr->handoffBuffers, &bufPtr->link);
+    bufPtr->chanPtr = NULL;
+    /*
+     * chanPtr->numRefs-- because bufPtr does not refer to it (though it is on
+     *                    the input queue, that is immaterial)
+     * chanPtr->numRefs++ because we still want to access chanPtr below after
+     *                    unlocking and relocking.
+     * The two cancel out. The latter will be reversed at function exit.
+     */
+
+    IocpChannelNudgeThread(lockedChanPtr, 0, 0);
+
+    /* This drops the reference from bufPtr which was delayed (see above) */
+    IocpChannelReleaseBufferReference(lockedChanPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelAdaptReadSize --
+ *
+ *    Adjusts the size and number of posted reads of a channel in adaptive
+ *    mode based on how full completed reads are. A run of reads that fill
+ *    their buffers first grows the buffer size and once that is at its
+ *    limit, the number of reads kept posted. A longer run of reads that
+ *    mostly come back empty reverses these in the opposite order so idle
+ *    connections hold a single small buffer.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Updates the auto* fields of the channel which take effect on the
+ *    next posted read.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpChannelAdaptReadSize(
+    IocpChannel *lockedChanPtr, /* Locked channel */
+    const IocpBuffer *bufPtr)   /* Successfully completed read */
+{
+#define IOCP_READ_ADAPT_GROW_RUN   2
+#define IOCP_READ_ADAPT_SHRINK_RUN 4
+    int nbytes = bufPtr->data.len;
+
+    if (lockedChanPtr->readBufferSize != 0 || bufPtr->winError != 0 || nbytes == 0)
+        return;
+
+    if (nbytes >= bufPtr->data.capacity) {
+        if (lockedChanPtr->readFillScore < 0)
+            lockedChanPtr->readFillScore = 0;
+        if (++lockedChanPtr->readFillScore < IOCP_READ_ADAPT_GROW_RUN)
+            return;
+        lockedChanPtr->readFillScore = 0;
+        if (lockedChanPtr->autoReadSize < IOCP_READ_BUFFER_AUTO_MAX_SIZE)
+            lockedChanPtr->autoReadSize *= 2;
+        else if (lockedChanPtr->autoPendingReads < lockedChanPtr->maxPendingReads)
+            lockedChanPtr->autoPendingReads++;
+        else
+            return;
+        IOCP_COUNTER_INCR(IocpReadSizeGrows);
+    }
+    else if (nbytes <= bufPtr->data.capacity / 4) {
+        if (lockedChanPtr->readFillScore > 0)
+            lockedChanPtr->readFillScore = 0;
+        if (--lockedChanPtr->readFillScore > -IOCP_READ_ADAPT_SHRINK_RUN)
+            return;
+        lockedChanPtr->readFillScore = 0;
+        if (lockedChanPtr->autoPendingReads > 1)
+            lockedChanPtr->autoPendingReads--;
+        else if (lockedChanPtr->autoReadSize > IOCP_READ_BUFFER_MIN_SIZE)
+            lockedChanPtr->autoReadSize /= 2;
+        else
+            return;
+        IOCP_COUNTER_INCR(IocpReadSizeShrinks);
+    }
+    else {
+        lockedChanPtr->readFillScore = 0;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpCompleteRead --
+ *
+ *    Handles completion of read operations from IOCP.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The passed bufPtr is freed or enqueued on the owning IocpChannel. Its
+ *    reference to lockedChanPtr is released and the Tcl thread notified via the event loop.
+ *    If the Tcl thread is blocked on this channel, it is woken up.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpCompleteRead(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by caller */
+    IocpBuffer *bufPtr)         /* I/O completion buffer */
+{
+    int queued;
+
+    IOCP_TRACE(("IocpCompleteRead Enter: lockedChanPtr=%p. state=0x%x\n", lockedChanPtr, lockedChanPtr->state));
+
+    IOCP_ASSERT(lockedChanPtr->pendingReads > 0);
+    lockedChanPtr->pendingReads--;
+    if (bufPtr->flags & IOCP_BUFFER_F_TRACKED) {
+        IocpListRemove(&lockedChanPtr->postedReads, &bufPtr->link);
+        bufPtr->flags &= ~IOCP_BUFFER_F_TRACKED;
+    }
+    IOCP_COUNTER_INCR(IocpReadOps);
+    lockedChanPtr->stats.readOps++;
+
+    if (lockedChanPtr->state == IOCP_STATE_CLOSED) {
+        bufPtr->chanPtr = NULL;
+        IocpChannelReleaseBufferReference(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
+        IocpBufferFree(bufPtr);
+        return;
+    }
+
+    if (lockedChanPtr->vtblPtr->readcompleted != NULL &&
+        lockedChanPtr->vtblPtr->readcompleted(lockedChanPtr, bufPtr) == ERROR_IO_PENDING) {
+        return; /* Reposted. Buffer still holds its channel reference. */
+    }
+
+    if (lockedChanPtr->readTimeout != 0 && bufPtr->data.len > 0)
+        lockedChanPtr->lastInputTick = GetTickCount64();
+    if (lockedChanPtr->flags & IOCP_CHAN_F_READ_TIMEDOUT) {
+        /* Reads cancelled by IocpChannelTimerExpired report the timeout */
+        if (bufPtr->winError == ERROR_OPERATION_ABORTED)
+            bufPtr->winError = WSAETIMEDOUT;
+        if (lockedChanPtr->pendingReads == 0)
+            lockedChanPtr->flags &= ~IOCP_CHAN_F_READ_TIMEDOUT;
+    }
+
+    IocpChannelAdaptReadSize(lockedChanPtr, bufPtr);
+    if ((bufPtr->flags & IOCP_BUFFER_F_DISCARD) == 0 && bufPtr->data.len > 0) {
+        IOCP_COUNTER_ADD(IocpBytesRead, bufPtr->data.len);
+        lockedChanPtr->stats.bytesRead += bufPtr->data.len;
+    }
+
+    bufPtr->chanPtr = NULL;
+    /*
+     * chanPtr->numRefs-- because bufPtr does not refer to it (though it is on
+     *                    the input queue, that is immaterial)
+     * chanPtr->numRefs++ because we still want to access chanPtr below after
+     *                    unlocking and relocking.
+     * The two cancel out. The latter will be reversed at function exit.
+     */
+
+    /*
+     * With multiple completion threads, completions for the same channel
+     * may be processed in a different order from which the reads were
+     * posted. If reads posted earlier are still in the hands of other
+     * completion threads, park the buffer (ordered by sequence) until they
+     * show up. Note sequence comparisons are relative to readSeqQueued to
+     * take care of wraparound.
+     */
+    if (bufPtr->sequence != lockedChanPtr->readSeqQueued) {
+        unsigned int distance = bufPtr->sequence - lockedChanPtr->readSeqQueued;
+        IocpLink *linkPtr;
+        for (linkPtr = lockedChanPtr->reorderBuffers.headPtr;
+             linkPtr != NULL;
+             linkPtr = linkPtr->nextPtr) {
+            IocpBuffer *otherPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+            if ((otherPtr->sequence - lockedChanPtr->readSeqQueued) > distance)
+                break;
+        }
+        if (linkPtr == NULL)
+            IocpListAppend(&lockedChanPtr->reorderBuffers, &bufPtr->link);
+        else
+            IocpListInsertBefore(&lockedChanPtr->reorderBuffers, linkPtr, &bufPtr->link);
+        IocpChannelReleaseBufferReference(lockedChanPtr);
+        return;
+    }
+
+    /*
+     * Hand off the buffer, and any parked buffers that follow it, to the
+     * Tcl thread, through the inputready() hook if the channel has one.
+     * Buffers marked for discarding only take up their place in the
+     * sequence and are freed. Then if anything was queued and the channel
+     * was blocked, awaken the sleeping thread. Otherwise send it a Tcl
+     * event notification.
+     */
+    queued = 0;
+    while (1) {
+        if (bufPtr->flags & IOCP_BUFFER_F_DISCARD)
+            IocpBufferFree(bufPtr);
+        else if (lockedChanPtr->vtblPtr->inputready)
+            queued += lockedChanPtr->vtblPtr->inputready(lockedChanPtr, bufPtr);
+        else {
+            IocpChannelQueueInput(lockedChanPtr, bufPtr);
+            queued = 1;
+        }
+        lockedChanPtr->readSeqQueued++;
+        if (lockedChanPtr->reorderBuffers.headPtr == NULL)
+            break;
+        bufPtr = CONTAINING_RECORD(
+            lockedChanPtr->reorderBuffers.headPtr, IocpBuffer, link);
+        if (bufPtr->sequence != lockedChanPtr->readSeqQueued)
+            break;
+        IocpListPopFront(&lockedChanPtr->reorderBuffers);
+    }
+
+    /*
+     * Note that zero bytes read => EOF. That will also be handled in the
+     * Tcl thread since in any case it has to be notified of closure. So
+     * also any errors indicated by bufPtr->winError.
+     */
+    if (queued)
+        IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_READ, 0);
+
+    /* This drops the reference from bufPtr which was delayed (see above) */
+    IocpChannelReleaseBufferReference(lockedChanPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpCompleteWrite --
+ *
+ *    Handles completion of Write operations from IOCP.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The passed bufPtr, along with any buffers gathered into the same
+ *    write, is freed and its reference to lockedChanPtr released. Queued
+ *    output is posted to the device. The Tcl thread
+ *    notified via the event loop. If the Tcl thread is blocked on this channel,
+ *    it is woken up.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpCompleteWrite(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by caller */
+    IocpBuffer *bufPtr)         /* I/O completion buffer */
+{
+    IocpBuffer *nextPtr;
+    LONG64      written = 0;
+
+    IOCP_ASSERT(lockedChanPtr->pendingWrites > 0);
+    lockedChanPtr->pendingWrites--;
+
+    bufPtr->chanPtr = NULL;
+    do {
+        nextPtr = bufPtr->context[0].ptr;
+        lockedChanPtr->outputBytes -= bufPtr->data.len;
+        written += bufPtr->data.len;
+        if (bufPtr->flags & IOCP_BUFFER_F_TRANSMIT)
+            CloseHandle(bufPtr->context[1].h);
+        IocpBufferFree(bufPtr);
+        bufPtr = nextPtr;
+    } while (bufPtr);
+    IOCP_COUNTER_INCR(IocpWriteOps);
+    IOCP_COUNTER_ADD(IocpBytesWritten, written);
+    lockedChanPtr->stats.writeOps++;
+    lockedChanPtr->stats.bytesWritten += written;
+    IOCP_ASSERT(lockedChanPtr->outputBytes >= 0);
+
+    if (lockedChanPtr->state == IOCP_STATE_OPEN &&
+        lockedChanPtr->outputBuffers.headPtr &&
+        lockedChanPtr->vtblPtr->flushoutput) {
+        IocpWinError winError = lockedChanPtr->vtblPtr->flushoutput(lockedChanPtr);
+        if (winError != ERROR_SUCCESS && lockedChanPtr->winError == ERROR_SUCCESS)
+            lockedChanPtr->winError = winError;
+    }
+
+    if (lockedChanPtr->state != IOCP_STATE_CLOSED) {
+        lockedChanPtr->flags |= IOCP_CHAN_F_WRITE_DONE;
+        /* TBD - optimize under which conditions we need to nudge thread */
+        IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_WRITE, 0);
+    }
+    IocpChannelReleaseBufferReference(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpCompleteBuffer --
+ *
+ *    Dispatches a dequeued completion to the handler for the operation.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    See the IocpComplete* handlers. The buffer's reference to the channel
+ *    is released but the channel stays locked.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpCompleteBuffer(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by caller */
+    IocpBuffer  *bufPtr,         /* I/O completion buffer */
+    DWORD        nbytes,         /* Number of bytes transferred */
+    IocpWinError winError)       /* Completion status */
+{
+    if (bufPtr->postedAt != 0) {
+        /* Inline and registered I/O completions are not stamped at dequeue */
+        if (bufPtr->completedAt == 0)
+            bufPtr->completedAt = IocpLatencyTimestamp();
+        IocpLatencyRecord(bufPtr->operation == IOCP_BUFFER_OP_WRITE ?
+                          IOCP_LATENCY_WRITE_COMPLETION :
+                          IOCP_LATENCY_READ_COMPLETION,
+                          bufPtr->postedAt, bufPtr->completedAt);
+    }
+    else
+        bufPtr->completedAt = 0;
+
+    /* Write buffers retain the posted length for output accounting */
+    if (bufPtr->operation != IOCP_BUFFER_OP_WRITE)
+        bufPtr->data.len = nbytes;
+    bufPtr->winError = winError;
+    if (bufPtr->winError != 0 &&
+        lockedChanPtr->vtblPtr->translateerror != NULL) {
+        /* Translate to a more specific error code */
+        bufPtr->winError = lockedChanPtr->vtblPtr->translateerror(lockedChanPtr, bufPtr);
+    }
+    IOCP_ETW_BUFFER("BufferComplete", bufPtr, lockedChanPtr, nbytes, bufPtr->winError);
+
+    /*
+     * NOTE - it is responsibility of called completion routines
+     * to dispose of bufPtr and its channel reference.
+     */
+    IOCP_TRACE(("IocpCompleteBuffer: chanPtr=%p, chanPtr->state=0x%x, bufPtr->operation=%d, bufPtr->winError=%d\n", lockedChanPtr, lockedChanPtr->state, bufPtr->operation, bufPtr->winError));
+    switch (bufPtr->operation) {
+    case IOCP_BUFFER_OP_READ:
+        IocpCompleteRead(lockedChanPtr, bufPtr);
+        break;
+    case IOCP_BUFFER_OP_WRITE:
+        IocpCompleteWrite(lockedChanPtr, bufPtr);
+        break;
+    case IOCP_BUFFER_OP_CONNECT:
+        IocpCompleteConnect(lockedChanPtr, bufPtr);
+        break;
+    case IOCP_BUFFER_OP_DISCONNECT:
+        IocpCompleteDisconnect(lockedChanPtr, bufPtr);
+        break;
+    case IOCP_BUFFER_OP_ACCEPT:
+        IocpCompleteAccept(lockedChanPtr, bufPtr);
+        break;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelCompleteInline --
+ *
+ *    Processes an I/O operation that completed synchronously on a handle
+ *    marked with FILE_SKIP_COMPLETION_PORT_ON_SUCCESS. No completion packet
+ *    is queued to the port in this case so the caller, which has just
+ *    posted the operation, hands it over here instead of the completion
+ *    thread seeing it.
+ *
+ *    The caller must have already accounted for the operation as pending
+ *    (e.g. pendingReads) exactly as if it had returned WSA_IO_PENDING.
+ *
+ *    Completion handlers may post further operations (e.g. a write
+ *    completion flushing queued output) which may again complete inline.
+ *    To bound the recursion, once IOCP_INLINE_COMPLETION_MAX_DEPTH inline
+ *    completions are nested on a channel, the completion is instead queued
+ *    to the port for a completion thread to process as usual.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Same as the completion thread processing the buffer. The buffer's
+ *    reference to the channel is released. The channel stays locked.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpChannelCompleteInline(
+    IocpChannel *lockedChanPtr, /* Locked channel, referenced by bufPtr */
+    IocpBuffer  *bufPtr,        /* Buffer for the completed operation */
+    DWORD        nbytes)        /* Number of bytes transferred */
+{
+    if (lockedChanPtr->inlineDepth >= IOCP_INLINE_COMPLETION_MAX_DEPTH) {
+        /* Internal is already STATUS_SUCCESS since the operation completed */
+        if (PostQueuedCompletionStatus(iocpModuleState.completion_port, nbytes,
+                                       0, (OVERLAPPED *)&bufPtr->u)) {
+            IOCP_COUNTER_INCR(IocpInlineDeferrals);
+            return;
+        }
+        /* Could not queue. Nothing for it but to complete here. */
+    }
+    IOCP_COUNTER_INCR(IocpInlineCompletions);
+    /*
+     * The completion handlers expect the caller to hold a reference in
+     * addition to the buffer's. Caller is sure to have one since the
+     * channel is locked but it may not be accounted separately.
+     */
+    lockedChanPtr->numRefs++;
+    lockedChanPtr->inlineDepth++;
+    IocpCompleteBuffer(lockedChanPtr, bufPtr, nbytes, ERROR_SUCCESS);
+    lockedChanPtr->inlineDepth--;
+    IOCP_ASSERT(lockedChanPtr->numRefs > 1);
+    lockedChanPtr->numRefs--;
+}
+
 /*
  *------------------------------------------------------------------------
  *
- * IocpCompleteConnect --
+ * IocpThreadAlert --
  *
- *    Handles completion of connect operations from IOCP.
+ *    Alerts a Tcl thread that events have been queued for it. When called
+ *    from a completion thread that is processing a batch, the alert is
+ *    deferred until the end of the batch so that each Tcl thread is alerted
+ *    at most once per batch.
  *
  * Results:
  *    None.
  *
  * Side effects:
- *    The channel state is changed to OPEN or CONNECT_RETRY depending
- *    on buffer status. The passed bufPtr is freed and lockedChanPtr
- *    dropped. The Tcl thread is notified via the event queue or woken
- *    up if blocked.
+ *    The thread is alerted now or at the end of the current batch.
  *
  *------------------------------------------------------------------------
  */
-static void IocpCompleteConnect(
-    IocpChannel *lockedChanPtr, /* Locked channel, will be dropped */
-    IocpBuffer *bufPtr)         /* I/O completion buffer */
+static void IocpThreadAlert(Tcl_ThreadId threadId)
 {
-    switch (lockedChanPtr->state) {
-    case IOCP_STATE_CONNECTING:
-        lockedChanPtr->winError = bufPtr->winError;
-        lockedChanPtr->state = bufPtr->winError == 0 ? IOCP_STATE_CONNECTED : IOCP_STATE_CONNECT_RETRY;
-        /*
-         * Note last param is 1, forcing a thread to be notified even if no
-         * WATCH flags are set. This is for async connects where Tcl thread
-         * does not do a gets/read but only fconfigure -error.
-         */
-        IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT, 1);
-        break;
-
-    case IOCP_STATE_CLOSED: /* Ignore, nothing to be done */
-        break;
-
-    default: /* TBD - should not happen. How to report logic error */
-        break;
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    IocpAlertBatch *batchPtr = tsdPtr->alertBatchPtr;
+    int i;
+
+    if (batchPtr) {
+        for (i = 0; i < batchPtr->count; ++i) {
+            if (batchPtr->threads[i] == threadId)
+                return;         /* Already will be alerted */
+        }
+        if (batchPtr->count < IOCP_COMPLETION_BATCH_SIZE) {
+            batchPtr->threads[batchPtr->count++] = threadId;
+            return;
+        }
+        /* No room to defer. Alert immediately. */
     }
-
-    bufPtr->chanPtr = NULL;
-    IocpChannelDrop(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
-    IocpBufferFree(bufPtr);
+    Tcl_ThreadAlert(threadId);
 }
 
 /*
  *------------------------------------------------------------------------
  *
- * IocpCompleteDisconnect --
+ * IocpBatchSizeBucket --
  *
- *    Handles completion of disconnect operations from IOCP.
+ *    Maps the number of entries in a completion batch to a histogram bucket.
+ *    Bucket i counts batches of 2^i to 2^(i+1)-1 entries with the last
+ *    bucket holding all larger batches.
  *
  * Results:
- *    None.
+ *    Index in the range 0 to IOCP_BATCH_SIZE_BUCKETS-1.
  *
  * Side effects:
- *    The associated socket is closed, the passed bufPtr is freed
- *    and lockedChanPtr
- *    dropped. The Tcl thread is notified via the event queue or woken
- *    up if blocked.
+ *    None.
  *
  *------------------------------------------------------------------------
  */
-static void IocpCompleteDisconnect(
-    IocpChannel *lockedChanPtr, /* Locked channel, will be dropped */
-    IocpBuffer *bufPtr)         /* I/O completion buffer */
+IOCP_INLINE int
+IocpBatchSizeBucket(ULONG numEntries)
 {
-    if (lockedChanPtr->vtblPtr->disconnected) {
-        lockedChanPtr->vtblPtr->disconnected(lockedChanPtr);
+    int bucket = 0;
+    while (numEntries > 1 && bucket < (IOCP_BATCH_SIZE_BUCKETS-1)) {
+        numEntries >>= 1;
+        bucket += 1;
     }
-    bufPtr->chanPtr = NULL;
-    IocpChannelDrop(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
-    IocpBufferFree(bufPtr);
+    return bucket;
 }
 
-
 /*
  *------------------------------------------------------------------------
  *
- * IocpCompleteAccept --
+ * IocpCountersSum --
  *
- *    Handles completion of connection accept operations from IOCP.
+ *    Sums the per-processor counter slots. The slots are updated with
+ *    interlocked operations without any other synchronization so the
+ *    sum is not a consistent snapshot across counters but each individual
+ *    counter is accurate as of some point during the call.
  *
  * Results:
  *    None.
  *
  * Side effects:
- *    The passed bufPtr is freed or enqueued on the owning IocpChannel. The
- *    lockedChanPtr is dropped and the Tcl thread notified via the event loop.
- *    If the Tcl thread is blocked on this channel, it is woken up.
+ *    The structure pointed to by sumPtr is filled with the totals.
  *
  *------------------------------------------------------------------------
  */
-static void IocpCompleteAccept(
-    IocpChannel *lockedChanPtr, /* Locked channel, will be dropped */
-    IocpBuffer *bufPtr)         /* I/O completion buffer */
+void
+IocpCountersSum(IocpCounters *sumPtr)
 {
-    IOCP_TRACE(("IocpCompleteAccept Enter: lockedChanPtr=%p. state=0x%x\n", lockedChanPtr, lockedChanPtr->state));
-
-    /*
-     * Reminder: unlike reads/writes, the count of pending accept operations
-     * is on a per listening socket basis, not per channel. Since we don't
-     * deal with channel-type specific operations here, the count is
-     * decremented in the channel-specific code in the Tcl thread.
-     *
-     * So also, deal with the channel states in the Tcl thread. Don't
-     * bother with them here.
-     *
-     * TBD - may be make reads/writes the same for consistency?
-     */
-
-    /*
-     * Add the buffer to the input queue which also doubles as the accept queue
-     * since listeners are disabled for read and write at the channel level.
-     * Then if the channel was blocked, awaken the sleeping thread. Otherwise
-     * send it a Tcl event notification.
-     */
-    IocpListAppend(&lockedChanPtr->inputBuffers, &bufPtr->link);
-    bufPtr->chanPtr = NULL;
-    /*
-     * chanPtr->numRefs-- because bufPtr does not refer to it (though it is on
-     *                    the inputBuffers queue, that is immaterial)
-     * chanPtr->numRefs++ because we still want to access chanPtr below after
-     *                    unlocking and relocking.
-     * The two cancel out. The latter will be reversed at function exit.
-     */
-
-    IocpChannelNudgeThread(lockedChanPtr, 0, 0);
-
-    /* This drops the reference from bufPtr which was delayed (see above) */
-    IocpChannelDrop(lockedChanPtr);
+    LONG64 *totals = (LONG64 *) sumPtr;
+    int     nfields = sizeof(IocpCounters) / sizeof(LONG64);
+    int     slot, i;
+
+    memset(sumPtr, 0, sizeof(*sumPtr));
+    for (slot = 0; slot < IOCP_COUNTER_SLOTS; ++slot) {
+        volatile LONG64 *values = (volatile LONG64 *)&iocpCounters[slot].counters;
+        for (i = 0; i < nfields; ++i) {
+            totals[i] += values[i];
+        }
+    }
 }
 
 /*
  *------------------------------------------------------------------------
  *
- * IocpCompleteRead --
+ * IocpCompletionThread --
  *
- *    Handles completion of read operations from IOCP.
+ *    Thread function for the completion port threads. Completions are
+ *    dequeued in batches of up to IOCP_COMPLETION_BATCH_SIZE. Entries in a
+ *    batch are grouped by channel so that each channel is only locked once
+ *    per batch, and the alerts to Tcl threads are deferred to the end of
+ *    the batch.
+ *
+ *    A packet with a NULL OVERLAPPED is a request for the thread to exit.
  *
  * Results:
- *    None.
+ *    Exit code for the thread.
  *
  * Side effects:
- *    The passed bufPtr is freed or enqueued on the owning IocpChannel. The
- *    lockedChanPtr is dropped and the Tcl thread notified via the event loop.
- *    If the Tcl thread is blocked on this channel, it is woken up.
+ *    Processes completions.
  *
  *------------------------------------------------------------------------
  */
-static void IocpCompleteRead(
-    IocpChannel *lockedChanPtr, /* Locked channel, will be dropped */
-    IocpBuffer *bufPtr)         /* I/O completion buffer */
+static DWORD WINAPI
+IocpCompletionThread (LPVOID lpParam)
 {
-    IOCP_TRACE(("IocpCompleteRead Enter: lockedChanPtr=%p. state=0x%x\n", lockedChanPtr, lockedChanPtr->state));
+    IocpWinError winError = 0;
+    HANDLE       iocpPort = (HANDLE) lpParam;
+    OVERLAPPED_ENTRY entries[IOCP_COMPLETION_BATCH_SIZE];
+    char             done[IOCP_COMPLETION_BATCH_SIZE];
+    IocpAlertBatch   alertBatch;
+    IocpTsd         *tsdPtr;
+    int              exitRequests = 0;
 
-    IOCP_ASSERT(lockedChanPtr->pendingReads > 0);
-    lockedChanPtr->pendingReads--;
+    tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    tsdPtr->alertBatchPtr = &alertBatch;
+    alertBatch.count = 0;
 
-    if (lockedChanPtr->state == IOCP_STATE_CLOSED) {
-        bufPtr->chanPtr = NULL;
-        IocpChannelDrop(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
-        IocpBufferFree(bufPtr);
-        return;
+#ifdef _MSC_VER
+    __try {
+#endif
+        while (exitRequests == 0) {
+            ULONG  numEntries;
+            ULONG  i, j;
+            BOOL   ok;
+            LONG64 dequeuedAt;
+
+            ok = GetQueuedCompletionStatusEx(iocpPort, entries,
+                                             IOCP_COMPLETION_BATCH_SIZE,
+                                             &numEntries, INFINITE, FALSE);
+            IOCP_TRACE(("IocpCompletionThread: GetQueuedCompletionStatusEx returned %d, numEntries=%d\n", ok, numEntries));
+            if (! ok) {
+                /* Port closed or some other error. TBD - how to log? */
+                winError = GetLastError();
+                break;          /* Vamoose */
+            }
+
+            IOCP_COUNTER_INCR(IocpCompletionBatches);
+            IOCP_COUNTER_ADD(IocpCompletionPackets, numEntries);
+            IOCP_COUNTER_INCR(IocpCompletionBatchSizes[IocpBatchSizeBucket(numEntries)]);
+            if ((LONG64)numEntries > iocpStats.IocpCompletionBatchMax)
+                InterlockedExchange64(&iocpStats.IocpCompletionBatchMax, numEntries); /* Racy but only a statistic */
+
+            dequeuedAt = iocpLatencyEnabled ? IocpLatencyTimestamp() : 0;
+
+            for (i = 0; i < numEntries; ++i)
+                done[i] = 0;
+
+            for (i = 0; i < numEntries; ++i) {
+                IocpChannel *chanPtr;
+
+                if (done[i])
+                    continue;
+                if (entries[i].lpOverlapped == NULL) {
+                    /* Exit request. Finish off rest of batch first. */
+                    exitRequests += 1;
+                    continue;
+                }
+                if (entries[i].lpCompletionKey != 0) {
+                    /* Not a IocpBuffer. See IocpCompletionHandler. */
+                    done[i] = 1;
+                    ((IocpCompletionHandler *)entries[i].lpCompletionKey)(&entries[i]);
+                    continue;
+                }
+
+                /*
+                 * Lock the channel once and process all entries in the batch
+                 * for that channel. An additional reference is held so the
+                 * completion handlers releasing buffer references do not
+                 * free the channel from under us.
+                 */
+                chanPtr = CONTAINING_RECORD(entries[i].lpOverlapped, IocpBuffer, u)->chanPtr;
+                IOCP_ASSERT(chanPtr != NULL);
+                IocpChannelLock(chanPtr);
+                chanPtr->numRefs += 1;
+                for (j = i; j < numEntries; ++j) {
+                    IocpBuffer  *bufPtr;
+                    OVERLAPPED  *overlapPtr = entries[j].lpOverlapped;
+                    IocpWinError bufError   = 0;
+                    if (done[j] || overlapPtr == NULL ||
+                        entries[j].lpCompletionKey != 0)
+                        continue;
+                    bufPtr = CONTAINING_RECORD(overlapPtr, IocpBuffer, u);
+                    if (bufPtr->chanPtr != chanPtr)
+                        continue;
+                    done[j] = 1;
+                    bufPtr->completedAt = dequeuedAt;
+                    /*
+                     * Internal holds the NTSTATUS of the operation. On
+                     * failure, GetOverlappedResult maps it to a Win32 error.
+                     * The handle is not accessed since the operation is
+                     * already complete.
+                     */
+                    if (overlapPtr->Internal != 0) {
+                        DWORD nbytes;
+                        if (! GetOverlappedResult(NULL, overlapPtr, &nbytes, FALSE)) {
+                            bufError = GetLastError();
+                            if (bufError == 0)
+                                bufError = WSAEINVAL; /* TBD - what else? */
+                        }
+                    }
+                    IocpCompleteBuffer(chanPtr, bufPtr,
+                                       entries[j].dwNumberOfBytesTransferred,
+                                       bufError);
+                }
+                IocpChannelDrop(chanPtr); /* Reverse above reference */
+            }
+
+            /* Now alert Tcl threads that have had events queued to them */
+            for (i = 0; i < (ULONG) alertBatch.count; ++i)
+                Tcl_ThreadAlert(alertBatch.threads[i]);
+            alertBatch.count = 0;
+        }
+#ifdef _MSC_VER
+    }
+    __except (winError = GetExceptionCode(), EXCEPTION_EXECUTE_HANDLER) {
+        Iocp_Panic("Tcl IOCP thread died with exception %#x\n", winError);
     }
+#endif
 
-    /*
-     * Add the buffer to the input queue. Then if the channel was blocked,
-     * awaken the sleeping thread. Otherwise send it a Tcl event notification.
-     */
-    IocpListAppend(&lockedChanPtr->inputBuffers, &bufPtr->link);
-    bufPtr->chanPtr = NULL;
-    /*
-     * chanPtr->numRefs-- because bufPtr does not refer to it (though it is on
-     *                    the inputBuffers queue, that is immaterial)
-     * chanPtr->numRefs++ because we still want to access chanPtr below after
-     *                    unlocking and relocking.
-     * The two cancel out. The latter will be reversed at function exit.
-     */
+    IOCP_TRACE(("CompletionThread exiting\n"));
 
     /*
-     * Note that zero bytes read => EOF. That will also be handled in the
-     * Tcl thread since in any case it has to be notified of closure. So
-     * also any errors indicated by bufPtr->winError.
+     * If more than one exit request was dequeued in a batch, pass on the
+     * extras as they were meant for other threads.
      */
-    IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_READ, 0);
+    while (--exitRequests > 0)
+        PostQueuedCompletionStatus(iocpPort, 0, 0, 0);
 
-    /* This drops the reference from bufPtr which was delayed (see above) */
-    IocpChannelDrop(lockedChanPtr);
+    tsdPtr->alertBatchPtr = NULL;
+    /* Not a Tcl thread so thread exit handlers will not be run */
+    IocpBufferCacheRelease(NULL);
+
+    return winError;
 }
 
 /*
  *------------------------------------------------------------------------
  *
- * IocpCompleteWrite --
+ * IocpReapCompletionThreads --
  *
- *    Handles completion of Write operations from IOCP.
+ *    Closes handles of completion threads that have exited and removes
+ *    them from the completion thread table. Caller must hold
+ *    iocpModuleState.lock.
  *
  * Results:
  *    None.
  *
  * Side effects:
- *    The passed bufPtr is freed and lockedChanPtr dropped. The Tcl thread
- *    notified via the event loop. If the Tcl thread is blocked on this channel,
- *    it is woken up.
+ *    The completion thread table is compacted.
  *
  *------------------------------------------------------------------------
  */
-static void IocpCompleteWrite(
-    IocpChannel *lockedChanPtr, /* Locked channel, will be dropped */
-    IocpBuffer *bufPtr)         /* I/O completion buffer */
+static void IocpReapCompletionThreads(void)
 {
-    IOCP_ASSERT(lockedChanPtr->pendingWrites > 0);
-    lockedChanPtr->pendingWrites--;
-
-    bufPtr->chanPtr = NULL;
-    IocpBufferFree(bufPtr);
-
-    if (lockedChanPtr->state != IOCP_STATE_CLOSED) {
-        lockedChanPtr->flags |= IOCP_CHAN_F_WRITE_DONE;
-        /* TBD - optimize under which conditions we need to nudge thread */
-        IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_WRITE, 0);
+    int i, j;
+    for (i = 0, j = 0; i < iocpModuleState.num_completion_threads; ++i) {
+        HANDLE threadH = iocpModuleState.completion_threads[i];
+        if (WaitForSingleObject(threadH, 0) == WAIT_OBJECT_0)
+            CloseHandle(threadH);
+        else
+            iocpModuleState.completion_threads[j++] = threadH;
     }
-    IocpChannelDrop(lockedChanPtr); /* Corresponding to bufPtr->chanPtr */
+    iocpModuleState.num_completion_threads = j;
 }
 
-static DWORD WINAPI
-IocpCompletionThread (LPVOID lpParam)
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpSetCompletionThreadCount --
+ *
+ *    Grows or shrinks the pool of threads servicing the completion port.
+ *    Threads are shrunk by posting exit packets to the port so the exiting
+ *    threads finish processing of any completions already dequeued.
+ *
+ * Results:
+ *    0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    Threads are created or asked to exit.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError IocpSetCompletionThreadCount(
+    int count)                  /* Desired number of threads */
 {
     IocpWinError winError = 0;
 
-#ifdef _MSC_VER
-    __try {
-#endif
-        while (1) {
-            IocpBuffer *bufPtr;
-            HANDLE      iocpPort = (HANDLE) lpParam;
-            DWORD       nbytes;
-            ULONG_PTR   key;
-            OVERLAPPED *overlapPtr;
-            BOOL        ok;
-            IocpChannel *chanPtr;
-
-            ok = GetQueuedCompletionStatus(iocpPort, &nbytes, &key,
-                                           &overlapPtr, INFINITE);
-            IOCP_TRACE(("IocpCompletionThread: GetQueuedCompletionStatus returned %d, overlapPtr=%p\n", ok, overlapPtr));
-            if (overlapPtr == NULL) {
-                /* If ok, exit signal. Else some error */
-                if (! ok) {
-                    /* TBD - how to signal or log error? */
-                }
-                break;          /* Vamoose */
-            }
-            bufPtr = CONTAINING_RECORD(overlapPtr, IocpBuffer, u);
-            bufPtr->data.len = nbytes;
-            if (!ok) {
-                bufPtr->winError = GetLastError();
-                if (bufPtr->winError == 0)
-                    bufPtr->winError =  WSAEINVAL; /* TBD - what else? */
-            }
-            else {
-                bufPtr->winError = 0;
-            }
-            chanPtr = bufPtr->chanPtr;
-            IOCP_ASSERT(chanPtr != NULL);
-            IocpChannelLock(chanPtr);
-
-            if (bufPtr->winError != 0 &&
-                chanPtr->vtblPtr->translateerror != NULL) {
-                /* Translate to a more specific error code */
-                bufPtr->winError = chanPtr->vtblPtr->translateerror(chanPtr, bufPtr);
-            }
+    if (count < 1 || count > IOCP_COMPLETION_THREADS_MAX)
+        return ERROR_INVALID_PARAMETER;
 
-            /*
-             * NOTE - it is responsibility of called completion routines
-             * to dispose of both chanPtr and bufPtr respectively.
-             */
-            IOCP_TRACE(("IocpCompletionThread: chanPtr=%p, chanPtr->state=0x%x, bufPtr->operation=%d, bufPtr->winError=%d\n", chanPtr, chanPtr->state, bufPtr->operation, bufPtr->winError));
-            switch (bufPtr->operation) {
-            case IOCP_BUFFER_OP_READ:
-                IocpCompleteRead(chanPtr, bufPtr);
-                break;
-            case IOCP_BUFFER_OP_WRITE:
-                IocpCompleteWrite(chanPtr, bufPtr);
-                break;
-            case IOCP_BUFFER_OP_CONNECT:
-                IocpCompleteConnect(chanPtr, bufPtr);
-                break;
-            case IOCP_BUFFER_OP_DISCONNECT:
-                IocpCompleteDisconnect(chanPtr, bufPtr);
-                break;
-            case IOCP_BUFFER_OP_ACCEPT:
-                IocpCompleteAccept(chanPtr, bufPtr);
-                break;
-            }
+    IocpLockAcquireExclusive(&iocpModuleState.lock);
+    IocpReapCompletionThreads();
+    while (iocpModuleState.active_completion_threads > count) {
+        if (! PostQueuedCompletionStatus(iocpModuleState.completion_port, 0, 0, 0)) {
+            winError = GetLastError();
+            break;
         }
-#ifdef _MSC_VER
+        iocpModuleState.active_completion_threads -= 1;
     }
-    __except (winError = GetExceptionCode(), EXCEPTION_EXECUTE_HANDLER) {
-        Iocp_Panic("Tcl IOCP thread died with exception %#x\n", winError);
+    while (iocpModuleState.active_completion_threads < count) {
+        HANDLE threadH;
+        if (iocpModuleState.num_completion_threads >= IOCP_COMPLETION_THREADS_MAX) {
+            /* Threads asked to exit have not done so as yet */
+            winError = ERROR_BUSY;
+            break;
+        }
+        threadH = CreateThread(NULL, 0, IocpCompletionThread,
+                               iocpModuleState.completion_port, 0, NULL);
+        if (threadH == NULL) {
+            winError = GetLastError();
+            break;
+        }
+        iocpModuleState.completion_threads[iocpModuleState.num_completion_threads++] = threadH;
+        iocpModuleState.active_completion_threads += 1;
     }
-#endif
-
-    IOCP_TRACE(("CompletionThread exiting\n"));
-
+    IocpLockReleaseExclusive(&iocpModuleState.lock);
     return winError;
 }
 
@@ -904,20 +2583,58 @@ Iocp_DoOnceState iocpProcessCleanupFlag;
 static IocpTclCode IocpProcessCleanup(ClientData clientdata)
 {
     if (iocpModuleState.initialized) {
-        /* Tell completion port thread to exit and wait for it */
-        PostQueuedCompletionStatus(iocpModuleState.completion_port, 0, 0, 0);
-        if (WaitForSingleObject(iocpModuleState.completion_thread, 500)
-            == WAIT_TIMEOUT) {
-            /* 0xdead - exit code for thread */
-            TerminateThread(iocpModuleState.completion_thread, 0xdead);
+        int i, numThreads;
+        DWORD waitStatus;
+
+        /* Timers must not fire on channels being torn down */
+        IocpTimerWheelFinalize();
+
+        /*
+         * Tell completion threads to exit and wait for them. The exit
+         * packets are queued behind any completions already queued so
+         * those are processed first. Threads are never terminated as that
+         * could leave channel or heap locks orphaned. If they do not exit
+         * in a reasonable time, resources they may still be accessing are
+         * simply not released since the process is exiting anyways.
+         */
+        IocpLockAcquireExclusive(&iocpModuleState.lock);
+        for (i = 0; i < iocpModuleState.active_completion_threads; ++i) {
+            PostQueuedCompletionStatus(iocpModuleState.completion_port, 0, 0, 0);
+        }
+        iocpModuleState.active_completion_threads = 0;
+        numThreads = iocpModuleState.num_completion_threads;
+        IocpLockReleaseExclusive(&iocpModuleState.lock);
+
+        if (numThreads == 0)
+            waitStatus = WAIT_OBJECT_0;
+        else
+            waitStatus = WaitForMultipleObjects(numThreads,
+                                                iocpModuleState.completion_threads,
+                                                TRUE,
+                                                IOCP_COMPLETION_THREAD_EXIT_TIMEOUT);
+        if (waitStatus == WAIT_TIMEOUT || waitStatus == WAIT_FAILED) {
+            IOCP_TRACE(("IocpProcessCleanup: completion threads did not exit.\n"));
+            return TCL_ERROR;
         }
-        CloseHandle(iocpModuleState.completion_thread);
-        iocpModuleState.completion_thread = NULL;
+
+        IocpLockAcquireExclusive(&iocpModuleState.lock);
+        IocpReapCompletionThreads();
+        IocpLockReleaseExclusive(&iocpModuleState.lock);
+
+        IocpRioFinalize();
+
+        IocpDnsCacheFinalize();
+
+        BT_ServiceCacheFinalize();
+
+        IocpTlsFinalize();
 
         CloseHandle(iocpModuleState.completion_port);
         iocpModuleState.completion_port = NULL;
 
-        IocpLockDelete(iocpModuleState.tsd_lock);
+        IocpBufferPoolFinalize();
+
+        IocpLockDelete(&iocpModuleState.lock);
 
         WSACleanup();
     }
@@ -932,7 +2649,9 @@ static void IocpProcessExitHandler(ClientData clientdata)
 /*
  * Initialization function to be called exactly once *per process*.
  * Caller responsible to ensure it's called only once in a thread-safe manner.
- * It initializes Winsock, creates the I/O completion port and thread.
+ * It initializes Winsock, creates the I/O completion port and threads.
+ * The number of completion threads and the port concurrency defaults to the
+ * number of processors.
  *
  * Returns TCL_OK on success, TCL_ERROR on error.
  */
@@ -941,12 +2660,31 @@ static IocpTclCode IocpProcessInit(ClientData clientdata)
 {
     WSADATA wsa_data;
     Tcl_Interp *interp = (Tcl_Interp *)clientdata;
+    SYSTEM_INFO sysInfo;
+    LARGE_INTEGER perfFrequency;
+    IocpWinError winError;
 
 #define WSA_VERSION_REQUESTED    MAKEWORD(2,2)
 
+    IocpBufferPoolInit();
+
+    QueryPerformanceFrequency(&perfFrequency);
+    iocpModuleState.perf_frequency = perfFrequency.QuadPart;
+
+    GetSystemInfo(&sysInfo);
+    /* Spinning for a completion is pointless without another processor */
+    iocpModuleState.default_max_spin_wait =
+        sysInfo.dwNumberOfProcessors > 1 ? IOCP_MAX_SPIN_WAIT_DEFAULT : 0;
+    iocpModuleState.completion_concurrency = sysInfo.dwNumberOfProcessors;
+    if (iocpModuleState.completion_concurrency < 1)
+        iocpModuleState.completion_concurrency = 1;
+    else if (iocpModuleState.completion_concurrency > IOCP_COMPLETION_THREADS_MAX)
+        iocpModuleState.completion_concurrency = IOCP_COMPLETION_THREADS_MAX;
+
     iocpModuleState.completion_port =
         CreateIoCompletionPort(
-            INVALID_HANDLE_VALUE, NULL, (ULONG_PTR)NULL, 0);
+            INVALID_HANDLE_VALUE, NULL, (ULONG_PTR)NULL,
+            iocpModuleState.completion_concurrency);
     if (iocpModuleState.completion_port == NULL) {
         Iocp_ReportLastWindowsError(interp, "couldn't create completion port: ");
         return TCL_ERROR;
@@ -958,10 +2696,12 @@ static IocpTclCode IocpProcessInit(ClientData clientdata)
         return TCL_ERROR;
     }
 
-    iocpModuleState.completion_thread =
-        CreateThread(NULL, 0, IocpCompletionThread, iocpModuleState.completion_port, 0, NULL);
-    if (iocpModuleState.completion_thread == NULL) {
-        Iocp_ReportLastWindowsError(interp, "couldn't create completion thread: ");
+    IocpLockInit(&iocpModuleState.lock);
+    iocpModuleState.num_completion_threads    = 0;
+    iocpModuleState.active_completion_threads = 0;
+    winError = IocpSetCompletionThreadCount(iocpModuleState.completion_concurrency);
+    if (winError != 0 && iocpModuleState.active_completion_threads == 0) {
+        Iocp_ReportWindowsError(interp, winError, "couldn't create completion thread: ");
         CloseHandle(iocpModuleState.completion_port);
         iocpModuleState.completion_port = NULL;
         WSACleanup();
@@ -969,7 +2709,7 @@ static IocpTclCode IocpProcessInit(ClientData clientdata)
     }
     iocpModuleState.initialized = 1;
 
-#ifdef IOCP_ENABLE_TRACE
+#if defined(IOCP_ENABLE_TRACE) || defined(IOCP_ENABLE_ETW)
     /* TBD - do we have to call TraceLoggingUnregister before exiting process */
     TraceLoggingRegister(iocpWinTraceProvider);
 #endif
@@ -1023,17 +2763,119 @@ IocpChannelClose (
 
     IocpChannelLock(chanPtr);
 
-    /* Call specific IOCP type to close OS handles */
-    ret = (chanPtr->vtblPtr->shutdown)(interp, chanPtr, 
-                                             TCL_CLOSE_READ|TCL_CLOSE_WRITE);
+    /* Call specific IOCP type to close OS handles */
+    ret = (chanPtr->vtblPtr->shutdown)(interp, chanPtr, 
+                                             TCL_CLOSE_READ|TCL_CLOSE_WRITE);
+
+    /* Irrespective of errors in above call, we're done with this channel */
+    IocpChannelSetState(chanPtr, IOCP_STATE_CLOSED);
+    chanPtr->channel = NULL;
+    IocpChannelDrop(chanPtr); /* Drops ref count from Tcl channel */
+    /* Do NOT refer to chanPtr beyond this point */
+
+    return ret;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpBufferRecordConsumption --
+ *
+ *    Records the latencies of a tracked read when its data is first
+ *    passed up to the Tcl channel.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The buffer is no longer tracked.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpBufferRecordConsumption(
+    IocpBuffer *bufPtr)         /* Buffer at the front of inputBuffers */
+{
+    if (bufPtr->completedAt != 0) {
+        LONG64 consumedAt = IocpLatencyTimestamp();
+        IocpLatencyRecord(IOCP_LATENCY_READ_DISPATCH,
+                          bufPtr->completedAt, consumedAt);
+        IocpLatencyRecord(IOCP_LATENCY_READ_TOTAL,
+                          bufPtr->postedAt, consumedAt);
+        bufPtr->completedAt = 0;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelInputUnlocked --
+ *
+ *    Passes up already received data without locking the channel in the
+ *    common case of an open channel with data queued. inputBuffers is
+ *    only accessed by the owning thread and completion threads hand off
+ *    data through the lock-free handoffBuffers queue, so only the flag
+ *    and state reads below can race with completion threads. Those are
+ *    only hints as data is passed up irrespective of state. Anything that
+ *    needs a state change, such as EOF or an error, is left to
+ *    IocpChannelInput. The lock is taken only when reads have to be posted.
+ *
+ * Results:
+ *    Number of bytes read into outPtr or -1 if the caller should take the
+ *    locked path.
+ *
+ * Side effects:
+ *    Fills outPtr with data and may post reads.
+ *
+ *------------------------------------------------------------------------
+ */
+static int IocpChannelInputUnlocked(
+    IocpChannel *chanPtr,       /* Not locked. Tcl holds a reference */
+    char        *outPtr,        /* Where to store data. */
+    int          maxReadCount)  /* Maximum number of bytes to read. */
+{
+    int bytesRead = 0;
+
+    if (chanPtr->state != IOCP_STATE_OPEN ||
+        (chanPtr->flags & (IOCP_CHAN_F_WRITEONLY | IOCP_CHAN_F_REMOTE_EOF)))
+        return -1;
 
-    /* Irrespective of errors in above call, we're done with this channel */
-    chanPtr->state   = IOCP_STATE_CLOSED;
-    chanPtr->channel = NULL;
-    IocpChannelDrop(chanPtr); /* Drops ref count from Tcl channel */
-    /* Do NOT refer to chanPtr beyond this point */
+    while (bytesRead < maxReadCount &&
+           (chanPtr->inputBuffers.headPtr || IocpChannelTakeInput(chanPtr))) {
+        IocpBuffer *bufPtr = CONTAINING_RECORD(chanPtr->inputBuffers.headPtr, IocpBuffer, link);
+        int numCopied;
+        /* Zero length => EOF */
+        if (bufPtr->winError != 0 || IocpBufferLength(bufPtr) == 0)
+            break;
+        IocpBufferRecordConsumption(bufPtr);
+        numCopied = IocpBufferMoveOut(bufPtr, outPtr + bytesRead,
+                                      maxReadCount - bytesRead);
+        IocpChannelAddInputBytes(chanPtr, -numCopied);
+        bytesRead += numCopied;
+        if (IocpBufferLength(bufPtr) == 0) {
+            IocpListPopFront(&chanPtr->inputBuffers);
+            IocpBufferFree(bufPtr);
+        }
+    }
+    if (bytesRead == 0)
+        return -1;
 
-    return ret;
+    /*
+     * Replace reads that have completed and resume reads held back by the
+     * input limits. Reading the counts unlocked is fine. Any read
+     * completing after this will notify the thread and lead to another
+     * call.
+     */
+    if (chanPtr->pendingReads < IocpChannelReadsToPost(chanPtr) ||
+        (chanPtr->flags & IOCP_CHAN_F_INPUT_THROTTLED)) {
+        IocpChannelLock(chanPtr);
+        /* Errors are ignored as data is being returned. See IocpChannelInput */
+        if (chanPtr->state == IOCP_STATE_OPEN &&
+            (chanPtr->flags & IOCP_CHAN_F_REMOTE_EOF) == 0)
+            (void) IocpChannelPostReads(chanPtr);
+        IocpChannelUnlock(chanPtr);
+    }
+    IOCP_COUNTER_INCR(IocpLockFreeInputs);
+    return bytesRead;
 }
 
 /*
@@ -1066,6 +2908,11 @@ IocpChannelInput (
     DWORD        winError;
 
     *errorCodePtr = 0;
+    bytesRead = IocpChannelInputUnlocked(chanPtr, outPtr, maxReadCount);
+    if (bytesRead >= 0)
+        return bytesRead;
+    bytesRead = 0;
+
     IocpChannelLock(chanPtr);
 
     IOCP_TRACE(("IocpChannelInput Enter: chanPtr=%p, state=0x%x\n", chanPtr, chanPtr->state));
@@ -1082,10 +2929,14 @@ IocpChannelInput (
     if (IocpStateConnectionInProgress(chanPtr->state)) {
         IocpChannelConnectionStep(chanPtr,
                                (chanPtr->flags & IOCP_CHAN_F_NONBLOCKING) == 0);
-        if (chanPtr->state == IOCP_STATE_CONNECTING ||
-            chanPtr->state == IOCP_STATE_CONNECT_RETRY) {
+        if (chanPtr->state == IOCP_STATE_RESOLVING ||
+            chanPtr->state == IOCP_STATE_CONNECTING ||
+            chanPtr->state == IOCP_STATE_CONNECT_RETRY ||
+            chanPtr->state == IOCP_STATE_HANDSHAKING) {
             /* Only possible when above call returns for non-blocking case */
             IOCP_ASSERT(chanPtr->flags & IOCP_CHAN_F_NONBLOCKING);
+            IOCP_COUNTER_INCR(IocpInputWouldBlock);
+            chanPtr->stats.inputWouldBlock++;
             *errorCodePtr = EAGAIN;
             bytesRead = -1;
             goto vamoose;
@@ -1094,9 +2945,11 @@ IocpChannelInput (
     }
 
     /* All these states would have taken early exit or transition above */
+    IOCP_ASSERT(chanPtr->state != IOCP_STATE_RESOLVING);
     IOCP_ASSERT(chanPtr->state != IOCP_STATE_CONNECTING);
     IOCP_ASSERT(chanPtr->state != IOCP_STATE_CONNECT_RETRY);
     IOCP_ASSERT(chanPtr->state != IOCP_STATE_CONNECTED);
+    IOCP_ASSERT(chanPtr->state != IOCP_STATE_HANDSHAKING);
 
     /*
      * Unless channel is marked as write-only (via shutdown) pass up data
@@ -1116,7 +2969,7 @@ IocpChannelInput (
      * Now we get to copy data out from our buffers to the Tcl buffer.
      * Note that a zero length input buffer signifies EOF.
      */
-    if (chanPtr->inputBuffers.headPtr == NULL) {
+    if (!IocpChannelTakeInput(chanPtr)) {
         IOCP_TRACE(("IocpChannelInput: No input buffers queued, chanPtr=%p\n", chanPtr));
         /* No input buffers. */
         if (chanPtr->state != IOCP_STATE_OPEN ||
@@ -1126,6 +2979,8 @@ IocpChannelInput (
         }
         /* OPEN but no data available. If non-blocking, just return. */
         if (chanPtr->flags & IOCP_CHAN_F_NONBLOCKING) {
+            IOCP_COUNTER_INCR(IocpInputWouldBlock);
+            chanPtr->stats.inputWouldBlock++;
             *errorCodePtr = EAGAIN;
             bytesRead     = -1;
             goto vamoose;
@@ -1138,8 +2993,12 @@ IocpChannelInput (
             *errorCodePtr = Tcl_GetErrno();
             goto vamoose;
         }
-        /* Wait for a posted read to complete */
-        IocpChannelAwaitCompletion(chanPtr, IOCP_CHAN_F_BLOCKED_READ); /* Unlocks and relocks! */
+        /*
+         * Wait for a posted read to complete unless one already did so
+         * inline while posting.
+         */
+        if (!IocpChannelTakeInput(chanPtr))
+            IocpChannelAwaitCompletion(chanPtr, IOCP_CHAN_F_BLOCKED_READ); /* Unlocks and relocks! */
         /*
          * State unknown as it might have changed while waiting but don't
          * care. What matters is if input data is available in the buffers.
@@ -1153,19 +3012,25 @@ IocpChannelInput (
      * we will pass it up.
      */
     remaining = maxReadCount;
-    while (remaining && chanPtr->inputBuffers.headPtr) {
+    while (remaining &&
+           (chanPtr->inputBuffers.headPtr || IocpChannelTakeInput(chanPtr))) {
         IocpBuffer *bufPtr = CONTAINING_RECORD(chanPtr->inputBuffers.headPtr, IocpBuffer, link);
         int numCopied;
         winError = bufPtr->winError;
+        IocpBufferRecordConsumption(bufPtr);
         if (winError == 0) {
             numCopied = IocpBufferMoveOut(bufPtr, outPtr, remaining);
+            IocpChannelAddInputBytes(chanPtr, -numCopied);
             outPtr    += numCopied;
             remaining -= numCopied;
             bytesRead += numCopied;
             if (IocpBufferLength(bufPtr) == 0) {
-                /* No more bytes in that buffer. Free it after removing from list */
+                /*
+                 * No more bytes in that buffer. Free it after removing from
+                 * list. This returns it to the buffer pool for reuse by
+                 * the next receive.
+                 */
                 IocpListPopFront(&chanPtr->inputBuffers);
-                /* TBD - optimize to reuse buffer for next receive */
                 IocpBufferFree(bufPtr);
             }
             if (numCopied == 0) {
@@ -1279,10 +3144,14 @@ IocpChannelOutput (
     if (IocpStateConnectionInProgress(chanPtr->state)) {
         IocpChannelConnectionStep(chanPtr,
                                   (chanPtr->flags & IOCP_CHAN_F_NONBLOCKING) == 0);
-        if (chanPtr->state == IOCP_STATE_CONNECTING ||
-            chanPtr->state == IOCP_STATE_CONNECT_RETRY) {
+        if (chanPtr->state == IOCP_STATE_RESOLVING ||
+            chanPtr->state == IOCP_STATE_CONNECTING ||
+            chanPtr->state == IOCP_STATE_CONNECT_RETRY ||
+            chanPtr->state == IOCP_STATE_HANDSHAKING) {
             /* Only possible when above call returns for non-blocking case */
             IOCP_ASSERT(chanPtr->flags & IOCP_CHAN_F_NONBLOCKING);
+            IOCP_COUNTER_INCR(IocpOutputWouldBlock);
+            chanPtr->stats.outputWouldBlock++;
             IocpChannelDrop(chanPtr);   /* Release the reference held by this function */
             *errorCodePtr = EAGAIN;
             return -1;
@@ -1316,6 +3185,8 @@ IocpChannelOutput (
              * Would block. If non-blocking, advise caller to try later.
              * If blocking socket, wait for previous writes to complete.
              */
+            IOCP_COUNTER_INCR(IocpOutputWouldBlock);
+            chanPtr->stats.outputWouldBlock++;
             if (chanPtr->flags & IOCP_CHAN_F_NONBLOCKING) {
                 *errorCodePtr = EAGAIN;
                 written = -1;
@@ -1537,14 +3408,14 @@ static int IocpChannelFileEventMask(
     if ((lockedChanPtr->flags & IOCP_CHAN_F_WATCH_INPUT) &&
         !(lockedChanPtr->flags & IOCP_CHAN_F_WRITEONLY) &&
         ((lockedChanPtr->flags & IOCP_CHAN_F_REMOTE_EOF) ||
-         lockedChanPtr->inputBuffers.headPtr)) {
+         IocpChannelTakeInput(lockedChanPtr))) {
         readyMask |= TCL_READABLE;
     }
     if ((lockedChanPtr->flags & IOCP_CHAN_F_WATCH_OUTPUT) &&        /* 1 */
         !(lockedChanPtr->flags & IOCP_CHAN_F_READONLY) &&           /* 2 */
         ((lockedChanPtr->flags & IOCP_CHAN_F_REMOTE_EOF) ||         /* 3a */
          ((lockedChanPtr->flags & IOCP_CHAN_F_WRITE_DONE) &&        /* 3b */
-          lockedChanPtr->pendingWrites < lockedChanPtr->maxPendingWrites))) {
+          lockedChanPtr->outputBytes < lockedChanPtr->maxOutputBytes))) {
         readyMask |= TCL_WRITABLE;
         /* So we do not keep notifying of write dones */
         lockedChanPtr->flags &= ~ IOCP_CHAN_F_WRITE_DONE;
@@ -1699,8 +3570,15 @@ void IocpChannelThreadAction(
 
     IOCP_TRACE(("IocpChannelThreadAction Enter: chanPtr=%p, action=%d, chanPtr->state=0x%x\n", chanPtr, action, chanPtr->state));
 
+    /* Detach from any previous thread's ready queue */
+    if (chanPtr->readyQueuePtr) {
+        IocpReadyQueueRemove(chanPtr);
+        IocpReadyQueueDrop(chanPtr->readyQueuePtr);
+        chanPtr->readyQueuePtr = NULL;
+    }
     if (action == TCL_CHANNEL_THREAD_INSERT) {
         chanPtr->owningThread = Tcl_GetCurrentThread();
+        chanPtr->readyQueuePtr = IocpReadyQueueGet();
         /*
          * Notify in case any I/O completion notifications pending. No harm
          * if there aren't
@@ -1749,6 +3627,7 @@ static void IocpNotifyChannel(
     IOCP_TRACE(("IocpNotifyChannel : chanPtr=%p, chanPtr->state=0x%x, readyMask=0x%x\n", lockedChanPtr, lockedChanPtr->state, readyMask));
     if (readyMask == 0)
         return;                 /* Nothing to notify */
+    IOCP_ETW_CHANNEL("ChannelNotify", lockedChanPtr, readyMask, "ReadyMask");
 
     /*
      * Unlock before calling Tcl_NotifyChannel which may recurse via the
@@ -1788,8 +3667,9 @@ static void IocpNotifyChannel(
  *
  * IocpEventHandler --
  *
- *    Called from the event loop. Processes all ready channels and notifies
- *    the Tcl channel subsystem of state changes.
+ *    Called from the event loop for the drain event queued by
+ *    IocpEventCheckProc. Processes the channels on the thread's ready queue
+ *    and notifies the Tcl channel subsystem of state changes.
  *
  * Results:
  *    Returns 0 if the event is to be kept on the event loop queue, and
@@ -1807,50 +3687,144 @@ int IocpEventHandler(
     int        flags            /* TCL_FILE_EVENTS */
     )
 {
-    IocpChannel *chanPtr;
+    IocpTsd *tsdPtr = (IocpTsd *)Tcl_GetThreadData(&iocpTsdKey, sizeof(IocpTsd));
+    IocpReadyQueue *queuePtr = tsdPtr->readyQueuePtr;
+    int count;
 
-    IOCP_TRACE(("IocpEventHandler Enter: chanPtr=%p, evPtr->reason=%d\n", ((IocpTclEvent *)evPtr)->chanPtr, ((IocpTclEvent *)evPtr)->reason));
+    IOCP_TRACE(("IocpEventHandler Enter: queuePtr=%p\n", queuePtr));
 
     if (!(flags & TCL_FILE_EVENTS)) {
         return 0;               /* We are not to process file/network events */
     }
 
-    chanPtr = ((IocpTclEvent *)evPtr)->chanPtr;
-    IocpChannelLock(chanPtr);
+    if (queuePtr == NULL)
+        return 1;               /* Thread is exiting */
 
-    IOCP_TRACE(("IocpEventHandler: chanPtr=%p, chanPtr->state=0x%x\n", chanPtr, chanPtr->state));
+    /*
+     * Only process the channels present at this point. Channels that are
+     * (re)added while processing, for example on EOF, are processed on the
+     * next drain so that the Tcl event loop gets a chance to run other
+     * events, e.g. a vwait completing.
+     */
+    IocpLockAcquireExclusive(&queuePtr->lock);
+    queuePtr->drainQueued = 0;
+    count = 0;
+    if (queuePtr->channels.headPtr) {
+        IocpLink *linkPtr;
+        for (linkPtr = queuePtr->channels.headPtr; linkPtr; linkPtr = linkPtr->nextPtr)
+            ++count;
+    }
+    IocpLockReleaseExclusive(&queuePtr->lock);
 
-    switch (chanPtr->state) {
-    case IOCP_STATE_LISTENING:
-        if (chanPtr->vtblPtr->accept) {
-            chanPtr->vtblPtr->accept(chanPtr);
-        }
-        break;
+    while (count--) {
+        IocpChannel *chanPtr;
+        IocpLink    *linkPtr;
 
-    case IOCP_STATE_CONNECTING:
-    case IOCP_STATE_CONNECT_RETRY:
-    case IOCP_STATE_CONNECTED:
-        IocpChannelConnectionStep(chanPtr, 0); /* May change state */
-        break;
+        IocpLockAcquireExclusive(&queuePtr->lock);
+        linkPtr = IocpListPopFront(&queuePtr->channels);
+        IocpLockReleaseExclusive(&queuePtr->lock);
+        if (linkPtr == NULL)
+            break;              /* Channels removed while processing */
+        IOCP_COUNTER_INCR(IocpEventsDequeued);
 
-    case IOCP_STATE_OPEN:
-    case IOCP_STATE_CONNECT_FAILED:
-    case IOCP_STATE_DISCONNECTED:
-        /* Notify Tcl channel subsystem if it has asked for it */
-        IocpNotifyChannel(chanPtr); /* May change state */
-        break;
-    default: /* INIT and CLOSED */
-        /* TBD - should not happen - log somewhere ? */
-        break;
-    }
+        /*
+         * Window between popping and locking the channel is harmless.
+         * Completion threads will see ON_EVENTQ set and not queue it
+         * but we process the latest channel state below anyways.
+         */
+        chanPtr = CONTAINING_RECORD(linkPtr, IocpChannel, readyLink);
+        IocpChannelLock(chanPtr);
+        IocpLinkInit(&chanPtr->readyLink);
+        chanPtr->flags &= ~IOCP_CHAN_F_ON_EVENTQ;
+
+        IOCP_TRACE(("IocpEventHandler: chanPtr=%p, chanPtr->state=0x%x\n", chanPtr, chanPtr->state));
+
+        if (chanPtr->readyQueuePtr == queuePtr) {
+            switch (chanPtr->state) {
+            case IOCP_STATE_LISTENING:
+                if (chanPtr->vtblPtr->accept) {
+                    chanPtr->vtblPtr->accept(chanPtr);
+                }
+                break;
+
+            case IOCP_STATE_RESOLVING:
+            case IOCP_STATE_CONNECTING:
+            case IOCP_STATE_CONNECT_RETRY:
+            case IOCP_STATE_CONNECTED:
+            case IOCP_STATE_HANDSHAKING:
+                IocpChannelConnectionStep(chanPtr, 0); /* May change state */
+                break;
+
+            case IOCP_STATE_OPEN:
+            case IOCP_STATE_CONNECT_FAILED:
+            case IOCP_STATE_DISCONNECTED:
+                /* Notify Tcl channel subsystem if it has asked for it */
+                IocpNotifyChannel(chanPtr); /* May change state */
+                break;
+            default: /* INIT and CLOSED */
+                /* TBD - should not happen - log somewhere ? */
+                break;
+            }
+        }
 
-    /* Drop the reference corresponding to queueing to the event q. */
-    ((IocpTclEvent *)evPtr)->chanPtr = NULL;
-    IocpChannelDrop(chanPtr);
+        /* Drop the reference corresponding to queueing to the ready q. */
+        IocpChannelDrop(chanPtr);
+    }
 
     return 1;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelInputThrottled --
+ *
+ *    Checks whether posting of reads should be held back because too much
+ *    received data is waiting to be consumed, either on the channel or
+ *    across all channels. Reads are held back once a high water mark is
+ *    reached and resume when the data drains to half of it. Only channels
+ *    that have input queued are held back. Since consuming that input
+ *    reposts reads, no channel waits on others draining their input and a
+ *    channel whose input has been consumed always has reads posted.
+ *
+ * Results:
+ *    Non-0 if reads should not be posted, else 0.
+ *
+ * Side effects:
+ *    Updates the IOCP_CHAN_F_INPUT_THROTTLED flag and throttle counts.
+ *
+ *------------------------------------------------------------------------
+ */
+static int IocpChannelInputThrottled(
+    IocpChannel *lockedChanPtr  /* Must be locked */
+    )
+{
+    int    chanMax   = lockedChanPtr->maxInputBytes;
+    int    globalMax = iocpInputBudget.maxBytes;
+    LONG64 queued    = iocpInputBudget.queuedBytes;
+
+    if (lockedChanPtr->inputBytes == 0) {
+        lockedChanPtr->flags &= ~IOCP_CHAN_F_INPUT_THROTTLED;
+        return 0;
+    }
+    if (lockedChanPtr->flags & IOCP_CHAN_F_INPUT_THROTTLED) {
+        if ((chanMax == 0 || lockedChanPtr->inputBytes <= chanMax / 2) &&
+            (globalMax == 0 || queued <= globalMax / 2)) {
+            lockedChanPtr->flags &= ~IOCP_CHAN_F_INPUT_THROTTLED;
+            return 0;
+        }
+        return 1;
+    }
+    if ((chanMax != 0 && lockedChanPtr->inputBytes >= chanMax) ||
+        (globalMax != 0 && queued >= globalMax)) {
+        lockedChanPtr->flags |= IOCP_CHAN_F_INPUT_THROTTLED;
+        lockedChanPtr->stats.inputThrottles++;
+        IOCP_COUNTER_INCR(IocpInputThrottles);
+        return 1;
+    }
+    return 0;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -1859,7 +3833,11 @@ int IocpEventHandler(
  *    Calls the channel specific code to post reads to the OS handle
  *    up to the maximum allowed to be outstanding for the channel or until
  *    the posting fails. In the latter case, an error is returned only
- *    if no reads are outstanding.
+ *    if no reads are outstanding. Reads that complete inline do not count
+ *    as outstanding so the number of posts is also bounded to limit the
+ *    data buffered on the channel. No reads are posted while the input
+ *    budgets are exceeded so that TCP flow control pushes back on the
+ *    sender.
  *
  * Results:
  *    0 on success or a Windows error code.
@@ -1875,7 +3853,24 @@ DWORD IocpChannelPostReads(
     )
 {
     DWORD winError = 0;
-    while (lockedChanPtr->pendingReads < lockedChanPtr->maxPendingReads) {
+    int   numPosts;
+    int   maxPosts = IocpChannelReadsToPost(lockedChanPtr);
+
+    /* Throttled channels have queued input so no error to report */
+    if (IocpChannelInputThrottled(lockedChanPtr))
+        return 0;
+
+    /* The read timeout runs from when reads are first posted */
+    if (lockedChanPtr->readTimeout != 0 &&
+        ! IocpTimerArmed(&lockedChanPtr->timer)) {
+        lockedChanPtr->lastInputTick = GetTickCount64();
+        (void) IocpChannelScheduleTimeouts(lockedChanPtr);
+    }
+
+    for (numPosts = 0;
+         numPosts < maxPosts &&
+             lockedChanPtr->pendingReads < maxPosts;
+         ++numPosts) {
         winError = lockedChanPtr->vtblPtr->postread(lockedChanPtr);
         if (winError)
             break;
@@ -1884,6 +3879,253 @@ DWORD IocpChannelPostReads(
     return (lockedChanPtr->pendingReads > 0) ? 0 : winError;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelTimeoutDue --
+ *
+ *    Returns when the next connect or read timeout of a channel is due.
+ *
+ * Results:
+ *    The GetTickCount64 value or 0 if no timeout applies.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static ULONGLONG IocpChannelTimeoutDue(
+    const IocpChannel *lockedChanPtr) /* Must be locked */
+{
+    if (IocpStateConnectionInProgress(lockedChanPtr->state)) {
+        /* Nothing further to time once connected, bar any handshake */
+        if (lockedChanPtr->state == IOCP_STATE_CONNECTED ||
+            (lockedChanPtr->flags & IOCP_CHAN_F_CONNECT_TIMEDOUT))
+            return 0;
+        return lockedChanPtr->connectDeadline;
+    }
+    if (lockedChanPtr->state == IOCP_STATE_OPEN &&
+        lockedChanPtr->readTimeout != 0)
+        return lockedChanPtr->lastInputTick + lockedChanPtr->readTimeout;
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelScheduleTimeouts --
+ *
+ *    Arms the channel timer for the next connect or read timeout, or
+ *    disarms it if there is none. Must be called when the timeouts are
+ *    changed. Restarting a timeout on activity only needs the deadline
+ *    fields to be updated. The timer then fires at the old deadline and
+ *    is rearmed for the new one by IocpChannelTimerExpired. This keeps
+ *    the I/O paths from touching the timer wheel at all.
+ *
+ * Results:
+ *    ERROR_SUCCESS or a Windows error code.
+ *
+ * Side effects:
+ *    The channel timer is armed or cancelled.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError IocpChannelScheduleTimeouts(
+    IocpChannel *lockedChanPtr) /* Must be locked */
+{
+    ULONGLONG due = IocpChannelTimeoutDue(lockedChanPtr);
+
+    if (due == 0) {
+        IocpTimerCancel(&lockedChanPtr->timer);
+        return ERROR_SUCCESS;
+    }
+    return IocpTimerArm(&lockedChanPtr->timer, due);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelCancelIo --
+ *
+ *    Cancels all pending operations on the channel's handle.
+ *
+ * Results:
+ *    Non-0 if cancellation was requested, 0 otherwise.
+ *
+ * Side effects:
+ *    The cancelled operations complete with ERROR_OPERATION_ABORTED.
+ *
+ *------------------------------------------------------------------------
+ */
+static int IocpChannelCancelIo(
+    IocpChannel *lockedChanPtr) /* Must be locked */
+{
+    ClientData handle;
+
+    if (lockedChanPtr->vtblPtr->gethandle == NULL ||
+        lockedChanPtr->vtblPtr->gethandle(lockedChanPtr, TCL_READABLE,
+                                          &handle) != TCL_OK)
+        return 0;
+    return CancelIoEx((HANDLE) handle, NULL) != 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelTrackRead --
+ *
+ *    Records an overlapped read that has been successfully posted so that
+ *    it can later be cancelled by IocpChannelCancelReads without
+ *    affecting other operations on the handle. The buffer is untracked
+ *    by IocpCompleteRead. Must be called with the channel still locked
+ *    from the time the read was posted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The buffer is linked on the channel's postedReads list.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpChannelTrackRead(
+    IocpChannel *lockedChanPtr, /* Must be locked */
+    IocpBuffer  *bufPtr)        /* Posted read */
+{
+    IOCP_ASSERT((bufPtr->flags & IOCP_BUFFER_F_TRACKED) == 0);
+    bufPtr->flags |= IOCP_BUFFER_F_TRACKED;
+    IocpListAppend(&lockedChanPtr->postedReads, &bufPtr->link);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelCancelReads --
+ *
+ *    Cancels the tracked reads posted on the channel's handle. Unlike
+ *    IocpChannelCancelIo, writes and other operations are not affected.
+ *
+ * Results:
+ *    Non-0 if cancellation was requested for at least one read, 0
+ *    otherwise.
+ *
+ * Side effects:
+ *    The cancelled reads complete with ERROR_OPERATION_ABORTED unless
+ *    they complete normally first.
+ *
+ *------------------------------------------------------------------------
+ */
+int IocpChannelCancelReads(
+    IocpChannel *lockedChanPtr) /* Must be locked */
+{
+    ClientData handle;
+    IocpLink  *linkPtr;
+    int        cancelled = 0;
+
+    if (lockedChanPtr->postedReads.headPtr == NULL ||
+        lockedChanPtr->vtblPtr->gethandle == NULL ||
+        lockedChanPtr->vtblPtr->gethandle(lockedChanPtr, TCL_READABLE,
+                                          &handle) != TCL_OK)
+        return 0;
+    for (linkPtr = lockedChanPtr->postedReads.headPtr; linkPtr;
+         linkPtr = linkPtr->nextPtr) {
+        IocpBuffer *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+        /* Buffers stay linked until their completion is processed */
+        if (CancelIoEx((HANDLE) handle, (OVERLAPPED *)&bufPtr->u))
+            cancelled = 1;
+    }
+    return cancelled;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpChannelTimerExpired --
+ *
+ *    Called by the timer wheel when a channel timeout may be due. Follows
+ *    the IocpTimerProc prototype. Deadlines may have moved on since the
+ *    timer was armed in which case it is simply rearmed.
+ *
+ *    A connect that times out is moved to CONNECT_RETRY, or to
+ *    CONNECT_FAILED if still resolving, with IOCP_CHAN_F_CONNECT_TIMEDOUT
+ *    set so IocpChannelConnectionStep fails it rather than trying further
+ *    addresses. The attempt in flight on the channel socket is cancelled
+ *    and any others, such as those of a racing connect, are abandoned
+ *    through the connecttimedout() vtbl hook. Their completions are
+ *    ignored. A handshake that times out has its I/O cancelled and fails
+ *    with WSAETIMEDOUT when the cancelled operation completes.
+ *
+ *    On a read timeout, the pending reads are cancelled and their
+ *    completions passed up with WSAETIMEDOUT by IocpCompleteRead so the
+ *    channel becomes readable with the timeout error. As for the idle
+ *    read cancellation in tclWinIocpWinsock.c, only the tracked reads are
+ *    cancelled so writes in progress are not affected. The timeout is
+ *    then restarted, as it is when there are no pending reads because,
+ *    for instance, received data has not yet been consumed.
+ *
+ * Results:
+ *    GetTickCount64 value at which to fire again or 0 to disarm.
+ *
+ * Side effects:
+ *    Pending I/O may be cancelled and the channel state changed.
+ *
+ *------------------------------------------------------------------------
+ */
+static ULONGLONG IocpChannelTimerExpired(
+    IocpTimer *timerPtr,        /* Channel timer. Channel is locked */
+    ULONGLONG  now)             /* GetTickCount64 value */
+{
+    IocpChannel *lockedChanPtr = timerPtr->chanPtr;
+    ULONGLONG    due;
+
+    /* Read timeout not yet started as the timer was armed for the connect */
+    if (lockedChanPtr->state == IOCP_STATE_OPEN &&
+        lockedChanPtr->lastInputTick == 0)
+        lockedChanPtr->lastInputTick = now;
+
+    due = IocpChannelTimeoutDue(lockedChanPtr);
+    if (due == 0 || due > now)
+        return due;
+
+    if (IocpStateConnectionInProgress(lockedChanPtr->state)) {
+        switch (lockedChanPtr->state) {
+        case IOCP_STATE_RESOLVING:
+            /* The lookup sees the state change and abandons the connect */
+            IocpChannelSetState(lockedChanPtr, IOCP_STATE_CONNECT_FAILED);
+            lockedChanPtr->flags |= IOCP_CHAN_F_REMOTE_EOF;
+            break;
+        case IOCP_STATE_CONNECTING:
+            IocpChannelSetState(lockedChanPtr, IOCP_STATE_CONNECT_RETRY);
+            /* Racing attempts are not on the channel socket */
+            if (lockedChanPtr->vtblPtr->connecttimedout)
+                lockedChanPtr->vtblPtr->connecttimedout(lockedChanPtr);
+            (void) IocpChannelCancelIo(lockedChanPtr);
+            break;
+        case IOCP_STATE_HANDSHAKING:
+            /* Only handshake I/O is outstanding. Its completion fails it. */
+            (void) IocpChannelCancelIo(lockedChanPtr);
+            break;
+        default:
+            break;              /* CONNECT_RETRY. The step will fail it. */
+        }
+        lockedChanPtr->flags   |= IOCP_CHAN_F_CONNECT_TIMEDOUT;
+        lockedChanPtr->winError = WSAETIMEDOUT;
+        IOCP_COUNTER_INCR(IocpConnectTimeouts);
+        /* As for connect completions, force a notification. */
+        IocpChannelNudgeThread(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT, 1);
+        return 0;
+    }
+
+    if (lockedChanPtr->pendingReads > 0 &&
+        (lockedChanPtr->flags & IOCP_CHAN_F_READ_TIMEDOUT) == 0 &&
+        IocpChannelCancelReads(lockedChanPtr)) {
+        lockedChanPtr->flags |= IOCP_CHAN_F_READ_TIMEDOUT;
+        IOCP_COUNTER_INCR(IocpReadTimeouts);
+    }
+    lockedChanPtr->lastInputTick = now;
+    return now + lockedChanPtr->readTimeout;
+}
+
 int
 Iocp_Init (Tcl_Interp *interp)
 {
@@ -1904,9 +4146,12 @@ Iocp_Init (Tcl_Interp *interp)
         return TCL_ERROR;
     if (BT_ModuleInitialize(interp) != TCL_OK)
         return TCL_ERROR;
+    if (Udp_ModuleInitialize(interp) != TCL_OK)
+        return TCL_ERROR;
 
     Tcl_CreateObjCommand(interp, "iocp::debugout", Iocp_DebugOutObjCmd, 0L, 0L);
     Tcl_CreateObjCommand(interp, "iocp::stats", Iocp_StatsObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(interp, "iocp::configure", Iocp_ConfigureObjCmd, 0L, 0L);
 
     Tcl_PkgProvide(interp, PACKAGE_NAME, PACKAGE_VERSION);
 
@@ -1930,7 +4175,28 @@ Iocp_DebugOutObjCmd (
     return TCL_OK;
 }
 
-/* Returns statistics */
+/*
+ *------------------------------------------------------------------------
+ *
+ * Iocp_StatsObjCmd --
+ *
+ *    Implements the iocp::stats command.
+ *
+ *        iocp::stats ?-latency ?-reset??
+ *
+ *    Without options, returns a dictionary of process-wide counters. With
+ *    -latency, returns the latency histograms enabled through
+ *    iocp::configure -latencystats. The histograms are cleared after
+ *    being returned if -reset is also specified.
+ *
+ * Results:
+ *    TCL_OK or TCL_ERROR.
+ *
+ * Side effects:
+ *    Latency histograms may be reset.
+ *
+ *------------------------------------------------------------------------
+ */
 IocpTclCode
 Iocp_StatsObjCmd (
     ClientData notUsed,			/* Not used. */
@@ -1938,41 +4204,324 @@ Iocp_StatsObjCmd (
     int objc,				/* Number of arguments. */
     Tcl_Obj *CONST objv[])		/* Argument objects. */
 {
-    Tcl_Obj *stats[12];
-    int n;
+    static Tcl_WideInt prevTicks;   /* Time of previous call */
+    static Tcl_WideInt prevPackets; /* Completion packets at previous call */
+    Tcl_Obj *stats[160];
+    Tcl_Obj *buckets[IOCP_BATCH_SIZE_BUCKETS];
+    IocpCounters sums;
+    int n, i;
+    Tcl_WideInt poolHits, poolMisses, poolBytes, poolCount, threadBytes;
+    Tcl_WideInt ticks, rate;
 #define ADDSTATS(field_) do { \
     stats[n++] = Tcl_NewStringObj(# field_, -1); \
     stats[n++] = IOCP_STATS_GET(Iocp ## field_); \
 } while (0)
+#define ADDWIDESTATS(name_, value_) do { \
+    stats[n++] = Tcl_NewStringObj(name_, -1); \
+    stats[n++] = Tcl_NewWideIntObj(value_); \
+} while (0)
+#define ADDCOUNTER(field_) ADDWIDESTATS(# field_, sums.Iocp ## field_)
+
+    if (objc > 1) {
+        static const char *const latencyOptions[] = {"-latency", "-reset", NULL};
+        int optIndex;
+        if (objc > 3 ||
+            Tcl_GetIndexFromObj(interp, objv[1], latencyOptions, "option",
+                                TCL_EXACT, &optIndex) != TCL_OK ||
+            optIndex != 0 ||
+            (objc == 3 &&
+             (Tcl_GetIndexFromObj(interp, objv[2], latencyOptions, "option",
+                                  TCL_EXACT, &optIndex) != TCL_OK ||
+              optIndex != 1))) {
+            Tcl_WrongNumArgs(interp, 1, objv, "?-latency ?-reset??");
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, IocpLatencyReport());
+        if (objc == 3)
+            IocpLatencyReset();
+        return TCL_OK;
+    }
+
+    IocpCountersSum(&sums);
+
+    /*
+     * Completion rate is measured over the interval since the previous call
+     * (from any thread). The first call reports the rate since load.
+     */
+    ticks = (Tcl_WideInt) GetTickCount64();
+    IocpLockAcquireExclusive(&iocpModuleState.lock);
+    if (ticks > prevTicks && sums.IocpCompletionPackets >= prevPackets) {
+        rate = ((sums.IocpCompletionPackets - prevPackets) * 1000)
+             / (ticks - prevTicks);
+    } else {
+        rate = 0;
+    }
+    prevTicks   = ticks;
+    prevPackets = sums.IocpCompletionPackets;
+    IocpLockReleaseExclusive(&iocpModuleState.lock);
 
     n = 0;
-    ADDSTATS(ChannelAllocs);
-    ADDSTATS(ChannelFrees);
-    ADDSTATS(BufferAllocs);
-    ADDSTATS(BufferFrees);
-    ADDSTATS(DataBufferAllocs);
-    ADDSTATS(DataBufferFrees);
+    ADDCOUNTER(ChannelAllocs);
+    ADDCOUNTER(ChannelFrees);
+    ADDCOUNTER(BufferAllocs);
+    ADDCOUNTER(BufferFrees);
+    ADDCOUNTER(DataBufferAllocs);
+    ADDCOUNTER(DataBufferFrees);
+
+    ADDCOUNTER(CompletionBatches);
+    ADDCOUNTER(CompletionPackets);
+    ADDWIDESTATS("CompletionsPerSecond", rate);
+    for (i = 0; i < IOCP_BATCH_SIZE_BUCKETS; ++i) {
+        buckets[i] = Tcl_NewWideIntObj(sums.IocpCompletionBatchSizes[i]);
+    }
+    stats[n++] = Tcl_NewStringObj("CompletionBatchSizes", -1);
+    stats[n++] = Tcl_NewListObj(IOCP_BATCH_SIZE_BUCKETS, buckets);
+    ADDSTATS(CompletionBatchMax);
+    ADDCOUNTER(InlineCompletions);
+    ADDCOUNTER(InlineDeferrals);
+    ADDCOUNTER(RioCompletions);
+    ADDCOUNTER(ReadSizeGrows);
+    ADDCOUNTER(ReadSizeShrinks);
+    ADDCOUNTER(ZeroByteProbes);
+
+    ADDCOUNTER(BytesRead);
+    ADDCOUNTER(BytesWritten);
+    ADDCOUNTER(ReadsPosted);
+    ADDCOUNTER(ReadOps);
+    ADDWIDESTATS("ReadsPending", sums.IocpReadsPosted - sums.IocpReadOps);
+    ADDCOUNTER(WritesPosted);
+    ADDCOUNTER(WriteOps);
+    ADDWIDESTATS("WritesPending", sums.IocpWritesPosted - sums.IocpWriteOps);
+    ADDCOUNTER(AcceptsPosted);
+    ADDCOUNTER(AcceptOps);
+    ADDWIDESTATS("AcceptsPending",
+                 sums.IocpAcceptsPosted - sums.IocpAcceptOps);
+    ADDCOUNTER(EventsQueued);
+    ADDCOUNTER(EventsDequeued);
+    ADDWIDESTATS("EventQueueDepth",
+                 sums.IocpEventsQueued - sums.IocpEventsDequeued);
+    ADDCOUNTER(InputWouldBlock);
+    ADDCOUNTER(OutputWouldBlock);
+    ADDCOUNTER(ConnectRetries);
+    ADDCOUNTER(SpinWaits);
+    ADDCOUNTER(SpinMisses);
+    ADDCOUNTER(SleepWaits);
+    ADDCOUNTER(LockFreeInputs);
+    ADDCOUNTER(UdpDatagramsReceived);
+    ADDCOUNTER(UdpDatagramsSent);
+
+    ADDCOUNTER(IdleReadCancels);
+    ADDCOUNTER(SocketRecycleHits);
+    ADDCOUNTER(SocketRecycleMisses);
+    ADDCOUNTER(SocketsRecycled);
+    ADDCOUNTER(AcceptsWithData);
+    ADDCOUNTER(AcceptBacklogGrows);
+    ADDCOUNTER(AcceptBacklogShrinks);
+    ADDCOUNTER(WorkerDispatches);
+    ADDCOUNTER(DnsCacheHits);
+    ADDCOUNTER(DnsCacheMisses);
+    ADDCOUNTER(DnsAsyncLookups);
+    ADDCOUNTER(DnsReverseLookups);
+    ADDCOUNTER(BtServiceCacheHits);
+    ADDCOUNTER(BtServiceCacheMisses);
+    ADDCOUNTER(BtAsyncRequests);
+    ADDCOUNTER(ConnectRaceAttempts);
+    ADDCOUNTER(ConnectRaceFallbacks);
+    ADDWIDESTATS("InputBytesQueued", iocpInputBudget.queuedBytes);
+    ADDCOUNTER(InputThrottles);
+    ADDCOUNTER(UdpTruncatedDrops);
+    ADDCOUNTER(UdpOverflowDrops);
+    ADDCOUNTER(UdpErrorDrops);
+    ADDCOUNTER(UdpEmptyDrops);
+    ADDCOUNTER(ReadTimeouts);
+    ADDCOUNTER(ConnectTimeouts);
+
+    IocpBufferPoolGetStats(&poolHits, &poolMisses, &poolBytes, &poolCount,
+                           &threadBytes);
+    ADDWIDESTATS("BufferPoolHits", poolHits);
+    ADDWIDESTATS("BufferPoolMisses", poolMisses);
+    ADDWIDESTATS("BufferPoolCachedBytes", poolBytes);
+    ADDWIDESTATS("BufferPoolCachedBuffers", poolCount);
+    ADDWIDESTATS("BufferThreadCachedBytes", threadBytes);
 
     IOCP_ASSERT(n <= sizeof(stats)/sizeof(stats[0]));
 
     Tcl_SetObjResult(interp, Tcl_NewListObj(n, stats));
     return TCL_OK;
 }
+
+/* Options for iocp::configure. Must match enum IocpConfigureOption */
+static const char *const iocpConfigureOptions[] = {
+    "-completionthreads", "-connectdelay", "-dnscachettl", "-latencystats",
+    "-maxcachedbytes", "-maxinputbytes", NULL
+};
+enum IocpConfigureOption {
+    IOCP_CONFIG_COMPLETIONTHREADS, IOCP_CONFIG_CONNECTDELAY,
+    IOCP_CONFIG_DNSCACHETTL, IOCP_CONFIG_LATENCYSTATS,
+    IOCP_CONFIG_MAXCACHEDBYTES, IOCP_CONFIG_MAXINPUTBYTES
+};
+
+/* Returns the value of an iocp::configure option. */
+static Tcl_Obj *IocpConfigureGet(enum IocpConfigureOption optIndex)
+{
+    Tcl_WideInt value = 0;
+    switch (optIndex) {
+    case IOCP_CONFIG_COMPLETIONTHREADS:
+        IocpLockAcquireExclusive(&iocpModuleState.lock);
+        value = iocpModuleState.active_completion_threads;
+        IocpLockReleaseExclusive(&iocpModuleState.lock);
+        break;
+    case IOCP_CONFIG_CONNECTDELAY:
+        value = (int) TcpGetConnectDelay();
+        break;
+    case IOCP_CONFIG_DNSCACHETTL:
+        value = (int) IocpDnsCacheGetTtl();
+        break;
+    case IOCP_CONFIG_LATENCYSTATS:
+        value = iocpLatencyEnabled;
+        break;
+    case IOCP_CONFIG_MAXCACHEDBYTES:
+        value = iocpBufferPool.maxBytes;
+        break;
+    case IOCP_CONFIG_MAXINPUTBYTES:
+        value = iocpInputBudget.maxBytes;
+        break;
+    }
+    return Tcl_NewWideIntObj(value);
+}
+
 /*
- * TBD - design change - would it be faster to post zero-byte read and then
- * copy from WSArecv to channel buffer in InputProc ? That may potentially
- * save one buffer copy (from IocpBuffer to channel buffer) although we
- * may potentially incur a copy from the packet into the kernel buffer since
- * we are not supplying a buffer. Zero byte read also has the disadvantage
- * of an additional kernel transition. On the other hand, it is less memory
- * intensive. See https://microsoft.public.win32.programmer.networks.narkive.com/FRa81Gzo/about-zero-byte-receive-iocp-server
- * for a discussion.
+ *------------------------------------------------------------------------
+ *
+ * Iocp_ConfigureObjCmd --
+ *
+ *    Implements the iocp::configure command which gets or sets process-wide
+ *    tunables.
+ *
+ *        iocp::configure ?OPTION ?VALUE OPTION VALUE...??
+ *
+ *    With no arguments, returns a dictionary of all options. With a single
+ *    option, returns its value. Otherwise sets the specified options.
+ *
+ *        -completionthreads N - Number of threads servicing the completion
+ *                            port. Defaults to number of processors.
+ *        -connectdelay MS - Milliseconds after which a connect attempt to
+ *                            the next remote address is started while
+ *                            earlier attempts are still in progress.
+ *                            0 disables racing connects.
+ *        -dnscachettl MS - Milliseconds for which resolved remote addresses
+ *                            are cached. 0 (default) disables the cache.
+ *        -latencystats BOOL - Whether to record I/O latency histograms
+ *                            reported by iocp::stats -latency. Defaults
+ *                            to false.
+ *        -maxcachedbytes N - Limit on the memory held in the process-wide
+ *                            buffer pool. 0 disables buffer pooling.
+ *        -maxinputbytes N - Limit on received data queued across all
+ *                            channels before reads are held back.
+ *                            0 disables the limit.
  *
- * Can only resolve by trying both and measuring.
+ * Results:
+ *    TCL_OK or TCL_ERROR.
+ *
+ * Side effects:
+ *    Options are modified as specified.
+ *
+ *------------------------------------------------------------------------
  */
+IocpTclCode
+Iocp_ConfigureObjCmd (
+    ClientData notUsed,			/* Not used. */
+    Tcl_Interp *interp,			/* Current interpreter. */
+    int objc,				/* Number of arguments. */
+    Tcl_Obj *CONST objv[])		/* Argument objects. */
+{
+    const char *const *options = iocpConfigureOptions;
+    int i, optIndex, intValue;
+    IocpWinError winError;
+
+    if (objc == 1) {
+        Tcl_Obj *resultObj = Tcl_NewListObj(0, NULL);
+        for (i = 0; options[i]; ++i) {
+            Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj(options[i], -1));
+            Tcl_ListObjAppendElement(NULL, resultObj, IocpConfigureGet(i));
+        }
+        Tcl_SetObjResult(interp, resultObj);
+        return TCL_OK;
+    }
+
+    if (objc == 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[1], options, "option",
+                                TCL_EXACT, &optIndex) != TCL_OK)
+            return TCL_ERROR;
+        Tcl_SetObjResult(interp, IocpConfigureGet(optIndex));
+        return TCL_OK;
+    }
+
+    if ((objc % 2) == 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-option value ...?");
+        return TCL_ERROR;
+    }
 
+    /* Validate all options before setting any */
+    for (i = 1; i < objc; i += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option",
+                                TCL_EXACT, &optIndex) != TCL_OK)
+            return TCL_ERROR;
+        if (optIndex == IOCP_CONFIG_LATENCYSTATS) {
+            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &intValue) != TCL_OK)
+                return TCL_ERROR;
+            continue;
+        }
+        if (Tcl_GetIntFromObj(interp, objv[i+1], &intValue) != TCL_OK)
+            return TCL_ERROR;
+        if (intValue < 0 ||
+            (optIndex == IOCP_CONFIG_COMPLETIONTHREADS &&
+             (intValue < 1 || intValue > IOCP_COMPLETION_THREADS_MAX)) ||
+            (optIndex == IOCP_CONFIG_CONNECTDELAY &&
+             intValue > IOCP_CONNECT_DELAY_MAX)) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            return TCL_ERROR;
+        }
+    }
+    for (i = 1; i < objc; i += 2) {
+        Tcl_GetIndexFromObj(NULL, objv[i], options, "option",
+                            TCL_EXACT, &optIndex);
+        if (optIndex == IOCP_CONFIG_LATENCYSTATS)
+            Tcl_GetBooleanFromObj(NULL, objv[i+1], &intValue);
+        else
+            Tcl_GetIntFromObj(NULL, objv[i+1], &intValue);
+        switch ((enum IocpConfigureOption) optIndex) {
+        case IOCP_CONFIG_COMPLETIONTHREADS:
+            winError = IocpSetCompletionThreadCount(intValue);
+            if (winError != 0)
+                return Iocp_ReportWindowsError(interp, winError, "couldn't set completion threads: ");
+            break;
+        case IOCP_CONFIG_CONNECTDELAY:
+            TcpSetConnectDelay(intValue);
+            break;
+        case IOCP_CONFIG_DNSCACHETTL:
+            IocpDnsCacheSetTtl(intValue);
+            break;
+        case IOCP_CONFIG_LATENCYSTATS:
+            IocpLatencyEnable(intValue);
+            break;
+        case IOCP_CONFIG_MAXCACHEDBYTES:
+            IocpBufferPoolSetMaxBytes(intValue);
+            break;
+        case IOCP_CONFIG_MAXINPUTBYTES:
+            iocpInputBudget.maxBytes = intValue;
+            break;
+        }
+    }
+    return TCL_OK;
+}
 /*
- * TBD - design change - Instead of going through the event loop to
- * notify fileevents, maybe set up a event source and set maxblocking time
- * to 0 as the core winsock implementation does.
+ * Zero-byte reads versus posted buffers: zero-byte reads (the zerobyte and
+ * auto values of the -readmode socket option) pin no memory in the kernel
+ * while a connection is idle at the cost of an additional kernel transition
+ * and a copy via the stack's own buffers for every burst of incoming data.
+ * The buffered mode remains the default since it is the faster of the two
+ * for busy connections. See https://microsoft.public.win32.programmer.networks.narkive.com/FRa81Gzo/about-zero-byte-receive-iocp-server
+ * for a discussion and the -readmode option of tests/netbench.tcl for
+ * measuring the two against each other.
  */
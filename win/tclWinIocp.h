@@ -45,7 +45,17 @@
 # endif
 #endif
 
-#ifdef IOCP_ENABLE_TRACE
+/*
+ * Typed ETW events (IOCP_ETW_*) are compiled in unless IOCP_DISABLE_ETW is
+ * defined, e.g. for compilers without TraceLoggingProvider.h. When no trace
+ * session has enabled the provider, each costs a test of the provider's
+ * enabled state.
+ */
+#ifndef IOCP_DISABLE_ETW
+# define IOCP_ENABLE_ETW
+#endif
+
+#if defined(IOCP_ENABLE_TRACE) || defined(IOCP_ENABLE_ETW)
 #include <TraceLoggingProvider.h>
 /* Used for ETW tracing */
 TRACELOGGING_DECLARE_PROVIDER( iocpWinTraceProvider );
@@ -69,6 +79,7 @@ typedef CRITICAL_SECTION IocpLock;
 #define IocpLockAcquireExclusive(lockPtr) EnterCriticalSection(lockPtr)
 #define IocpLockReleaseShared(lockPtr)    LeaveCriticalSection(lockPtr)
 #define IocpLockReleaseExclusive(lockPtr) LeaveCriticalSection(lockPtr)
+#define IocpLockTryAcquireExclusive(lockPtr) TryEnterCriticalSection(lockPtr)
 #define IocpLockDelete(lockPtr)           DeleteCriticalSection(lockPtr)
 IOCP_INLINE BOOL IocpConditionVariableWaitShared(
     PCONDITION_VARIABLE cvPtr,
@@ -89,6 +100,7 @@ typedef SRWLOCK IocpLock;
 #define IocpLockAcquireExclusive(lockPtr) AcquireSRWLockExclusive(lockPtr)
 #define IocpLockReleaseShared(lockPtr)    ReleaseSRWLockShared(lockPtr)
 #define IocpLockReleaseExclusive(lockPtr) ReleaseSRWLockExclusive(lockPtr)
+#define IocpLockTryAcquireExclusive(lockPtr) TryAcquireSRWLockExclusive(lockPtr)
 #define IocpLockDelete(lockPtr)           (void) 0
 IOCP_INLINE BOOL IocpConditionVariableWaitShared(
     PCONDITION_VARIABLE cvPtr,
@@ -113,6 +125,9 @@ typedef struct IocpChannel     IocpChannel;
 typedef struct IocpChannelVtbl IocpChannelVtbl;
 typedef struct IocpDataBuffer  IocpDataBuffer;
 typedef struct IocpBuffer      IocpBuffer;
+typedef struct IocpBufferCache IocpBufferCache;
+typedef struct IocpAlertBatch  IocpAlertBatch;
+typedef struct IocpReadyQueue  IocpReadyQueue;
 
 /*
  * Typedefs used by one-time initialization utilities.
@@ -142,18 +157,102 @@ IOCP_INLINE void IocpListInit(IocpList *listPtr) {
     listPtr->tailPtr = NULL;
 }
 
+/*
+ * Intrusive queue with any number of producers and a single consumer,
+ * after the algorithm by Dmitry Vyukov. Producers push without locking.
+ * Pops need no lock either but must not happen concurrently, which is
+ * normally ensured by only popping from the thread owning the queue. Only
+ * the nextPtr field of queued links is used. The stub link keeps the
+ * queue non-empty from the producers' point of view.
+ */
+typedef struct IocpHandoffQueue {
+    IocpLink * volatile tailPtr; /* Last pushed link. Written by producers */
+    IocpLink           *headPtr; /* Next link to pop. Consumer only */
+    IocpLink            stub;
+} IocpHandoffQueue;
+IOCP_INLINE void IocpHandoffQueueInit(IocpHandoffQueue *queuePtr) {
+    queuePtr->stub.nextPtr = NULL;
+    queuePtr->headPtr      = &queuePtr->stub;
+    queuePtr->tailPtr      = &queuePtr->stub;
+}
+
+/* List utilities */
+void IocpListAppend(IocpList *listPtr, IocpLink *linkPtr);
+void IocpListPrepend(IocpList *listPtr, IocpLink *linkPtr);
+void IocpListInsertBefore(IocpList *listPtr, IocpLink *beforePtr, IocpLink *linkPtr);
+void IocpListRemove(IocpList *listPtr, IocpLink *linkPtr);
+IocpLink *IocpListPopFront(IocpList *listPtr);
+void IocpHandoffQueuePush(IocpHandoffQueue *queuePtr, IocpLink *linkPtr);
+IocpLink *IocpHandoffQueuePop(IocpHandoffQueue *queuePtr);
+
+/*
+ * Timers driven by the timer wheel in tclWinIocpTimer.c. Timers are embedded
+ * in the structure whose timeouts they implement. Each is associated with
+ * a channel which must be locked when arming or cancelling the timer and
+ * is locked by the wheel when calling the timer procedure. The procedure
+ * is passed the current GetTickCount64 value and returns the value at
+ * which to fire again, or 0 to leave the timer disarmed. It must not
+ * arm or cancel timers itself.
+ */
+typedef struct IocpTimer IocpTimer;
+typedef ULONGLONG IocpTimerProc(IocpTimer *timerPtr, ULONGLONG now);
+struct IocpTimer {
+    IocpLink       link;        /* Links timers in a wheel slot */
+    IocpList      *slotPtr;     /* Wheel slot holding the timer. NULL if
+                                 * not armed */
+    ULONGLONG      due;         /* GetTickCount64 value at which to fire */
+    IocpChannel   *chanPtr;     /* Channel locked when firing */
+    IocpTimerProc *proc;        /* Called when the timer fires */
+};
+void         IocpTimerInit(IocpTimer *timerPtr, IocpChannel *chanPtr,
+                           IocpTimerProc *proc);
+IocpWinError IocpTimerArm(IocpTimer *timerPtr, ULONGLONG due);
+void         IocpTimerCancel(IocpTimer *timerPtr);
+void         IocpTimerWheelFinalize(void);
+/* Returns non-0 if armed. Channel must be locked. */
+IOCP_INLINE int IocpTimerArmed(const IocpTimer *timerPtr) {
+    return timerPtr->slotPtr != NULL;
+}
+
 /*
  * Common data shared across the IOCP implementation. This structure is
  * initialized once per process and referenced from both Tcl threads as well
- * as the IOCP worker threads. Should not be written to after initialization.
+ * as the IOCP worker threads. Except for the completion thread pool fields,
+ * which are protected by the lock, should not be written to after
+ * initialization.
  */
+#define IOCP_COMPLETION_THREADS_MAX 64 /* MAXIMUM_WAIT_OBJECTS */
+#define IOCP_COMPLETION_THREAD_EXIT_TIMEOUT 5000 /* ms to wait at exit */
+#define IOCP_COMPLETION_BATCH_SIZE 64 /* Max completions dequeued at a time */
 typedef struct IocpModuleState {
     HANDLE completion_port;   /* The completion port around which life revolves */
-    HANDLE completion_thread; /* Handle of thread servicing completions */
+    IocpLock lock;            /* Protects the completion thread pool */
+    HANDLE completion_threads[IOCP_COMPLETION_THREADS_MAX];
+                              /* Handles of threads servicing completions.
+                               * Includes threads that have been asked to
+                               * exit but have not been reaped yet. */
+    int    num_completion_threads;  /* Number of entries in above */
+    int    active_completion_threads; /* Number of threads not asked to exit */
+    int    completion_concurrency; /* Concurrency value for the port */
+    LONG64 perf_frequency;    /* Performance counter ticks per second */
+    int    default_max_spin_wait; /* Initial -maxspinwait of channels. 0 on
+                                   * single processor systems */
     int    initialized;       /* Whether initialized */
 } IocpSubSystem;
 extern IocpSubSystem iocpModuleState;
 
+/*
+ * Per-thread data. Allocated through Tcl_GetThreadData for both Tcl threads
+ * and the completion thread.
+ */
+typedef struct IocpTsd {
+    IocpBufferCache *bufferCachePtr; /* Thread cache for the buffer pool */
+    IocpAlertBatch  *alertBatchPtr;  /* Deferred Tcl thread alerts. Only
+                                      * used in completion threads. */
+    IocpReadyQueue  *readyQueuePtr;  /* Channels ready for processing. Only
+                                      * used in Tcl threads. */
+} IocpTsd;
+
 /* If true, enables trace output at runtime assuming it's enabled at compile */
 extern int iocpEnableTrace;
 
@@ -242,9 +341,27 @@ typedef struct IocpBuffer {
     } context[2];                  /* For buffer users. Not initialized and
                                     * not used by buffer functions */
     enum IocpBufferOp operation;   /* I/O operation */
+    unsigned int      sequence;    /* Posting order of reads. See
+                                    * IocpCompleteRead */
+    LONG64            postedAt;    /* Performance counter when posted or 0
+                                    * if latency is not being tracked */
+    LONG64            completedAt; /* Performance counter when completion
+                                    * was dequeued or 0 */
     int               flags;
 #define IOCP_BUFFER_F_WINSOCK 0x1 /* Buffer used for a Winsock operation.
                                    *  (meaning wsaOverlap, not overlap) */
+#define IOCP_BUFFER_F_RIO     0x2 /* Data area is a chunk of a registered
+                                   * I/O buffer. See tclWinIocpRio.c */
+#define IOCP_BUFFER_F_PROBE   0x4 /* Zero-byte read posted to detect when
+                                   * data is available */
+#define IOCP_BUFFER_F_DISCARD 0x8 /* Completed read carries nothing for the
+                                   * application. See readcompleted() */
+#define IOCP_BUFFER_F_TRANSMIT 0x10 /* Write posted with TransmitFile.
+                                    * context[1].h is the file handle which
+                                    * is closed on completion and data.len
+                                    * the total number of bytes sent */
+#define IOCP_BUFFER_F_TRACKED 0x20 /* Read linked on the channel's
+                                    * postedReads list */
 } IocpBuffer;
 
 /* State values for IOCP channels. Used as bit masks. */
@@ -259,9 +376,13 @@ enum IocpState {
     IOCP_STATE_DISCONNECTED   = 0x80, /* Remote end has disconnected */
     IOCP_STATE_CONNECT_FAILED = 0x100, /* All connect attempts failed */
     IOCP_STATE_CLOSED         = 0x200, /* Channel closed from both ends */
+    IOCP_STATE_RESOLVING      = 0x400, /* Async address lookup in progress.
+                                        * Precedes CONNECTING */
+    IOCP_STATE_HANDSHAKING    = 0x800, /* Connected, protocol handshake (e.g.
+                                        * TLS) in progress. Follows CONNECTED */
 };
 IOCP_INLINE int IocpStateConnectionInProgress(enum IocpState state) {
-    return (state & ( IOCP_STATE_CONNECTING | IOCP_STATE_CONNECTED | IOCP_STATE_CONNECT_RETRY)) != 0;
+    return (state & ( IOCP_STATE_RESOLVING | IOCP_STATE_CONNECTING | IOCP_STATE_CONNECTED | IOCP_STATE_CONNECT_RETRY | IOCP_STATE_HANDSHAKING)) != 0;
 }
 
 /*
@@ -292,18 +413,22 @@ IOCP_INLINE int IocpStateConnectionInProgress(enum IocpState state) {
  *   decrement happens when the IocpBuffer is freed.
  * 
  * - When a read I/O completes, the IOCP completion thread retrieves the
- *   IocpBuffer and places it on the IocpChannel's inputBuffers queue.
+ *   IocpBuffer and pushes it on the IocpChannel's handoffBuffers queue.
+ *   The owning Tcl thread moves buffers from there to its private
+ *   inputBuffers queue without locking the IocpChannel.
  * 
- * - The completion thread then sends a Tcl_Event notification referencing
- *   the IocpChannel to the thread owning the channel. The IocpChannel
+ * - The completion thread then appends the IocpChannel to the ready queue
+ *   of the thread owning the channel and alerts that thread. The IocpChannel
  *   reference count is incremented corresponding to this reference.
  * 
- * - The notified Tcl thread receives the event and processes the
- *   completion. The IocpChannel reference count is decremented as it is no
- *   longer referenced from the Tcl event queue.
+ * - The event source of the notified Tcl thread drains its ready queue and
+ *   processes the completion. The IocpChannel reference count is
+ *   decremented as it is no longer referenced from the ready queue.
  * 
  * - The IocpBuffer's on the IocpChannel inputBuffers queue are processed
- *   when the Tcl channel layer calls IocpInputProc to read data.
+ *   when the Tcl channel layer calls IocpInputProc to read data. While the
+ *   channel is open and data is queued, this does not take the IocpChannel
+ *   lock except to post further reads.
  * 
  * - Before closing the Tcl channel layer calls the IocpThreadActionProc to
  *   detach the channel.
@@ -323,12 +448,56 @@ IOCP_INLINE int IocpStateConnectionInProgress(enum IocpState state) {
  * Access to the structure is synchronized through the
  * IocpChannelLock/IocpChannelUnlock functions.
  */
+/*
+ * Per-channel counters. Protected by the channel lock.
+ */
+typedef struct IocpChannelStats {
+    LONG64 bytesRead;           /* Bytes received */
+    LONG64 bytesWritten;        /* Bytes sent */
+    LONG64 readOps;             /* Completed reads */
+    LONG64 writeOps;            /* Completed writes */
+    LONG64 accepts;             /* Completed accepts */
+    LONG64 inputWouldBlock;     /* Reads returning EAGAIN */
+    LONG64 outputWouldBlock;    /* Writes with no room to queue data */
+    LONG64 connectRetries;      /* Failed connect attempts */
+    LONG64 inputThrottles;      /* Times reads were held back because of
+                                 * unconsumed input */
+    LONG64 spinWaits;           /* Blocking waits satisfied while spinning */
+    LONG64 spinMisses;          /* Blocking waits that spun, then slept */
+    LONG64 sleepWaits;          /* Blocking waits that slept */
+} IocpChannelStats;
+
+/*
+ * Process-wide budget for received data queued on channels but not yet
+ * consumed by the application. See IocpChannelPostReads.
+ */
+typedef struct IocpInputBudget {
+    volatile LONG64 queuedBytes; /* Bytes in inputBuffers of all channels */
+    int             maxBytes;    /* High water mark. 0 => no limit */
+#define IOCP_INPUT_BUDGET_MAX_BYTES_DEFAULT (256*1024*1024)
+} IocpInputBudget;
+extern IocpInputBudget iocpInputBudget;
+
 typedef struct IocpChannel {
     const IocpChannelVtbl *vtblPtr; /* Dispatch for specific IocpChannel types */
     Tcl_Channel  channel;      /* Tcl channel */
     IocpList     inputBuffers; /* Input buffers whose data is to be
-                                * passed up to the Tcl channel layer. */
+                                * passed up to the Tcl channel layer.
+                                * Only accessed by the consumer of
+                                * handoffBuffers. See IocpChannelTakeInput */
+    IocpHandoffQueue handoffBuffers; /* Completed reads and accepts pushed
+                                      * by completion threads, in order,
+                                      * for moving to inputBuffers */
+    IocpList     reorderBuffers; /* Completed reads that are waiting for
+                                  * reads posted earlier to complete. */
+    unsigned int readSeqPosted;  /* Sequence number for next posted read */
+    unsigned int readSeqQueued;  /* Sequence number of next read to be
+                                  * handed off to inputBuffers */
     Tcl_ThreadId owningThread; /* Pointer to owning thread. */
+    IocpReadyQueue *readyQueuePtr; /* Ready queue of owning thread. Holds
+                                    * a reference to the queue. */
+    IocpLink     readyLink;    /* Links channel on readyQueuePtr->channels
+                                * when IOCP_CHAN_F_ON_EVENTQ is set */
     IocpLock  lock;            /* Synchronization */
     CONDITION_VARIABLE cv;     /* Used to wake up blocked Tcl thread waiting
                                 * a completion */
@@ -338,15 +507,70 @@ typedef struct IocpChannel {
     IocpWinError  winError;    /* Last error code on I/O */
 
     int pendingReads;                 /* Number of outstanding posted reads */
+    IocpList postedReads;             /* Posted overlapped reads that can be
+                                       * cancelled individually. See
+                                       * IocpChannelTrackRead */
     int maxPendingReads;              /* Max number of outstanding posted reads */
 #define IOCP_MAX_PENDING_READS_DEFAULT 3
+    int readBufferSize;               /* Capacity of posted read buffers.
+                                       * 0 => adapted to traffic using the
+                                       * auto* fields below */
+#define IOCP_READ_BUFFER_MIN_SIZE 1024
+#define IOCP_READ_BUFFER_MAX_SIZE (1024*1024)   /* Limit for fixed sizes */
+#define IOCP_READ_BUFFER_AUTO_MAX_SIZE 65536    /* Limit for adapted sizes */
+    int autoReadSize;                 /* Current size in adaptive mode */
+    int autoPendingReads;             /* Current number of reads to keep
+                                       * posted in adaptive mode */
+    int readFillScore;                /* > 0 : run of full reads,
+                                       * < 0 : run of mostly empty reads */
+    volatile LONG inputBytes;         /* Bytes of data in inputBuffers and
+                                       * handoffBuffers. Updated with
+                                       * interlocked operations as input
+                                       * may be consumed without the lock */
+    int maxInputBytes;                /* Reads are not reposted once
+                                       * inputBytes reaches this until it
+                                       * drains to half. 0 => no limit */
+#define IOCP_MAX_INPUT_BYTES_DEFAULT (1024*1024)
+    int maxSpinWait;                  /* Max microseconds to spin before
+                                       * sleeping in blocking waits.
+                                       * 0 => never spin */
+#define IOCP_MAX_SPIN_WAIT_DEFAULT 50
+#define IOCP_MAX_SPIN_WAIT_LIMIT   1000
+    int spinWaitEstimate;             /* Smoothed duration in microseconds
+                                       * of recent blocking waits */
     int pendingWrites;                /* Number of outstanding posted writes */
     int maxPendingWrites;             /* Max number of outstanding posted writes */
 #define IOCP_MAX_PENDING_WRITES_DEFAULT 3
+    IocpList outputBuffers;           /* Written data not yet posted to the
+                                       * device. Small writes are coalesced
+                                       * into the tail buffer. */
+    int outputBytes;                  /* Bytes in outputBuffers plus bytes
+                                       * in posted writes not completed */
+    int maxOutputBytes;               /* Writes are refused (would block)
+                                       * once outputBytes reaches this */
+#define IOCP_MAX_OUTPUT_BYTES_DEFAULT 65536
+
+    IocpTimer timer;                  /* Fires for connect and read
+                                       * timeouts. See
+                                       * IocpChannelScheduleTimeouts */
+    ULONGLONG connectDeadline;        /* GetTickCount64 value by which a
+                                       * connect must complete. 0 => none */
+    ULONGLONG lastInputTick;          /* GetTickCount64 value when data was
+                                       * last received, or the read timeout
+                                       * was last restarted */
+    DWORD connectTimeout;             /* Connect timeout in ms. 0 => none */
+    DWORD readTimeout;                /* Pending reads fail after this many
+                                       * ms without data. 0 => none */
+
+    int inlineDepth;                  /* Nesting of inline completions.
+                                       * See IocpChannelCompleteInline */
+#define IOCP_INLINE_COMPLETION_MAX_DEPTH 4
+
+    IocpChannelStats stats;           /* Returned by fconfigure -stats */
 
     int       flags;
 
-#define IOCP_CHAN_F_ON_EVENTQ    0x0002 /* The channel is on the event q */
+#define IOCP_CHAN_F_ON_EVENTQ    0x0002 /* The channel is on the ready q */
 #define IOCP_CHAN_F_WRITE_DONE   0x0004 /* One or more writes completed */
 #define IOCP_CHAN_F_WATCH_INPUT  0x0008 /* Notify Tcl on data arrival */
 #define IOCP_CHAN_F_WATCH_OUTPUT 0x0010 /* Notify Tcl on output unblocking */
@@ -358,9 +582,51 @@ typedef struct IocpChannel {
 #define IOCP_CHAN_F_BLOCKED_READ    0x0400 /* Blocked for read completion */
 #define IOCP_CHAN_F_BLOCKED_WRITE   0x0800 /* Blocked for write completion */
 #define IOCP_CHAN_F_BLOCKED_CONNECT 0x1000 /* Blocked for connect completion */
+#define IOCP_CHAN_F_INPUT_THROTTLED 0x2000 /* Reads held back by input budget */
+#define IOCP_CHAN_F_READ_TIMEDOUT   0x4000 /* Pending reads cancelled by
+                                            * the read timeout */
+#define IOCP_CHAN_F_CONNECT_TIMEDOUT 0x8000 /* Connect timeout expired */
 #define IOCP_CHAN_F_BLOCKED_MASK \
     (IOCP_CHAN_F_BLOCKED_READ | IOCP_CHAN_F_BLOCKED_WRITE | IOCP_CHAN_F_BLOCKED_CONNECT)
 } IocpChannel;
+/* Returns the capacity of the next read buffer to post */
+IOCP_INLINE int IocpChannelReadBufferSize(const IocpChannel *chanPtr) {
+    return chanPtr->readBufferSize ? chanPtr->readBufferSize : chanPtr->autoReadSize;
+}
+/* Returns the number of reads to keep posted */
+IOCP_INLINE int IocpChannelReadsToPost(const IocpChannel *chanPtr) {
+    if (chanPtr->readBufferSize == 0 &&
+        chanPtr->autoPendingReads < chanPtr->maxPendingReads)
+        return chanPtr->autoPendingReads;
+    return chanPtr->maxPendingReads;
+}
+/* Accounts for data added to (nbytes > 0) or removed from input. No lock needed. */
+IOCP_INLINE void IocpChannelAddInputBytes(IocpChannel *chanPtr, int nbytes) {
+    InterlockedExchangeAdd(&chanPtr->inputBytes, nbytes);
+    InterlockedExchangeAdd64(&iocpInputBudget.queuedBytes, nbytes);
+}
+/*
+ * Returns non-0 if queued input has reached the per-channel or process-wide
+ * high water mark. Unlike IocpChannelPostReads, does not track throttling.
+ */
+IOCP_INLINE int IocpChannelInputOverBudget(const IocpChannel *chanPtr) {
+    return (chanPtr->maxInputBytes != 0 &&
+            chanPtr->inputBytes >= chanPtr->maxInputBytes) ||
+        (iocpInputBudget.maxBytes != 0 &&
+         iocpInputBudget.queuedBytes >= iocpInputBudget.maxBytes);
+}
+/*
+ * Moves input handed off by completion threads to inputBuffers. Must only
+ * be called by the consumer of the channel's input, i.e. the owning thread
+ * or a thread holding the lock when the owner cannot be using the channel.
+ * Returns non-0 if inputBuffers is not empty.
+ */
+IOCP_INLINE int IocpChannelTakeInput(IocpChannel *chanPtr) {
+    IocpLink *linkPtr;
+    while ((linkPtr = IocpHandoffQueuePop(&chanPtr->handoffBuffers)) != NULL)
+        IocpListAppend(&chanPtr->inputBuffers, linkPtr);
+    return chanPtr->inputBuffers.headPtr != NULL;
+}
 IOCP_INLINE void IocpChannelLock(IocpChannel *chanPtr) {
     IocpLockAcquireExclusive(&chanPtr->lock);
 }
@@ -433,6 +699,12 @@ typedef struct IocpChannelVtbl {
      * Driver may take any action required and should return 0 on success
      * or a Windows error code. The IOCP channel base will transition
      * to an OPEN state or to a DISCONNECTED state accordingly.
+     * A driver that needs a handshake before data transfer may instead
+     * post the handshake I/O as IOCP_BUFFER_OP_CONNECT buffers, move the
+     * channel to HANDSHAKING and return ERROR_IO_PENDING. The handshake is
+     * then driven by connectcompleted() and the channel moves to OPEN or
+     * DISCONNECTED when that returns something other than ERROR_IO_PENDING.
+     * It may not block.
      */
     IocpWinError (*connected)(       /* May be NULL */
         IocpChannel *lockedChanPtr); /* Locked on entry. Must be locked on
@@ -446,14 +718,44 @@ typedef struct IocpChannelVtbl {
     IocpWinError (*connectfailed)( /* May be NULL */
         IocpChannel *lockedChanPtr);   /* Locked on entry. Must be locked on
                                         * return. */
+
+    /*
+     * connectcompleted() is called from the completion thread when a posted
+     * connect completes while the channel is in CONNECTING state, before
+     * the channel state is updated from the completion status. A driver
+     * that has several connect attempts in flight may consume the
+     * completion by returning ERROR_IO_PENDING in which case the channel
+     * state is left alone. Otherwise it should return 0.
+     *
+     * It is also called for completions in HANDSHAKING state (see
+     * connected()). It should then return ERROR_IO_PENDING while the
+     * handshake continues, 0 when it has succeeded or a Windows error code.
+     * Either way the buffer is freed by the caller.
+     */
+    IocpWinError (*connectcompleted)( /* May be NULL */
+        IocpChannel *lockedChanPtr, /* Locked on entry. Must be locked on
+                                     * return. */
+        IocpBuffer  *bufPtr);       /* Completed connect. Still references
+                                     * lockedChanPtr */
+    /*
+     * connecttimedout() is called from the timer wheel when the connect
+     * timeout expires in CONNECTING state, after the state has been
+     * changed to CONNECT_RETRY. It should abandon any connect attempts
+     * that are not posted on the channel socket, which is cancelled by
+     * the caller. Late completions of those attempts are ignored.
+     */
+    void (*connecttimedout)(    /* May be NULL */
+        IocpChannel *lockedChanPtr); /* Locked on entry. Must be locked on
+                                      * return. */
     /*
      * disconnected() is called from the completion thread when a
      * when a disconnection request is completed. It may take any
      * appropriate action such as closing sockets.
      */
     void (*disconnected)(       /* May be NULL */
-        IocpChannel *lockedChanPtr); /* Locked on entry. Must be locked on
-                                      * return. */
+        IocpChannel *lockedChanPtr, /* Locked on entry. Must be locked on
+                                     * return. */
+        IocpWinError winError);     /* Completion status of the request */
 
     /*
      * postread() is called to post an I/O call to read more data.
@@ -462,12 +764,45 @@ typedef struct IocpChannelVtbl {
     DWORD (*postread)( /* May be NULL if channel is created without TCL_READABLE */
         IocpChannel *lockedChanPtr); /* Locked on entry, locked on return */
 
+    /*
+     * readcompleted() is called from the completion thread when a posted
+     * read completes, after pendingReads has been decremented, and before
+     * the buffer is queued to inputBuffers. It may fill in the buffer (for
+     * example, when the read was a readiness probe) or mark it with
+     * IOCP_BUFFER_F_DISCARD in which case it is freed in its turn instead
+     * of being queued. If it reposts the buffer it should return
+     * ERROR_IO_PENDING and the buffer is left alone. Otherwise it should
+     * return 0.
+     */
+    IocpWinError (*readcompleted)( /* May be NULL */
+        IocpChannel *lockedChanPtr, /* Locked on entry, locked on return */
+        IocpBuffer  *bufPtr);       /* Completed read. Still references
+                                     * lockedChanPtr */
+
+    /*
+     * inputready() is called from the completion thread with each read
+     * buffer not marked for discarding, in the order the reads were
+     * posted, in place of queueing it to the channel. It may transform
+     * the data (for example, decrypting it), hold on to the buffer or
+     * free it. It should pass data on with IocpChannelQueueInput and
+     * return the number of buffers queued.
+     */
+    int (*inputready)(             /* May be NULL */
+        IocpChannel *lockedChanPtr, /* Locked on entry, locked on return */
+        IocpBuffer  *bufPtr);       /* Completed read. Does not reference
+                                     * lockedChanPtr */
+
     /*
      * postwrite() is called to write data to the device. If any data is written,
      * the function should return 0 and store the count of bytes written in
      * *countPtr. If no data can be written because the device would block,
      * the function should return 0 and store 0 in *countPtr. On error,
      * the function return a Windows error code. countPtr is ignored.
+     * The function may queue the data in outputBuffers instead of posting
+     * it immediately in which case flushoutput() must be implemented.
+     * Either way, outputBytes must be incremented by the count written.
+     * Posted write buffers link any further buffers sent in the same
+     * operation through context[0].ptr.
      */
     IocpWinError (*postwrite)( /* May be NULL if channel is created without TCL_WRITABLE */
         IocpChannel *lockedChanPtr, /* Locked on entry, locked on return */
@@ -475,6 +810,14 @@ typedef struct IocpChannelVtbl {
         int          nbytes,        /* Number of bytes to write */
         int         *countPtr);     /* Where to store number written */
 
+    /*
+     * flushoutput() is called from the completion thread when a write
+     * completes to post data queued in outputBuffers. Should return 0 on
+     * success and a Windows error code on error.
+     */
+    IocpWinError (*flushoutput)( /* May be NULL */
+        IocpChannel *lockedChanPtr); /* Locked on entry, locked on return */
+
     /*
      * gethandle() retrieves the operating system handle associated with the
      * channel. On success, the function should return TCL_OK and store the
@@ -538,12 +881,32 @@ enum IocpEventReason {
     IOCP_EVENT_THREAD_INSERTED  /* Channel inserted into a thread */
 };
 
-/* Used to notify the thread owning a channel through Tcl event loop */
-typedef struct IocpTclEvent {
-    Tcl_Event    event;         /* Must be first field */
-    IocpChannel *chanPtr;       /* Channel associated with this event */
-    enum IocpEventReason reason;  /* Currently mostly used for tracing/debugging */
-} IocpTclEvent;
+/*
+ * Tcl threads to be alerted at the end of a completion batch. The threads
+ * array has no duplicates.
+ */
+typedef struct IocpAlertBatch {
+    int          count;
+    Tcl_ThreadId threads[IOCP_COMPLETION_BATCH_SIZE];
+} IocpAlertBatch;
+
+/*
+ * Each Tcl thread that owns IOCP channels has a ready queue of channels
+ * that need attention from the thread. Completion threads append channels
+ * to it and alert the Tcl thread. The queue is drained by a Tcl event
+ * source in the owning thread. A channel is on the queue at most once as
+ * indicated by IOCP_CHAN_F_ON_EVENTQ and the queue holds a reference to the
+ * channel while it is on the queue.
+ *
+ * Lock order is channel lock first, then queue lock.
+ */
+typedef struct IocpReadyQueue {
+    IocpLock     lock;          /* Protects all fields below */
+    IocpList     channels;      /* Channels linked through readyLink */
+    Tcl_ThreadId threadId;      /* Owning thread. 0 after thread exit */
+    int          numRefs;       /* Owning thread + IocpChannel.readyQueuePtr */
+    int          drainQueued;   /* A drain event is on the Tcl event queue */
+} IocpReadyQueue;
 
 /*
  * Tcl channel function dispatch structure.
@@ -551,25 +914,142 @@ typedef struct IocpTclEvent {
 extern Tcl_ChannelType IocpChannelDispatch;
 
 /*
- * Statistics for sanity checking etc.
+ * Statistics for sanity checking etc. Only for values that are not plain
+ * event counts. Those belong in IocpCounters below.
  */
 typedef struct IocpStats {
-    volatile long IocpChannelAllocs;
-    volatile long IocpChannelFrees;
-    volatile long IocpBufferAllocs;
-    volatile long IocpBufferFrees;
-    volatile long IocpDataBufferAllocs;
-    volatile long IocpDataBufferFrees;
+    volatile LONG64 IocpCompletionBatchMax; /* Largest batch dequeued */
 } IocpStats;
 extern IocpStats iocpStats;
-/* Wrapper in case we switch to 64bit counters in the future */
-#define IOCP_STATS_GET(field_) Tcl_NewLongObj(iocpStats.field_)
+#define IOCP_STATS_GET(field_) Tcl_NewWideIntObj(iocpStats.field_)
 
-#ifdef IOCP_DEBUG
-#define IOCP_STATS_INCR(field_) InterlockedIncrement(&iocpStats.field_)
-#else
-#define IOCP_STATS_INCR(field_) (void) 0
-#endif
+/*
+ * Counters for events on the I/O paths. To keep completion threads from
+ * contending for the same cache lines, each processor updates its own slot
+ * of iocpCounters and the slots are summed when read. Updates still need
+ * to be interlocked since a thread may move to another processor between
+ * picking a slot and updating it, but are then almost never contended.
+ * IocpCounters must consist only of LONG64 fields as IocpCountersSum
+ * treats it as an array.
+ */
+#define IOCP_COUNTER_SLOTS 64      /* Power of 2 */
+#define IOCP_BATCH_SIZE_BUCKETS 7  /* Batch sizes 1, 2-3, 4-7 ... 64 */
+typedef struct IocpCounters {
+    volatile LONG64 IocpChannelAllocs;
+    volatile LONG64 IocpChannelFrees;
+    volatile LONG64 IocpBufferAllocs;
+    volatile LONG64 IocpBufferFrees;
+    volatile LONG64 IocpDataBufferAllocs;
+    volatile LONG64 IocpDataBufferFrees;
+    volatile LONG64 IocpCompletionBatches; /* GetQueuedCompletionStatusEx calls */
+    volatile LONG64 IocpCompletionPackets; /* Completions dequeued */
+    volatile LONG64 IocpCompletionBatchSizes[IOCP_BATCH_SIZE_BUCKETS];
+                                        /* Batches by log2 of size */
+    volatile LONG64 IocpInlineCompletions; /* Completed without the port */
+    volatile LONG64 IocpInlineDeferrals; /* Inline completions handed back
+                                          * to the port as too deeply nested */
+    volatile LONG64 IocpRioCompletions; /* Dequeued from RIO queue */
+    volatile LONG64 IocpReadSizeGrows;  /* Adaptive read buffer increases */
+    volatile LONG64 IocpReadSizeShrinks; /* Adaptive read buffer decreases */
+    volatile LONG64 IocpZeroByteProbes; /* Zero-byte reads posted */
+    volatile LONG64 IocpBytesRead;      /* Bytes received */
+    volatile LONG64 IocpBytesWritten;   /* Bytes sent */
+    volatile LONG64 IocpReadsPosted;    /* Reads posted to devices */
+    volatile LONG64 IocpReadOps;        /* Posted reads completed */
+    volatile LONG64 IocpWritesPosted;   /* Writes posted to devices */
+    volatile LONG64 IocpWriteOps;       /* Posted writes completed */
+    volatile LONG64 IocpAcceptsPosted;  /* Accepts posted on listeners */
+    volatile LONG64 IocpAcceptOps;      /* Posted accepts completed */
+    volatile LONG64 IocpEventsQueued;   /* Channels added to ready queues */
+    volatile LONG64 IocpEventsDequeued; /* Channels removed from ready queues */
+    volatile LONG64 IocpInputWouldBlock; /* Reads returning EAGAIN */
+    volatile LONG64 IocpOutputWouldBlock; /* Writes with no room for data */
+    volatile LONG64 IocpConnectRetries; /* Failed connect attempts */
+    volatile LONG64 IocpSpinWaits;      /* Blocking waits ended while spinning */
+    volatile LONG64 IocpSpinMisses;     /* Blocking waits that spun, then slept */
+    volatile LONG64 IocpSleepWaits;     /* Blocking waits that slept */
+    volatile LONG64 IocpLockFreeInputs; /* Channel reads served without
+                                         * taking the channel lock */
+    volatile LONG64 IocpUdpDatagramsReceived; /* Datagrams queued for input */
+    volatile LONG64 IocpUdpDatagramsSent; /* Datagrams posted for sending */
+    volatile LONG64 IocpIdleReadCancels; /* Idle connections whose posted
+                                          * reads were cancelled */
+    volatile LONG64 IocpSocketRecycleHits; /* Accepts using a recycled socket */
+    volatile LONG64 IocpSocketRecycleMisses; /* Accepts that found the
+                                              * recycle pool empty */
+    volatile LONG64 IocpSocketsRecycled; /* Sockets returned to a pool */
+    volatile LONG64 IocpAcceptsWithData; /* Accepts that received data */
+    volatile LONG64 IocpAcceptBacklogGrows; /* Accept target raised */
+    volatile LONG64 IocpAcceptBacklogShrinks; /* Accept target lowered */
+    volatile LONG64 IocpWorkerDispatches; /* Accepts handed to workers */
+    volatile LONG64 IocpDnsCacheHits;   /* Lookups satisfied from cache */
+    volatile LONG64 IocpDnsCacheMisses; /* Lookups not in cache */
+    volatile LONG64 IocpDnsAsyncLookups; /* Lookups queued to thread pool */
+    volatile LONG64 IocpDnsReverseLookups; /* Reverse lookups queued */
+    volatile LONG64 IocpConnectRaceAttempts; /* Connects started by races */
+    volatile LONG64 IocpConnectRaceFallbacks; /* Races not won by the first
+                                               * address tried */
+    volatile LONG64 IocpInputThrottles; /* Times reads were held back because
+                                         * of unconsumed input */
+    volatile LONG64 IocpUdpTruncatedDrops; /* Datagrams too large for the
+                                            * receive buffer */
+    volatile LONG64 IocpUdpOverflowDrops; /* Datagrams dropped because of
+                                           * unconsumed input */
+    volatile LONG64 IocpUdpErrorDrops;  /* Receives failed with an error
+                                         * scoped to a single datagram */
+    volatile LONG64 IocpUdpEmptyDrops;  /* Zero-length datagrams */
+    volatile LONG64 IocpReadTimeouts;   /* Reads failed by -readtimeout */
+    volatile LONG64 IocpConnectTimeouts; /* Connects failed by
+                                          * -connecttimeout */
+    volatile LONG64 IocpBtServiceCacheHits; /* Service lookups satisfied
+                                             * from cache */
+    volatile LONG64 IocpBtServiceCacheMisses; /* Service lookups not in cache */
+    volatile LONG64 IocpBtAsyncRequests; /* Bluetooth requests queued to
+                                          * thread pool */
+} IocpCounters;
+typedef union IocpCounterSlot {
+    IocpCounters counters;
+    char pad[(sizeof(IocpCounters) + 63) & ~63]; /* Cache line multiple */
+} IocpCounterSlot;
+extern IocpCounterSlot iocpCounters[IOCP_COUNTER_SLOTS];
+IOCP_INLINE IocpCounters *IocpCountersForCurrentCpu(void) {
+    return &iocpCounters[GetCurrentProcessorNumber() & (IOCP_COUNTER_SLOTS-1)].counters;
+}
+#define IOCP_COUNTER_INCR(field_) \
+    InterlockedIncrement64(&IocpCountersForCurrentCpu()->field_)
+#define IOCP_COUNTER_ADD(field_, n_) \
+    InterlockedExchangeAdd64(&IocpCountersForCurrentCpu()->field_, (n_))
+void IocpCountersSum(IocpCounters *sumPtr);
+
+/*
+ * Optional latency histograms. When enabled with iocp::configure
+ * -latencystats, buffers are timestamped when posted, when their
+ * completion is dequeued and when the data is consumed by the channel
+ * input. The intervals are recorded in log-linear histograms in
+ * microseconds. See tclWinIocpLatency.c. When disabled, the only cost is
+ * a test of iocpLatencyEnabled at posting and of the buffer timestamps.
+ */
+enum IocpLatencyInterval {
+    IOCP_LATENCY_READ_COMPLETION,  /* Read posted to completion dequeued */
+    IOCP_LATENCY_READ_DISPATCH,    /* Read dequeued to data consumed */
+    IOCP_LATENCY_READ_TOTAL,       /* Read posted to data consumed */
+    IOCP_LATENCY_WRITE_COMPLETION, /* Write posted to completion dequeued */
+    IOCP_LATENCY_INTERVALS         /* Must be last */
+};
+extern int iocpLatencyEnabled;
+IOCP_INLINE LONG64 IocpLatencyTimestamp(void) {
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+/* Stamps a buffer being posted. Stamp of 0 means not tracked. */
+#define IOCP_LATENCY_STAMP_POST(bufPtr_)                                  \
+    ((bufPtr_)->postedAt = iocpLatencyEnabled ? IocpLatencyTimestamp() : 0)
+void IocpLatencyRecord(enum IocpLatencyInterval interval,
+                       LONG64 fromTicks, LONG64 toTicks);
+void IocpLatencyEnable(int enable);
+void IocpLatencyReset(void);
+Tcl_Obj *IocpLatencyReport(void);
 
 #ifdef BUILD_iocp
 
@@ -596,13 +1076,6 @@ extern struct IocpTcl85IntPlatStubs *tclIntPlatStubsPtr;
  */
 IocpTclCode Iocp_DoOnce(Iocp_DoOnceState *stateP, Iocp_DoOnceProc *once_fn, ClientData clientdata);
 
-
-/* List utilities */
-void IocpListAppend(IocpList *listPtr, IocpLink *linkPtr);
-void IocpListPrepend(IocpList *listPtr, IocpLink *linkPtr);
-void IocpListRemove(IocpList *listPtr, IocpLink *linkPtr);
-IocpLink *IocpListPopFront(IocpList *listPtr);
-
 /* Error utilities */
 Tcl_Obj *Iocp_MapWindowsError(DWORD error, HANDLE moduleHandle, const char *msgPtr);
 IocpTclCode Iocp_ReportWindowsError(Tcl_Interp *interp, DWORD winerr, const char *msgPtr);
@@ -618,6 +1091,37 @@ void __cdecl IocpTrace(const char *formatStr, ...);
 # define IOCP_TRACE(params_) (void) 0;
 #endif
 
+/*
+ * ETW events for the buffer and channel lifecycle. Unlike IOCP_TRACE, these
+ * carry typed fields and involve no formatting so they can be enabled on
+ * production servers with any ETW consumer (xperf, WPR/WPA, tracelog).
+ * Events are filtered with the keywords below and all use verbose level.
+ */
+#define IOCP_ETW_KEYWORD_BUFFER  0x1 /* BufferAlloc, BufferPost ... */
+#define IOCP_ETW_KEYWORD_CHANNEL 0x2 /* ChannelState, ChannelEnqueue ... */
+#ifdef IOCP_ENABLE_ETW
+# define IOCP_ETW_BUFFER(name_, bufPtr_, chanPtr_, nbytes_, winError_) \
+    TraceLoggingWrite(iocpWinTraceProvider, name_,                    \
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                    \
+        TraceLoggingKeyword(IOCP_ETW_KEYWORD_BUFFER),                 \
+        TraceLoggingPointer((bufPtr_), "Buffer"),                     \
+        TraceLoggingPointer((chanPtr_), "Channel"),                   \
+        TraceLoggingInt32((bufPtr_)->operation, "Operation"),         \
+        TraceLoggingUInt32((nbytes_), "Bytes"),                       \
+        TraceLoggingUInt32((winError_), "WinError"))
+# define IOCP_ETW_CHANNEL(name_, chanPtr_, value_, valueName_)         \
+    TraceLoggingWrite(iocpWinTraceProvider, name_,                    \
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                    \
+        TraceLoggingKeyword(IOCP_ETW_KEYWORD_CHANNEL),                \
+        TraceLoggingPointer((chanPtr_), "Channel"),                   \
+        TraceLoggingHexInt32((chanPtr_)->state, "State"),             \
+        TraceLoggingHexInt32((value_), valueName_),                   \
+        TraceLoggingUInt32((chanPtr_)->winError, "WinError"))
+#else
+# define IOCP_ETW_BUFFER(name_, bufPtr_, chanPtr_, nbytes_, winError_) (void) 0
+# define IOCP_ETW_CHANNEL(name_, chanPtr_, value_, valueName_) (void) 0
+#endif
+
 /* Buffer utilities */
 int IocpDataBufferMoveOut(IocpDataBuffer *bufPtr, char *outPtr, int len);
 IOCP_INLINE void IocpDataBufferCopyIn(IocpDataBuffer *bufPtr, const char *inPtr, int len) {
@@ -625,6 +1129,11 @@ IOCP_INLINE void IocpDataBufferCopyIn(IocpDataBuffer *bufPtr, const char *inPtr,
     memcpy(bufPtr->bytes, inPtr, len);
     bufPtr->len = len;
 }
+IOCP_INLINE void IocpDataBufferAppend(IocpDataBuffer *bufPtr, const char *inPtr, int len) {
+    IOCP_ASSERT(bufPtr->capacity - bufPtr->begin - bufPtr->len >= len);
+    memcpy(bufPtr->bytes + bufPtr->begin + bufPtr->len, inPtr, len);
+    bufPtr->len += len;
+}
 IocpBuffer *IocpBufferNew(int capacity, enum IocpBufferOp, int);
 void IocpBufferFree(IocpBuffer *bufPtr);
 IOCP_INLINE int IocpBufferLength(const IocpBuffer *bufPtr) {
@@ -636,6 +1145,26 @@ IOCP_INLINE int IocpBufferMoveOut(IocpBuffer *bufPtr, char *outPtr, int len) {
 IOCP_INLINE void IocpBufferCopyIn(IocpBuffer *bufPtr, const char *inPtr, int len) {
     IocpDataBufferCopyIn(&bufPtr->data, inPtr, len);
 }
+IOCP_INLINE void IocpBufferAppend(IocpBuffer *bufPtr, const char *inPtr, int len) {
+    IocpDataBufferAppend(&bufPtr->data, inPtr, len);
+}
+
+/*
+ * Hands off a completed read buffer to the Tcl thread. The bytes are
+ * accounted before the push as the Tcl thread may consume them without
+ * locking the channel.
+ */
+IOCP_INLINE void IocpChannelQueueInput(IocpChannel *lockedChanPtr, IocpBuffer *bufPtr) {
+    IocpChannelAddInputBytes(lockedChanPtr, IocpBufferLength(bufPtr));
+    IocpHandoffQueuePush(&lockedChanPtr->handoffBuffers, &bufPtr->link);
+}
+
+/*
+ * Packets queued to the completion port with a non-0 completion key are not
+ * IocpBuffer completions. The key is then a pointer to the function to be
+ * called by the completion thread to handle the packet.
+ */
+typedef void IocpCompletionHandler(OVERLAPPED_ENTRY *entryPtr);
 
 /* IOCP wrappers */
 IOCP_INLINE HANDLE IocpAttachDefaultPort(HANDLE h) {
@@ -645,21 +1174,70 @@ IOCP_INLINE HANDLE IocpAttachDefaultPort(HANDLE h) {
                                   0);
 }
 
+/*
+ * Marks a handle attached to the port so that operations that complete
+ * synchronously do not queue a completion packet. Callers must then
+ * handle such completions inline. See IocpChannelCompleteInline.
+ */
+IOCP_INLINE IocpWinError IocpSkipCompletionPortOnSuccess(HANDLE h) {
+    if (SetFileCompletionNotificationModes(
+            h, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS | FILE_SKIP_SET_EVENT_ON_HANDLE))
+        return ERROR_SUCCESS;
+    return GetLastError();
+}
+
 /* Callback utilities */
 void IocpRegisterAcceptCallbackCleanup(Tcl_Interp *, IocpAcceptCallback *);
 void IocpUnregisterAcceptCallbackCleanup(Tcl_Interp *, IocpAcceptCallback *);
 void IocpUnregisterAcceptCallbackCleanupOnClose(ClientData callbackData);
 
+/* Worker thread pools for listeners */
+typedef struct IocpWorkerPool IocpWorkerPool;
+IocpWorkerPool *IocpWorkerPoolNew(Tcl_Interp *interp, int numThreads,
+                                  const char *initScript,
+                                  const char *acceptScript);
+void            IocpWorkerPoolRelease(IocpWorkerPool *poolPtr);
+IocpWinError    IocpWorkerPoolDispatch(IocpWorkerPool *poolPtr,
+                                       IocpChannel *chanPtr,
+                                       const char *namePrefix, int flags,
+                                       const char *host, int port);
+#define IOCP_WORKER_MAX_THREADS 256 /* Max -threads */
+
 /* Generic channel functions */
 Tcl_Channel  IocpCreateTclChannel(IocpChannel*, const char*, int);
 Tcl_Channel  IocpMakeTclChannel(Tcl_Interp *,IocpChannel* lockedChanPtr, const char*, int);
 IocpChannel *IocpChannelNew(const IocpChannelVtbl *vtblPtr);
 void         IocpChannelAwaitCompletion(IocpChannel *lockedChanPtr, int flags);
+IocpWinError IocpChannelAwaitHandshake(IocpChannel *lockedChanPtr);
 int          IocpChannelWakeAfterCompletion(IocpChannel *lockedChanPtr, int blockMask);
 void         IocpChannelEnqueueEvent(IocpChannel *lockedChanPtr, enum IocpEventReason,  int force);
 void         IocpChannelDrop(IocpChannel *lockedChanPtr);
+void         IocpChannelSetState(IocpChannel *lockedChanPtr, enum IocpState newState);
+void         IocpChannelGetStats(IocpChannel *lockedChanPtr, Tcl_DString *dsPtr);
 DWORD        IocpChannelPostReads(IocpChannel *lockedChanPtr);
+IocpWinError IocpChannelScheduleTimeouts(IocpChannel *lockedChanPtr);
 void         IocpChannelNudgeThread(IocpChannel *lockedChanPtr, int blockMask, int force);
+void         IocpChannelCompleteInline(IocpChannel *lockedChanPtr,
+                                       IocpBuffer *bufPtr, DWORD nbytes);
+void         IocpChannelTrackRead(IocpChannel *lockedChanPtr, IocpBuffer *bufPtr);
+int          IocpChannelCancelReads(IocpChannel *lockedChanPtr);
+void         IocpCompleteBuffer(IocpChannel *lockedChanPtr, IocpBuffer *bufPtr,
+                                DWORD nbytes, IocpWinError winError);
+
+/* Registered I/O buffer support */
+void IocpRioBufferDetach(IocpBuffer *bufPtr);
+void IocpRioFinalize(void);
+
+/* Shared TLS credentials. See tclWinIocpTls.c */
+void IocpTlsFinalize(void);
+
+void IocpDnsCacheSetTtl(DWORD ttl);
+DWORD IocpDnsCacheGetTtl(void);
+void IocpDnsCacheFinalize(void);
+#define IOCP_CONNECT_DELAY_DEFAULT 250   /* ms. RFC 8305 recommendation */
+#define IOCP_CONNECT_DELAY_MAX     10000 /* ms */
+void TcpSetConnectDelay(DWORD delay);
+DWORD TcpGetConnectDelay(void);
 
 IocpTclCode IocpSetChannelDefaults(Tcl_Channel channel);
 
@@ -693,6 +1271,9 @@ void AcceptCallbackProc(ClientData callbackData, Tcl_Channel chan,
 /* Module initializations */
 IocpTclCode Tcp_ModuleInitialize(Tcl_Interp *interp);
 IocpTclCode BT_ModuleInitialize(Tcl_Interp *interp);
+void        BT_ServiceCacheFinalize(void);
+IocpTclCode BT_SdrModuleInitialize(Tcl_Interp *interp);
+IocpTclCode Udp_ModuleInitialize(Tcl_Interp *interp);
 
 /*
  * Prototypes for IOCP exported functions.
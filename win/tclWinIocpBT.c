@@ -23,6 +23,118 @@ enum BT_COMMAND
     BT_STATUS_INCOMING,
 };
 
+/*
+ * Asynchronous discovery and the service record cache
+ *
+ * Device inquiries and SDP lookups can block for many seconds. The
+ * asynchronous commands run them on a system thread pool thread. Each
+ * device or service record found is queued as a Tcl event to the thread
+ * that issued the request and passed to a callback command prefix from
+ * there. The final event reports completion or an error and frees the
+ * request. Tcl objects are only created in the requesting thread so
+ * results are passed in their Win32 form. A callback returning a break
+ * or raising an error cancels delivery of further results.
+ *
+ * Service records retrieved from a device are kept in a process-wide
+ * cache keyed by device address and service class. It is disabled by
+ * default and enabled by setting a non-zero TTL through ServiceCacheTtl.
+ * Lookups always retrieve all record fields so one cached entry serves
+ * callers asking for any subset of them. Failed lookups are not cached.
+ */
+#define BT_SDP_CACHE_MAX_ENTRIES 64
+#define BT_LUP_RETURN_FIELDS                                          \
+    (LUP_RETURN_NAME | LUP_RETURN_TYPE | LUP_RETURN_COMMENT |         \
+     LUP_RETURN_ADDR | LUP_RETURN_BLOB)
+
+/* A Win32 independent copy of a WSAQUERYSET returned by a lookup. */
+typedef struct BtServiceRecord {
+    struct BtServiceRecord *nextPtr;
+    WCHAR         *instanceName;   /* NULL if not returned */
+    WCHAR         *comment;        /* NULL if not returned */
+    unsigned char *blob;           /* NULL if not returned */
+    DWORD          blobLen;
+    int            haveServiceClassId;
+    GUID           serviceClassId;
+    int            haveRemoteAddr;
+    SOCKADDR_BTH   remoteAddr;
+    int            protocol;       /* Only valid if haveRemoteAddr */
+} BtServiceRecord;
+
+/* Records from one lookup. Shared between the cache and requesters. */
+typedef struct BtServiceRecords {
+    volatile LONG    numRefs;
+    BtServiceRecord *firstPtr;
+    BtServiceRecord *lastPtr;
+} BtServiceRecords;
+
+typedef struct BtSdpCacheEntry {
+    IocpLink          link;           /* Links entries in btSdpCache */
+    BtServiceRecords *recordsPtr;     /* Counted reference */
+    ULONGLONG         expiry;         /* Tick count when entry expires */
+    BTH_ADDR          device;         /* Part of key */
+    GUID              serviceClassId; /* Part of key */
+} BtSdpCacheEntry;
+
+static struct {
+    IocpLock lock;              /* Protects all fields below */
+    IocpList entries;           /* BtSdpCacheEntry, most recent first */
+    int      numEntries;        /* Number of entries in list */
+    DWORD    ttl;               /* Time to live in ms. 0 => cache disabled */
+} btSdpCache;
+static Iocp_DoOnceState btSdpCacheInitFlag;
+
+typedef enum BtAsyncKind {
+    BT_ASYNC_INQUIRY,           /* Device search */
+    BT_ASYNC_LOOKUP             /* Service lookup */
+} BtAsyncKind;
+
+typedef struct BtAsyncRequest {
+    Tcl_ThreadId  threadId;     /* Thread that issued the request */
+    Tcl_Interp   *interp;       /* Preserved until the final event */
+    Tcl_Obj      *cmdObj;       /* Callback prefix. Requesting thread only */
+    volatile LONG cancelled;    /* No more results are wanted */
+    BtAsyncKind   kind;
+    union {
+        BLUETOOTH_DEVICE_SEARCH_PARAMS search;
+        struct {
+            BTH_ADDR device;
+            GUID     serviceClassId;
+            DWORD    flags;     /* LUP_RETURN_* fields to pass back */
+            int      useCache;  /* If 0, do not satisfy from cache */
+        } lookup;
+    } u;
+} BtAsyncRequest;
+
+typedef enum BtAsyncEventType {
+    BT_ASYNC_EV_DEVICE,         /* device holds a found device */
+    BT_ASYNC_EV_RECORD,         /* recordPtr is a found service record */
+    BT_ASYNC_EV_DONE            /* Final event. Frees the request */
+} BtAsyncEventType;
+
+typedef struct BtAsyncEvent {
+    Tcl_Event             event;      /* Must be first */
+    BtAsyncRequest       *reqPtr;
+    BtAsyncEventType      type;
+    IocpWinError          winError;   /* BT_ASYNC_EV_DONE. 0 on success */
+    BtServiceRecord      *recordPtr;  /* BT_ASYNC_EV_RECORD */
+    BtServiceRecords     *recordsPtr; /* BT_ASYNC_EV_DONE. Reference to
+                                       * release or NULL */
+    BLUETOOTH_DEVICE_INFO device;     /* BT_ASYNC_EV_DEVICE */
+} BtAsyncEvent;
+
+static void BtServiceRecordsRelease(BtServiceRecords *recordsPtr);
+static Tcl_Obj *ObjFromBtServiceRecord(const BtServiceRecord *recordPtr,
+                                       DWORD flags);
+static IocpWinError BtLookupServiceNextRecord(HANDLE lookupH, DWORD flags,
+                                              BtServiceRecord **recordPtrPtr);
+static IocpTclCode BtResolveRfcommPort(Tcl_Interp *interp,
+                                       const BLUETOOTH_ADDRESS *btAddrPtr,
+                                       Tcl_Obj *serviceObj, int *portPtr);
+static IocpWinError BtLookupServiceRecords(BTH_ADDR device,
+                                           const GUID *serviceClassIdPtr,
+                                           int useCache,
+                                           BtAsyncRequest *reqPtr,
+                                           BtServiceRecords **recordsPtrPtr);
 
 static Tcl_Obj *ObjFromSYSTEMTIME(const SYSTEMTIME *timeP);
 static Tcl_Obj *ObjFromBLUETOOTH_ADDRESS (const BLUETOOTH_ADDRESS *addrPtr);
@@ -217,13 +329,14 @@ BT_GetRadioInfoObjCmd (
 /*
  *------------------------------------------------------------------------
  *
- * BT_FindFirstDeviceObj --
+ * BtParseDeviceSearchOptions --
  *
- *    Initiates a search for a Bluetooth device matching specified options.
+ *    Parses the device search options shared by the synchronous and
+ *    asynchronous device search commands.
  *
  * Results:
- *    List of two elements consisting of the search handle and first device
- *    handle. These handles must be closed appropriately.
+ *    TCL_OK with *paramsPtr filled in, or TCL_ERROR with an error
+ *    message in interp.
  *
  * Side effects:
  *    None.
@@ -231,11 +344,11 @@ BT_GetRadioInfoObjCmd (
  *------------------------------------------------------------------------
  */
 static IocpTclCode
-BT_FindFirstDeviceObjCmd(
-    ClientData notUsed,    /* Not used. */
-    Tcl_Interp *interp,    /* Current interpreter. */
-    int objc,              /* Number of arguments. */
-    Tcl_Obj *CONST objv[]) /* Argument objects. */
+BtParseDeviceSearchOptions(
+    Tcl_Interp *interp,                      /* Current interpreter. */
+    int objc,                                /* Number of options. */
+    Tcl_Obj *CONST objv[],                   /* Option objects. */
+    BLUETOOTH_DEVICE_SEARCH_PARAMS *paramsPtr) /* Output search parameters */
 {
     static const char *const opts[] = {
         "-authenticated", "-remembered", "-unknown", "-connected", "-inquire",
@@ -244,26 +357,22 @@ BT_FindFirstDeviceObjCmd(
     enum Opts {
         AUTHENTICATED, REMEMBERED, UNKNOWN, CONNECTED, INQUIRE, TIMEOUT, RADIO
     };
-    int i, opt, timeout, tclResult;
-    BLUETOOTH_DEVICE_SEARCH_PARAMS params;
-    BLUETOOTH_DEVICE_INFO          info;
-    HBLUETOOTH_DEVICE_FIND         findHandle;
-    Tcl_Obj *objs[2];
+    int i, opt, timeout;
 
-    memset(&params, 0, sizeof(params));
-    params.dwSize = sizeof(params);
-    params.cTimeoutMultiplier = 8; /* Default if -inquire is specified, else ignored */
-    for (i = 1; i < objc; ++i) {
+    memset(paramsPtr, 0, sizeof(*paramsPtr));
+    paramsPtr->dwSize = sizeof(*paramsPtr);
+    paramsPtr->cTimeoutMultiplier = 8; /* Default if -inquire is specified, else ignored */
+    for (i = 0; i < objc; ++i) {
         if (Tcl_GetIndexFromObj(interp, objv[i], opts, "option",
                                 TCL_EXACT, &opt) != TCL_OK) {
             return TCL_ERROR;
         }
         switch ((enum Opts) opt) {
-        case AUTHENTICATED: params.fReturnAuthenticated = 1; break;
-        case REMEMBERED   : params.fReturnRemembered = 1; break;
-        case UNKNOWN      : params.fReturnUnknown = 1; break;
-        case CONNECTED    : params.fReturnConnected = 1; break;
-        case INQUIRE      : params.fIssueInquiry = 1; break;
+        case AUTHENTICATED: paramsPtr->fReturnAuthenticated = 1; break;
+        case REMEMBERED   : paramsPtr->fReturnRemembered = 1; break;
+        case UNKNOWN      : paramsPtr->fReturnUnknown = 1; break;
+        case CONNECTED    : paramsPtr->fReturnConnected = 1; break;
+        case INQUIRE      : paramsPtr->fIssueInquiry = 1; break;
         case TIMEOUT      :
             if (++i >= objc) {
                 Tcl_SetObjResult(interp,
@@ -274,11 +383,11 @@ BT_FindFirstDeviceObjCmd(
                 return TCL_ERROR;
             /* timeout is in milliseconds. The cTimeoutMultiplier is units of 1280ms */
             if (timeout <= 0)
-                params.cTimeoutMultiplier = 0;
+                paramsPtr->cTimeoutMultiplier = 0;
             else if (timeout >= (48*1280))
-                params.cTimeoutMultiplier = 48; /* Max permitted value */
+                paramsPtr->cTimeoutMultiplier = 48; /* Max permitted value */
             else
-                params.cTimeoutMultiplier = (timeout + 1279)/1280;
+                paramsPtr->cTimeoutMultiplier = (timeout + 1279)/1280;
             break;
         case RADIO:
             if (++i >= objc) {
@@ -286,7 +395,7 @@ BT_FindFirstDeviceObjCmd(
                                  STRING_LITERAL_OBJ("no argument given for -radio option"));
                 return TCL_ERROR;
             }
-            if (PointerObjVerify(interp, objv[i], &params.hRadio, "HRADIO") != TCL_OK)
+            if (PointerObjVerify(interp, objv[i], &paramsPtr->hRadio, "HRADIO") != TCL_OK)
                 return TCL_ERROR;
         }
     }
@@ -294,13 +403,47 @@ BT_FindFirstDeviceObjCmd(
     /*
      * If no filters specified, return all.
      */
-    if (! (params.fReturnAuthenticated || params.fReturnRemembered
-            || params.fReturnUnknown || params.fReturnConnected) ) {
-        params.fReturnAuthenticated = 1;
-        params.fReturnRemembered    = 1;
-        params.fReturnUnknown       = 1;
-        params.fReturnConnected     = 1;
+    if (! (paramsPtr->fReturnAuthenticated || paramsPtr->fReturnRemembered
+            || paramsPtr->fReturnUnknown || paramsPtr->fReturnConnected) ) {
+        paramsPtr->fReturnAuthenticated = 1;
+        paramsPtr->fReturnRemembered    = 1;
+        paramsPtr->fReturnUnknown       = 1;
+        paramsPtr->fReturnConnected     = 1;
     }
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_FindFirstDeviceObj --
+ *
+ *    Initiates a search for a Bluetooth device matching specified options.
+ *
+ * Results:
+ *    List of two elements consisting of the search handle and first device
+ *    handle. These handles must be closed appropriately.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_FindFirstDeviceObjCmd(
+    ClientData notUsed,    /* Not used. */
+    Tcl_Interp *interp,    /* Current interpreter. */
+    int objc,              /* Number of arguments. */
+    Tcl_Obj *CONST objv[]) /* Argument objects. */
+{
+    int tclResult;
+    BLUETOOTH_DEVICE_SEARCH_PARAMS params;
+    BLUETOOTH_DEVICE_INFO          info;
+    HBLUETOOTH_DEVICE_FIND         findHandle;
+    Tcl_Obj *objs[2];
+
+    if (BtParseDeviceSearchOptions(interp, objc-1, objv+1, &params) != TCL_OK)
+        return TCL_ERROR;
 
     info.dwSize = sizeof(info);
     findHandle = BluetoothFindFirstDevice(&params, &info);
@@ -925,9 +1068,14 @@ static IocpChannelVtbl btClientVtbl =  {
     BtClientBlockingConnect,
     WinsockClientAsyncConnected,
     WinsockClientAsyncConnectFailed,
+    NULL,                       /* ConnectCompleted */
+    NULL,                       /* ConnectTimedOut */
     WinsockClientDisconnected,
     WinsockClientPostRead,
+    WinsockClientReadCompleted,
+    NULL,                       /* InputReady */
     WinsockClientPostWrite,
+    WinsockClientFlushOutput,
     WinsockClientGetHandle,
     WinsockClientGetOption,
     WinsockClientSetOption,
@@ -980,7 +1128,7 @@ BtClientBlockingConnect(
             SetHandleInformation((HANDLE)so, HANDLE_FLAG_INHERIT, 0);
 
             if (IocpAttachDefaultPort((HANDLE)so) != NULL) {
-                btPtr->base.state = IOCP_STATE_OPEN;
+                IocpChannelSetState(&btPtr->base, IOCP_STATE_OPEN);
                 btPtr->so         = so;
                 /*
                  * Clear any error stored during -async operation prior to
@@ -999,7 +1147,7 @@ BtClientBlockingConnect(
     if (so != INVALID_SOCKET)
         closesocket(so);
 
-    btPtr->base.state    = IOCP_STATE_CONNECT_FAILED;
+    IocpChannelSetState(&btPtr->base, IOCP_STATE_CONNECT_FAILED);
     btPtr->base.winError = winError;
     return winError;
 }
@@ -1073,6 +1221,7 @@ BtClientPostConnect(
     bufPtr->chanPtr    = WinsockClientToIocpChannel(btPtr);
     btPtr->base.numRefs += 1; /* Reversed when buffer is unlinked from channel */
 
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, bufPtr->chanPtr, 0, 0);
     if (fnConnectEx(btPtr->so, btPtr->addresses.inet.remote->ai_addr,
                     (int) btPtr->addresses.inet.remote->ai_addrlen,
                     NULL, 0, &nbytes, &bufPtr->u.wsaOverlap) == FALSE) {
@@ -1121,7 +1270,7 @@ BtClientInitiateConnection(
     IOCP_ASSERT(btPtr->base.state == IOCP_STATE_INIT || btPtr->base.state == IOCP_STATE_CONNECT_RETRY);
     IOCP_ASSERT(btPtr->so == INVALID_SOCKET);
 
-    btPtr->base.state = IOCP_STATE_CONNECTING;
+    IocpChannelSetState(&btPtr->base, IOCP_STATE_CONNECTING);
 
     so = socket(AF_BTH, SOCK_STREAM, BTHPROTO_RFCOMM);
     if (so != INVALID_SOCKET) {
@@ -1143,7 +1292,7 @@ BtClientInitiateConnection(
     /*
      * Failed. We report the stored error in preference to error in current call.
      */
-    btPtr->base.state = IOCP_STATE_CONNECT_FAILED;
+    IocpChannelSetState(&btPtr->base, IOCP_STATE_CONNECT_FAILED);
     if (btPtr->base.winError == 0)
         btPtr->base.winError = winError;
     return btPtr->base.winError;
@@ -1290,7 +1439,7 @@ BT_SocketObjCmd(ClientData  notUsed,   /* Not used. */
     enum socketOptions { SKT_ASYNC, SKT_SERVER, SKT_AUTHENTICATE };
     int               optionIndex, a, server = 0, async = 0, authenticate = 0;
     const char *      script = NULL;
-    int               port;
+    int               port, resolvePort = 0;
     Tcl_Channel       chan = NULL;
 
 #ifdef TBD
@@ -1365,9 +1514,15 @@ BT_SocketObjCmd(ClientData  notUsed,   /* Not used. */
         return TCL_ERROR;
     }
 
-    /* Last arg is always port for both */
-    if (Tcl_GetIntFromObj(interp, objv[objc-1], &port) != TCL_OK)
-        return TCL_ERROR;
+    /*
+     * Last arg is always port for both. Clients may instead give a service
+     * class UUID which is resolved after the device address is parsed.
+     */
+    if (Tcl_GetIntFromObj(NULL, objv[objc-1], &port) != TCL_OK) {
+        if (server)
+            return Tcl_GetIntFromObj(interp, objv[objc-1], &port);
+        resolvePort = 1;
+    }
 
     if (server) {
         char *              copyScript;
@@ -1415,6 +1570,10 @@ BT_SocketObjCmd(ClientData  notUsed,   /* Not used. */
         if (ObjToBLUETOOTH_ADDRESS(interp, objv[a], &btAddress) != TCL_OK) {
             return TCL_ERROR;
         }
+        if (resolvePort &&
+            BtResolveRfcommPort(interp, &btAddress, objv[objc-1], &port) != TCL_OK) {
+            return TCL_ERROR;
+        }
 
         chan = Iocp_OpenBTClient(interp, port, &btAddress, async);
         if (chan == NULL) {
@@ -1550,12 +1709,11 @@ BT_LookupServiceNextObjCmd (
     int objc,              /* Number of arguments. */
     Tcl_Obj *const objv[]) /* Argument objects. */
 {
-    HANDLE        lookupH;
-    WSAQUERYSETW *qsP;
-    DWORD         qsLen;
-    IocpWinError  winError;
-    IocpTclCode   tclResult;
-    DWORD         flags;
+    HANDLE           lookupH;
+    BtServiceRecord *recordPtr;
+    IocpWinError     winError;
+    IocpTclCode      tclResult;
+    DWORD            flags;
 
     if (objc != 3) {
         Tcl_WrongNumArgs(interp, 1, objv, "HWSALOOKUPSERVICE FLAGS");
@@ -1568,6 +1726,166 @@ BT_LookupServiceNextObjCmd (
     if (Tcl_GetIntFromObj(interp, objv[2], (int *)&flags) != TCL_OK)
         return TCL_ERROR;
 
+    winError = BtLookupServiceNextRecord(lookupH, flags, &recordPtr);
+    if (winError == 0) {
+        Tcl_SetObjResult(interp, ObjFromBtServiceRecord(recordPtr, flags));
+        ckfree(recordPtr);
+        tclResult = TCL_OK;
+    } else if (winError == WSA_E_NO_MORE) {
+        /* Not an error, but no more values */
+        tclResult = TCL_BREAK;
+    }
+    else {
+         tclResult = Iocp_ReportWindowsError(
+            interp,
+            winError,
+            "Could not retrieve Bluetooth service information: ");
+    }
+    return tclResult;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtServiceRecordNew --
+ *
+ *    Copies the fields of a WSAQUERYSETW returned by a service lookup
+ *    into a single allocation that does not reference the query buffer.
+ *
+ * Results:
+ *    Pointer to the record which must be freed with ckfree.
+ *
+ * Side effects:
+ *    Memory is allocated.
+ *
+ *------------------------------------------------------------------------
+ */
+static BtServiceRecord *
+BtServiceRecordNew(const WSAQUERYSETW *qsP)
+{
+    BtServiceRecord *recordPtr;
+    IocpSizeT        nameSize = 0, commentSize = 0, blobSize = 0;
+    char            *p;
+
+    if (qsP->lpszServiceInstanceName)
+        nameSize = (wcslen(qsP->lpszServiceInstanceName) + 1) * sizeof(WCHAR);
+    if (qsP->lpszComment)
+        commentSize = (wcslen(qsP->lpszComment) + 1) * sizeof(WCHAR);
+    if (qsP->lpBlob)
+        blobSize = qsP->lpBlob->cbSize;
+
+    recordPtr = ckalloc(sizeof(*recordPtr) + nameSize + commentSize + blobSize);
+    memset(recordPtr, 0, sizeof(*recordPtr));
+    p = (char *)(recordPtr + 1);
+    if (qsP->lpszServiceInstanceName) {
+        recordPtr->instanceName = (WCHAR *)p;
+        memcpy(p, qsP->lpszServiceInstanceName, nameSize);
+        p += nameSize;
+    }
+    if (qsP->lpszComment) {
+        recordPtr->comment = (WCHAR *)p;
+        memcpy(p, qsP->lpszComment, commentSize);
+        p += commentSize;
+    }
+    if (qsP->lpBlob) {
+        recordPtr->blob    = (unsigned char *)p;
+        recordPtr->blobLen = qsP->lpBlob->cbSize;
+        if (blobSize)
+            memcpy(p, qsP->lpBlob->pBlobData, blobSize);
+    }
+    if (qsP->lpServiceClassId) {
+        recordPtr->haveServiceClassId = 1;
+        recordPtr->serviceClassId     = *qsP->lpServiceClassId;
+    }
+    if (qsP->lpcsaBuffer && qsP->lpcsaBuffer->RemoteAddr.lpSockaddr) {
+        recordPtr->haveRemoteAddr = 1;
+        recordPtr->remoteAddr =
+            *(SOCKADDR_BTH *)qsP->lpcsaBuffer->RemoteAddr.lpSockaddr;
+        recordPtr->protocol = qsP->lpcsaBuffer->iProtocol;
+    }
+    return recordPtr;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * ObjFromBtServiceRecord --
+ *
+ *    Returns a dictionary containing the fields of a service record that
+ *    were requested through the LUP_RETURN_* bits in flags.
+ *
+ * Results:
+ *    Pointer to a Tcl_Obj with reference count 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+ObjFromBtServiceRecord(const BtServiceRecord *recordPtr, DWORD flags)
+{
+    Tcl_Obj *objs[12];
+    int i = 0;
+
+    if (flags & LUP_RETURN_NAME && recordPtr->instanceName) {
+        objs[i++] = STRING_LITERAL_OBJ("ServiceInstanceName");
+        objs[i++] = Tcl_NewUnicodeObj(recordPtr->instanceName, -1);
+    }
+
+    if (flags & LUP_RETURN_ADDR && recordPtr->haveRemoteAddr) {
+        objs[i++] = STRING_LITERAL_OBJ("RemoteAddress");
+        objs[i++] = ObjFromSOCKADDR_BTH(&recordPtr->remoteAddr);
+        objs[i++] = STRING_LITERAL_OBJ("Protocol");
+        objs[i++] = Tcl_NewIntObj(recordPtr->protocol);
+    }
+
+    if (flags & LUP_RETURN_COMMENT && recordPtr->comment) {
+        objs[i++] = STRING_LITERAL_OBJ("Comment");
+        objs[i++] = Tcl_NewUnicodeObj(recordPtr->comment, -1);
+    }
+
+    if (flags & LUP_RETURN_TYPE && recordPtr->haveServiceClassId) {
+        objs[i++] = STRING_LITERAL_OBJ("ServiceClassId");
+        objs[i++] = Tclh_WrapUuid(&recordPtr->serviceClassId);
+    }
+
+    if (flags & LUP_RETURN_BLOB && recordPtr->blob) {
+        objs[i++] = STRING_LITERAL_OBJ("Blob");
+        objs[i++] = Tcl_NewByteArrayObj(recordPtr->blob, recordPtr->blobLen);
+    }
+
+    IOCP_ASSERT(i <= (sizeof(objs)/sizeof(objs[0])));
+    return Tcl_NewListObj(i, objs);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtLookupServiceNextRecord --
+ *
+ *    Retrieves the next record from a service lookup handle.
+ *
+ * Results:
+ *    0 on success with *recordPtrPtr set to a record to be freed with
+ *    ckfree. WSA_E_NO_MORE if there are no more records, else a Winsock
+ *    error code.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+BtLookupServiceNextRecord(
+    HANDLE            lookupH,      /* As returned by WSALookupServiceBegin */
+    DWORD             flags,        /* LUP_RETURN_* flags */
+    BtServiceRecord **recordPtrPtr) /* Output record */
+{
+    WSAQUERYSETW *qsP;
+    DWORD         qsLen;
+    IocpWinError  winError;
+
     /*
      * WSAQUERYSET is variable size. We will keep looping until
      * it is big enough.
@@ -1590,87 +1908,922 @@ BT_LookupServiceNextObjCmd (
         qsP->dwSize      = sizeof(*qsP);
         qsP->dwNameSpace = NS_BTH;
     }
-    if (winError == 0) {
-        Tcl_Obj *objs[12];
-        int i = 0;
+    if (winError == 0)
+        *recordPtrPtr = BtServiceRecordNew(qsP);
+    ckfree(qsP);
+    return winError;
+}
 
-        if (flags & LUP_RETURN_NAME && qsP->lpszServiceInstanceName) {
-            objs[i++] = STRING_LITERAL_OBJ("ServiceInstanceName");
-            objs[i++] = Tcl_NewUnicodeObj(qsP->lpszServiceInstanceName, -1);
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtServiceRecordsRelease --
+ *
+ *    Releases a reference to a list of service records, freeing it when
+ *    the last reference goes away.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The records may be freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BtServiceRecordsRelease(BtServiceRecords *recordsPtr)
+{
+    if (InterlockedDecrement(&recordsPtr->numRefs) == 0) {
+        BtServiceRecord *recordPtr = recordsPtr->firstPtr;
+        while (recordPtr) {
+            BtServiceRecord *nextPtr = recordPtr->nextPtr;
+            ckfree(recordPtr);
+            recordPtr = nextPtr;
         }
+        ckfree(recordsPtr);
+    }
+}
 
-        if (flags & LUP_RETURN_ADDR && qsP->lpcsaBuffer) {
-            SOCKADDR_BTH *soAddr;
-            objs[i++] = STRING_LITERAL_OBJ("RemoteAddress");
-            soAddr  = (SOCKADDR_BTH *)qsP->lpcsaBuffer->RemoteAddr.lpSockaddr;
-            objs[i++] = ObjFromSOCKADDR_BTH(soAddr);
-            objs[i++] = STRING_LITERAL_OBJ("Protocol");
-            objs[i++] = Tcl_NewIntObj(qsP->lpcsaBuffer->iProtocol);
-        }
+static IocpTclCode BtSdpCacheInit(ClientData notUsed)
+{
+    IocpLockInit(&btSdpCache.lock);
+    IocpListInit(&btSdpCache.entries);
+    btSdpCache.numEntries = 0;
+    btSdpCache.ttl        = 0;
+    return TCL_OK;
+}
 
-        if (flags & LUP_RETURN_COMMENT && qsP->lpszComment) {
-            objs[i++] = STRING_LITERAL_OBJ("Comment");
-            objs[i++] = Tcl_NewUnicodeObj(qsP->lpszComment, -1);
-        }
+/* Removes and frees a cache entry. Caller must hold btSdpCache.lock */
+static void BtSdpCacheRemoveEntry(BtSdpCacheEntry *entryPtr)
+{
+    IocpListRemove(&btSdpCache.entries, &entryPtr->link);
+    btSdpCache.numEntries -= 1;
+    BtServiceRecordsRelease(entryPtr->recordsPtr);
+    ckfree(entryPtr);
+}
 
-        if (flags & LUP_RETURN_TYPE && qsP->lpServiceClassId) {
-            objs[i++] = STRING_LITERAL_OBJ("ServiceClassId");
-            objs[i++] = Tclh_WrapUuid(qsP->lpServiceClassId);
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtSdpCacheLookup --
+ *
+ *    Looks up the cache for the service records of a service class on
+ *    a device. Expired entries encountered are removed.
+ *
+ * Results:
+ *    A counted reference to the records or NULL if not in the cache.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static BtServiceRecords *
+BtSdpCacheLookup(BTH_ADDR device, const GUID *serviceClassIdPtr)
+{
+    BtServiceRecords *recordsPtr = NULL;
+    IocpLink         *linkPtr, *nextPtr;
+    ULONGLONG         now;
+
+    Iocp_DoOnce(&btSdpCacheInitFlag, BtSdpCacheInit, NULL);
+    IocpLockAcquireExclusive(&btSdpCache.lock);
+    if (btSdpCache.ttl != 0) {
+        now = GetTickCount64();
+        for (linkPtr = btSdpCache.entries.headPtr; linkPtr; linkPtr = nextPtr) {
+            BtSdpCacheEntry *entryPtr =
+                CONTAINING_RECORD(linkPtr, BtSdpCacheEntry, link);
+            nextPtr = linkPtr->nextPtr;
+            if (entryPtr->expiry <= now) {
+                BtSdpCacheRemoveEntry(entryPtr);
+                continue;
+            }
+            if (entryPtr->device == device &&
+                IsEqualGUID(&entryPtr->serviceClassId, serviceClassIdPtr)) {
+                recordsPtr = entryPtr->recordsPtr;
+                InterlockedIncrement(&recordsPtr->numRefs);
+                break;
+            }
         }
+    }
+    IocpLockReleaseExclusive(&btSdpCache.lock);
 
-        if (flags & LUP_RETURN_BLOB && qsP->lpBlob) {
-            objs[i++] = STRING_LITERAL_OBJ("Blob");
-            objs[i++]
-                = Tcl_NewByteArrayObj(qsP->lpBlob->pBlobData, qsP->lpBlob->cbSize);
-        }
+    if (recordsPtr)
+        IOCP_COUNTER_INCR(IocpBtServiceCacheHits);
+    else
+        IOCP_COUNTER_INCR(IocpBtServiceCacheMisses);
+    return recordsPtr;
+}
 
-        IOCP_ASSERT(i <= (sizeof(objs)/sizeof(objs[0])));
-        Tcl_SetObjResult(interp, Tcl_NewListObj(i, objs));
-        tclResult = TCL_OK;
-    } else if (winError == WSA_E_NO_MORE) {
-        /* Not an error, but no more values */
-        tclResult = TCL_BREAK;
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtSdpCacheAdd --
+ *
+ *    Adds the service records of a service class on a device to the
+ *    cache if it is enabled, replacing any existing entry for the same
+ *    key. If the cache is full the oldest entry is evicted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The cache takes its own reference to the records.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BtSdpCacheAdd(
+    BTH_ADDR          device,
+    const GUID       *serviceClassIdPtr,
+    BtServiceRecords *recordsPtr)
+{
+    BtSdpCacheEntry *entryPtr;
+    IocpLink        *linkPtr;
+
+    Iocp_DoOnce(&btSdpCacheInitFlag, BtSdpCacheInit, NULL);
+    IocpLockAcquireExclusive(&btSdpCache.lock);
+    if (btSdpCache.ttl != 0) {
+        for (linkPtr = btSdpCache.entries.headPtr; linkPtr; linkPtr = linkPtr->nextPtr) {
+            entryPtr = CONTAINING_RECORD(linkPtr, BtSdpCacheEntry, link);
+            if (entryPtr->device == device &&
+                IsEqualGUID(&entryPtr->serviceClassId, serviceClassIdPtr)) {
+                BtSdpCacheRemoveEntry(entryPtr);
+                break;
+            }
+        }
+        if (btSdpCache.numEntries >= BT_SDP_CACHE_MAX_ENTRIES) {
+            BtSdpCacheRemoveEntry(CONTAINING_RECORD(
+                btSdpCache.entries.tailPtr, BtSdpCacheEntry, link));
+        }
+        entryPtr = ckalloc(sizeof(*entryPtr));
+        IocpLinkInit(&entryPtr->link);
+        InterlockedIncrement(&recordsPtr->numRefs);
+        entryPtr->recordsPtr     = recordsPtr;
+        entryPtr->expiry         = GetTickCount64() + btSdpCache.ttl;
+        entryPtr->device         = device;
+        entryPtr->serviceClassId = *serviceClassIdPtr;
+        IocpListPrepend(&btSdpCache.entries, &entryPtr->link);
+        btSdpCache.numEntries += 1;
     }
-    else {
-         tclResult = Iocp_ReportWindowsError(
-            interp,
-            winError,
-            "Could not retrieve Bluetooth service information: ");
+    IocpLockReleaseExclusive(&btSdpCache.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtSdpCacheSetTtl --
+ *
+ *    Sets the time to live for cache entries. Setting it to 0 disables
+ *    the cache and flushes all entries. Otherwise the new TTL applies to
+ *    entries added from then on.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The cache may be flushed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BtSdpCacheSetTtl(DWORD ttl)
+{
+    Iocp_DoOnce(&btSdpCacheInitFlag, BtSdpCacheInit, NULL);
+    IocpLockAcquireExclusive(&btSdpCache.lock);
+    btSdpCache.ttl = ttl;
+    if (ttl == 0) {
+        while (btSdpCache.entries.headPtr) {
+            BtSdpCacheRemoveEntry(CONTAINING_RECORD(
+                btSdpCache.entries.headPtr, BtSdpCacheEntry, link));
+        }
     }
-    ckfree(qsP);
-    return tclResult;
+    IocpLockReleaseExclusive(&btSdpCache.lock);
 }
 
 /*
  *------------------------------------------------------------------------
  *
- * BT_ModuleInitialize --
+ * BT_ServiceCacheFinalize --
  *
- *    Initializes the Bluetooth module.
+ *    Flushes the service record cache at process exit.
  *
  * Results:
- *    TCL_OK on success, TCL_ERROR on failure.
+ *    None.
  *
  * Side effects:
- *    Creates the Bluetooth related Tcl commands.
+ *    All cache entries are freed.
  *
  *------------------------------------------------------------------------
  */
-IocpTclCode
-BT_ModuleInitialize(Tcl_Interp *interp)
+void
+BT_ServiceCacheFinalize(void)
 {
+    BtSdpCacheSetTtl(0);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtAsyncEventNew --
+ * BtAsyncPost --
+ *
+ *    Allocate and queue events to the thread that issued an asynchronous
+ *    request. BtAsyncPost must be the last access to the request from
+ *    the posting thread when posting the BT_ASYNC_EV_DONE event.
+ *
+ * Results:
+ *    BtAsyncEventNew returns the new event.
+ *
+ * Side effects:
+ *    The requesting thread is alerted.
+ *
+ *------------------------------------------------------------------------
+ */
+static BtAsyncEvent *
+BtAsyncEventNew(BtAsyncEventType type)
+{
+    BtAsyncEvent *evPtr = ckalloc(sizeof(*evPtr));
+    memset(evPtr, 0, sizeof(*evPtr));
+    evPtr->type = type;
+    return evPtr;
+}
+
+static int BtAsyncEventProc(Tcl_Event *tclEvPtr, int flags);
+
+static void
+BtAsyncPost(BtAsyncRequest *reqPtr, BtAsyncEvent *evPtr)
+{
+    Tcl_ThreadId threadId = reqPtr->threadId;
+
+    evPtr->event.proc = BtAsyncEventProc;
+    evPtr->reqPtr     = reqPtr;
+    Tcl_ThreadQueueEvent(threadId, &evPtr->event, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(threadId);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtLookupServiceRecords --
+ *
+ *    Retrieves the service records of a service class on a device, from
+ *    the cache if permitted and present, else from the device. Records
+ *    retrieved from the device are added to the cache on success. If
+ *    reqPtr is not NULL, each record is also posted to the requester as
+ *    it is retrieved.
+ *
+ * Results:
+ *    0 on success, else a Winsock error code. In either case
+ *    *recordsPtrPtr is set to a counted reference to the records
+ *    retrieved, possibly partial on error, or NULL if no list was
+ *    allocated. Posted record events point into this list so it must not
+ *    be released until they have been processed.
+ *
+ * Side effects:
+ *    The device may be queried.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+BtLookupServiceRecords(
+    BTH_ADDR           device,            /* Remote device */
+    const GUID        *serviceClassIdPtr, /* Service class of interest */
+    int                useCache,          /* If 0, bypass the cache */
+    BtAsyncRequest    *reqPtr,            /* Requester. May be NULL */
+    BtServiceRecords **recordsPtrPtr)     /* Output records */
+{
+    BtServiceRecords *recordsPtr;
+    BtServiceRecord  *recordPtr;
+    BLUETOOTH_ADDRESS btAddr;
+    WSAQUERYSETW      qs;
+    HANDLE            lookupH;
+    IocpWinError      winError;
+    char              context[18];
+    WCHAR             wcontext[18];
+    int               i;
+
+    *recordsPtrPtr = NULL;
+    if (useCache) {
+        recordsPtr = BtSdpCacheLookup(device, serviceClassIdPtr);
+        if (recordsPtr) {
+            *recordsPtrPtr = recordsPtr;
+            if (reqPtr) {
+                for (recordPtr = recordsPtr->firstPtr;
+                     recordPtr && !reqPtr->cancelled;
+                     recordPtr = recordPtr->nextPtr) {
+                    BtAsyncEvent *evPtr = BtAsyncEventNew(BT_ASYNC_EV_RECORD);
+                    evPtr->recordPtr = recordPtr;
+                    BtAsyncPost(reqPtr, evPtr);
+                }
+            }
+            return 0;
+        }
+    }
+
+    /* The context is the device address which is pure ASCII */
+    btAddr.ullLong = device;
+    StringFromBLUETOOTH_ADDRESS(&btAddr, context, sizeof(context));
+    for (i = 0; i < (int) sizeof(context); ++i)
+        wcontext[i] = context[i];
+
+    /*
+     * Only these fields need to be set for Bluetooth. See
+     * BT_LookupServiceBeginObjCmd. A miss always goes to the device.
+     */
+    ZeroMemory(&qs, sizeof(qs));
+    qs.dwSize           = sizeof(qs);
+    qs.lpServiceClassId = (GUID *)serviceClassIdPtr;
+    qs.dwNameSpace      = NS_BTH;
+    qs.lpszContext      = wcontext;
+    if (WSALookupServiceBeginW(&qs, LUP_FLUSHCACHE, &lookupH) != 0)
+        return WSAGetLastError();
+
+    recordsPtr = ckalloc(sizeof(*recordsPtr));
+    recordsPtr->numRefs  = 1;
+    recordsPtr->firstPtr = NULL;
+    recordsPtr->lastPtr  = NULL;
+    *recordsPtrPtr       = recordsPtr;
+    while (1) {
+        if (reqPtr && reqPtr->cancelled) {
+            winError = ERROR_CANCELLED;
+            break;
+        }
+        winError = BtLookupServiceNextRecord(lookupH, BT_LUP_RETURN_FIELDS,
+                                             &recordPtr);
+        if (winError != 0)
+            break;
+        recordPtr->nextPtr = NULL;
+        if (recordsPtr->lastPtr)
+            recordsPtr->lastPtr->nextPtr = recordPtr;
+        else
+            recordsPtr->firstPtr = recordPtr;
+        recordsPtr->lastPtr = recordPtr;
+        if (reqPtr) {
+            BtAsyncEvent *evPtr = BtAsyncEventNew(BT_ASYNC_EV_RECORD);
+            evPtr->recordPtr = recordPtr;
+            BtAsyncPost(reqPtr, evPtr);
+        }
+    }
+    WSALookupServiceEnd(lookupH);
+
+    if (winError != WSA_E_NO_MORE)
+        return winError;
+    BtSdpCacheAdd(device, serviceClassIdPtr, recordsPtr);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtFindDevices --
+ *
+ *    Runs a device search for an asynchronous request, posting each
+ *    device found to the requester.
+ *
+ * Results:
+ *    0 on success, else a Windows error code.
+ *
+ * Side effects:
+ *    A device inquiry may be issued.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+BtFindDevices(BtAsyncRequest *reqPtr)
+{
+    BLUETOOTH_DEVICE_INFO  info;
+    HBLUETOOTH_DEVICE_FIND findHandle;
+    IocpWinError           winError;
+
+    info.dwSize = sizeof(info);
+    findHandle = BluetoothFindFirstDevice(&reqPtr->u.search, &info);
+    if (findHandle == NULL) {
+        winError = GetLastError();
+        return winError == ERROR_NO_MORE_ITEMS ? 0 : winError;
+    }
+    while (1) {
+        BtAsyncEvent *evPtr;
+        if (reqPtr->cancelled) {
+            winError = 0;
+            break;
+        }
+        evPtr         = BtAsyncEventNew(BT_ASYNC_EV_DEVICE);
+        evPtr->device = info;
+        BtAsyncPost(reqPtr, evPtr);
+        info.dwSize = sizeof(info);
+        if (BluetoothFindNextDevice(findHandle, &info) != TRUE) {
+            winError = GetLastError();
+            if (winError == ERROR_NO_MORE_ITEMS)
+                winError = 0;
+            break;
+        }
+    }
+    BluetoothFindDeviceClose(findHandle);
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtAsyncWorker --
+ *
+ *    Thread pool function that runs an asynchronous request and then
+ *    posts the completion event.
+ *
+ * Results:
+ *    Always 0.
+ *
+ * Side effects:
+ *    Events are queued to the requesting thread.
+ *
+ *------------------------------------------------------------------------
+ */
+static DWORD WINAPI
+BtAsyncWorker(LPVOID contextPtr)
+{
+    BtAsyncRequest   *reqPtr     = contextPtr;
+    BtServiceRecords *recordsPtr = NULL;
+    BtAsyncEvent     *evPtr;
+    IocpWinError      winError;
+
+    if (reqPtr->kind == BT_ASYNC_INQUIRY) {
+        winError = BtFindDevices(reqPtr);
+    } else {
+        winError = BtLookupServiceRecords(reqPtr->u.lookup.device,
+                                          &reqPtr->u.lookup.serviceClassId,
+                                          reqPtr->u.lookup.useCache,
+                                          reqPtr,
+                                          &recordsPtr);
+    }
+    evPtr             = BtAsyncEventNew(BT_ASYNC_EV_DONE);
+    evPtr->winError   = winError;
+    evPtr->recordsPtr = recordsPtr;
+    BtAsyncPost(reqPtr, evPtr);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtAsyncEventProc --
+ *
+ *    Passes a result of an asynchronous request to its callback in the
+ *    requesting thread. The callback is invoked with the arguments
+ *    `device DEVICEINFO`, `record SERVICERECORD`, `done` or
+ *    `error MESSAGE`. Nothing further is delivered once the callback
+ *    returns a break or raises an error, or the interpreter is deleted.
+ *
+ * Results:
+ *    Always returns 1 to indicate the event has been handled.
+ *
+ * Side effects:
+ *    The callback is evaluated. The final event frees the request.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+BtAsyncEventProc(
+    Tcl_Event *tclEvPtr,        /* Pointer to BtAsyncEvent */
+    int        flags)           /* Not used */
+{
+    BtAsyncEvent   *evPtr  = (BtAsyncEvent *) tclEvPtr;
+    BtAsyncRequest *reqPtr = evPtr->reqPtr;
+    Tcl_Interp     *interp = reqPtr->interp;
+
+    if (Tcl_InterpDeleted(interp))
+        reqPtr->cancelled = 1;
+
+    if (! reqPtr->cancelled) {
+        Tcl_Obj *cmdObj = Tcl_DuplicateObj(reqPtr->cmdObj);
+        int      result;
+
+        Tcl_IncrRefCount(cmdObj);
+        switch (evPtr->type) {
+        case BT_ASYNC_EV_DEVICE:
+            Tcl_ListObjAppendElement(NULL, cmdObj, STRING_LITERAL_OBJ("device"));
+            Tcl_ListObjAppendElement(
+                NULL, cmdObj, ObjFromBLUETOOTH_DEVICE_INFO(&evPtr->device));
+            break;
+        case BT_ASYNC_EV_RECORD:
+            Tcl_ListObjAppendElement(NULL, cmdObj, STRING_LITERAL_OBJ("record"));
+            Tcl_ListObjAppendElement(
+                NULL, cmdObj,
+                ObjFromBtServiceRecord(evPtr->recordPtr, reqPtr->u.lookup.flags));
+            break;
+        case BT_ASYNC_EV_DONE:
+            if (evPtr->winError == 0) {
+                Tcl_ListObjAppendElement(NULL, cmdObj, STRING_LITERAL_OBJ("done"));
+            } else {
+                Tcl_ListObjAppendElement(NULL, cmdObj, STRING_LITERAL_OBJ("error"));
+                Tcl_ListObjAppendElement(
+                    NULL, cmdObj,
+                    Iocp_MapWindowsError(
+                        evPtr->winError, NULL,
+                        reqPtr->kind == BT_ASYNC_INQUIRY ?
+                        "Bluetooth device search failed: " :
+                        "Could not retrieve Bluetooth service information: "));
+            }
+            break;
+        }
+        result = Tcl_EvalObjEx(interp, cmdObj, TCL_EVAL_GLOBAL);
+        Tcl_DecrRefCount(cmdObj);
+        if (result != TCL_OK) {
+            /* As for fileevent handlers, an error also ends delivery */
+            reqPtr->cancelled = 1;
+            if (result != TCL_BREAK)
+                Tcl_BackgroundException(interp, result);
+        }
+    }
+
+    if (evPtr->type == BT_ASYNC_EV_DONE) {
+        if (evPtr->recordsPtr)
+            BtServiceRecordsRelease(evPtr->recordsPtr);
+        Tcl_DecrRefCount(reqPtr->cmdObj);
+        Tcl_Release(interp);
+        ckfree(reqPtr);
+    }
+    return 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtAsyncQueue --
+ *
+ *    Queues an asynchronous request, whose kind specific fields have
+ *    been filled in, to the system thread pool.
+ *
+ * Results:
+ *    A standard Tcl result. On error, reqPtr is freed.
+ *
+ * Side effects:
+ *    The interpreter is preserved until the request completes.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BtAsyncQueue(
+    Tcl_Interp     *interp,     /* Interpreter for the callback */
+    BtAsyncRequest *reqPtr,     /* Request to queue */
+    Tcl_Obj        *cmdObj)     /* Callback command prefix */
+{
+    reqPtr->threadId  = Tcl_GetCurrentThread();
+    reqPtr->interp    = interp;
+    reqPtr->cmdObj    = cmdObj;
+    reqPtr->cancelled = 0;
+    Tcl_IncrRefCount(cmdObj);
+    Tcl_Preserve(interp);
+    /* Inquiries can take several seconds */
+    if (! QueueUserWorkItem(BtAsyncWorker, reqPtr, WT_EXECUTELONGFUNCTION)) {
+        IocpWinError winError = GetLastError();
+        Tcl_Release(interp);
+        Tcl_DecrRefCount(cmdObj);
+        ckfree(reqPtr);
+        return Iocp_ReportWindowsError(
+            interp, winError, "Could not queue Bluetooth request: ");
+    }
+    IOCP_COUNTER_INCR(IocpBtAsyncRequests);
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_FindDevicesAsyncObjCmd --
+ *
+ *    Implements the Tcl command
+ *        FindDevicesAsync CMDPREFIX ?SEARCHOPTIONS?
+ *    The options are as for FindFirstDevice. CMDPREFIX is invoked in the
+ *    current thread once for each device found and then on completion as
+ *    described in BtAsyncEventProc.
+ *
+ * Results:
+ *    A standard Tcl result.
+ *
+ * Side effects:
+ *    A device search is started on a thread pool thread. A radio handle
+ *    passed with -hradio must not be closed before the search completes.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_FindDevicesAsyncObjCmd(
+    ClientData notUsed,    /* Not used. */
+    Tcl_Interp *interp,    /* Current interpreter. */
+    int objc,              /* Number of arguments. */
+    Tcl_Obj *CONST objv[]) /* Argument objects. */
+{
+    BtAsyncRequest *reqPtr;
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "CMDPREFIX ?OPTIONS?");
+        return TCL_ERROR;
+    }
+    reqPtr = ckalloc(sizeof(*reqPtr));
+    memset(reqPtr, 0, sizeof(*reqPtr));
+    reqPtr->kind = BT_ASYNC_INQUIRY;
+    if (BtParseDeviceSearchOptions(interp, objc-2, objv+2,
+                                   &reqPtr->u.search) != TCL_OK) {
+        ckfree(reqPtr);
+        return TCL_ERROR;
+    }
+    return BtAsyncQueue(interp, reqPtr, objv[1]);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtParseLookupArgs --
+ *
+ *    Parses the trailing DEVICE SERVICEGUID FLAGS arguments of the
+ *    service lookup commands.
+ *
+ * Results:
+ *    A standard Tcl result.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BtParseLookupArgs(
+    Tcl_Interp *interp,         /* Current interpreter. */
+    Tcl_Obj *CONST objv[],      /* DEVICE SERVICEGUID FLAGS */
+    BTH_ADDR   *devicePtr,
+    Tclh_UUID  *serviceClassIdPtr,
+    DWORD      *flagsPtr)
+{
+    BLUETOOTH_ADDRESS btAddr;
+
+    if (ObjToBLUETOOTH_ADDRESS(interp, objv[0], &btAddr) != TCL_OK ||
+        UnwrapUuid(interp, objv[1], serviceClassIdPtr) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[2], (int *)flagsPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    *devicePtr = btAddr.ullLong;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_LookupServiceObjCmd --
+ *
+ *    Implements the Tcl command
+ *        LookupService ?-flushcache? DEVICE SERVICEGUID FLAGS
+ *    which retrieves all records for a service class on a device. The
+ *    service record cache is used unless -flushcache is specified.
+ *
+ * Results:
+ *    TCL_OK    - Success, the interp result is a list of service
+ *                information elements in the form returned by
+ *                LookupServiceNext.
+ *    TCL_ERROR - Error. Interp result contains the error message.
+ *
+ * Side effects:
+ *    The device may be queried.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_LookupServiceObjCmd(
+    ClientData notUsed,    /* Not used. */
+    Tcl_Interp *interp,    /* Current interpreter. */
+    int objc,              /* Number of arguments. */
+    Tcl_Obj *CONST objv[]) /* Argument objects. */
+{
+    BtServiceRecords *recordsPtr;
+    BtServiceRecord  *recordPtr;
+    BTH_ADDR          device;
+    Tclh_UUID         serviceClassId;
+    DWORD             flags;
+    IocpWinError      winError;
+    int               useCache = 1;
+    Tcl_Obj          *resultObj;
+
+    if (objc == 5 && !strcmp("-flushcache", Tcl_GetString(objv[1]))) {
+        useCache = 0;
+        --objc;
+        ++objv;
+    }
+    if (objc != 4) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-flushcache? DEVICE SERVICEGUID FLAGS");
+        return TCL_ERROR;
+    }
+    if (BtParseLookupArgs(interp, objv+1, &device, &serviceClassId, &flags)
+        != TCL_OK)
+        return TCL_ERROR;
+
+    winError = BtLookupServiceRecords(
+        device, &serviceClassId, useCache, NULL, &recordsPtr);
+    if (winError != 0) {
+        if (recordsPtr)
+            BtServiceRecordsRelease(recordsPtr);
+        return Iocp_ReportWindowsError(
+            interp, winError,
+            "Could not retrieve Bluetooth service information: ");
+    }
+    resultObj = Tcl_NewListObj(0, NULL);
+    for (recordPtr = recordsPtr->firstPtr; recordPtr; recordPtr = recordPtr->nextPtr) {
+        Tcl_ListObjAppendElement(
+            NULL, resultObj, ObjFromBtServiceRecord(recordPtr, flags));
+    }
+    BtServiceRecordsRelease(recordsPtr);
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_LookupServiceAsyncObjCmd --
+ *
+ *    Implements the Tcl command
+ *        LookupServiceAsync ?-flushcache? CMDPREFIX DEVICE SERVICEGUID FLAGS
+ *    which is the asynchronous form of LookupService. CMDPREFIX is
+ *    invoked in the current thread once for each record and then on
+ *    completion as described in BtAsyncEventProc.
+ *
+ * Results:
+ *    A standard Tcl result.
+ *
+ * Side effects:
+ *    The lookup is started on a thread pool thread.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_LookupServiceAsyncObjCmd(
+    ClientData notUsed,    /* Not used. */
+    Tcl_Interp *interp,    /* Current interpreter. */
+    int objc,              /* Number of arguments. */
+    Tcl_Obj *CONST objv[]) /* Argument objects. */
+{
+    BtAsyncRequest *reqPtr;
+    int             useCache = 1;
+
+    if (objc == 6 && !strcmp("-flushcache", Tcl_GetString(objv[1]))) {
+        useCache = 0;
+        --objc;
+        ++objv;
+    }
+    if (objc != 5) {
+        Tcl_WrongNumArgs(interp, 1, objv,
+                         "?-flushcache? CMDPREFIX DEVICE SERVICEGUID FLAGS");
+        return TCL_ERROR;
+    }
+    reqPtr = ckalloc(sizeof(*reqPtr));
+    memset(reqPtr, 0, sizeof(*reqPtr));
+    reqPtr->kind = BT_ASYNC_LOOKUP;
+    reqPtr->u.lookup.useCache = useCache;
+    if (BtParseLookupArgs(interp, objv+2, &reqPtr->u.lookup.device,
+                          &reqPtr->u.lookup.serviceClassId,
+                          &reqPtr->u.lookup.flags) != TCL_OK) {
+        ckfree(reqPtr);
+        return TCL_ERROR;
+    }
+    return BtAsyncQueue(interp, reqPtr, objv[1]);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_ServiceCacheTtlObjCmd --
+ *
+ *    Implements the Tcl command ServiceCacheTtl ?MS? which sets the
+ *    time to live for entries in the service record cache. A value of 0
+ *    disables the cache and flushes it.
+ *
+ * Results:
+ *    TCL_OK with the TTL in effect as the interp result, or TCL_ERROR.
+ *
+ * Side effects:
+ *    The cache may be flushed.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_ServiceCacheTtlObjCmd(
+    ClientData notUsed,    /* Not used. */
+    Tcl_Interp *interp,    /* Current interpreter. */
+    int objc,              /* Number of arguments. */
+    Tcl_Obj *CONST objv[]) /* Argument objects. */
+{
+    DWORD ttl;
+
+    if (objc > 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?MS?");
+        return TCL_ERROR;
+    }
+    if (objc == 2) {
+        int intValue;
+        if (Tcl_GetIntFromObj(interp, objv[1], &intValue) != TCL_OK)
+            return TCL_ERROR;
+        if (intValue < 0) {
+            Tcl_SetObjResult(interp,
+                             STRING_LITERAL_OBJ("TTL must not be negative."));
+            return TCL_ERROR;
+        }
+        BtSdpCacheSetTtl(intValue);
+    }
+    Iocp_DoOnce(&btSdpCacheInitFlag, BtSdpCacheInit, NULL);
+    IocpLockAcquireShared(&btSdpCache.lock);
+    ttl = btSdpCache.ttl;
+    IocpLockReleaseShared(&btSdpCache.lock);
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(ttl));
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtResolveRfcommPort --
+ *
+ *    Resolves the RFCOMM port of a service class on a device. The service
+ *    record cache is consulted first.
+ *
+ * Results:
+ *    A standard Tcl result with the port stored in *portPtr on success.
+ *
+ * Side effects:
+ *    The device may be queried.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BtResolveRfcommPort(
+    Tcl_Interp              *interp,     /* For error messages */
+    const BLUETOOTH_ADDRESS *btAddrPtr,  /* Remote device */
+    Tcl_Obj                 *serviceObj, /* Service class UUID */
+    int                     *portPtr)    /* Output port */
+{
+    BtServiceRecords *recordsPtr;
+    BtServiceRecord  *recordPtr;
+    Tclh_UUID         serviceClassId;
+    IocpWinError      winError;
+    IocpTclCode       tclResult = TCL_ERROR;
+
+    if (UnwrapUuid(interp, serviceObj, &serviceClassId) != TCL_OK)
+        return TCL_ERROR;
+    winError = BtLookupServiceRecords(
+        btAddrPtr->ullLong, &serviceClassId, 1, NULL, &recordsPtr);
+    if (winError != 0) {
+        Iocp_ReportWindowsError(
+            interp, winError,
+            "Could not retrieve Bluetooth service information: ");
+    } else {
+        for (recordPtr = recordsPtr->firstPtr; recordPtr;
+             recordPtr = recordPtr->nextPtr) {
+            if (recordPtr->haveRemoteAddr &&
+                recordPtr->remoteAddr.addressFamily == AF_BTH &&
+                recordPtr->protocol == BTHPROTO_RFCOMM) {
+                *portPtr  = recordPtr->remoteAddr.port;
+                tclResult = TCL_OK;
+                break;
+            }
+        }
+        if (tclResult != TCL_OK) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                                 "Could not resolve service \"%s\" to a port.",
+                                 Tcl_GetString(serviceObj)));
+        }
+    }
+    if (recordsPtr)
+        BtServiceRecordsRelease(recordsPtr);
+    return tclResult;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_ModuleInitialize --
+ *
+ *    Initializes the Bluetooth module.
+ *
+ * Results:
+ *    TCL_OK on success, TCL_ERROR on failure.
+ *
+ * Side effects:
+ *    Creates the Bluetooth related Tcl commands.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpTclCode
+BT_ModuleInitialize(Tcl_Interp *interp)
+{
+    Tcl_CreateObjCommand(
+        interp, "iocp::bt::CloseHandle", BT_CloseHandleObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(
+        interp, "iocp::bt::FindFirstRadio", BT_FindFirstRadioObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(
+        interp, "iocp::bt::FindNextRadio", BT_FindNextRadioObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::FindFirstRadioClose",
+                         BT_FindFirstRadioCloseObjCmd,
+                         0L,
+                         0L);
     Tcl_CreateObjCommand(
-        interp, "iocp::bt::CloseHandle", BT_CloseHandleObjCmd, 0L, 0L);
-    Tcl_CreateObjCommand(
-        interp, "iocp::bt::FindFirstRadio", BT_FindFirstRadioObjCmd, 0L, 0L);
-    Tcl_CreateObjCommand(
-        interp, "iocp::bt::FindNextRadio", BT_FindNextRadioObjCmd, 0L, 0L);
-    Tcl_CreateObjCommand(interp,
-                         "iocp::bt::FindFirstRadioClose",
-                         BT_FindFirstRadioCloseObjCmd,
-                         0L,
-                         0L);
-    Tcl_CreateObjCommand(
         interp, "iocp::bt::GetRadioInfo", BT_GetRadioInfoObjCmd, 0L, 0L);
     Tcl_CreateObjCommand(
         interp, "iocp::bt::FindFirstDevice", BT_FindFirstDeviceObjCmd, 0L, 0L);
@@ -1727,10 +2880,30 @@ BT_ModuleInitialize(Tcl_Interp *interp)
                          BT_LookupServiceNextObjCmd,
                          NULL,
                          NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::LookupService",
+                         BT_LookupServiceObjCmd,
+                         NULL,
+                         NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::LookupServiceAsync",
+                         BT_LookupServiceAsyncObjCmd,
+                         NULL,
+                         NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::FindDevicesAsync",
+                         BT_FindDevicesAsyncObjCmd,
+                         NULL,
+                         NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::ServiceCacheTtl",
+                         BT_ServiceCacheTtlObjCmd,
+                         NULL,
+                         NULL);
 
 #ifdef IOCP_DEBUG
     Tcl_CreateObjCommand(interp, "iocp::bt::FormatAddress", BT_FormatAddressObjCmd, 0L, 0L);
 #endif
-    return TCL_OK;
+    return BT_SdrModuleInitialize(interp);
 }
 
@@ -0,0 +1,1167 @@
+/*
+ * tclWinIocpBTSdr.c --
+ *
+ *	Decoding of Bluetooth service discovery records and mapping of
+ *	Bluetooth assigned numbers to names.
+ *
+ * Copyright (c) 2020 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "tclWinIocp.h"
+
+/*
+ * Overview
+ *
+ * A service discovery record is a data element sequence of alternating
+ * attribute ids and values. iocp::bt::sdr::decode returns it as a
+ * dictionary mapping each attribute id to its value in the form
+ * {TYPE VALUE}. Sequences and alternatives ("selection") have a list of
+ * such pairs as their value. The script level commands in btsdr.tcl
+ * interpret these.
+ *
+ * Assigned numbers are kept in tables sorted by UUID so they can be
+ * searched with a binary search. Each table has a companion index to its
+ * entries sorted by case-folded name for the reverse mapping. The tables
+ * and indices were generated from the same data so they must be updated
+ * together. Names are pure ASCII.
+ *
+ * As records are decoded in bulk, the type names, mapped names and UUIDs
+ * appearing in them are shared Tcl_Obj's cached per interpreter.
+ */
+
+#define BT_ARRAY_SIZE(a_) (sizeof(a_)/sizeof((a_)[0]))
+
+/* Limit on nesting of element sequences to bound recursion. */
+#define BT_SDR_MAX_DEPTH 32
+
+/* Limit on number of distinct UUID objects cached per interpreter. */
+#define BT_SDR_UUID_CACHE_MAX 256
+
+/* Data element types. Values up to BT_SDR_URL are as encoded. */
+enum BtSdrType {
+    BT_SDR_NIL,
+    BT_SDR_UINT,
+    BT_SDR_INT,
+    BT_SDR_UUID,
+    BT_SDR_TEXT,
+    BT_SDR_BOOLEAN,
+    BT_SDR_SEQUENCE,
+    BT_SDR_SELECTION,
+    BT_SDR_URL,
+    BT_SDR_UNKNOWN,
+    BT_SDR_TYPE_COUNT
+};
+static const char *const btSdrTypeNames[BT_SDR_TYPE_COUNT] = {
+    "nil", "uint", "int", "uuid", "text", "boolean", "sequence",
+    "selection", "url", "unknown"
+};
+
+/* Template for UUIDs derived from the Bluetooth base UUID */
+static const char btBaseUuid[] = "00000000-0000-1000-8000-00805f9b34fb";
+#define BT_UUID_STRLEN 36
+
+typedef struct BtUuidName {
+    const char *uuid;           /* Lower case UUID. Sort key */
+    const char *name;
+} BtUuidName;
+
+typedef struct BtAttributeName {
+    int         id;             /* Sort key */
+    const char *name;
+} BtAttributeName;
+
+/*
+ * https://www.bluetooth.com/specifications/assigned-numbers/service-discovery/
+ * Service classes also serve as profile identifiers.
+ */
+static const BtUuidName btServiceClassNames[] = {
+    {"00001000-0000-1000-8000-00805f9b34fb", "ServiceDiscoveryServerServiceClassID"},
+    {"00001001-0000-1000-8000-00805f9b34fb", "BrowseGroupDescriptorServiceClassID"},
+    {"00001002-0000-1000-8000-00805f9b34fb", "PublicBrowseRoot"},
+    {"00001101-0000-1000-8000-00805f9b34fb", "SerialPort"},
+    {"00001102-0000-1000-8000-00805f9b34fb", "LANAccessUsingPPP"},
+    {"00001103-0000-1000-8000-00805f9b34fb", "DialupNetworking"},
+    {"00001104-0000-1000-8000-00805f9b34fb", "IrMCSync"},
+    {"00001105-0000-1000-8000-00805f9b34fb", "OBEXObjectPush"},
+    {"00001106-0000-1000-8000-00805f9b34fb", "OBEXFileTransfer"},
+    {"00001107-0000-1000-8000-00805f9b34fb", "IrMCSyncCommand"},
+    {"00001108-0000-1000-8000-00805f9b34fb", "Headset"},
+    {"00001109-0000-1000-8000-00805f9b34fb", "CordlessTelephony"},
+    {"0000110a-0000-1000-8000-00805f9b34fb", "AudioSource"},
+    {"0000110b-0000-1000-8000-00805f9b34fb", "AudioSink"},
+    {"0000110c-0000-1000-8000-00805f9b34fb", "A/V_RemoteControlTarget"},
+    {"0000110d-0000-1000-8000-00805f9b34fb", "AdvancedAudioDistribution"},
+    {"0000110e-0000-1000-8000-00805f9b34fb", "A/V_RemoteControl"},
+    {"0000110f-0000-1000-8000-00805f9b34fb", "A/V_RemoteControlController"},
+    {"00001110-0000-1000-8000-00805f9b34fb", "Intercom"},
+    {"00001111-0000-1000-8000-00805f9b34fb", "Fax"},
+    {"00001112-0000-1000-8000-00805f9b34fb", "Headset - Audio Gateway (AG)"},
+    {"00001115-0000-1000-8000-00805f9b34fb", "PANU"},
+    {"00001116-0000-1000-8000-00805f9b34fb", "NAP"},
+    {"00001117-0000-1000-8000-00805f9b34fb", "GN"},
+    {"00001118-0000-1000-8000-00805f9b34fb", "DirectPrinting"},
+    {"00001119-0000-1000-8000-00805f9b34fb", "ReferencePrinting"},
+    {"0000111a-0000-1000-8000-00805f9b34fb", "Basic Imaging Profile"},
+    {"0000111b-0000-1000-8000-00805f9b34fb", "ImagingResponder"},
+    {"0000111c-0000-1000-8000-00805f9b34fb", "ImagingAutomaticArchive"},
+    {"0000111d-0000-1000-8000-00805f9b34fb", "ImagingReferencedObjects"},
+    {"0000111e-0000-1000-8000-00805f9b34fb", "Handsfree"},
+    {"0000111f-0000-1000-8000-00805f9b34fb", "HandsfreeAudioGateway"},
+    {"00001120-0000-1000-8000-00805f9b34fb", "DirectPrintingReferenceObjectsService"},
+    {"00001121-0000-1000-8000-00805f9b34fb", "ReflectedUI"},
+    {"00001122-0000-1000-8000-00805f9b34fb", "BasicPrinting"},
+    {"00001123-0000-1000-8000-00805f9b34fb", "PrintingStatus"},
+    {"00001124-0000-1000-8000-00805f9b34fb", "HumanInterfaceDeviceService"},
+    {"00001125-0000-1000-8000-00805f9b34fb", "HardcopyCableReplacement"},
+    {"00001126-0000-1000-8000-00805f9b34fb", "HCR_Print"},
+    {"00001127-0000-1000-8000-00805f9b34fb", "HCR_Scan"},
+    {"00001128-0000-1000-8000-00805f9b34fb", "Common_ISDN_Access"},
+    {"0000112d-0000-1000-8000-00805f9b34fb", "SIM_Access"},
+    {"0000112e-0000-1000-8000-00805f9b34fb", "Phonebook Access - PCE"},
+    {"0000112f-0000-1000-8000-00805f9b34fb", "Phonebook Access - PSE"},
+    {"00001130-0000-1000-8000-00805f9b34fb", "Phonebook Access"},
+    {"00001131-0000-1000-8000-00805f9b34fb", "Headset - HS"},
+    {"00001132-0000-1000-8000-00805f9b34fb", "Message Access Server"},
+    {"00001133-0000-1000-8000-00805f9b34fb", "Message Notification Server"},
+    {"00001134-0000-1000-8000-00805f9b34fb", "Message Access Profile"},
+    {"00001135-0000-1000-8000-00805f9b34fb", "GNSS"},
+    {"00001136-0000-1000-8000-00805f9b34fb", "GNSS_Server"},
+    {"00001137-0000-1000-8000-00805f9b34fb", "3D Display"},
+    {"00001138-0000-1000-8000-00805f9b34fb", "3D Glasses"},
+    {"00001139-0000-1000-8000-00805f9b34fb", "3D Synchronization"},
+    {"0000113a-0000-1000-8000-00805f9b34fb", "MPS Profile UUID"},
+    {"0000113b-0000-1000-8000-00805f9b34fb", "MPS SC UUID"},
+    {"0000113c-0000-1000-8000-00805f9b34fb", "CTN Access Service"},
+    {"0000113d-0000-1000-8000-00805f9b34fb", "CTN Notification Service"},
+    {"0000113e-0000-1000-8000-00805f9b34fb", "CTN Profile"},
+    {"00001200-0000-1000-8000-00805f9b34fb", "PnPInformation"},
+    {"00001201-0000-1000-8000-00805f9b34fb", "GenericNetworking"},
+    {"00001202-0000-1000-8000-00805f9b34fb", "GenericFileTransfer"},
+    {"00001203-0000-1000-8000-00805f9b34fb", "GenericAudio"},
+    {"00001204-0000-1000-8000-00805f9b34fb", "GenericTelephony"},
+    {"00001303-0000-1000-8000-00805f9b34fb", "VideoSource"},
+    {"00001304-0000-1000-8000-00805f9b34fb", "VideoSink"},
+    {"00001305-0000-1000-8000-00805f9b34fb", "VideoDistribution"},
+    {"00001400-0000-1000-8000-00805f9b34fb", "HDP"},
+    {"00001401-0000-1000-8000-00805f9b34fb", "HDP Source"},
+    {"00001402-0000-1000-8000-00805f9b34fb", "HDP Sink"},
+    {"02030302-1d19-415f-86f2-22a2106a0a77", "Wireless iAP v2"},
+};
+static const unsigned char btServiceClassNamesByName[] = {
+    51, 52, 53, 16, 17, 14, 15, 13, 12, 26, 34, 1,
+    40, 11, 56, 57, 58, 5, 24, 32, 19, 62, 61, 60,
+    63, 23, 49, 50, 30, 31, 37, 38, 39, 67, 69, 68,
+    10, 20, 45, 36, 28, 29, 27, 18, 6, 9, 4, 48,
+    46, 47, 54, 55, 22, 8, 7, 21, 44, 42, 43, 59,
+    35, 2, 25, 33, 3, 0, 41, 66, 65, 64, 70,
+};
+
+static const BtUuidName btProtocolNames[] = {
+    {"00000001-0000-1000-8000-00805f9b34fb", "SDP"},
+    {"00000002-0000-1000-8000-00805f9b34fb", "UDP"},
+    {"00000003-0000-1000-8000-00805f9b34fb", "RFCOMM"},
+    {"00000004-0000-1000-8000-00805f9b34fb", "TCP"},
+    {"00000005-0000-1000-8000-00805f9b34fb", "TCS-BIN"},
+    {"00000006-0000-1000-8000-00805f9b34fb", "TCS-AT"},
+    {"00000007-0000-1000-8000-00805f9b34fb", "ATT"},
+    {"00000008-0000-1000-8000-00805f9b34fb", "OBEX"},
+    {"00000009-0000-1000-8000-00805f9b34fb", "IP"},
+    {"0000000a-0000-1000-8000-00805f9b34fb", "FTP"},
+    {"0000000c-0000-1000-8000-00805f9b34fb", "HTTP"},
+    {"0000000e-0000-1000-8000-00805f9b34fb", "WSP"},
+    {"0000000f-0000-1000-8000-00805f9b34fb", "BNEP"},
+    {"00000010-0000-1000-8000-00805f9b34fb", "UPNP"},
+    {"00000011-0000-1000-8000-00805f9b34fb", "HIDP"},
+    {"00000012-0000-1000-8000-00805f9b34fb", "HardcopyControlChannel"},
+    {"00000014-0000-1000-8000-00805f9b34fb", "HardcopyDataChannel"},
+    {"00000016-0000-1000-8000-00805f9b34fb", "HardcopyNotification"},
+    {"00000017-0000-1000-8000-00805f9b34fb", "AVCTP"},
+    {"00000019-0000-1000-8000-00805f9b34fb", "AVDTP"},
+    {"0000001b-0000-1000-8000-00805f9b34fb", "CMTP"},
+    {"0000001e-0000-1000-8000-00805f9b34fb", "MCAPControlChannel"},
+    {"0000001f-0000-1000-8000-00805f9b34fb", "MCAPDataChannel"},
+    {"00000100-0000-1000-8000-00805f9b34fb", "L2CAP"},
+};
+static const unsigned char btProtocolNamesByName[] = {
+    6, 18, 19, 12, 20, 9, 15, 16, 17, 14, 10, 8,
+    23, 21, 22, 7, 2, 0, 3, 5, 4, 1, 13, 11,
+};
+
+static const BtAttributeName btAttributeNames[] = {
+    {0, "ServiceRecordHandle"},
+    {1, "ServiceClassIDList"},
+    {2, "ServiceRecordState"},
+    {3, "ServiceID"},
+    {4, "ProtocolDescriptorList"},
+    {5, "BrowseGroupList"},
+    {6, "LanguageBaseAttributeIDList"},
+    {7, "ServiceInfoTimeToLive"},
+    {8, "ServiceAvailability"},
+    {9, "BluetoothProfileDescriptorList"},
+    {10, "DocumentationURL"},
+    {11, "ClientExecutableURL"},
+    {12, "IconURL"},
+    {13, "AdditionalProtocolDescriptorList"},
+    {256, "ServiceName"},
+    {257, "ServiceDescription"},
+    {258, "ProviderName"},
+};
+static const unsigned char btAttributeNamesByName[] = {
+    13, 9, 5, 11, 10, 12, 6, 4, 16, 8, 1, 15,
+    3, 7, 14, 0, 2,
+};
+
+/* Tables selectable from script level */
+enum BtNameTableId {
+    BT_NAMES_SERVICE_CLASS,
+    BT_NAMES_PROTOCOL,
+    BT_NAMES_TABLE_COUNT,
+    BT_NAMES_ANY = BT_NAMES_TABLE_COUNT /* All tables in order */
+};
+static const char *const btNameTableNames[] = {
+    "service_class", "protocol", "any", NULL
+};
+static const struct {
+    const BtUuidName    *entries;
+    const unsigned char *byName;
+    int                  numEntries;
+} btNameTables[BT_NAMES_TABLE_COUNT] = {
+    {btServiceClassNames, btServiceClassNamesByName,
+     BT_ARRAY_SIZE(btServiceClassNames)},
+    {btProtocolNames, btProtocolNamesByName, BT_ARRAY_SIZE(btProtocolNames)},
+};
+
+/* Per-interpreter cache of shared objects */
+typedef struct BtSdrInterpData {
+    Tcl_Obj      *typeObjs[BT_SDR_TYPE_COUNT];
+    Tcl_Obj      *serviceClassNameObjs[BT_ARRAY_SIZE(btServiceClassNames)];
+    Tcl_Obj      *protocolNameObjs[BT_ARRAY_SIZE(btProtocolNames)];
+    Tcl_Obj      *attributeNameObjs[BT_ARRAY_SIZE(btAttributeNames)];
+    Tcl_HashTable uuidObjs;     /* UUID string -> Tcl_Obj */
+} BtSdrInterpData;
+
+static const char btSdrAssocDataKey[] = "iocp::bt::sdr";
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtCachedStringObj --
+ *
+ *    Returns the object cached in a slot, creating it from a string
+ *    if the slot is empty.
+ *
+ * Results:
+ *    The cached object. The cache holds a reference to it.
+ *
+ * Side effects:
+ *    The slot may be filled in.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+BtCachedStringObj(Tcl_Obj **slotPtr, const char *s)
+{
+    if (*slotPtr == NULL) {
+        *slotPtr = Tcl_NewStringObj(s, -1);
+        Tcl_IncrRefCount(*slotPtr);
+    }
+    return *slotPtr;
+}
+
+static Tcl_Obj *
+BtNameObj(BtSdrInterpData *dataPtr, int tableId, int index)
+{
+    Tcl_Obj **slots = tableId == BT_NAMES_SERVICE_CLASS ?
+        dataPtr->serviceClassNameObjs : dataPtr->protocolNameObjs;
+    return BtCachedStringObj(&slots[index],
+                             btNameTables[tableId].entries[index].name);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtUuidObj --
+ *
+ *    Returns an object for a lower case UUID string. Objects are shared
+ *    through a per-interpreter cache up to BT_SDR_UUID_CACHE_MAX UUIDs.
+ *
+ * Results:
+ *    Pointer to a Tcl_Obj which may be shared.
+ *
+ * Side effects:
+ *    The object may be added to the cache.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+BtUuidObj(BtSdrInterpData *dataPtr, const char *uuid)
+{
+    Tcl_HashEntry *hePtr;
+    Tcl_Obj       *objPtr;
+    int            isNew;
+
+    hePtr = Tcl_FindHashEntry(&dataPtr->uuidObjs, uuid);
+    if (hePtr)
+        return Tcl_GetHashValue(hePtr);
+    objPtr = Tcl_NewStringObj(uuid, BT_UUID_STRLEN);
+    if (dataPtr->uuidObjs.numEntries < BT_SDR_UUID_CACHE_MAX) {
+        hePtr = Tcl_CreateHashEntry(&dataPtr->uuidObjs, uuid, &isNew);
+        Tcl_IncrRefCount(objPtr);
+        Tcl_SetHashValue(hePtr, objPtr);
+    }
+    return objPtr;
+}
+
+/* Case insensitive comparison matching the order of the ByName indices. */
+static int
+BtNameCompare(const char *a, const char *b)
+{
+    unsigned char ca, cb;
+    do {
+        ca = (unsigned char) *a++;
+        cb = (unsigned char) *b++;
+        if (ca >= 'A' && ca <= 'Z')
+            ca += 'a' - 'A';
+        if (cb >= 'A' && cb <= 'Z')
+            cb += 'a' - 'A';
+    } while (ca == cb && ca != '\0');
+    return ca - cb;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtLookupUuid --
+ * BtLookupName --
+ *
+ *    Binary search of a name table by UUID and by name.
+ *
+ * Results:
+ *    Index of the entry in the table or -1 if not found.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+BtLookupUuid(int tableId, const char *uuid)
+{
+    const BtUuidName *entries = btNameTables[tableId].entries;
+    int lo = 0, hi = btNameTables[tableId].numEntries - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(uuid, entries[mid].uuid);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+static int
+BtLookupName(int tableId, const char *name)
+{
+    const BtUuidName    *entries = btNameTables[tableId].entries;
+    const unsigned char *byName  = btNameTables[tableId].byName;
+    int lo = 0, hi = btNameTables[tableId].numEntries - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = BtNameCompare(name, entries[byName[mid]].name);
+        if (cmp == 0)
+            return byName[mid];
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+static int
+BtLookupAttributeId(int id)
+{
+    int lo = 0, hi = BT_ARRAY_SIZE(btAttributeNames) - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (id == btAttributeNames[mid].id)
+            return mid;
+        if (id < btAttributeNames[mid].id)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+static int
+BtLookupAttributeName(const char *name)
+{
+    int lo = 0, hi = BT_ARRAY_SIZE(btAttributeNames) - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int index = btAttributeNamesByName[mid];
+        int cmp = BtNameCompare(name, btAttributeNames[index].name);
+        if (cmp == 0)
+            return index;
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtIsUuid --
+ *
+ *    Checks if a string has UUID syntax. This is only a syntax check.
+ *
+ * Results:
+ *    Non-zero if the string is a UUID, else 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+BtIsUuid(const char *s, int len)
+{
+    int i;
+
+    if (len != BT_UUID_STRLEN)
+        return 0;
+    for (i = 0; i < BT_UUID_STRLEN; ++i) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            if (s[i] != '-')
+                return 0;
+        } else if (!isxdigit((unsigned char) s[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtNormalizeUuid --
+ *
+ *    Converts a UUID or 16-bit Bluetooth UUID to lower case full form.
+ *
+ * Results:
+ *    TCL_OK with the UUID stored in uuid, or TCL_ERROR with an error
+ *    message in interp.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BtNormalizeUuid(
+    Tcl_Interp *interp,
+    Tcl_Obj    *objP,
+    char        uuid[BT_UUID_STRLEN+1])
+{
+    int         i, len;
+    const char *s = Tcl_GetStringFromObj(objP, &len);
+
+    if (BtIsUuid(s, len)) {
+        for (i = 0; i <= BT_UUID_STRLEN; ++i)
+            uuid[i] = (char) tolower((unsigned char) s[i]);
+        return TCL_OK;
+    }
+    if (len == 4) {
+        for (i = 0; i < 4 && isxdigit((unsigned char) s[i]); ++i)
+            ;
+        if (i == 4) {
+            memcpy(uuid, btBaseUuid, sizeof(btBaseUuid));
+            for (i = 0; i < 4; ++i)
+                uuid[4+i] = (char) tolower((unsigned char) s[i]);
+            return TCL_OK;
+        }
+    }
+    Tcl_SetObjResult(interp,
+                     Tcl_ObjPrintf("\"%s\" is not a valid 16 bit UUID.", s));
+    return TCL_ERROR;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtObjFromBigEndian --
+ *
+ *    Returns an integer object for an 8 or 16 byte big endian integer.
+ *    Values that do not fit in a Tcl_WideInt are returned as their
+ *    decimal string. Tcl treats these as integers when used as such.
+ *
+ * Results:
+ *    Pointer to a Tcl_Obj with reference count 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+BtObjFromBigEndian(
+    const unsigned char *bytes,     /* Big endian value */
+    int                  len,       /* 8 or 16 */
+    int                  isSigned)
+{
+    unsigned char buf[16];
+    DWORD         limbs[4];
+    char          digits[41];       /* 39 digits, sign and terminator */
+    int           i, pos, negative, nonzero;
+
+    negative = isSigned && (bytes[0] & 0x80);
+    if (len == 8 && (isSigned || !(bytes[0] & 0x80))) {
+        ULONGLONG value = 0;
+        for (i = 0; i < 8; ++i)
+            value = (value << 8) | bytes[i];
+        return Tcl_NewWideIntObj((Tcl_WideInt) value);
+    }
+
+    /* Sign or zero extend to 16 bytes and take the magnitude */
+    memset(buf, negative ? 0xff : 0, sizeof(buf) - len);
+    memcpy(buf + sizeof(buf) - len, bytes, len);
+    for (i = 0; i < 4; ++i) {
+        limbs[i] = ((DWORD)buf[4*i] << 24) | ((DWORD)buf[4*i+1] << 16)
+                 | ((DWORD)buf[4*i+2] << 8) | buf[4*i+3];
+    }
+    if (negative) {
+        ULONGLONG carry = 1;
+        for (i = 3; i >= 0; --i) {
+            carry += (DWORD) ~limbs[i];
+            limbs[i] = (DWORD) carry;
+            carry >>= 32;
+        }
+    }
+
+    pos = sizeof(digits) - 1;
+    digits[pos] = '\0';
+    do {
+        ULONGLONG rem = 0;
+        nonzero = 0;
+        for (i = 0; i < 4; ++i) {
+            ULONGLONG cur = (rem << 32) | limbs[i];
+            limbs[i] = (DWORD) (cur / 10);
+            rem      = cur % 10;
+            nonzero |= limbs[i] != 0;
+        }
+        digits[--pos] = (char) ('0' + rem);
+    } while (nonzero);
+    if (negative)
+        digits[--pos] = '-';
+    return Tcl_NewStringObj(digits + pos, -1);
+}
+
+static IocpTclCode
+BtSdrError(Tcl_Interp *interp, const char *message)
+{
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(message, -1));
+    return TCL_ERROR;
+}
+
+static IocpTclCode BtSdrDecodeElements(Tcl_Interp *interp,
+                                       BtSdrInterpData *dataPtr,
+                                       const unsigned char *bytes, int len,
+                                       int depth, Tcl_Obj **listObjPtr);
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtSdrDecodeElement --
+ *
+ *    Decodes the leading data element in a buffer as defined in the
+ *    Bluetooth Core specification, Vol 3, Part B, Section 3.
+ *
+ * Results:
+ *    TCL_OK with the type and value objects stored in elemObjs and the
+ *    number of bytes used by the element in *consumedPtr. TCL_ERROR with
+ *    an error message in interp if the data is malformed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BtSdrDecodeElement(
+    Tcl_Interp          *interp,
+    BtSdrInterpData     *dataPtr,
+    const unsigned char *bytes,       /* Element data */
+    int                  len,         /* Length of bytes. > 0 */
+    int                  depth,       /* Nesting level of the element */
+    Tcl_Obj             *elemObjs[2], /* Output type and value */
+    int                 *consumedPtr) /* Output bytes consumed */
+{
+    unsigned int         type, lenBits, dataOffset, elemLen;
+    const unsigned char *elem;
+    char                 uuid[BT_UUID_STRLEN+1];
+    static const char    hexDigits[] = "0123456789abcdef";
+    int                  i;
+
+    type    = bytes[0] >> 3;
+    lenBits = bytes[0] & 0x7;
+
+    /* The nil type is formatted slightly differently. */
+    if (type == BT_SDR_NIL) {
+        if (lenBits != 0)
+            return BtSdrError(interp, "Invalid non-0 length for nil type.");
+        elemObjs[0]  = dataPtr->typeObjs[BT_SDR_NIL];
+        elemObjs[1]  = Tcl_NewObj();
+        *consumedPtr = 1;
+        return TCL_OK;
+    }
+
+    if (lenBits < 5) {
+        elemLen    = 1u << lenBits;
+        dataOffset = 1;
+    } else {
+        dataOffset = lenBits == 5 ? 2 : (lenBits == 6 ? 3 : 5);
+        if ((unsigned int) len < dataOffset)
+            return BtSdrError(interp, "Truncated binary header.");
+        elemLen = 0;
+        for (i = 1; i < (int) dataOffset; ++i)
+            elemLen = (elemLen << 8) | bytes[i];
+    }
+    if ((unsigned int) len - dataOffset < elemLen)
+        return BtSdrError(interp, "Truncated binary data.");
+    elem = bytes + dataOffset;
+
+    switch (type) {
+    case BT_SDR_UINT:
+        if (elemLen == 1)
+            elemObjs[1] = Tcl_NewWideIntObj(elem[0]);
+        else if (elemLen == 2)
+            elemObjs[1] = Tcl_NewWideIntObj((elem[0] << 8) | elem[1]);
+        else if (elemLen == 4)
+            elemObjs[1] = Tcl_NewWideIntObj(
+                ((DWORD)elem[0] << 24) | ((DWORD)elem[1] << 16)
+                | ((DWORD)elem[2] << 8) | elem[3]);
+        else if (elemLen == 8 || elemLen == 16)
+            elemObjs[1] = BtObjFromBigEndian(elem, elemLen, 0);
+        else
+            return BtSdrError(interp, "Invalid integer width.");
+        break;
+    case BT_SDR_INT:
+        if (elemLen == 1)
+            elemObjs[1] = Tcl_NewWideIntObj((signed char) elem[0]);
+        else if (elemLen == 2)
+            elemObjs[1] = Tcl_NewWideIntObj((short) ((elem[0] << 8) | elem[1]));
+        else if (elemLen == 4)
+            elemObjs[1] = Tcl_NewWideIntObj(
+                (LONG) (((DWORD)elem[0] << 24) | ((DWORD)elem[1] << 16)
+                        | ((DWORD)elem[2] << 8) | elem[3]));
+        else if (elemLen == 8 || elemLen == 16)
+            elemObjs[1] = BtObjFromBigEndian(elem, elemLen, 1);
+        else
+            return BtSdrError(interp, "Invalid integer width.");
+        break;
+    case BT_SDR_UUID:
+        memcpy(uuid, btBaseUuid, sizeof(btBaseUuid));
+        if (elemLen == 2 || elemLen == 4) {
+            /* 16 and 32 bit forms replace leading digits of base UUID */
+            char *p = uuid + (elemLen == 2 ? 4 : 0);
+            for (i = 0; i < (int) elemLen; ++i) {
+                *p++ = hexDigits[elem[i] >> 4];
+                *p++ = hexDigits[elem[i] & 0xf];
+            }
+        } else if (elemLen == 16) {
+            char *p = uuid;
+            for (i = 0; i < 16; ++i) {
+                if (i == 4 || i == 6 || i == 8 || i == 10)
+                    *p++ = '-';
+                *p++ = hexDigits[elem[i] >> 4];
+                *p++ = hexDigits[elem[i] & 0xf];
+            }
+        } else {
+            Tcl_SetObjResult(interp,
+                             Tcl_ObjPrintf("Invalid length %u for UUID.", elemLen));
+            return TCL_ERROR;
+        }
+        elemObjs[1] = BtUuidObj(dataPtr, uuid);
+        break;
+    case BT_SDR_BOOLEAN:
+        if (elemLen != 1)
+            return BtSdrError(interp, "Invalid length for boolean type.");
+        elemObjs[1] = Tcl_NewIntObj(elem[0] != 0);
+        break;
+    case BT_SDR_SEQUENCE:
+    case BT_SDR_SELECTION:
+        if (depth >= BT_SDR_MAX_DEPTH)
+            return BtSdrError(interp, "Data element sequences nested too deeply.");
+        if (BtSdrDecodeElements(interp, dataPtr, elem, elemLen, depth + 1,
+                                &elemObjs[1]) != TCL_OK)
+            return TCL_ERROR;
+        break;
+    case BT_SDR_TEXT:
+    case BT_SDR_URL:
+    default:
+        /* Kept as binary as the encoding is not known */
+        elemObjs[1] = Tcl_NewByteArrayObj(elem, elemLen);
+        break;
+    }
+
+    elemObjs[0]  = dataPtr->typeObjs[type < BT_SDR_UNKNOWN ? type : BT_SDR_UNKNOWN];
+    *consumedPtr = dataOffset + elemLen;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtSdrDecodeElements --
+ *
+ *    Decodes a buffer containing a series of data elements.
+ *
+ * Results:
+ *    TCL_OK with a list of {TYPE VALUE} pairs stored in *listObjPtr, or
+ *    TCL_ERROR with an error message in interp.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BtSdrDecodeElements(
+    Tcl_Interp          *interp,
+    BtSdrInterpData     *dataPtr,
+    const unsigned char *bytes,
+    int                  len,
+    int                  depth,
+    Tcl_Obj            **listObjPtr)
+{
+    Tcl_Obj *listObj = Tcl_NewListObj(0, NULL);
+
+    while (len > 0) {
+        Tcl_Obj *elemObjs[2];
+        int      consumed;
+        if (BtSdrDecodeElement(interp, dataPtr, bytes, len, depth,
+                               elemObjs, &consumed) != TCL_OK) {
+            Tcl_IncrRefCount(listObj);
+            Tcl_DecrRefCount(listObj);
+            return TCL_ERROR;
+        }
+        Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewListObj(2, elemObjs));
+        bytes += consumed;
+        len   -= consumed;
+    }
+    *listObjPtr = listObj;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_SdrDecodeObjCmd --
+ *
+ *    Implements the Tcl command iocp::bt::sdr::decode BINSDR that decodes
+ *    a binary service discovery record.
+ *
+ * Results:
+ *    TCL_OK with a dictionary mapping attribute ids to {TYPE VALUE}
+ *    pairs as the interp result, or TCL_ERROR.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_SdrDecodeObjCmd(
+    ClientData clientData,      /* BtSdrInterpData */
+    Tcl_Interp *interp,         /* Current interpreter. */
+    int objc,                   /* Number of arguments. */
+    Tcl_Obj *CONST objv[])      /* Argument objects. */
+{
+    BtSdrInterpData     *dataPtr = clientData;
+    const unsigned char *bytes;
+    Tcl_Obj             *elemObjs[2];
+    Tcl_Obj            **attrObjs;
+    Tcl_Obj             *dictObj;
+    int                  len, consumed, numAttrs, i;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "BINSDR");
+        return TCL_ERROR;
+    }
+    bytes = Tcl_GetByteArrayFromObj(objv[1], &len);
+    dictObj = Tcl_NewDictObj();
+    if (len == 0) {
+        Tcl_SetObjResult(interp, dictObj);
+        return TCL_OK;
+    }
+
+    /* A record is a single sequence of attribute id and value elements */
+    if (BtSdrDecodeElement(interp, dataPtr, bytes, len, 0,
+                           elemObjs, &consumed) != TCL_OK) {
+        Tcl_DecrRefCount(dictObj);
+        return TCL_ERROR;
+    }
+    Tcl_IncrRefCount(elemObjs[1]);
+    if (elemObjs[0] != dataPtr->typeObjs[BT_SDR_SEQUENCE] ||
+        Tcl_ListObjGetElements(NULL, elemObjs[1], &numAttrs, &attrObjs) != TCL_OK) {
+        Tcl_DecrRefCount(elemObjs[1]);
+        Tcl_DecrRefCount(dictObj);
+        return BtSdrError(interp, "Service discovery record is not a sequence.");
+    }
+    for (i = 0; i < numAttrs; i += 2) {
+        Tcl_Obj *idObj;
+        /* Attribute ids are {uint ID} pairs */
+        Tcl_ListObjIndex(NULL, attrObjs[i], 1, &idObj);
+        Tcl_DictObjPut(NULL, dictObj, idObj,
+                       i + 1 < numAttrs ? attrObjs[i+1] : Tcl_NewObj());
+    }
+    Tcl_DecrRefCount(elemObjs[1]);
+    Tcl_SetObjResult(interp, dictObj);
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_NamesMapUuidObjCmd --
+ *
+ *    Implements the Tcl command
+ *        iocp::bt::names::MapUuid TABLE UUID
+ *    where TABLE is service_class, protocol or any. UUID may be a full
+ *    UUID or a 16-bit Bluetooth UUID.
+ *
+ * Results:
+ *    TCL_OK with the mapped name, or the UUID in lower case full form if
+ *    it has no mapping, as the interp result. TCL_ERROR if UUID is not
+ *    a valid UUID.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_NamesMapUuidObjCmd(
+    ClientData clientData,      /* BtSdrInterpData */
+    Tcl_Interp *interp,         /* Current interpreter. */
+    int objc,                   /* Number of arguments. */
+    Tcl_Obj *CONST objv[])      /* Argument objects. */
+{
+    BtSdrInterpData *dataPtr = clientData;
+    char             uuid[BT_UUID_STRLEN+1];
+    int              tableId, first, last, index;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "TABLE UUID");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], btNameTableNames, "table",
+                            TCL_EXACT, &tableId) != TCL_OK ||
+        BtNormalizeUuid(interp, objv[2], uuid) != TCL_OK)
+        return TCL_ERROR;
+
+    first = tableId == BT_NAMES_ANY ? 0 : tableId;
+    last  = tableId == BT_NAMES_ANY ? BT_NAMES_TABLE_COUNT - 1 : tableId;
+    for (tableId = first; tableId <= last; ++tableId) {
+        index = BtLookupUuid(tableId, uuid);
+        if (index >= 0) {
+            Tcl_SetObjResult(interp, BtNameObj(dataPtr, tableId, index));
+            return TCL_OK;
+        }
+    }
+    Tcl_SetObjResult(interp, BtUuidObj(dataPtr, uuid));
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_NamesMapNameObjCmd --
+ *
+ *    Implements the Tcl command
+ *        iocp::bt::names::MapName TABLE NAME
+ *    where TABLE is service_class, protocol or any. Names are matched
+ *    without regard to case. NAME may also be a UUID.
+ *
+ * Results:
+ *    TCL_OK with the UUID as the interp result, or TCL_ERROR if the name
+ *    could not be mapped.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_NamesMapNameObjCmd(
+    ClientData clientData,      /* BtSdrInterpData */
+    Tcl_Interp *interp,         /* Current interpreter. */
+    int objc,                   /* Number of arguments. */
+    Tcl_Obj *CONST objv[])      /* Argument objects. */
+{
+    BtSdrInterpData *dataPtr = clientData;
+    const char      *name;
+    int              tableId, first, last, index, len;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "TABLE NAME");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], btNameTableNames, "table",
+                            TCL_EXACT, &tableId) != TCL_OK)
+        return TCL_ERROR;
+
+    name = Tcl_GetStringFromObj(objv[2], &len);
+    if (BtIsUuid(name, len)) {
+        Tcl_SetObjResult(interp, objv[2]);
+        return TCL_OK;
+    }
+    first = tableId == BT_NAMES_ANY ? 0 : tableId;
+    last  = tableId == BT_NAMES_ANY ? BT_NAMES_TABLE_COUNT - 1 : tableId;
+    for (tableId = first; tableId <= last; ++tableId) {
+        index = BtLookupName(tableId, name);
+        if (index >= 0) {
+            Tcl_SetObjResult(
+                interp,
+                BtUuidObj(dataPtr, btNameTables[tableId].entries[index].uuid));
+            return TCL_OK;
+        }
+    }
+    Tcl_SetObjResult(
+        interp,
+        Tcl_ObjPrintf("Name \"%s\" could not be mapped to a UUID", name));
+    return TCL_ERROR;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_NamesEntriesObjCmd --
+ *
+ *    Implements the Tcl command iocp::bt::names::Entries TABLE.
+ *
+ * Results:
+ *    TCL_OK with a flat list of UUIDs and names in the table as the
+ *    interp result, or TCL_ERROR.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_NamesEntriesObjCmd(
+    ClientData clientData,      /* BtSdrInterpData */
+    Tcl_Interp *interp,         /* Current interpreter. */
+    int objc,                   /* Number of arguments. */
+    Tcl_Obj *CONST objv[])      /* Argument objects. */
+{
+    BtSdrInterpData *dataPtr = clientData;
+    Tcl_Obj         *resultObj;
+    int              tableId, first, last, index;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "TABLE");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], btNameTableNames, "table",
+                            TCL_EXACT, &tableId) != TCL_OK)
+        return TCL_ERROR;
+
+    resultObj = Tcl_NewListObj(0, NULL);
+    first = tableId == BT_NAMES_ANY ? 0 : tableId;
+    last  = tableId == BT_NAMES_ANY ? BT_NAMES_TABLE_COUNT - 1 : tableId;
+    for (tableId = first; tableId <= last; ++tableId) {
+        for (index = 0; index < btNameTables[tableId].numEntries; ++index) {
+            Tcl_ListObjAppendElement(
+                NULL, resultObj,
+                BtUuidObj(dataPtr, btNameTables[tableId].entries[index].uuid));
+            Tcl_ListObjAppendElement(
+                NULL, resultObj, BtNameObj(dataPtr, tableId, index));
+        }
+    }
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_NamesMapAttributeObjCmd --
+ *
+ *    Implements the Tcl command
+ *        iocp::bt::names::MapAttribute name|id ATTR
+ *    which maps a universal attribute id or name to a name or id.
+ *
+ * Results:
+ *    For `name`, the attribute name if ATTR is a known id or name, else
+ *    ATTR itself if it is an integer. For `id`, ATTR itself if it is an
+ *    integer, else the id of the named attribute. Otherwise TCL_ERROR.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+BT_NamesMapAttributeObjCmd(
+    ClientData clientData,      /* BtSdrInterpData */
+    Tcl_Interp *interp,         /* Current interpreter. */
+    int objc,                   /* Number of arguments. */
+    Tcl_Obj *CONST objv[])      /* Argument objects. */
+{
+    static const char *const directions[] = {"name", "id", NULL};
+    enum { TO_NAME, TO_ID };
+    BtSdrInterpData *dataPtr = clientData;
+    int              direction, id, index;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "name|id ATTR");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], directions, "direction",
+                            TCL_EXACT, &direction) != TCL_OK)
+        return TCL_ERROR;
+
+    if (Tcl_GetIntFromObj(NULL, objv[2], &id) == TCL_OK) {
+        index = direction == TO_NAME ? BtLookupAttributeId(id) : -1;
+        Tcl_SetObjResult(
+            interp,
+            index < 0 ? objv[2] :
+            BtCachedStringObj(&dataPtr->attributeNameObjs[index],
+                              btAttributeNames[index].name));
+        return TCL_OK;
+    }
+
+    index = BtLookupAttributeName(Tcl_GetString(objv[2]));
+    if (index < 0) {
+        Tcl_SetObjResult(interp,
+                         Tcl_ObjPrintf("Unknown attribute \"%s\".",
+                                       Tcl_GetString(objv[2])));
+        return TCL_ERROR;
+    }
+    if (direction == TO_NAME)
+        Tcl_SetObjResult(interp,
+                         BtCachedStringObj(&dataPtr->attributeNameObjs[index],
+                                           btAttributeNames[index].name));
+    else
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(btAttributeNames[index].id));
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BtSdrInterpDataDelete --
+ *
+ *    Frees the per-interpreter object cache when the interpreter is
+ *    deleted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Cached objects are released.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+BtSdrInterpDataDelete(ClientData clientData, Tcl_Interp *interp)
+{
+    BtSdrInterpData *dataPtr = clientData;
+    Tcl_HashEntry   *hePtr;
+    Tcl_HashSearch   search;
+    int              i;
+
+    for (i = 0; i < BT_SDR_TYPE_COUNT; ++i)
+        Tcl_DecrRefCount(dataPtr->typeObjs[i]);
+    for (i = 0; i < (int) BT_ARRAY_SIZE(dataPtr->serviceClassNameObjs); ++i) {
+        if (dataPtr->serviceClassNameObjs[i])
+            Tcl_DecrRefCount(dataPtr->serviceClassNameObjs[i]);
+    }
+    for (i = 0; i < (int) BT_ARRAY_SIZE(dataPtr->protocolNameObjs); ++i) {
+        if (dataPtr->protocolNameObjs[i])
+            Tcl_DecrRefCount(dataPtr->protocolNameObjs[i]);
+    }
+    for (i = 0; i < (int) BT_ARRAY_SIZE(dataPtr->attributeNameObjs); ++i) {
+        if (dataPtr->attributeNameObjs[i])
+            Tcl_DecrRefCount(dataPtr->attributeNameObjs[i]);
+    }
+    for (hePtr = Tcl_FirstHashEntry(&dataPtr->uuidObjs, &search); hePtr;
+         hePtr = Tcl_NextHashEntry(&search)) {
+        Tcl_Obj *objPtr = Tcl_GetHashValue(hePtr);
+        Tcl_DecrRefCount(objPtr);
+    }
+    Tcl_DeleteHashTable(&dataPtr->uuidObjs);
+    ckfree(dataPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * BT_SdrModuleInitialize --
+ *
+ *    Creates the service discovery record and name mapping commands.
+ *
+ * Results:
+ *    TCL_OK.
+ *
+ * Side effects:
+ *    Commands are created and the per-interpreter cache is attached to
+ *    the interpreter.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpTclCode
+BT_SdrModuleInitialize(Tcl_Interp *interp)
+{
+    BtSdrInterpData *dataPtr;
+    int              i;
+
+    dataPtr = ckalloc(sizeof(*dataPtr));
+    memset(dataPtr, 0, sizeof(*dataPtr));
+    for (i = 0; i < BT_SDR_TYPE_COUNT; ++i) {
+        dataPtr->typeObjs[i] = Tcl_NewStringObj(btSdrTypeNames[i], -1);
+        Tcl_IncrRefCount(dataPtr->typeObjs[i]);
+    }
+    Tcl_InitHashTable(&dataPtr->uuidObjs, TCL_STRING_KEYS);
+    Tcl_SetAssocData(interp, btSdrAssocDataKey, BtSdrInterpDataDelete, dataPtr);
+
+    Tcl_CreateObjCommand(
+        interp, "iocp::bt::sdr::decode", BT_SdrDecodeObjCmd, dataPtr, NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::names::MapUuid",
+                         BT_NamesMapUuidObjCmd,
+                         dataPtr,
+                         NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::names::MapName",
+                         BT_NamesMapNameObjCmd,
+                         dataPtr,
+                         NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::names::MapAttribute",
+                         BT_NamesMapAttributeObjCmd,
+                         dataPtr,
+                         NULL);
+    Tcl_CreateObjCommand(interp,
+                         "iocp::bt::names::Entries",
+                         BT_NamesEntriesObjCmd,
+                         dataPtr,
+                         NULL);
+    return TCL_OK;
+}
@@ -0,0 +1,740 @@
+/*
+ * tclWinIocpDns.c --
+ *
+ *	Host name resolution for Winsock based channels. Resolution can be
+ *	done asynchronously on a system thread pool thread and results can
+ *	be kept in a process-wide cache with a configurable time to live.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "tclWinIocp.h"
+#include "tclWinIocpWinsock.h"
+
+/*
+ * Overview
+ *
+ * Resolved address lists are wrapped in reference counted
+ * IocpResolvedAddrs structures. A channel holds a reference for as long as
+ * it needs its address list. The cache holds one more reference per entry.
+ * A cached list can therefore be shared by any number of channels
+ * connecting to the same destination without copying.
+ *
+ * The cache is keyed by host, port and address family. It is disabled by
+ * default and enabled by setting a non-zero TTL with iocp::configure
+ * -dnscachettl. getaddrinfo does not return DNS record TTLs so the
+ * configured value applies to all entries. Failed lookups are not cached.
+ *
+ * Asynchronous lookups run getaddrinfo on a thread pool thread through
+ * QueueUserWorkItem. They then call back the requester from that thread.
+ * GetAddrInfoExW overlapped lookups are not used since they are only
+ * available on Windows 8 and later.
+ *
+ * Reverse lookups of connection endpoints for -peername and -sockname are
+ * done the same way with getnameinfo. Their results are kept in a second
+ * list keyed by host address alone, subject to the same TTL and size
+ * limit. Channels additionally keep the result for their own endpoints
+ * for as long as they are open.
+ */
+
+#define IOCP_DNS_CACHE_MAX_ENTRIES 256
+
+typedef struct IocpDnsCacheEntry {
+    IocpLink           link;         /* Links entries in iocpDnsCache */
+    IocpResolvedAddrs *resolvedPtr;  /* Counted reference */
+    ULONGLONG          expiry;       /* Tick count when entry expires */
+    int                family;       /* Part of key: address family */
+    int                port;         /* Part of key: port */
+    char               host[1];      /* Part of key: host. Variable size */
+} IocpDnsCacheEntry;
+
+typedef struct IocpDnsReverseEntry {
+    IocpLink     link;          /* Links entries in iocpDnsCache */
+    ULONGLONG    expiry;        /* Tick count when entry expires */
+    IocpSockaddr addr;          /* Key: host address. Port is ignored */
+    int          addrLen;       /* Size of addr */
+    char         hostName[1];   /* Host name. Variable size */
+} IocpDnsReverseEntry;
+
+static struct {
+    IocpLock lock;              /* Protects all fields below */
+    IocpList entries;           /* IocpDnsCacheEntry, most recent first */
+    int      numEntries;        /* Number of entries in list */
+    IocpList reverseEntries;    /* IocpDnsReverseEntry, most recent first */
+    int      numReverseEntries; /* Number of entries in reverseEntries */
+    DWORD    ttl;               /* Time to live in ms. 0 => cache disabled */
+} iocpDnsCache;
+static Iocp_DoOnceState iocpDnsCacheInitFlag;
+
+/* Context for asynchronous lookups */
+typedef struct IocpResolveRequest {
+    IocpResolveDoneProc *doneProc;   /* Callback on completion */
+    ClientData           clientData; /* Passed to doneProc */
+    int                  family;
+    int                  port;
+    char                 host[1];    /* Variable size */
+} IocpResolveRequest;
+
+/* Context for asynchronous reverse lookups */
+typedef struct IocpReverseResolveRequest {
+    IocpReverseResolveDoneProc *doneProc;   /* Callback on completion */
+    ClientData                  clientData; /* Passed to doneProc */
+    IocpSockaddr                addr;       /* Address to look up */
+    int                         addrLen;    /* Size of addr */
+} IocpReverseResolveRequest;
+
+static DWORD WINAPI IocpResolveWorker(LPVOID contextPtr);
+static DWORD WINAPI IocpReverseResolveWorker(LPVOID contextPtr);
+static IocpWinError IocpResolveUncached(const char *host, int port, int family,
+                                        IocpResolvedAddrs **resolvedPtrPtr);
+
+static IocpTclCode IocpDnsCacheInit(ClientData notUsed)
+{
+    IocpLockInit(&iocpDnsCache.lock);
+    IocpListInit(&iocpDnsCache.entries);
+    iocpDnsCache.numEntries = 0;
+    IocpListInit(&iocpDnsCache.reverseEntries);
+    iocpDnsCache.numReverseEntries = 0;
+    iocpDnsCache.ttl        = 0;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpDnsCacheRemoveEntry --
+ * IocpDnsReverseRemoveEntry --
+ *
+ *    Removes an entry from the cache and frees it. Caller must hold
+ *    iocpDnsCache.lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The cache reference to the address list is released.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpDnsCacheRemoveEntry(IocpDnsCacheEntry *entryPtr)
+{
+    IocpListRemove(&iocpDnsCache.entries, &entryPtr->link);
+    iocpDnsCache.numEntries -= 1;
+    IocpResolvedAddrsRelease(entryPtr->resolvedPtr);
+    ckfree(entryPtr);
+}
+
+static void IocpDnsReverseRemoveEntry(IocpDnsReverseEntry *entryPtr)
+{
+    IocpListRemove(&iocpDnsCache.reverseEntries, &entryPtr->link);
+    iocpDnsCache.numReverseEntries -= 1;
+    ckfree(entryPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpDnsCacheLookup --
+ *
+ *    Looks up the cache for a resolved address list. Expired entries
+ *    encountered are removed.
+ *
+ * Results:
+ *    A counted reference to the address list or NULL if not in the cache.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpResolvedAddrs *IocpDnsCacheLookup(
+    const char *host,           /* Host in system encoding. Not NULL */
+    int         port,
+    int         family)
+{
+    IocpResolvedAddrs *resolvedPtr = NULL;
+    IocpLink          *linkPtr, *nextPtr;
+    ULONGLONG          now;
+
+    Iocp_DoOnce(&iocpDnsCacheInitFlag, IocpDnsCacheInit, NULL);
+    IocpLockAcquireExclusive(&iocpDnsCache.lock);
+    if (iocpDnsCache.ttl != 0) {
+        now = GetTickCount64();
+        for (linkPtr = iocpDnsCache.entries.headPtr; linkPtr; linkPtr = nextPtr) {
+            IocpDnsCacheEntry *entryPtr =
+                CONTAINING_RECORD(linkPtr, IocpDnsCacheEntry, link);
+            nextPtr = linkPtr->nextPtr;
+            if (entryPtr->expiry <= now) {
+                IocpDnsCacheRemoveEntry(entryPtr);
+                continue;
+            }
+            if (entryPtr->port == port && entryPtr->family == family &&
+                strcmp(entryPtr->host, host) == 0) {
+                resolvedPtr = entryPtr->resolvedPtr;
+                InterlockedIncrement(&resolvedPtr->numRefs);
+                break;
+            }
+        }
+    }
+    IocpLockReleaseExclusive(&iocpDnsCache.lock);
+
+    if (resolvedPtr)
+        IOCP_COUNTER_INCR(IocpDnsCacheHits);
+    else
+        IOCP_COUNTER_INCR(IocpDnsCacheMisses);
+    return resolvedPtr;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpDnsCacheAdd --
+ *
+ *    Adds a resolved address list to the cache if the cache is enabled.
+ *    If the cache is full the oldest entry is evicted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The cache takes its own reference to the address list.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpDnsCacheAdd(
+    const char        *host,    /* Host in system encoding. Not NULL */
+    int                port,
+    int                family,
+    IocpResolvedAddrs *resolvedPtr)
+{
+    IocpDnsCacheEntry *entryPtr;
+    IocpSizeT          hostLen = Tclh_strlen(host);
+
+    Iocp_DoOnce(&iocpDnsCacheInitFlag, IocpDnsCacheInit, NULL);
+    IocpLockAcquireExclusive(&iocpDnsCache.lock);
+    if (iocpDnsCache.ttl != 0) {
+        if (iocpDnsCache.numEntries >= IOCP_DNS_CACHE_MAX_ENTRIES) {
+            IocpDnsCacheRemoveEntry(CONTAINING_RECORD(
+                iocpDnsCache.entries.tailPtr, IocpDnsCacheEntry, link));
+        }
+        entryPtr = ckalloc(offsetof(IocpDnsCacheEntry, host) + hostLen + 1);
+        IocpLinkInit(&entryPtr->link);
+        InterlockedIncrement(&resolvedPtr->numRefs);
+        entryPtr->resolvedPtr = resolvedPtr;
+        entryPtr->expiry      = GetTickCount64() + iocpDnsCache.ttl;
+        entryPtr->family      = family;
+        entryPtr->port        = port;
+        memcpy(entryPtr->host, host, hostLen + 1);
+        IocpListPrepend(&iocpDnsCache.entries, &entryPtr->link);
+        iocpDnsCache.numEntries += 1;
+    }
+    IocpLockReleaseExclusive(&iocpDnsCache.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpDnsCacheSetTtl --
+ * IocpDnsCacheGetTtl --
+ *
+ *    Sets and retrieves the time to live for cache entries. Setting it to
+ *    0 disables the cache and flushes all entries. Otherwise the new TTL
+ *    applies to entries added from then on.
+ *
+ * Results:
+ *    IocpDnsCacheGetTtl returns the TTL in milliseconds.
+ *
+ * Side effects:
+ *    The cache may be flushed.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpDnsCacheSetTtl(DWORD ttl)
+{
+    Iocp_DoOnce(&iocpDnsCacheInitFlag, IocpDnsCacheInit, NULL);
+    IocpLockAcquireExclusive(&iocpDnsCache.lock);
+    iocpDnsCache.ttl = ttl;
+    if (ttl == 0) {
+        while (iocpDnsCache.entries.headPtr) {
+            IocpDnsCacheRemoveEntry(CONTAINING_RECORD(
+                iocpDnsCache.entries.headPtr, IocpDnsCacheEntry, link));
+        }
+        while (iocpDnsCache.reverseEntries.headPtr) {
+            IocpDnsReverseRemoveEntry(CONTAINING_RECORD(
+                iocpDnsCache.reverseEntries.headPtr, IocpDnsReverseEntry, link));
+        }
+    }
+    IocpLockReleaseExclusive(&iocpDnsCache.lock);
+}
+
+DWORD IocpDnsCacheGetTtl(void)
+{
+    DWORD ttl;
+    Iocp_DoOnce(&iocpDnsCacheInitFlag, IocpDnsCacheInit, NULL);
+    IocpLockAcquireShared(&iocpDnsCache.lock);
+    ttl = iocpDnsCache.ttl;
+    IocpLockReleaseShared(&iocpDnsCache.lock);
+    return ttl;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpDnsCacheFinalize --
+ *
+ *    Flushes the cache at process exit.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    All cache entries are freed.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpDnsCacheFinalize(void)
+{
+    IocpDnsCacheSetTtl(0);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolvedAddrsRelease --
+ *
+ *    Releases a reference to a resolved address list, freeing it when
+ *    the last reference goes away.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The address list may be freed.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpResolvedAddrsRelease(IocpResolvedAddrs *resolvedPtr)
+{
+    if (InterlockedDecrement(&resolvedPtr->numRefs) == 0) {
+        freeaddrinfo(resolvedPtr->addrs);
+        ckfree(resolvedPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolveFamily --
+ *
+ *    Returns the address family to use for resolving remote addresses.
+ *    As for the Tcl core socket command, this can be forced through the
+ *    ::tcl::unsupported::socketAF variable. Must be called in the
+ *    interpreter's thread.
+ *
+ * Results:
+ *    AF_INET, AF_INET6 or AF_UNSPEC.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+int IocpResolveFamily(Tcl_Interp *interp) /* May be NULL */
+{
+    const char *family;
+
+    if (interp != NULL) {
+        family = Tcl_GetVar(interp, "::tcl::unsupported::socketAF", 0);
+        if (family != NULL) {
+            if (strcmp(family, "inet") == 0)
+                return AF_INET;
+            if (strcmp(family, "inet6") == 0)
+                return AF_INET6;
+        }
+    }
+    return AF_UNSPEC;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolveCached --
+ *
+ *    Returns the cached address list for a destination without blocking.
+ *
+ * Results:
+ *    A counted reference to the address list or NULL if not cached.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpResolvedAddrs *IocpResolveCached(
+    const char *host,           /* Host in system encoding. Not NULL */
+    int         port,
+    int         family)         /* AF_INET, AF_INET6 or AF_UNSPEC */
+{
+    return IocpDnsCacheLookup(host, port, family);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolve --
+ *
+ *    Resolves a remote host and port to a list of stream socket addresses.
+ *    The cache is consulted first and updated with the result of a
+ *    successful lookup. The call blocks while the lookup is in progress.
+ *    It does not call into Tcl so it can be called from any thread.
+ *
+ * Results:
+ *    0 on success with a counted reference to the address list stored in
+ *    *resolvedPtrPtr, else a getaddrinfo error code. These are the same
+ *    as Windows error codes.
+ *
+ * Side effects:
+ *    The cache may be updated.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError IocpResolve(
+    const char *host,           /* Host in system encoding. Not NULL */
+    int         port,
+    int         family,         /* AF_INET, AF_INET6 or AF_UNSPEC */
+    IocpResolvedAddrs **resolvedPtrPtr)
+{
+    IocpResolvedAddrs *resolvedPtr;
+
+    resolvedPtr = IocpDnsCacheLookup(host, port, family);
+    if (resolvedPtr) {
+        *resolvedPtrPtr = resolvedPtr;
+        return 0;
+    }
+    return IocpResolveUncached(host, port, family, resolvedPtrPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolveUncached --
+ *
+ *    Resolves a remote host and port without consulting the cache. The
+ *    cache is updated on success.
+ *
+ * Results:
+ *    As for IocpResolve.
+ *
+ * Side effects:
+ *    The cache may be updated.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError IocpResolveUncached(
+    const char *host,           /* Host in system encoding. Not NULL */
+    int         port,
+    int         family,         /* AF_INET, AF_INET6 or AF_UNSPEC */
+    IocpResolvedAddrs **resolvedPtrPtr)
+{
+    IocpResolvedAddrs *resolvedPtr;
+    struct addrinfo    hints;
+    struct addrinfo   *addrs;
+    char               portBuf[TCL_INTEGER_SPACE];
+    int                result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = family;
+    hints.ai_socktype = SOCK_STREAM;
+    /* As in TclCreateSocketAddress, port 0 is passed as no service */
+    sprintf_s(portBuf, sizeof(portBuf), "%d", port);
+    result = getaddrinfo(host, port == 0 ? NULL : portBuf, &hints, &addrs);
+    if (result != 0)
+        return result;
+
+    resolvedPtr          = ckalloc(sizeof(*resolvedPtr));
+    resolvedPtr->addrs   = addrs;
+    resolvedPtr->numRefs = 1;   /* Caller's reference */
+    IocpDnsCacheAdd(host, port, family, resolvedPtr);
+    *resolvedPtrPtr = resolvedPtr;
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolveAsync --
+ *
+ *    Queues a lookup of a remote host and port to the system thread pool.
+ *    On completion, doneProc is called from the pool thread with the same
+ *    results as IocpResolve. doneProc must not call into Tcl. The cache
+ *    is not consulted as callers are expected to have done so with
+ *    IocpResolveCached.
+ *
+ * Results:
+ *    0 if the lookup was queued, else a Windows error code in which case
+ *    doneProc will not be called.
+ *
+ * Side effects:
+ *    A thread pool work item is queued.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError IocpResolveAsync(
+    const char          *host,       /* Host in system encoding. Not NULL */
+    int                  port,
+    int                  family,     /* AF_INET, AF_INET6 or AF_UNSPEC */
+    IocpResolveDoneProc *doneProc,   /* Completion callback */
+    ClientData           clientData) /* Passed to doneProc */
+{
+    IocpResolveRequest *requestPtr;
+    IocpSizeT           hostLen = Tclh_strlen(host);
+
+    requestPtr = ckalloc(offsetof(IocpResolveRequest, host) + hostLen + 1);
+    requestPtr->doneProc   = doneProc;
+    requestPtr->clientData = clientData;
+    requestPtr->family     = family;
+    requestPtr->port       = port;
+    memcpy(requestPtr->host, host, hostLen + 1);
+
+    if (! QueueUserWorkItem(IocpResolveWorker, requestPtr, WT_EXECUTEDEFAULT)) {
+        IocpWinError winError = GetLastError();
+        ckfree(requestPtr);
+        return winError;
+    }
+    IOCP_COUNTER_INCR(IocpDnsAsyncLookups);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpResolveWorker --
+ *
+ *    Thread pool work item for asynchronous lookups.
+ *
+ * Results:
+ *    Always 0.
+ *
+ * Side effects:
+ *    The request's completion callback is invoked.
+ *
+ *------------------------------------------------------------------------
+ */
+static DWORD WINAPI IocpResolveWorker(LPVOID contextPtr)
+{
+    IocpResolveRequest *requestPtr  = contextPtr;
+    IocpResolvedAddrs  *resolvedPtr = NULL;
+    IocpWinError        winError;
+
+    winError = IocpResolveUncached(requestPtr->host, requestPtr->port,
+                                   requestPtr->family, &resolvedPtr);
+    requestPtr->doneProc(requestPtr->clientData, resolvedPtr, winError);
+    ckfree(requestPtr);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpSockaddrSameHost --
+ *
+ *    Compares the host part of two Internet addresses, ignoring ports.
+ *
+ * Results:
+ *    Non-0 if the addresses are of the same host, else 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+int IocpSockaddrSameHost(
+    const IocpSockaddr *aPtr,
+    const IocpSockaddr *bPtr)
+{
+    if (aPtr->sa.sa_family != bPtr->sa.sa_family)
+        return 0;
+    if (aPtr->sa.sa_family == AF_INET)
+        return aPtr->sa4.sin_addr.s_addr == bPtr->sa4.sin_addr.s_addr;
+    if (aPtr->sa.sa_family == AF_INET6)
+        return IN6_ARE_ADDR_EQUAL(&aPtr->sa6.sin6_addr, &bPtr->sa6.sin6_addr) &&
+            aPtr->sa6.sin6_scope_id == bPtr->sa6.sin6_scope_id;
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReverseResolveCached --
+ *
+ *    Looks up the cache for the host name of an address. Expired entries
+ *    encountered are removed.
+ *
+ * Results:
+ *    A ckalloc'ed copy of the host name, to be freed by the caller, or
+ *    NULL if not in the cache.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+char *IocpReverseResolveCached(
+    const IocpSockaddr *addrPtr) /* Address to look up */
+{
+    char      *hostName = NULL;
+    IocpLink  *linkPtr, *nextPtr;
+    ULONGLONG  now;
+
+    Iocp_DoOnce(&iocpDnsCacheInitFlag, IocpDnsCacheInit, NULL);
+    IocpLockAcquireExclusive(&iocpDnsCache.lock);
+    if (iocpDnsCache.ttl != 0) {
+        now = GetTickCount64();
+        for (linkPtr = iocpDnsCache.reverseEntries.headPtr; linkPtr; linkPtr = nextPtr) {
+            IocpDnsReverseEntry *entryPtr =
+                CONTAINING_RECORD(linkPtr, IocpDnsReverseEntry, link);
+            nextPtr = linkPtr->nextPtr;
+            if (entryPtr->expiry <= now) {
+                IocpDnsReverseRemoveEntry(entryPtr);
+                continue;
+            }
+            if (IocpSockaddrSameHost(&entryPtr->addr, addrPtr)) {
+                IocpSizeT len = Tclh_strlen(entryPtr->hostName);
+                hostName = ckalloc(len + 1);
+                memcpy(hostName, entryPtr->hostName, len + 1);
+                break;
+            }
+        }
+    }
+    IocpLockReleaseExclusive(&iocpDnsCache.lock);
+
+    if (hostName)
+        IOCP_COUNTER_INCR(IocpDnsCacheHits);
+    else
+        IOCP_COUNTER_INCR(IocpDnsCacheMisses);
+    return hostName;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpDnsReverseAdd --
+ *
+ *    Adds the host name of an address to the cache if the cache is
+ *    enabled. If the cache is full the oldest entry is evicted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpDnsReverseAdd(
+    const IocpSockaddr *addrPtr,
+    int                 addrLen,
+    const char         *hostName)
+{
+    IocpDnsReverseEntry *entryPtr;
+    IocpSizeT            len = Tclh_strlen(hostName);
+
+    Iocp_DoOnce(&iocpDnsCacheInitFlag, IocpDnsCacheInit, NULL);
+    IocpLockAcquireExclusive(&iocpDnsCache.lock);
+    if (iocpDnsCache.ttl != 0) {
+        if (iocpDnsCache.numReverseEntries >= IOCP_DNS_CACHE_MAX_ENTRIES) {
+            IocpDnsReverseRemoveEntry(CONTAINING_RECORD(
+                iocpDnsCache.reverseEntries.tailPtr, IocpDnsReverseEntry, link));
+        }
+        entryPtr = ckalloc(offsetof(IocpDnsReverseEntry, hostName) + len + 1);
+        IocpLinkInit(&entryPtr->link);
+        entryPtr->expiry  = GetTickCount64() + iocpDnsCache.ttl;
+        entryPtr->addr    = *addrPtr;
+        entryPtr->addrLen = addrLen;
+        memcpy(entryPtr->hostName, hostName, len + 1);
+        IocpListPrepend(&iocpDnsCache.reverseEntries, &entryPtr->link);
+        iocpDnsCache.numReverseEntries += 1;
+    }
+    IocpLockReleaseExclusive(&iocpDnsCache.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReverseResolveAsync --
+ *
+ *    Queues a lookup of the host name of an Internet address to the
+ *    system thread pool. On completion, doneProc is called from the pool
+ *    thread. doneProc must not call into Tcl. As for IocpResolveAsync, the
+ *    cache is not consulted as callers are expected to have done so with
+ *    IocpReverseResolveCached.
+ *
+ * Results:
+ *    0 if the lookup was queued, else a Windows error code in which case
+ *    doneProc will not be called.
+ *
+ * Side effects:
+ *    A thread pool work item is queued.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError IocpReverseResolveAsync(
+    const IocpSockaddr         *addrPtr,    /* Address to look up */
+    int                         addrLen,    /* Size of *addrPtr */
+    IocpReverseResolveDoneProc *doneProc,   /* Completion callback */
+    ClientData                  clientData) /* Passed to doneProc */
+{
+    IocpReverseResolveRequest *requestPtr;
+
+    requestPtr = ckalloc(sizeof(*requestPtr));
+    requestPtr->doneProc   = doneProc;
+    requestPtr->clientData = clientData;
+    requestPtr->addr       = *addrPtr;
+    requestPtr->addrLen    = addrLen;
+
+    if (! QueueUserWorkItem(IocpReverseResolveWorker, requestPtr,
+                            WT_EXECUTEDEFAULT)) {
+        IocpWinError winError = GetLastError();
+        ckfree(requestPtr);
+        return winError;
+    }
+    IOCP_COUNTER_INCR(IocpDnsReverseLookups);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpReverseResolveWorker --
+ *
+ *    Thread pool work item for asynchronous reverse lookups. As for the
+ *    Tcl core, the numeric form is returned for addresses without a name.
+ *
+ * Results:
+ *    Always 0.
+ *
+ * Side effects:
+ *    The request's completion callback is invoked and successful lookups
+ *    added to the cache.
+ *
+ *------------------------------------------------------------------------
+ */
+static DWORD WINAPI IocpReverseResolveWorker(LPVOID contextPtr)
+{
+    IocpReverseResolveRequest *requestPtr = contextPtr;
+    IocpWinError winError = ERROR_SUCCESS;
+    char         hostName[NI_MAXHOST];
+
+    if (getnameinfo(&requestPtr->addr.sa, requestPtr->addrLen,
+                    hostName, sizeof(hostName), NULL, 0, 0) != 0)
+        winError = WSAGetLastError();
+    else
+        IocpDnsReverseAdd(&requestPtr->addr, requestPtr->addrLen, hostName);
+    requestPtr->doneProc(requestPtr->clientData, &requestPtr->addr,
+                         winError == ERROR_SUCCESS ? hostName : NULL, winError);
+    ckfree(requestPtr);
+    return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * tclWinIocpLatency.c --
+ *
+ *	Latency histograms for the pipeline from posting an I/O request,
+ *	through its completion being dequeued by a completion thread, to
+ *	the data being consumed by the Tcl channel. Used to determine
+ *	whether delays arise in the kernel, the completion threads or the
+ *	Tcl event loop.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "tclWinIocp.h"
+
+/*
+ * Overview
+ *
+ * Each histogram is log-linear in the manner of HDR histograms. Values
+ * below IOCP_LATENCY_LINEAR_LIMIT microseconds have a bucket each. Every
+ * power of 2 range above that is divided into IOCP_LATENCY_SUB_BUCKETS
+ * equal buckets so the relative error of a recorded value is bounded by
+ * 1/IOCP_LATENCY_SUB_BUCKETS at all magnitudes. Values beyond the largest
+ * range are counted in the last bucket.
+ *
+ * Buckets are updated with interlocked operations from completion and Tcl
+ * threads without any locking. A report or reset concurrent with updates
+ * may therefore see a sample in some totals and not others. That is
+ * acceptable for statistics.
+ */
+
+#define IOCP_LATENCY_SUB_BUCKET_BITS 3
+#define IOCP_LATENCY_SUB_BUCKETS (1 << IOCP_LATENCY_SUB_BUCKET_BITS)
+#define IOCP_LATENCY_LINEAR_LIMIT (2 * IOCP_LATENCY_SUB_BUCKETS)
+#define IOCP_LATENCY_MAX_BITS 32 /* ~71 minutes in microseconds */
+#define IOCP_LATENCY_BUCKETS                                            \
+    (IOCP_LATENCY_LINEAR_LIMIT +                                        \
+     (IOCP_LATENCY_MAX_BITS - IOCP_LATENCY_SUB_BUCKET_BITS - 1) * IOCP_LATENCY_SUB_BUCKETS)
+
+typedef struct IocpLatencyHistogram {
+    volatile LONG64 counts[IOCP_LATENCY_BUCKETS];
+    volatile LONG64 samples;    /* Number of recorded values */
+    volatile LONG64 sum;        /* Sum of recorded values */
+    volatile LONG64 max;        /* Largest recorded value */
+} IocpLatencyHistogram;
+
+/* Names of intervals in reports. Must match enum IocpLatencyInterval */
+static const char *iocpLatencyIntervalNames[] = {
+    "ReadCompletion",
+    "ReadDispatch",
+    "ReadTotal",
+    "WriteCompletion",
+};
+
+int iocpLatencyEnabled;
+static IocpLatencyHistogram iocpLatencyHistograms[IOCP_LATENCY_INTERVALS];
+static LONG64 iocpLatencyFrequency; /* Performance counter ticks per second */
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyBucket --
+ *
+ *    Maps a latency value to its histogram bucket.
+ *
+ * Results:
+ *    Index of the bucket.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+IocpLatencyBucket(ULONG64 value) /* Microseconds */
+{
+    int msb;
+
+    if (value < IOCP_LATENCY_LINEAR_LIMIT)
+        return (int) value;
+    if (value >= ((ULONG64)1 << IOCP_LATENCY_MAX_BITS))
+        return IOCP_LATENCY_BUCKETS - 1;
+    for (msb = IOCP_LATENCY_SUB_BUCKET_BITS + 1; (value >> (msb + 1)) != 0; ++msb)
+        ;
+    /* Top IOCP_LATENCY_SUB_BUCKET_BITS+1 bits select the bucket in range */
+    return IOCP_LATENCY_LINEAR_LIMIT
+        + (msb - IOCP_LATENCY_SUB_BUCKET_BITS - 1) * IOCP_LATENCY_SUB_BUCKETS
+        + (int) (value >> (msb - IOCP_LATENCY_SUB_BUCKET_BITS))
+        - IOCP_LATENCY_SUB_BUCKETS;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyBucketLimit --
+ *
+ *    Returns the largest value that maps to a histogram bucket.
+ *
+ * Results:
+ *    Upper limit of the bucket in microseconds.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static ULONG64
+IocpLatencyBucketLimit(int bucket)
+{
+    int range, shift;
+
+    if (bucket < IOCP_LATENCY_LINEAR_LIMIT)
+        return bucket;
+    range = (bucket - IOCP_LATENCY_LINEAR_LIMIT) / IOCP_LATENCY_SUB_BUCKETS;
+    shift = range + 1;
+    return ((ULONG64)(IOCP_LATENCY_SUB_BUCKETS
+                      + (bucket - IOCP_LATENCY_LINEAR_LIMIT) % IOCP_LATENCY_SUB_BUCKETS
+                      + 1) << shift) - 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyRecord --
+ *
+ *    Records the interval between two performance counter values.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The histogram for the interval is updated.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpLatencyRecord(
+    enum IocpLatencyInterval interval, /* Histogram to update */
+    LONG64 fromTicks,                  /* Start of interval */
+    LONG64 toTicks)                    /* End of interval */
+{
+    IocpLatencyHistogram *histPtr = &iocpLatencyHistograms[interval];
+    LONG64 value;
+    LONG64 max;
+
+    if (iocpLatencyFrequency == 0 || toTicks < fromTicks)
+        return;
+    value = ((toTicks - fromTicks) * 1000000) / iocpLatencyFrequency;
+    InterlockedIncrement64(&histPtr->counts[IocpLatencyBucket(value)]);
+    InterlockedIncrement64(&histPtr->samples);
+    InterlockedExchangeAdd64(&histPtr->sum, value);
+    while (value > (max = histPtr->max)) {
+        if (InterlockedCompareExchange64(&histPtr->max, value, max) == max)
+            break;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyEnable --
+ *
+ *    Enables or disables timestamping of buffers. Buffers already posted
+ *    are recorded or not depending on the setting when they were posted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Sets iocpLatencyEnabled.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpLatencyEnable(int enable)
+{
+    if (enable && iocpLatencyFrequency == 0) {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        iocpLatencyFrequency = frequency.QuadPart;
+    }
+    iocpLatencyEnabled = enable ? 1 : 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyReset --
+ *
+ *    Clears all latency histograms.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Recorded samples are discarded.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpLatencyReset(void)
+{
+    int interval, bucket;
+
+    for (interval = 0; interval < IOCP_LATENCY_INTERVALS; ++interval) {
+        IocpLatencyHistogram *histPtr = &iocpLatencyHistograms[interval];
+        for (bucket = 0; bucket < IOCP_LATENCY_BUCKETS; ++bucket)
+            InterlockedExchange64(&histPtr->counts[bucket], 0);
+        InterlockedExchange64(&histPtr->samples, 0);
+        InterlockedExchange64(&histPtr->sum, 0);
+        InterlockedExchange64(&histPtr->max, 0);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyHistogramReport --
+ *
+ *    Summarizes a histogram as a dictionary with keys Count, Mean, Max,
+ *    P50, P90, P99, P999 and Buckets. The percentiles are the upper limits
+ *    of the buckets containing them. Buckets is a flat list of bucket
+ *    upper limits and counts for non-empty buckets.
+ *
+ * Results:
+ *    A Tcl_Obj with a zero reference count.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+IocpLatencyHistogramReport(IocpLatencyHistogram *histPtr)
+{
+    static const struct {
+        const char *name;
+        int         permille;
+    } percentiles[] = {
+        {"P50", 500}, {"P90", 900}, {"P99", 990}, {"P999", 999}
+    };
+    LONG64   counts[IOCP_LATENCY_BUCKETS];
+    LONG64   total, max, seen;
+    const int npercentiles = sizeof(percentiles)/sizeof(percentiles[0]);
+    Tcl_Obj *objs[2 * (4 + sizeof(percentiles)/sizeof(percentiles[0]))];
+    Tcl_Obj *bucketsObj;
+    int      n, bucket, pct;
+
+    /* Take a copy so percentiles are consistent with the bucket list. */
+    total = 0;
+    for (bucket = 0; bucket < IOCP_LATENCY_BUCKETS; ++bucket) {
+        counts[bucket] = histPtr->counts[bucket];
+        total += counts[bucket];
+    }
+    max = histPtr->max;
+
+    n = 0;
+    objs[n++] = Tcl_NewStringObj("Count", -1);
+    objs[n++] = Tcl_NewWideIntObj(total);
+    objs[n++] = Tcl_NewStringObj("Mean", -1);
+    objs[n++] = Tcl_NewWideIntObj(histPtr->samples ?
+                                  histPtr->sum / histPtr->samples : 0);
+    objs[n++] = Tcl_NewStringObj("Max", -1);
+    objs[n++] = Tcl_NewWideIntObj(max);
+
+    seen = 0;
+    bucket = 0;
+    for (pct = 0; pct < npercentiles; ++pct) {
+        /* Rank of the sample at the percentile, rounding up */
+        LONG64  rank = (total * percentiles[pct].permille + 999) / 1000;
+        ULONG64 limit = 0;
+        if (total != 0) {
+            while (bucket < IOCP_LATENCY_BUCKETS && seen + counts[bucket] < rank)
+                seen += counts[bucket++];
+            limit = IocpLatencyBucketLimit(bucket);
+            if (limit > (ULONG64) max)
+                limit = max;
+        }
+        objs[n++] = Tcl_NewStringObj(percentiles[pct].name, -1);
+        objs[n++] = Tcl_NewWideIntObj(limit);
+    }
+
+    bucketsObj = Tcl_NewListObj(0, NULL);
+    for (bucket = 0; bucket < IOCP_LATENCY_BUCKETS; ++bucket) {
+        if (counts[bucket] == 0)
+            continue;
+        Tcl_ListObjAppendElement(
+            NULL, bucketsObj,
+            Tcl_NewWideIntObj(IocpLatencyBucketLimit(bucket)));
+        Tcl_ListObjAppendElement(NULL, bucketsObj,
+                                 Tcl_NewWideIntObj(counts[bucket]));
+    }
+    objs[n++] = Tcl_NewStringObj("Buckets", -1);
+    objs[n++] = bucketsObj;
+
+    IOCP_ASSERT(n <= sizeof(objs)/sizeof(objs[0]));
+    return Tcl_NewListObj(n, objs);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpLatencyReport --
+ *
+ *    Returns the latency histograms as a dictionary keyed by interval
+ *    name. Values are in microseconds.
+ *
+ * Results:
+ *    A Tcl_Obj with a zero reference count.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+Tcl_Obj *
+IocpLatencyReport(void)
+{
+    Tcl_Obj *objs[2 * IOCP_LATENCY_INTERVALS + 2];
+    int      n, interval;
+
+    n = 0;
+    objs[n++] = Tcl_NewStringObj("Enabled", -1);
+    objs[n++] = Tcl_NewBooleanObj(iocpLatencyEnabled);
+    for (interval = 0; interval < IOCP_LATENCY_INTERVALS; ++interval) {
+        objs[n++] = Tcl_NewStringObj(iocpLatencyIntervalNames[interval], -1);
+        objs[n++] = IocpLatencyHistogramReport(&iocpLatencyHistograms[interval]);
+    }
+    return Tcl_NewListObj(n, objs);
+}
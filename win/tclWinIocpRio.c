@@ -0,0 +1,665 @@
+/*
+ * tclWinIocpRio.c --
+ *
+ *	Registered I/O (RIO) data path for Winsock based channels.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+/*
+ * The RIO declarations in mswsock.h are only visible when targeting
+ * Windows 8 or later. The functions are only ever called through the
+ * function table retrieved at run time so raising the target here does
+ * not prevent loading on Windows 7 where the table is simply not available
+ * and channels fall back to the overlapped I/O path.
+ */
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0602
+# undef _WIN32_WINNT
+# define _WIN32_WINNT 0x0602
+#endif
+
+#include "tclWinIocp.h"
+#include "tclWinIocpWinsock.h"
+
+/*
+ * Overview
+ *
+ * Data buffers used with RIO must be registered with the system. Buffers
+ * are carved out of registered slabs in chunks of IOCP_RIO_CHUNK_SIZE. An
+ * IocpBuffer using a chunk is marked with IOCP_BUFFER_F_RIO, has its
+ * data.bytes pointing into the slab and context[1] holding the slab index.
+ * IocpBufferFree returns the chunk through IocpRioBufferDetach.
+ *
+ * All RIO request queues share one completion queue that is serviced by the
+ * completion threads. The completion queue notifies through the IOCP
+ * completion port with IocpRioCompletionHandler as the completion key. Only
+ * a single notification is armed at a time so at most one completion thread
+ * dequeues RIO completions at any time.
+ *
+ * Each channel using RIO has its own request queue which is created when
+ * the first read or write is posted. RIO request queues are not thread safe
+ * and are only accessed with the owning channel locked.
+ *
+ * Locks are acquired in the order channel lock -> cqLock. The completion
+ * handler never holds cqLock while locking a channel.
+ */
+
+#define IOCP_RIO_CHUNK_SIZE     IOCP_BUFFER_DEFAULT_SIZE
+#define IOCP_RIO_SLAB_SIZE      (256 * IOCP_RIO_CHUNK_SIZE)
+#define IOCP_RIO_MAX_SLABS      64
+#define IOCP_RIO_MAX_OUTSTANDING 20 /* Upper limit of -maxpending{reads,writes} */
+#define IOCP_RIO_CQ_SLOTS       (2 * IOCP_RIO_MAX_OUTSTANDING) /* Per channel */
+#define IOCP_RIO_CQ_INITIAL_SIZE (64 * IOCP_RIO_CQ_SLOTS)
+#define IOCP_RIO_CQ_MAX_SIZE    RIO_MAX_CQ_SIZE
+#define IOCP_RIO_DEQUEUE_SIZE   64
+
+typedef struct IocpRioSlab {
+    char        *base;          /* Start of registered memory */
+    RIO_BUFFERID bufferId;      /* Registration id */
+} IocpRioSlab;
+
+static struct IocpRio {
+    RIO_EXTENSION_FUNCTION_TABLE fns; /* RIO functions */
+    IocpLock     lock;          /* Protects slabs and free chunk list */
+    IocpRioSlab  slabs[IOCP_RIO_MAX_SLABS]; /* Append only. Entries below
+                                             * numSlabs are not modified
+                                             * until finalization. */
+    int          numSlabs;
+    void        *freeChunks;    /* Singly linked through first pointer in
+                                 * each chunk */
+    IocpLock     cqLock;        /* Protects completion queue fields */
+    RIO_CQ       cq;            /* Shared completion queue */
+    ULONG        cqSize;        /* Current size of cq */
+    ULONG        cqReserved;    /* Slots reserved by request queues */
+    OVERLAPPED   notifyOverlap; /* Used for cq notifications via the port */
+    int          initialized;
+} iocpRio;
+
+static Iocp_DoOnceState iocpRioInitFlag;
+
+static IocpCompletionHandler IocpRioCompletionHandler;
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioInit --
+ *
+ *    Retrieves the RIO function table and creates the shared completion
+ *    queue. Called once per process through Iocp_DoOnce.
+ *
+ * Results:
+ *    TCL_OK if RIO is usable, TCL_ERROR otherwise.
+ *
+ * Side effects:
+ *    The completion queue is created and armed for notification.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode IocpRioInit(ClientData notUsed)
+{
+    static GUID rioGuid = WSAID_MULTIPLE_RIO;
+    RIO_NOTIFICATION_COMPLETION notification;
+    SOCKET so;
+    DWORD  nbytes;
+
+    so = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0,
+                    WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    if (so == INVALID_SOCKET)
+        return TCL_ERROR;
+    iocpRio.fns.cbSize = sizeof(iocpRio.fns);
+    if (WSAIoctl(so, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+                 &rioGuid, sizeof(rioGuid),
+                 &iocpRio.fns, sizeof(iocpRio.fns),
+                 &nbytes, NULL, NULL) != 0) {
+        closesocket(so);
+        return TCL_ERROR;
+    }
+    closesocket(so);
+
+    memset(&iocpRio.notifyOverlap, 0, sizeof(iocpRio.notifyOverlap));
+    notification.Type               = RIO_IOCP_COMPLETION;
+    notification.Iocp.IocpHandle    = iocpModuleState.completion_port;
+    notification.Iocp.CompletionKey = (PVOID) IocpRioCompletionHandler;
+    notification.Iocp.Overlapped    = &iocpRio.notifyOverlap;
+    iocpRio.cq = iocpRio.fns.RIOCreateCompletionQueue(IOCP_RIO_CQ_INITIAL_SIZE,
+                                                      &notification);
+    if (iocpRio.cq == RIO_INVALID_CQ)
+        return TCL_ERROR;
+    if (iocpRio.fns.RIONotify(iocpRio.cq) != ERROR_SUCCESS) {
+        iocpRio.fns.RIOCloseCompletionQueue(iocpRio.cq);
+        iocpRio.cq = RIO_INVALID_CQ;
+        return TCL_ERROR;
+    }
+
+    IocpLockInit(&iocpRio.lock);
+    IocpLockInit(&iocpRio.cqLock);
+    iocpRio.cqSize      = IOCP_RIO_CQ_INITIAL_SIZE;
+    iocpRio.cqReserved  = 0;
+    iocpRio.numSlabs    = 0;
+    iocpRio.freeChunks  = NULL;
+    iocpRio.initialized = 1;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioFinalize --
+ *
+ *    Releases RIO resources at process exit. Must only be called after the
+ *    completion threads have exited.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The completion queue is closed and buffer slabs released. Buffers
+ *    still in use are not returned to the slabs when freed later.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpRioFinalize(void)
+{
+    int i;
+
+    if (! iocpRio.initialized)
+        return;
+    IocpLockAcquireExclusive(&iocpRio.lock);
+    iocpRio.initialized = 0;
+    iocpRio.fns.RIOCloseCompletionQueue(iocpRio.cq);
+    iocpRio.cq = RIO_INVALID_CQ;
+    for (i = 0; i < iocpRio.numSlabs; ++i) {
+        iocpRio.fns.RIODeregisterBuffer(iocpRio.slabs[i].bufferId);
+        VirtualFree(iocpRio.slabs[i].base, 0, MEM_RELEASE);
+    }
+    iocpRio.numSlabs   = 0;
+    iocpRio.freeChunks = NULL;
+    IocpLockReleaseExclusive(&iocpRio.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioAvailable --
+ *
+ *    Returns whether registered I/O can be used.
+ *
+ * Results:
+ *    Non-zero if available, 0 otherwise.
+ *
+ * Side effects:
+ *    RIO is initialized on the first call.
+ *
+ *------------------------------------------------------------------------
+ */
+int IocpRioAvailable(void)
+{
+    return Iocp_DoOnce(&iocpRioInitFlag, IocpRioInit, NULL) == TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioSocket --
+ *
+ *    Creates a socket that can be used for registered I/O as well as
+ *    overlapped I/O.
+ *
+ * Results:
+ *    The socket or INVALID_SOCKET on failure.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+SOCKET IocpRioSocket(int family, int type, int protocol)
+{
+    return WSASocketW(family, type, protocol, NULL, 0,
+                      WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioBufferAttach --
+ *
+ *    Attaches a registered chunk as the data area of a IocpBuffer that
+ *    was allocated with 0 capacity.
+ *
+ * Results:
+ *    ERROR_SUCCESS or a Windows error code.
+ *
+ * Side effects:
+ *    A new slab may be allocated and registered.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError IocpRioBufferAttach(IocpBuffer *bufPtr)
+{
+    char *chunkPtr;
+    int   slabIndex;
+
+    IOCP_ASSERT(bufPtr->data.bytes == NULL);
+
+    IocpLockAcquireExclusive(&iocpRio.lock);
+    if (iocpRio.freeChunks == NULL) {
+        IocpRioSlab *slabPtr;
+        int i;
+        if (! iocpRio.initialized || iocpRio.numSlabs == IOCP_RIO_MAX_SLABS) {
+            IocpLockReleaseExclusive(&iocpRio.lock);
+            return WSAENOBUFS;
+        }
+        slabPtr = &iocpRio.slabs[iocpRio.numSlabs];
+        slabPtr->base = VirtualAlloc(NULL, IOCP_RIO_SLAB_SIZE,
+                                     MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (slabPtr->base == NULL) {
+            IocpLockReleaseExclusive(&iocpRio.lock);
+            return WSAENOBUFS;
+        }
+        slabPtr->bufferId = iocpRio.fns.RIORegisterBuffer(slabPtr->base,
+                                                          IOCP_RIO_SLAB_SIZE);
+        if (slabPtr->bufferId == RIO_INVALID_BUFFERID) {
+            IocpWinError winError = WSAGetLastError();
+            VirtualFree(slabPtr->base, 0, MEM_RELEASE);
+            IocpLockReleaseExclusive(&iocpRio.lock);
+            return winError;
+        }
+        for (i = IOCP_RIO_SLAB_SIZE - IOCP_RIO_CHUNK_SIZE; i >= 0; i -= IOCP_RIO_CHUNK_SIZE) {
+            chunkPtr = slabPtr->base + i;
+            *(void **)chunkPtr = iocpRio.freeChunks;
+            iocpRio.freeChunks = chunkPtr;
+        }
+        iocpRio.numSlabs++;
+    }
+    chunkPtr = iocpRio.freeChunks;
+    iocpRio.freeChunks = *(void **)chunkPtr;
+
+    /*
+     * Locate the slab. There are few slabs so a linear search is fine.
+     * This must be done under the lock as another thread may be adding
+     * a slab. Once added, a slab entry does not change until
+     * finalization so it can be read later without the lock (see
+     * IocpRioBufferDescriptor).
+     */
+    for (slabIndex = 0; slabIndex < iocpRio.numSlabs; ++slabIndex) {
+        char *base = iocpRio.slabs[slabIndex].base;
+        if (chunkPtr >= base && chunkPtr < base + IOCP_RIO_SLAB_SIZE)
+            break;
+    }
+    IOCP_ASSERT(slabIndex < iocpRio.numSlabs);
+    IocpLockReleaseExclusive(&iocpRio.lock);
+
+    bufPtr->data.bytes    = chunkPtr;
+    bufPtr->data.capacity = IOCP_RIO_CHUNK_SIZE;
+    bufPtr->data.begin    = 0;
+    bufPtr->data.len      = 0;
+    bufPtr->context[1].i  = slabIndex;
+    bufPtr->flags        |= IOCP_BUFFER_F_RIO;
+    return ERROR_SUCCESS;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioBufferDetach --
+ *
+ *    Returns the registered chunk attached to a IocpBuffer. Called from
+ *    IocpBufferFree.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The IocpBuffer is left with no data area.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpRioBufferDetach(IocpBuffer *bufPtr)
+{
+    IOCP_ASSERT(bufPtr->flags & IOCP_BUFFER_F_RIO);
+    IocpLockAcquireExclusive(&iocpRio.lock);
+    /* After finalization the slab memory is gone. Just forget the chunk. */
+    if (iocpRio.initialized) {
+        *(void **)bufPtr->data.bytes = iocpRio.freeChunks;
+        iocpRio.freeChunks = bufPtr->data.bytes;
+    }
+    IocpLockReleaseExclusive(&iocpRio.lock);
+    bufPtr->data.bytes    = NULL;
+    bufPtr->data.capacity = 0;
+    bufPtr->data.begin    = 0;
+    bufPtr->data.len      = 0;
+    bufPtr->flags        &= ~IOCP_BUFFER_F_RIO;
+}
+
+/*
+ * Returns the RIO_BUF descriptor for the data area of a IocpBuffer. For
+ * sends the descriptor covers the data, for receives the whole chunk.
+ */
+IOCP_INLINE void IocpRioBufferDescriptor(IocpBuffer *bufPtr, RIO_BUF *rioBufPtr, int forSend) {
+    IocpRioSlab *slabPtr = &iocpRio.slabs[bufPtr->context[1].i];
+    rioBufPtr->BufferId = slabPtr->bufferId;
+    rioBufPtr->Offset   = (ULONG) (bufPtr->data.bytes + bufPtr->data.begin - slabPtr->base);
+    rioBufPtr->Length   = forSend ? bufPtr->data.len : bufPtr->data.capacity;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpRioCompletionHandler --
+ *
+ *    Called from a completion thread when the RIO completion queue
+ *    signals completions. Dequeues and dispatches all completions and
+ *    rearms the notification.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    See IocpCompleteBuffer.
+ *
+ *------------------------------------------------------------------------
+ */
+static void IocpRioCompletionHandler(OVERLAPPED_ENTRY *notUsed)
+{
+    RIORESULT results[IOCP_RIO_DEQUEUE_SIZE];
+    ULONG     i, numResults;
+
+    while (1) {
+        IocpLockAcquireExclusive(&iocpRio.cqLock);
+        numResults = iocpRio.fns.RIODequeueCompletion(iocpRio.cq, results,
+                                                      IOCP_RIO_DEQUEUE_SIZE);
+        if (numResults == 0 || numResults == RIO_CORRUPT_CQ) {
+            /* Rearm. Triggers immediately if completions arrived since. */
+            iocpRio.fns.RIONotify(iocpRio.cq);
+            IocpLockReleaseExclusive(&iocpRio.cqLock);
+            break;
+        }
+        IocpLockReleaseExclusive(&iocpRio.cqLock);
+
+        IOCP_COUNTER_ADD(IocpRioCompletions, numResults);
+
+        /*
+         * Like the completion thread, lock a channel once for a run of
+         * completions for that channel holding an additional reference.
+         */
+        i = 0;
+        while (i < numResults) {
+            IocpBuffer  *bufPtr  = (IocpBuffer *) results[i].RequestContext;
+            IocpChannel *chanPtr = bufPtr->chanPtr;
+
+            IOCP_ASSERT(chanPtr != NULL);
+            IocpChannelLock(chanPtr);
+            chanPtr->numRefs += 1;
+            do {
+                IocpCompleteBuffer(chanPtr, bufPtr,
+                                   results[i].BytesTransferred,
+                                   results[i].Status);
+                if (++i == numResults)
+                    break;
+                bufPtr = (IocpBuffer *) results[i].RequestContext;
+            } while (bufPtr->chanPtr == chanPtr);
+            IocpChannelDrop(chanPtr); /* Reverse above reference */
+        }
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientRioAttach --
+ *
+ *    Creates the RIO request queue for a channel, reserving space for its
+ *    completions in the shared completion queue.
+ *
+ * Results:
+ *    ERROR_SUCCESS or a Windows error code.
+ *
+ * Side effects:
+ *    The completion queue may be resized.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError WinsockClientRioAttach(
+    WinsockClient *lockedWsPtr) /* Must be locked */
+{
+    IocpWinError winError = ERROR_SUCCESS;
+    RIO_RQ       rq;
+
+    if (! IocpRioAvailable())
+        return WSAEOPNOTSUPP;
+
+    IocpLockAcquireExclusive(&iocpRio.cqLock);
+    if (iocpRio.cqReserved + IOCP_RIO_CQ_SLOTS > iocpRio.cqSize) {
+        ULONG newSize = 2 * iocpRio.cqSize;
+        if (newSize > IOCP_RIO_CQ_MAX_SIZE ||
+            ! iocpRio.fns.RIOResizeCompletionQueue(iocpRio.cq, newSize)) {
+            IocpLockReleaseExclusive(&iocpRio.cqLock);
+            return WSAENOBUFS;
+        }
+        iocpRio.cqSize = newSize;
+    }
+    rq = iocpRio.fns.RIOCreateRequestQueue(lockedWsPtr->so,
+                                           IOCP_RIO_MAX_OUTSTANDING, 1,
+                                           IOCP_RIO_MAX_OUTSTANDING, 1,
+                                           iocpRio.cq, iocpRio.cq,
+                                           lockedWsPtr);
+    if (rq == RIO_INVALID_RQ)
+        winError = WSAGetLastError();
+    else
+        iocpRio.cqReserved += IOCP_RIO_CQ_SLOTS;
+    IocpLockReleaseExclusive(&iocpRio.cqLock);
+
+    if (winError == ERROR_SUCCESS)
+        lockedWsPtr->rioRq = rq;
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientRioUsable --
+ *
+ *    Checks if a channel is to use registered I/O, setting up its request
+ *    queue on first use. If that fails, the channel permanently falls back
+ *    to overlapped I/O.
+ *
+ * Results:
+ *    Non-zero if RIO is to be used for the channel, 0 otherwise.
+ *
+ * Side effects:
+ *    The request queue may be created.
+ *
+ *------------------------------------------------------------------------
+ */
+static int WinsockClientRioUsable(
+    WinsockClient *lockedWsPtr) /* Must be locked */
+{
+    if (lockedWsPtr->rioRq)
+        return 1;
+    if ((lockedWsPtr->flags & IOCP_WINSOCK_RIO) == 0)
+        return 0;
+    if (WinsockClientRioAttach(lockedWsPtr) != ERROR_SUCCESS) {
+        lockedWsPtr->flags &= ~IOCP_WINSOCK_RIO;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientRioFinit --
+ *
+ *    Releases the RIO resources of a channel. Must be called after the
+ *    socket is closed, which also frees the request queue.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The completion queue reservation is released.
+ *
+ *------------------------------------------------------------------------
+ */
+void WinsockClientRioFinit(IocpChannel *chanPtr)
+{
+    WinsockClient *wsPtr = IocpChannelToWinsockClient(chanPtr);
+
+    IOCP_ASSERT(wsPtr->so == INVALID_SOCKET);
+    if (wsPtr->rioRq) {
+        IocpLockAcquireExclusive(&iocpRio.cqLock);
+        iocpRio.cqReserved -= IOCP_RIO_CQ_SLOTS;
+        IocpLockReleaseExclusive(&iocpRio.cqLock);
+        wsPtr->rioRq = NULL;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientRioPostRead --
+ *
+ *    Posts a registered receive buffer to the socket. Implements the
+ *    behavior defined for postread() in IocpChannel vtbl. Falls back to
+ *    WinsockClientPostRead if RIO cannot be used for the channel.
+ *
+ * Results:
+ *    Returns 0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    The receive is queued to the request queue from where its completion
+ *    will be retrieved by a completion thread. The pending reads count
+ *    in the IocpChannel is incremented.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientRioPostRead(IocpChannel *lockedChanPtr)
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpBuffer   *bufPtr;
+    RIO_BUF       rioBuf;
+    IocpWinError  winError;
+
+    IOCP_ASSERT(lockedWsPtr->base.state == IOCP_STATE_OPEN);
+    if (! WinsockClientRioUsable(lockedWsPtr))
+        return WinsockClientPostRead(lockedChanPtr);
+
+    bufPtr = IocpBufferNew(0, IOCP_BUFFER_OP_READ, IOCP_BUFFER_F_WINSOCK);
+    if (bufPtr == NULL)
+        return WSAENOBUFS;
+    winError = IocpRioBufferAttach(bufPtr);
+    if (winError != ERROR_SUCCESS) {
+        IocpBufferFree(bufPtr);
+        return winError;
+    }
+
+    bufPtr->chanPtr    = lockedChanPtr;
+    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+    /* Completions may be dequeued out of order by the completion threads */
+    bufPtr->sequence   = lockedChanPtr->readSeqPosted++;
+
+    IocpRioBufferDescriptor(bufPtr, &rioBuf, 0);
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, rioBuf.Length, 0);
+    IOCP_LATENCY_STAMP_POST(bufPtr);
+    if (! iocpRio.fns.RIOReceive(lockedWsPtr->rioRq, &rioBuf, 1, 0, bufPtr)) {
+        winError = WSAGetLastError();
+        lockedChanPtr->numRefs -= 1;
+        lockedChanPtr->readSeqPosted--;
+        bufPtr->chanPtr = NULL;
+        IocpBufferFree(bufPtr);
+        return winError;
+    }
+    lockedChanPtr->pendingReads++;
+    IOCP_COUNTER_INCR(IocpReadsPosted);
+
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientRioPostWrite --
+ *
+ *    Copies passed data to a registered buffer and posts it to the socket.
+ *    Implements the behaviour expected of the postwrite() function in
+ *    IocpChannel vtbl. Falls back to WinsockClientPostWrite if RIO cannot
+ *    be used for the channel.
+ *
+ * Results:
+ *    If data is successfully written, return 0 and stores written count,
+ *    which may be less than nbytes, into *countPtr. If no data could be
+ *    written because device would block returns 0 and stores 0 in
+ *    *countPtr. On error, returns a Windows error.
+ *
+ * Side effects:
+ *    The send is queued to the request queue from where its completion
+ *    will be retrieved by a completion thread. The pending writes count
+ *    in the IocpChannel is incremented.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientRioPostWrite(
+    IocpChannel *lockedChanPtr, /* Must be locked on entry */
+    const char  *bytes,         /* Pointer to data to write */
+    int          nbytes,        /* Number of data bytes to write */
+    int         *countPtr)      /* Output - Number of bytes written */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpBuffer   *bufPtr;
+    RIO_BUF       rioBuf;
+    IocpWinError  winError;
+
+    IOCP_ASSERT(lockedWsPtr->base.state == IOCP_STATE_OPEN);
+    if (! WinsockClientRioUsable(lockedWsPtr))
+        return WinsockClientPostWrite(lockedChanPtr, bytes, nbytes, countPtr);
+
+    /* If we have already too many outstanding writes or bytes */
+    if (lockedChanPtr->pendingWrites >= lockedChanPtr->maxPendingWrites ||
+        lockedChanPtr->outputBytes >= lockedChanPtr->maxOutputBytes) {
+        /* Not an error but indicate nothing written */
+        *countPtr = 0;
+        return ERROR_SUCCESS;
+    }
+
+    bufPtr = IocpBufferNew(0, IOCP_BUFFER_OP_WRITE, IOCP_BUFFER_F_WINSOCK);
+    if (bufPtr == NULL)
+        return WSAENOBUFS;
+    winError = IocpRioBufferAttach(bufPtr);
+    if (winError != ERROR_SUCCESS) {
+        IocpBufferFree(bufPtr);
+        return winError;
+    }
+
+    /* Tcl channel layer will pass the remainder in a subsequent call */
+    if (nbytes > bufPtr->data.capacity)
+        nbytes = bufPtr->data.capacity;
+    IocpBufferCopyIn(bufPtr, bytes, nbytes);
+    bufPtr->context[0].ptr = NULL; /* No gathered buffers */
+
+    bufPtr->chanPtr    = lockedChanPtr;
+    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+
+    IocpRioBufferDescriptor(bufPtr, &rioBuf, 1);
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, rioBuf.Length, 0);
+    IOCP_LATENCY_STAMP_POST(bufPtr);
+    if (! iocpRio.fns.RIOSend(lockedWsPtr->rioRq, &rioBuf, 1, 0, bufPtr)) {
+        winError = WSAGetLastError();
+        lockedChanPtr->numRefs -= 1;
+        bufPtr->chanPtr = NULL;
+        IocpBufferFree(bufPtr);
+        *countPtr = -1;
+        return winError;
+    }
+    *countPtr = nbytes;
+    lockedChanPtr->pendingWrites++;
+    IOCP_COUNTER_INCR(IocpWritesPosted);
+    lockedChanPtr->outputBytes += nbytes;
+
+    return 0;
+}
@@ -29,23 +29,96 @@
 
 static void         TcpClientInit(IocpChannel *chanPtr);
 static void         TcpClientFinit(IocpChannel *chanPtr);
-static IocpWinError TcpClientPostConnect(WinsockClient *chanPtr);
+static void         TcpRioClientInit(IocpChannel *chanPtr);
+static void         TcpRioClientFinit(IocpChannel *chanPtr);
+static int          TcpClientShutdown(Tcl_Interp *, IocpChannel *, int);
+static IocpWinError TcpClientPostConnect(WinsockClient *tcpPtr, SOCKET so,
+                                         struct addrinfo *localAddr,
+                                         struct addrinfo *remoteAddr);
 static IocpWinError TcpClientBlockingConnect(IocpChannel *);
+static IocpWinError TcpClientTimedConnect(WinsockClient *tcpPtr);
+static IocpWinError TcpClientBlockingConnected(IocpChannel *lockedChanPtr);
 static IocpWinError TcpClientAsyncConnectFailed(IocpChannel *lockedChanPtr);
+static IocpWinError TcpClientConnectCompleted(IocpChannel *lockedChanPtr,
+                                              IocpBuffer *bufPtr);
+static void         TcpClientConnectTimedOut(IocpChannel *lockedChanPtr);
 static void         TcpClientFreeAddresses(WinsockClient *tcpPtr);
+static IocpResolveDoneProc TcpClientResolved;
 
 static IocpChannelVtbl tcpClientVtbl =  {
     /* "Virtual" functions */
     TcpClientInit,
     TcpClientFinit,
-    WinsockClientShutdown,
+    TcpClientShutdown,
     NULL,                       /* Accept */
     TcpClientBlockingConnect,
     WinsockClientAsyncConnected,
     TcpClientAsyncConnectFailed,
+    TcpClientConnectCompleted,
+    TcpClientConnectTimedOut,
     WinsockClientDisconnected,
     WinsockClientPostRead,
+    WinsockClientReadCompleted,
+    NULL,                       /* InputReady */
     WinsockClientPostWrite,
+    WinsockClientFlushOutput,
+    WinsockClientGetHandle,
+    WinsockClientGetOption,
+    WinsockClientSetOption,
+    WinsockClientTranslateError,
+    /* Data members */
+    iocpWinsockOptionNames,
+    sizeof(WinsockClient)
+};
+
+/*
+ * Same as tcpClientVtbl except for the TLS handshake on connecting and
+ * decryption of received data. Encryption is done in the shared write path.
+ */
+static IocpChannelVtbl tcpTlsClientVtbl =  {
+    /* "Virtual" functions */
+    TcpClientInit,
+    TcpClientFinit,
+    TcpClientShutdown,
+    NULL,                       /* Accept */
+    TcpClientBlockingConnect,
+    WinsockClientTlsConnected,
+    TcpClientAsyncConnectFailed,
+    TcpClientConnectCompleted,
+    TcpClientConnectTimedOut,
+    WinsockClientDisconnected,
+    WinsockClientPostRead,
+    WinsockClientReadCompleted,
+    WinsockClientTlsInputReady,
+    WinsockClientPostWrite,
+    WinsockClientFlushOutput,
+    WinsockClientGetHandle,
+    WinsockClientGetOption,
+    WinsockClientSetOption,
+    WinsockClientTranslateError,
+    /* Data members */
+    iocpWinsockOptionNames,
+    sizeof(WinsockClient)
+};
+
+/* Same as tcpClientVtbl except data transfer uses registered I/O */
+static IocpChannelVtbl tcpRioClientVtbl =  {
+    /* "Virtual" functions */
+    TcpRioClientInit,
+    TcpRioClientFinit,
+    TcpClientShutdown,
+    NULL,                       /* Accept */
+    TcpClientBlockingConnect,
+    WinsockClientAsyncConnected,
+    TcpClientAsyncConnectFailed,
+    TcpClientConnectCompleted,
+    TcpClientConnectTimedOut,
+    WinsockClientDisconnected,
+    WinsockClientRioPostRead,
+    WinsockClientReadCompleted, /* In case of fallback */
+    NULL,                       /* InputReady */
+    WinsockClientRioPostWrite,
+    WinsockClientFlushOutput,   /* In case of fallback */
     WinsockClientGetHandle,
     WinsockClientGetOption,
     WinsockClientSetOption,
@@ -55,7 +128,63 @@ static IocpChannelVtbl tcpClientVtbl =  {
     sizeof(WinsockClient)
 };
 IOCP_INLINE int IocpIsInetClient(IocpChannel *chanPtr) {
-    return (chanPtr->vtblPtr == &tcpClientVtbl);
+    return (chanPtr->vtblPtr == &tcpClientVtbl ||
+            chanPtr->vtblPtr == &tcpTlsClientVtbl ||
+            chanPtr->vtblPtr == &tcpRioClientVtbl);
+}
+
+/*
+ * State of a racing connect as described in RFC 8305 (Happy Eyeballs).
+ * Connect attempts to successive remote addresses are started every
+ * racePtr->delay milliseconds, or as soon as the previous attempt fails,
+ * without waiting for earlier attempts to complete. The first attempt to
+ * succeed supplies the channel socket and the rest are closed. Address
+ * families are alternated so a black-holed family costs at most one delay.
+ */
+typedef struct TcpConnectAttempt {
+    struct addrinfo *remote;   /* Remote address. Points into remotes list */
+    struct addrinfo *local;    /* Local address. Points into locals list */
+    SOCKET           so;       /* INVALID_SOCKET unless connect in flight */
+} TcpConnectAttempt;
+
+/*
+ * Context for the one-shot timer that starts the next attempt. Timers are
+ * never deleted by the channel, only superseded. A superseded timer does
+ * nothing but free itself when it fires. This avoids any need to wait for
+ * a running callback while holding the channel lock.
+ */
+typedef struct TcpRaceTimer {
+    WinsockClient *tcpPtr;     /* Holds a counted reference to the channel */
+    HANDLE         timer;      /* Timer queue timer */
+} TcpRaceTimer;
+
+typedef struct TcpConnectRace {
+    TcpRaceTimer     *timerPtr;    /* Current stagger timer or NULL */
+    DWORD             delay;       /* Stagger between attempts in ms */
+    int               numAttempts; /* Number of entries in attempts[] */
+    int               nextAttempt; /* Index of next attempt to start */
+    int               numPending;  /* Number of attempts in flight */
+    TcpConnectAttempt attempts[1]; /* Actually numAttempts entries */
+} TcpConnectRace;
+
+/* Configured through iocp::configure -connectdelay */
+static volatile LONG tcpConnectDelay = IOCP_CONNECT_DELAY_DEFAULT;
+
+static int          TcpClientRaceInit(WinsockClient *tcpPtr);
+static IocpWinError TcpClientRaceStart(WinsockClient *lockedTcpPtr);
+static IocpWinError TcpClientRaceNext(WinsockClient *lockedTcpPtr);
+static void         TcpClientRaceFree(WinsockClient *lockedTcpPtr);
+static VOID CALLBACK TcpClientRaceTimerFired(PVOID, BOOLEAN);
+
+/*
+ * Creates a client socket, registered for RIO if the client channel
+ * uses registered I/O. Note socket call, unlike WSASocket is overlapped
+ * by default.
+ */
+IOCP_INLINE SOCKET TcpClientSocket(WinsockClient *tcpPtr, int family) {
+    if (tcpPtr->flags & IOCP_WINSOCK_RIO)
+        return IocpRioSocket(family, SOCK_STREAM, 0);
+    return socket(family, SOCK_STREAM, 0);
 }
 
 /****************************************************************
@@ -74,19 +203,46 @@ typedef struct TcpListeningSocket {
     int                       aiSocktype; /* ... to create sockets ... */
     int                       aiProtocol; /* ... passed to _AcceptEx */
     int                       pendingAcceptPosts; /* #queued accepts posts */
-    int                       maxPendingAcceptPosts; /* Loose max of above */
-#define IOCP_WINSOCK_MAX_ACCEPTS 5  /* Even raising to 20 does not seem to
-                                       matter with apache benchmark */
+    int                       targetAcceptPosts; /* Loose max of above. Adapts
+                                                  * to the accept rate within
+                                                  * the listener bounds */
+    int                       batchAccepts; /* #accepts in current batch */
+    ULONGLONG                 lastAcceptTick; /* Time of last accept batch */
+    WinsockSocketPool        *poolPtr; /* Sockets of closed connections
+                                        * for reuse by accepts. May be NULL */
 } TcpListeningSocket;
 
+/*
+ * Layout of the data area of accept buffers. The AcceptEx output area
+ * holds receiveSize bytes of data received with the connection followed by
+ * the connection addresses. See MSDN docs for sizing of the latter.
+ */
 typedef struct TcpAcceptBuffer {
 #define IOCP_ACCEPT_ADDRESS_LEN (16*sizeof(IocpSockaddr))
-    char addresses[2*IOCP_ACCEPT_ADDRESS_LEN]; /* Will be used to retrieve
-                                                * connection addresses as
-                                                * part of AcceptEx call. See
-                                                * MSDN docs for sizing */
-    int  listenerIndex;                       /* Index into TcpListener.listeners[] */
+    int  socketFlags;                         /* Persistent IOCP_WINSOCK_*
+                                               * flags of a recycled accept
+                                               * socket. -1 if newly created */
+    int  receiveSize;                         /* Size of data to receive */
+    double output[1];                         /* AcceptEx output area. Declared
+                                               * double for alignment */
 } TcpAcceptBuffer;
+#define IOCP_ACCEPT_BUFFER_SIZE(receiveSize_)           \
+    ((int) offsetof(TcpAcceptBuffer, output) + (receiveSize_) \
+     + 2*IOCP_ACCEPT_ADDRESS_LEN)
+#define IOCP_ACCEPT_MAX_RECEIVE 65536 /* Max -acceptreadsize */
+
+/*
+ * Bounds on the number of outstanding accepts per listening socket. The
+ * number posted starts at the lower bound, doubles whenever a batch of
+ * completions consumes half or more of those outstanding and halves for
+ * every IOCP_ACCEPT_SHRINK_INTERVAL ms without connections.
+ */
+#define IOCP_ACCEPT_MIN_PENDING_DEFAULT 5
+#define IOCP_ACCEPT_MAX_PENDING_DEFAULT 64
+#define IOCP_ACCEPT_MAX_PENDING_LIMIT   1024
+#define IOCP_ACCEPT_SHRINK_INTERVAL     1000
+#define IOCP_ACCEPT_BATCH_SIZE          32 /* Max accepts drained before
+                                            * invoking callbacks */
 
 /* TCP listener channel state */
 typedef struct TcpListener {
@@ -99,8 +255,29 @@ typedef struct TcpListener {
     int                 numListeners;   /* Only 0..numListeners-1 elements of
                                          * listeners[] should be examined and
                                          * can have value INVALID_SOCKET */
+    int                 inlineCompletion; /* If true, accepted sockets
+                                           * complete synchronous I/O inline */
+    int                 rio;            /* If true, accepted sockets use
+                                         * registered I/O */
+    int                 readMode;       /* Read mode of accepted sockets */
+    DWORD               idleTimeout;    /* Idle timeout of accepted sockets */
+    DWORD               readTimeout;    /* Read timeout of accepted sockets */
+    int                 acceptReadSize; /* Bytes of data to receive along
+                                         * with each accept. 0 => none */
+    int                 minPendingAccepts; /* Bounds for the ... */
+    int                 maxPendingAccepts; /* ... adaptive accept backlog */
+    IocpWorkerPool     *workerPoolPtr;  /* Worker threads that accepted
+                                         * connections are handed off to.
+                                         * NULL => listener thread */
 } TcpListener;
 
+/* Connection accepted in a batch whose callback is yet to be invoked */
+typedef struct TcpAcceptedConnection {
+    Tcl_Channel  channel;
+    char         host[INET6_ADDRSTRLEN]; /* Numeric remote address */
+    int          port;                   /* Remote port */
+} TcpAcceptedConnection;
+
 /*
  * Prototypes for TCP client implementation
  */
@@ -120,6 +297,9 @@ static void         TcpListenerFinit(IocpChannel *chanPtr);
 static int          TcpListenerShutdown(Tcl_Interp *,
                                        IocpChannel *chanPtr, int flags);
 static IocpWinError TcpListenerAccept(IocpChannel *lockedChanPtr);
+static void         TcpListenerAdaptBacklog(TcpListener *lockedTcpPtr,
+                                            TcpListeningSocket *listenerPtr,
+                                            ULONGLONG now);
 static IocpTclCode  TcpListenerGetOption (IocpChannel *lockedChanPtr,
                                           Tcl_Interp *interp, int optIndex,
                                           Tcl_DString *dsPtr);
@@ -136,9 +316,14 @@ static IocpChannelVtbl tcpListenerVtbl = {
     NULL, /* BlockingConnect */
     NULL, /* AsyncConnected */
     NULL, /* AsyncConnectFailed */
+    NULL, /* ConnectCompleted */
+    NULL, /* ConnectTimedOut */
     NULL, /* Disconnected */
     NULL, /* PostRead */
+    NULL, /* ReadCompleted */
+    NULL, /* InputReady */
     NULL, /* PostWrite */
+    NULL, /* FlushOutput */
     NULL, // TBD TcpListenerGetHandle,
     TcpListenerGetOption,
     TcpListenerSetOption,
@@ -202,18 +387,64 @@ static void TcpClientFinit(IocpChannel *chanPtr)
 
     IOCP_ASSERT(IocpIsInetClient(chanPtr));
     tcpPtr = IocpChannelToWinsockClient(chanPtr);
+    if (tcpPtr->addresses.inet.racePtr)
+        TcpClientRaceFree(tcpPtr);
     TcpClientFreeAddresses(tcpPtr);
     WinsockClientFinit(chanPtr);
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpRioClientInit --
+ *
+ *    Initializes a Tcp channel that uses registered I/O for data transfer.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static void TcpRioClientInit(IocpChannel *chanPtr)
+{
+    TcpClientInit(chanPtr);
+    IocpChannelToWinsockClient(chanPtr)->flags |= IOCP_WINSOCK_RIO;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpRioClientFinit --
+ *
+ *    Finalizer for a Tcp channel that uses registered I/O. Same
+ *    synchronization requirements as TcpClientFinit.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    As for TcpClientFinit. In addition, any RIO resources are released.
+ *
+ *------------------------------------------------------------------------
+ */
+static void TcpRioClientFinit(IocpChannel *chanPtr)
+{
+    TcpClientFinit(chanPtr);
+    WinsockClientRioFinit(chanPtr);
+}
+
 /*
  *------------------------------------------------------------------------
  *
  * TcpClientPostConnect --
  *
- *    Posts a connect request to the IO completion port for a Tcp channel.
- *    The local and remote addresses are those specified in the tcpPtr
- *    localAddr and remoteAddr fields. Neither must be NULL.
+ *    Posts a connect request to the IO completion port for a Tcp channel
+ *    on the passed socket. Neither address must be NULL. The socket is
+ *    stored in the context[0] field of the posted buffer to identify the
+ *    attempt on completion.
  *
  *    The function does not check or modify the connection state. That is
  *    the caller's responsibility.
@@ -227,9 +458,11 @@ static void TcpClientFinit(IocpChannel *chanPtr)
  *------------------------------------------------------------------------
  */
 static IocpWinError TcpClientPostConnect(
-    WinsockClient *tcpPtr  /* Channel pointer, may or may not be locked
-                             * but caller has to ensure no interference */
-    )
+    WinsockClient   *tcpPtr,     /* Channel pointer, may or may not be locked
+                                  * but caller has to ensure no interference */
+    SOCKET           so,         /* Socket to connect */
+    struct addrinfo *localAddr,  /* Local address to bind to */
+    struct addrinfo *remoteAddr) /* Remote address to connect to */
 {
     static GUID     ConnectExGuid = WSAID_CONNECTEX;
     LPFN_CONNECTEX  fnConnectEx;
@@ -238,8 +471,7 @@ static IocpWinError TcpClientPostConnect(
     DWORD           winError;
 
     /* Bind local address. Required for ConnectEx */
-    if (bind(tcpPtr->so, tcpPtr->addresses.inet.local->ai_addr,
-             (int) tcpPtr->addresses.inet.local->ai_addrlen) != 0) {
+    if (bind(so, localAddr->ai_addr, (int) localAddr->ai_addrlen) != 0) {
         return WSAGetLastError();
     }
 
@@ -248,7 +480,7 @@ static IocpWinError TcpClientPostConnect(
      * because strictly speaking it depends on the socket and
      * address family that map to a protocol driver.
      */
-    if (WSAIoctl(tcpPtr->so, SIO_GET_EXTENSION_FUNCTION_POINTER,
+    if (WSAIoctl(so, SIO_GET_EXTENSION_FUNCTION_POINTER,
                  &ConnectExGuid, sizeof(GUID),
                  &fnConnectEx,
                  sizeof(fnConnectEx),
@@ -256,7 +488,7 @@ static IocpWinError TcpClientPostConnect(
         fnConnectEx == NULL) {
         return WSAGetLastError();
     }
-    if (IocpAttachDefaultPort((HANDLE) tcpPtr->so) == NULL) {
+    if (IocpAttachDefaultPort((HANDLE) so) == NULL) {
         return GetLastError(); /* NOT WSAGetLastError() ! */
     }
 
@@ -265,10 +497,11 @@ static IocpWinError TcpClientPostConnect(
         return WSAENOBUFS;
 
     bufPtr->chanPtr    = WinsockClientToIocpChannel(tcpPtr);
+    bufPtr->context[0].so = so;
     tcpPtr->base.numRefs += 1; /* Reversed when buffer is unlinked from channel */
 
-    if (fnConnectEx(tcpPtr->so, tcpPtr->addresses.inet.remote->ai_addr,
-                    (int) tcpPtr->addresses.inet.remote->ai_addrlen,
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, bufPtr->chanPtr, 0, 0);
+    if (fnConnectEx(so, remoteAddr->ai_addr, (int) remoteAddr->ai_addrlen,
                     NULL, 0, &nbytes, &bufPtr->u.wsaOverlap) == FALSE) {
         winError = WSAGetLastError();
         if (winError != WSA_IO_PENDING) {
@@ -305,11 +538,15 @@ static void TcpClientFreeAddresses(
                                  * ensure no other threads can access. */
 {
     /* Potential addresses to use no longer needed when connection is open. */
-    if (tcpPtr->addresses.inet.remotes) {
+    if (tcpPtr->addresses.inet.remotesRefPtr) {
+        /* List may be shared with the address cache and other channels */
+        IocpResolvedAddrsRelease(tcpPtr->addresses.inet.remotesRefPtr);
+        tcpPtr->addresses.inet.remotesRefPtr = NULL;
+    } else if (tcpPtr->addresses.inet.remotes) {
         freeaddrinfo(tcpPtr->addresses.inet.remotes);
-        tcpPtr->addresses.inet.remotes = NULL;
-        tcpPtr->addresses.inet.remote  = NULL;
     }
+    tcpPtr->addresses.inet.remotes = NULL;
+    tcpPtr->addresses.inet.remote  = NULL;
     if (tcpPtr->addresses.inet.locals) {
         freeaddrinfo(tcpPtr->addresses.inet.locals);
         tcpPtr->addresses.inet.locals = NULL;
@@ -324,7 +561,11 @@ static void TcpClientFreeAddresses(
  * TcpClientBlockingConnect --
  *
  *    Attempt connection through each source destination address pair in
- *    blocking mode until one succeeds or all fail.
+ *    blocking mode until one succeeds or all fail. If racing connects are
+ *    enabled and there is more than one address to try, the attempts are
+ *    raced through the completion port as for async connects and the
+ *    function waits for the outcome. The same is done if the channel has a
+ *    connect timeout.
  *
  * Results:
  *    0 on success, other Windows error code.
@@ -337,6 +578,8 @@ static void TcpClientFreeAddresses(
  *    On failure, tcpPtr state is changed to CONNECT_FAILED and the returned
  *    error is also stored in tcpPtr->base.winError.
  *
+ *    For TLS channels, the handshake is completed before returning.
+ *
  *------------------------------------------------------------------------
  */
 static IocpWinError TcpClientBlockingConnect(
@@ -346,11 +589,36 @@ static IocpWinError TcpClientBlockingConnect(
     WinsockClient *tcpPtr = IocpChannelToWinsockClient(chanPtr);
     struct addrinfo *localAddr;
     struct addrinfo *remoteAddr;
-    DWORD  winError = WSAHOST_NOT_FOUND; /* In case address lists are empty */
+    DWORD  winError;
     SOCKET so = INVALID_SOCKET;
 
     IOCP_ASSERT(IocpIsInetClient(chanPtr));
 
+    /* A blocking connect() cannot be timed so go through the port */
+    if (tcpPtr->base.connectTimeout != 0)
+        return TcpClientTimedConnect(tcpPtr); /* Caller holds the lock */
+
+    if (TcpClientRaceInit(tcpPtr)) {
+        /* Caller holds the lock as required for waiting */
+        winError = TcpClientRaceStart(tcpPtr);
+        while (winError == ERROR_SUCCESS &&
+               tcpPtr->base.state == IOCP_STATE_CONNECTING) {
+            IocpChannelAwaitCompletion(chanPtr, IOCP_CHAN_F_BLOCKED_CONNECT);
+        }
+        if (tcpPtr->base.state == IOCP_STATE_CONNECTED &&
+            TcpClientBlockingConnected(chanPtr) == ERROR_SUCCESS) {
+            return ERROR_SUCCESS;
+        }
+        IocpChannelSetState(&tcpPtr->base, IOCP_STATE_CONNECT_FAILED);
+        return tcpPtr->base.winError;
+    }
+
+    /*
+     * Report the error from a previous async attempt if there are no
+     * addresses left to try.
+     */
+    winError = tcpPtr->base.winError ? tcpPtr->base.winError : WSAHOST_NOT_FOUND;
+
     /*
      * tcpPtr->addresses.inet.remote will hold the next remote address to try.
      * This is not necessarily the same as tcpPtr->addresses.inet.remotes
@@ -372,8 +640,7 @@ static IocpWinError TcpClientBlockingConnect(
         for (; localAddr; localAddr = localAddr->ai_next) {
             if (remoteAddr->ai_family != localAddr->ai_family)
                 continue;
-            so = socket(localAddr->ai_family, SOCK_STREAM, 0);
-            /* Note socket call, unlike WSASocket is overlapped by default */
+            so = TcpClientSocket(tcpPtr, localAddr->ai_family);
 
             if (so != INVALID_SOCKET &&
                 bind(so, localAddr->ai_addr, (int) localAddr->ai_addrlen) == 0 &&
@@ -382,8 +649,18 @@ static IocpWinError TcpClientBlockingConnect(
                 /* Sockets should not be inherited by children */
                 SetHandleInformation((HANDLE)so, HANDLE_FLAG_INHERIT, 0);
                 if (IocpAttachDefaultPort((HANDLE)so) != NULL) {
-                    tcpPtr->base.state = IOCP_STATE_OPEN;
                     tcpPtr->so = so;
+                    if (tcpPtr->tlsPtr) {
+                        winError = WinsockClientTlsHandshake(tcpPtr);
+                        if (winError == ERROR_IO_PENDING)
+                            winError = IocpChannelAwaitHandshake(chanPtr);
+                        if (winError != ERROR_SUCCESS) {
+                            /* Not specific to the address so do not try others */
+                            tcpPtr->so = INVALID_SOCKET;
+                            goto failed;
+                        }
+                    }
+                    IocpChannelSetState(&tcpPtr->base, IOCP_STATE_OPEN);
                     /*
                      * Clear any error stored during -async operation prior to
                      * blocking connect
@@ -405,8 +682,9 @@ static IocpWinError TcpClientBlockingConnect(
         }
     }
 
+failed:
     /* Failed to connect. Return an error */
-    tcpPtr->base.state    = IOCP_STATE_CONNECT_FAILED;
+    IocpChannelSetState(&tcpPtr->base, IOCP_STATE_CONNECT_FAILED);
     tcpPtr->base.winError = winError;
 
     if (so != INVALID_SOCKET)
@@ -422,7 +700,9 @@ static IocpWinError TcpClientBlockingConnect(
  *    Initiates an asynchronous TCP connection from the local address
  *    pointed to by tcpPtr->localAddr to the remote address tcpPtr->remoteAddr.
  *    One or both are updated to point to the next address (pair) to try
- *    next in case this attempt does not succeed.
+ *    next in case this attempt does not succeed. If racing connects are
+ *    enabled and there is more than one address to try, a race is started
+ *    instead.
  *
  * Results:
  *    0 if the connection was initiated successfully, otherwise Windows error
@@ -447,7 +727,10 @@ TcpClientInitiateConnection(
     IOCP_ASSERT(tcpPtr->base.state == IOCP_STATE_INIT || tcpPtr->base.state == IOCP_STATE_CONNECT_RETRY);
     IOCP_ASSERT(tcpPtr->so == INVALID_SOCKET);
 
-    tcpPtr->base.state = IOCP_STATE_CONNECTING;
+    if (TcpClientRaceInit(tcpPtr))
+        return TcpClientRaceStart(tcpPtr);
+
+    IocpChannelSetState(&tcpPtr->base, IOCP_STATE_CONNECTING);
 
     for ( ;
           tcpPtr->addresses.inet.remote;
@@ -459,14 +742,15 @@ TcpClientInitiateConnection(
 
             if (tcpPtr->addresses.inet.remote->ai_family != tcpPtr->addresses.inet.local->ai_family)
                 continue;
-            so = socket(tcpPtr->addresses.inet.local->ai_family, SOCK_STREAM, 0);
-            /* Note socket call, unlike WSASocket is overlapped by default */
+            so = TcpClientSocket(tcpPtr, tcpPtr->addresses.inet.local->ai_family);
 
             if (so != INVALID_SOCKET) {
                 /* Sockets should not be inherited by children */
                 SetHandleInformation((HANDLE)so, HANDLE_FLAG_INHERIT, 0);
                 tcpPtr->so = so;
-                winError = TcpClientPostConnect(tcpPtr);
+                winError = TcpClientPostConnect(tcpPtr, so,
+                                                tcpPtr->addresses.inet.local,
+                                                tcpPtr->addresses.inet.remote);
                 if (winError == ERROR_SUCCESS) {
                     /* Update so next attempt will be with next local addr */
                     tcpPtr->addresses.inet.local = tcpPtr->addresses.inet.local->ai_next;
@@ -488,7 +772,7 @@ TcpClientInitiateConnection(
     /*
      * Failed. We report the stored error in preference to error in current call.
      */
-    tcpPtr->base.state = IOCP_STATE_CONNECT_FAILED;
+    IocpChannelSetState(&tcpPtr->base, IOCP_STATE_CONNECT_FAILED);
     if (tcpPtr->base.winError == 0)
         tcpPtr->base.winError = winError;
     if (so != INVALID_SOCKET)
@@ -526,6 +810,582 @@ static IocpWinError TcpClientAsyncConnectFailed(
     return TcpClientInitiateConnection(tcpPtr);
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientTimedConnect --
+ *
+ *    Connects a blocking channel that has a connect timeout. The attempts
+ *    are made through the completion port as for async connects, trying
+ *    each address in turn, while the calling thread waits for the outcome
+ *    or for the timeout to fail the connect.
+ *
+ * Results:
+ *    0 on success, other Windows error code.
+ *
+ * Side effects:
+ *    As for TcpClientBlockingConnect. A timed out connect fails with
+ *    WSAETIMEDOUT.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError TcpClientTimedConnect(
+    WinsockClient *lockedTcpPtr) /* Must be locked as required for waiting */
+{
+    IocpChannel *lockedChanPtr = WinsockClientToIocpChannel(lockedTcpPtr);
+    IocpWinError winError;
+
+    if (lockedChanPtr->state == IOCP_STATE_CONNECT_RETRY)
+        winError = TcpClientAsyncConnectFailed(lockedChanPtr);
+    else
+        winError = TcpClientInitiateConnection(lockedTcpPtr);
+    if (winError == ERROR_SUCCESS)
+        winError = IocpChannelScheduleTimeouts(lockedChanPtr);
+
+    while (winError == ERROR_SUCCESS) {
+        if (lockedChanPtr->state == IOCP_STATE_CONNECTING)
+            IocpChannelAwaitCompletion(lockedChanPtr, IOCP_CHAN_F_BLOCKED_CONNECT);
+        else if (lockedChanPtr->state == IOCP_STATE_CONNECT_RETRY &&
+                 (lockedChanPtr->flags & IOCP_CHAN_F_CONNECT_TIMEDOUT) == 0)
+            winError = TcpClientAsyncConnectFailed(lockedChanPtr);
+        else
+            break;
+    }
+
+    if (lockedChanPtr->state == IOCP_STATE_CONNECTED &&
+        TcpClientBlockingConnected(lockedChanPtr) == ERROR_SUCCESS) {
+        return ERROR_SUCCESS;
+    }
+    IocpChannelSetState(lockedChanPtr, IOCP_STATE_CONNECT_FAILED);
+    if (lockedChanPtr->flags & IOCP_CHAN_F_CONNECT_TIMEDOUT)
+        lockedChanPtr->winError = WSAETIMEDOUT;
+    else if (lockedChanPtr->winError == ERROR_SUCCESS)
+        lockedChanPtr->winError = winError ? winError : WSAECONNREFUSED;
+    return lockedChanPtr->winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientBlockingConnected --
+ *
+ *    Completes a blocking connect once the channel is in CONNECTED state,
+ *    waiting for the handshake of TLS channels to finish.
+ *
+ * Results:
+ *    0 on success, other Windows error code.
+ *
+ * Side effects:
+ *    On success, the channel is moved to OPEN state.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError TcpClientBlockingConnected(
+    IocpChannel *lockedChanPtr) /* Must be locked as required for waiting */
+{
+    IocpWinError winError = lockedChanPtr->vtblPtr->connected(lockedChanPtr);
+
+    if (winError == ERROR_IO_PENDING)
+        return IocpChannelAwaitHandshake(lockedChanPtr);
+    if (winError == ERROR_SUCCESS) {
+        IocpChannelSetState(lockedChanPtr, IOCP_STATE_OPEN);
+        lockedChanPtr->winError = ERROR_SUCCESS;
+    }
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpSetConnectDelay --
+ * TcpGetConnectDelay --
+ *
+ *    Set and retrieve the delay after which racing connects start an
+ *    attempt to the next address. A delay of 0 disables racing so that
+ *    addresses are tried one after another.
+ *
+ * Results:
+ *    TcpGetConnectDelay returns the delay in milliseconds.
+ *
+ * Side effects:
+ *    The new delay applies to connects initiated afterwards.
+ *
+ *------------------------------------------------------------------------
+ */
+void TcpSetConnectDelay(DWORD delay)
+{
+    InterlockedExchange(&tcpConnectDelay, (LONG) delay);
+}
+
+DWORD TcpGetConnectDelay(void)
+{
+    return (DWORD) tcpConnectDelay;
+}
+
+/*
+ * Returns the first local address of the same family as remoteAddr or NULL
+ * if there is none. Each remote address is raced with only that one.
+ */
+static struct addrinfo *TcpClientRaceLocal(
+    WinsockClient   *tcpPtr,
+    struct addrinfo *remoteAddr)
+{
+    struct addrinfo *localAddr;
+    for (localAddr = tcpPtr->addresses.inet.locals;
+         localAddr;
+         localAddr = localAddr->ai_next) {
+        if (localAddr->ai_family == remoteAddr->ai_family)
+            return localAddr;
+    }
+    return NULL;
+}
+
+/*
+ * Returns the first remote address at or after remoteAddr that has a
+ * usable local address and whose family is (sameFamily true) or is not
+ * (sameFamily false) the specified one. NULL if none.
+ */
+static struct addrinfo *TcpClientRaceCandidate(
+    WinsockClient   *tcpPtr,
+    struct addrinfo *remoteAddr,
+    int              family,
+    int              sameFamily)
+{
+    for (; remoteAddr; remoteAddr = remoteAddr->ai_next) {
+        if ((remoteAddr->ai_family == family) == (sameFamily != 0) &&
+            TcpClientRaceLocal(tcpPtr, remoteAddr) != NULL)
+            return remoteAddr;
+    }
+    return NULL;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientRaceInit --
+ *
+ *    Sets up a racing connect for the remote addresses not yet tried if
+ *    racing is enabled and there is more than one of them. Attempts
+ *    alternate between the family of the first address and the others,
+ *    otherwise preserving the order returned by the resolver (RFC 8305
+ *    section 4).
+ *
+ * Results:
+ *    1 if a race was set up, else 0.
+ *
+ * Side effects:
+ *    tcpPtr->addresses.inet.racePtr is allocated.
+ *
+ *------------------------------------------------------------------------
+ */
+static int TcpClientRaceInit(
+    WinsockClient *tcpPtr)      /* Caller must ensure exclusivity */
+{
+    TcpConnectRace  *racePtr;
+    struct addrinfo *firstAddr, *sameAddr, *otherAddr;
+    DWORD            delay = TcpGetConnectDelay();
+    int              i, n, family;
+
+    IOCP_ASSERT(tcpPtr->addresses.inet.racePtr == NULL);
+    if (delay == 0)
+        return 0;
+
+    firstAddr = TcpClientRaceCandidate(tcpPtr, tcpPtr->addresses.inet.remote,
+                                       AF_UNSPEC, 0);
+    if (firstAddr == NULL)
+        return 0;
+    family = firstAddr->ai_family;
+    for (n = 0, sameAddr = firstAddr; sameAddr; sameAddr = sameAddr->ai_next) {
+        if (TcpClientRaceLocal(tcpPtr, sameAddr))
+            ++n;
+    }
+    if (n < 2)
+        return 0;
+
+    racePtr = ckalloc(offsetof(TcpConnectRace, attempts)
+                      + n * sizeof(racePtr->attempts[0]));
+    racePtr->timerPtr    = NULL;
+    racePtr->delay       = delay;
+    racePtr->numAttempts = n;
+    racePtr->nextAttempt = 0;
+    racePtr->numPending  = 0;
+
+    sameAddr  = firstAddr;
+    otherAddr = TcpClientRaceCandidate(tcpPtr, firstAddr, family, 0);
+    for (i = 0; i < n; ++i) {
+        struct addrinfo *remoteAddr;
+        if (otherAddr == NULL || (sameAddr != NULL && (i & 1) == 0)) {
+            remoteAddr = sameAddr;
+            sameAddr = TcpClientRaceCandidate(tcpPtr, sameAddr->ai_next,
+                                              family, 1);
+        } else {
+            remoteAddr = otherAddr;
+            otherAddr = TcpClientRaceCandidate(tcpPtr, otherAddr->ai_next,
+                                               family, 0);
+        }
+        racePtr->attempts[i].remote = remoteAddr;
+        racePtr->attempts[i].local  = TcpClientRaceLocal(tcpPtr, remoteAddr);
+        racePtr->attempts[i].so     = INVALID_SOCKET;
+    }
+
+    tcpPtr->addresses.inet.racePtr = racePtr;
+    return 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientRaceStart --
+ *
+ *    Starts the first attempt of the race set up by TcpClientRaceInit.
+ *
+ * Results:
+ *    0 if an attempt was started, otherwise Windows error code which is
+ *    also stored in tcpPtr->base.winError.
+ *
+ * Side effects:
+ *    State is changed to CONNECTING on success or CONNECT_FAILED if no
+ *    attempt could be started in which case the race is freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError TcpClientRaceStart(
+    WinsockClient *lockedTcpPtr) /* Must be locked or otherwise exclusive */
+{
+    IocpWinError winError;
+
+    IocpChannelSetState(&lockedTcpPtr->base, IOCP_STATE_CONNECTING);
+    winError = TcpClientRaceNext(lockedTcpPtr);
+    if (winError != ERROR_SUCCESS) {
+        TcpClientRaceFree(lockedTcpPtr);
+        lockedTcpPtr->addresses.inet.remote = NULL; /* Nothing left to try */
+        IocpChannelSetState(&lockedTcpPtr->base, IOCP_STATE_CONNECT_FAILED);
+        lockedTcpPtr->base.winError = winError;
+    }
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientRaceNext --
+ *
+ *    Starts the next attempt in a race, skipping any that fail to post,
+ *    and arms a timer to start the one after if any remain.
+ *
+ * Results:
+ *    0 if an attempt was started, else the Windows error code from the
+ *    last attempt.
+ *
+ * Side effects:
+ *    Any current stagger timer is superseded.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError TcpClientRaceNext(
+    WinsockClient *lockedTcpPtr) /* Must be locked */
+{
+    TcpConnectRace *racePtr  = lockedTcpPtr->addresses.inet.racePtr;
+    IocpWinError    winError = WSAHOST_NOT_FOUND;
+    TcpRaceTimer   *timerPtr;
+
+    racePtr->timerPtr = NULL;
+    while (racePtr->nextAttempt < racePtr->numAttempts) {
+        TcpConnectAttempt *attemptPtr = &racePtr->attempts[racePtr->nextAttempt++];
+        SOCKET so = TcpClientSocket(lockedTcpPtr, attemptPtr->remote->ai_family);
+        if (so == INVALID_SOCKET) {
+            winError = WSAGetLastError();
+            continue;
+        }
+        /* Sockets should not be inherited by children */
+        SetHandleInformation((HANDLE)so, HANDLE_FLAG_INHERIT, 0);
+        winError = TcpClientPostConnect(lockedTcpPtr, so, attemptPtr->local,
+                                        attemptPtr->remote);
+        if (winError != ERROR_SUCCESS) {
+            closesocket(so);
+            continue;
+        }
+        attemptPtr->so = so;
+        racePtr->numPending += 1;
+        IOCP_COUNTER_INCR(IocpConnectRaceAttempts);
+        break;
+    }
+    if (winError != ERROR_SUCCESS)
+        return winError;
+
+    if (racePtr->nextAttempt < racePtr->numAttempts) {
+        /*
+         * On failure to create the timer, the next attempt is only started
+         * when the current one fails.
+         */
+        timerPtr = ckalloc(sizeof(*timerPtr));
+        timerPtr->tcpPtr = lockedTcpPtr;
+        lockedTcpPtr->base.numRefs += 1; /* Reversed when the timer fires */
+        if (CreateTimerQueueTimer(&timerPtr->timer, NULL,
+                                  TcpClientRaceTimerFired, timerPtr,
+                                  racePtr->delay, 0, WT_EXECUTEONLYONCE)) {
+            racePtr->timerPtr = timerPtr;
+        } else {
+            lockedTcpPtr->base.numRefs -= 1;
+            ckfree(timerPtr);
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientRaceTimerFired --
+ *
+ *    Timer callback that starts the next attempt in a race unless the
+ *    timer has been superseded or the race is over.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The timer and its channel reference are released.
+ *
+ *------------------------------------------------------------------------
+ */
+static VOID CALLBACK
+TcpClientRaceTimerFired(
+    PVOID   contextPtr,
+    BOOLEAN timerFired)
+{
+    TcpRaceTimer   *timerPtr = contextPtr;
+    WinsockClient  *tcpPtr   = timerPtr->tcpPtr;
+    TcpConnectRace *racePtr;
+
+    IocpChannelLock(WinsockClientToIocpChannel(tcpPtr));
+    racePtr = tcpPtr->addresses.inet.racePtr;
+    if (racePtr && racePtr->timerPtr == timerPtr &&
+        tcpPtr->base.state == IOCP_STATE_CONNECTING) {
+        /* Earlier attempts still in flight so a failure here is not final */
+        (void) TcpClientRaceNext(tcpPtr);
+    }
+    /* Not waiting since this is the callback itself. */
+    DeleteTimerQueueTimer(NULL, timerPtr->timer, NULL);
+    ckfree(timerPtr);
+    IocpChannelDrop(WinsockClientToIocpChannel(tcpPtr));
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientRaceFree --
+ *
+ *    Ends a race, closing the sockets of attempts still in flight. Their
+ *    completions are ignored when they arrive.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The race is freed and any stagger timer superseded.
+ *
+ *------------------------------------------------------------------------
+ */
+static void TcpClientRaceFree(
+    WinsockClient *lockedTcpPtr) /* Must be locked or otherwise exclusive */
+{
+    TcpConnectRace *racePtr = lockedTcpPtr->addresses.inet.racePtr;
+    int i;
+
+    for (i = 0; i < racePtr->nextAttempt; ++i) {
+        if (racePtr->attempts[i].so != INVALID_SOCKET)
+            closesocket(racePtr->attempts[i].so);
+    }
+    ckfree(racePtr);
+    lockedTcpPtr->addresses.inet.racePtr = NULL;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientConnectCompleted --
+ *
+ *    Called from the completion thread when a connect completes in
+ *    CONNECTING state. Follows the API defined by connectcompleted() in
+ *    the IocpChannel vtbl. Completions for connects that are not part of a
+ *    race are left to the default handling. In a race, the first success
+ *    wins and its socket becomes the channel socket. A failure starts the
+ *    next attempt without waiting for the stagger timer and is only
+ *    passed on once all attempts have failed.
+ *
+ *    In HANDSHAKING state, completions of the TLS handshake I/O are passed
+ *    to WinsockClientTlsHandshakeCompleted. Those are told apart from late
+ *    completions of abandoned race attempts by their socket.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if the completion was consumed, else 0. In
+ *    HANDSHAKING state, see WinsockClientTlsHandshakeCompleted.
+ *
+ * Side effects:
+ *    Connect attempts may be started or closed.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError TcpClientConnectCompleted(
+    IocpChannel *lockedChanPtr, /* Locked on entry, locked on return */
+    IocpBuffer  *bufPtr)        /* Completed connect */
+{
+    WinsockClient  *tcpPtr  = IocpChannelToWinsockClient(lockedChanPtr);
+    TcpConnectRace *racePtr = tcpPtr->addresses.inet.racePtr;
+    SOCKET          so      = bufPtr->context[0].so;
+    int             i;
+
+    if (lockedChanPtr->state == IOCP_STATE_HANDSHAKING) {
+        if (so != tcpPtr->so || tcpPtr->tlsPtr == NULL)
+            return ERROR_IO_PENDING; /* Not handshake I/O. Ignore */
+        return WinsockClientTlsHandshakeCompleted(tcpPtr, bufPtr);
+    }
+
+    if (racePtr == NULL)
+        return so == tcpPtr->so ? 0 : ERROR_IO_PENDING;
+
+    for (i = 0; i < racePtr->nextAttempt; ++i) {
+        if (racePtr->attempts[i].so == so)
+            break;
+    }
+    if (i == racePtr->nextAttempt)
+        return ERROR_IO_PENDING; /* Socket already closed. Ignore */
+    racePtr->attempts[i].so = INVALID_SOCKET;
+    racePtr->numPending -= 1;
+
+    if (bufPtr->winError == ERROR_SUCCESS) {
+        tcpPtr->so = so;
+        tcpPtr->addresses.inet.remote = racePtr->attempts[i].remote;
+        tcpPtr->addresses.inet.local  = racePtr->attempts[i].local;
+        if (i > 0)
+            IOCP_COUNTER_INCR(IocpConnectRaceFallbacks);
+        TcpClientRaceFree(tcpPtr);
+        return 0;               /* Channel will transition to CONNECTED */
+    }
+
+    closesocket(so);
+    tcpPtr->base.winError = bufPtr->winError;
+    if (TcpClientRaceNext(tcpPtr) == ERROR_SUCCESS || racePtr->numPending > 0)
+        return ERROR_IO_PENDING;
+
+    /* All attempts failed. Let the channel go to CONNECT_RETRY and fail. */
+    TcpClientRaceFree(tcpPtr);
+    tcpPtr->addresses.inet.remote = NULL; /* Nothing left to try */
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientConnectTimedOut --
+ *
+ *    Called from the timer wheel when the connect timeout expires. Follows
+ *    the API defined by connecttimedout() in the IocpChannel vtbl. The
+ *    attempts of a race are posted on their own sockets, not the channel
+ *    socket, so the race is ended here to close them.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Any racing connect is freed. Stagger timers still pending find the
+ *    race gone and do nothing beyond releasing their reference.
+ *
+ *------------------------------------------------------------------------
+ */
+static void TcpClientConnectTimedOut(
+    IocpChannel *lockedChanPtr) /* Locked on entry, locked on return */
+{
+    WinsockClient *tcpPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if (tcpPtr->addresses.inet.racePtr)
+        TcpClientRaceFree(tcpPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientShutdown --
+ *
+ *    Conforms to the IocpChannel shutdown interface. Abandons any racing
+ *    connect on a full close before the Winsock shutdown.
+ *
+ * Results:
+ *    0 on success, else a POSIX error code.
+ *
+ * Side effects:
+ *    The Windows socket is closed in direction(s) specified by flags.
+ *
+ *------------------------------------------------------------------------
+ */
+static int TcpClientShutdown(
+    Tcl_Interp  *interp,        /* May be NULL */
+    IocpChannel *lockedChanPtr, /* Locked pointer to the base IocpChannel */
+    int          flags)         /* Combination of TCL_CLOSE_{READ,WRITE} */
+{
+    WinsockClient *tcpPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if ((flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE)) == (TCL_CLOSE_READ|TCL_CLOSE_WRITE) &&
+        tcpPtr->addresses.inet.racePtr) {
+        TcpClientRaceFree(tcpPtr);
+    }
+    return WinsockClientShutdown(interp, lockedChanPtr, flags);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpClientResolved --
+ *
+ *    Called from a thread pool thread when the asynchronous lookup of the
+ *    remote addresses of a channel in RESOLVING state completes. Initiates
+ *    the connection on success. Follows the IocpResolveDoneProc prototype.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The channel moves to CONNECTING or CONNECT_FAILED state and the
+ *    owning thread is notified. The reference held by the lookup is
+ *    released.
+ *
+ *------------------------------------------------------------------------
+ */
+static void TcpClientResolved(
+    ClientData         clientData,  /* WinsockClient with a reference held
+                                     * by the lookup */
+    IocpResolvedAddrs *resolvedPtr, /* Counted reference to addresses. NULL
+                                     * on failure */
+    IocpWinError       winError)    /* Lookup status */
+{
+    WinsockClient *tcpPtr = (WinsockClient *) clientData;
+
+    IocpChannelLock(WinsockClientToIocpChannel(tcpPtr));
+    if (tcpPtr->base.state != IOCP_STATE_RESOLVING) {
+        /* Channel was closed while the lookup was in progress. */
+        if (resolvedPtr)
+            IocpResolvedAddrsRelease(resolvedPtr);
+    } else {
+        if (winError == ERROR_SUCCESS) {
+            tcpPtr->addresses.inet.remotesRefPtr = resolvedPtr;
+            tcpPtr->addresses.inet.remotes = resolvedPtr->addrs;
+            tcpPtr->addresses.inet.remote  = resolvedPtr->addrs;
+            IocpChannelSetState(&tcpPtr->base, IOCP_STATE_INIT);
+            winError = TcpClientInitiateConnection(tcpPtr);
+        }
+        if (winError != ERROR_SUCCESS) {
+            IocpChannelSetState(&tcpPtr->base, IOCP_STATE_CONNECT_FAILED);
+            tcpPtr->base.winError = winError;
+            tcpPtr->base.flags   |= IOCP_CHAN_F_REMOTE_EOF;
+        }
+        /* As for connect completions, force a notification. */
+        IocpChannelNudgeThread(WinsockClientToIocpChannel(tcpPtr),
+                               IOCP_CHAN_F_BLOCKED_CONNECT, 1);
+    }
+    IocpChannelDrop(WinsockClientToIocpChannel(tcpPtr));
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -550,15 +1410,25 @@ Iocp_OpenTcpClient(
     const char *host,		/* Host on which to open port. */
     const char *myaddr,		/* Client-side address */
     int myport,			/* Client-side port */
-    int async)			/* If nonzero, attempt to do an asynchronous
+    int async,			/* If nonzero, attempt to do an asynchronous
                  * connect. Otherwise we do a blocking
                  * connect. */
+    int rio,			/* If nonzero, use registered I/O if
+                 * available */
+    Tcl_Obj *tlsObj,		/* If not NULL, TLS options. The connection
+                 * is then secured with TLS */
+    int connectTimeout)		/* Milliseconds after which the connect
+                 * fails. 0 => no timeout */
 {
     const char *errorMsg = NULL;
-    struct addrinfo *remoteAddrs = NULL, *localAddrs = NULL;
+    struct addrinfo *localAddrs = NULL;
+    IocpResolvedAddrs *remotesRefPtr = NULL;
     WinsockClient *tcpPtr = NULL;
+    IocpTls       *tlsPtr = NULL;
     Tcl_Channel     channel;
     IocpWinError winError;
+    Tcl_DString  nativeHost;
+    int          family;
 
 #ifdef TBD
 
@@ -578,12 +1448,29 @@ Iocp_OpenTcpClient(
 #endif
 
     /*
-     * Do the name lookups for the local and remote addresses.
+     * Do the name lookups for the local and remote addresses. For async
+     * connects, the remote lookup is deferred to a thread pool thread
+     * unless the addresses are cached. The local address is still
+     * resolved here as it is normally a literal address or absent.
      */
 
-    if (!TclCreateSocketAddress(interp, &remoteAddrs, host, port, 0, &errorMsg)
-            || !TclCreateSocketAddress(interp, &localAddrs, myaddr, myport, 1,
-                    &errorMsg)) {
+    family = IocpResolveFamily(interp);
+    Tcl_UtfToExternalDString(NULL, host, -1, &nativeHost);
+    if (async) {
+        remotesRefPtr = IocpResolveCached(Tcl_DStringValue(&nativeHost),
+                                          port, family);
+        winError = ERROR_SUCCESS;
+    } else {
+        winError = IocpResolve(Tcl_DStringValue(&nativeHost), port, family,
+                               &remotesRefPtr);
+    }
+    if (winError != ERROR_SUCCESS) {
+        errorMsg = gai_strerrorA(winError);
+    } else {
+        (void) TclCreateSocketAddress(interp, &localAddrs, myaddr, myport, 1,
+                                      &errorMsg);
+    }
+    if (errorMsg != NULL) {
         if (interp != NULL) {
             Tcl_SetObjResult(interp, Tcl_ObjPrintf(
                     "couldn't resolve addresses: %s", errorMsg));
@@ -591,20 +1478,48 @@ Iocp_OpenTcpClient(
         goto fail;
     }
 
-    tcpPtr = (WinsockClient *) IocpChannelNew(&tcpClientVtbl);
+    if (rio && ! IocpRioAvailable())
+        rio = 0;                /* Silently fall back to overlapped I/O */
+    if (tlsObj && IocpTlsNew(interp, tlsObj, host, &tlsPtr) != TCL_OK)
+        goto fail;
+    tcpPtr = (WinsockClient *) IocpChannelNew(
+        tlsPtr ? &tcpTlsClientVtbl : (rio ? &tcpRioClientVtbl : &tcpClientVtbl));
     if (tcpPtr == NULL) {
         if (interp != NULL) {
             Tcl_SetResult(interp, "couldn't allocate WinsockClient", TCL_STATIC);
         }
         goto fail;
     }
-    tcpPtr->addresses.inet.remotes = remoteAddrs;
-    tcpPtr->addresses.inet.remote  = remoteAddrs; /* First in remote address list */
+    tcpPtr->tlsPtr = tlsPtr;
+    tlsPtr = NULL;              /* Now owned by tcpPtr */
+    if (connectTimeout > 0) {
+        tcpPtr->base.connectTimeout  = connectTimeout;
+        tcpPtr->base.connectDeadline = GetTickCount64() + connectTimeout;
+    }
+    if (remotesRefPtr) {
+        tcpPtr->addresses.inet.remotesRefPtr = remotesRefPtr;
+        tcpPtr->addresses.inet.remotes = remotesRefPtr->addrs;
+        tcpPtr->addresses.inet.remote  = remotesRefPtr->addrs; /* First in list */
+        remotesRefPtr = NULL;   /* Now owned by tcpPtr */
+    }
     tcpPtr->addresses.inet.locals  = localAddrs;
     tcpPtr->addresses.inet.local   = localAddrs;  /* First in local address list */
+    localAddrs = NULL;          /* Now owned by tcpPtr */
 
     IocpChannelLock(WinsockClientToIocpChannel(tcpPtr));
-    if (async) {
+    if (async && tcpPtr->addresses.inet.remotes == NULL) {
+        /* Connection initiated by TcpClientResolved once lookup completes */
+        IocpChannelSetState(&tcpPtr->base, IOCP_STATE_RESOLVING);
+        tcpPtr->base.numRefs += 1; /* Reversed by TcpClientResolved */
+        winError = IocpResolveAsync(Tcl_DStringValue(&nativeHost), port,
+                                    family, TcpClientResolved, tcpPtr);
+        if (winError != ERROR_SUCCESS) {
+            tcpPtr->base.numRefs -= 1;
+            Iocp_ReportWindowsError(interp, winError, "couldn't resolve addresses: ");
+            goto fail;
+        }
+    }
+    else if (async) {
         winError = TcpClientInitiateConnection(tcpPtr);
         if (winError != ERROR_SUCCESS) {
             IocpSetInterpPosixErrorFromWin32(interp, winError, gSocketOpenErrorMessage);
@@ -614,7 +1529,11 @@ Iocp_OpenTcpClient(
     else {
         winError = TcpClientBlockingConnect( WinsockClientToIocpChannel(tcpPtr) );
         if (winError != ERROR_SUCCESS) {
-            IocpSetInterpPosixErrorFromWin32(interp, winError, gSocketOpenErrorMessage);
+            if (tcpPtr->tlsPtr && IocpTlsError(tcpPtr->tlsPtr) != 0)
+                Iocp_ReportWindowsError(interp, IocpTlsError(tcpPtr->tlsPtr),
+                                        "TLS handshake failed: ");
+            else
+                IocpSetInterpPosixErrorFromWin32(interp, winError, gSocketOpenErrorMessage);
             goto fail;
         }
         TcpClientFreeAddresses(tcpPtr); /* Free unneeded memory */
@@ -624,7 +1543,16 @@ Iocp_OpenTcpClient(
             goto fail;
         }
     }
+    if (async && connectTimeout > 0) {
+        /* Async connects are failed by the timer once the deadline passes */
+        winError = IocpChannelScheduleTimeouts(WinsockClientToIocpChannel(tcpPtr));
+        if (winError != ERROR_SUCCESS) {
+            Iocp_ReportWindowsError(interp, winError, "couldn't start connect timer: ");
+            goto fail;
+        }
+    }
     IocpChannelUnlock(WinsockClientToIocpChannel(tcpPtr));
+    Tcl_DStringFree(&nativeHost);
 
     /*
      * At this point, the completion thread may have modified tcpPtr and
@@ -684,17 +1612,24 @@ fail:
      * Failure exit. If tcpPtr is allocated, it must be locked when
      * jumping here.
      */
+    Tcl_DStringFree(&nativeHost);
     if (tcpPtr) {
+        /* Make a pending lookup completion discard its result */
+        if (tcpPtr->base.state == IOCP_STATE_RESOLVING)
+            IocpChannelSetState(&tcpPtr->base, IOCP_STATE_CLOSED);
         /* Also frees attached {local,remote}Addrs */
         IocpChannelDrop(WinsockClientToIocpChannel(tcpPtr));
     }
     else {
-        if (remoteAddrs != NULL) {
-            freeaddrinfo(remoteAddrs);
+        if (remotesRefPtr != NULL) {
+            IocpResolvedAddrsRelease(remotesRefPtr);
         }
         if (localAddrs != NULL) {
             freeaddrinfo(localAddrs);
         }
+        if (tlsPtr != NULL) {
+            IocpTlsFree(tlsPtr);
+        }
     }
     return NULL;
 }
@@ -723,6 +1658,11 @@ void TcpListenerCloseSockets(
         for (i = 0; i < tcpPtr->numListeners; ++i) {
             if (tcpPtr->listeners[i].so != INVALID_SOCKET)
                 closesocket(tcpPtr->listeners[i].so);
+            if (tcpPtr->listeners[i].poolPtr) {
+                /* Connections still open close their sockets on disconnect */
+                WinsockSocketPoolResize(tcpPtr->listeners[i].poolPtr, 0);
+                WinsockSocketPoolRelease(tcpPtr->listeners[i].poolPtr);
+            }
         }
         ckfree(tcpPtr->listeners);
         tcpPtr->listeners = NULL;
@@ -750,6 +1690,15 @@ static void TcpListenerInit(IocpChannel *chanPtr)
     TcpListener *tcpPtr = IocpChannelToTcpListener(chanPtr);
     tcpPtr->numListeners = 0;
     tcpPtr->listeners = NULL;
+    tcpPtr->inlineCompletion = 0;
+    tcpPtr->rio = 0;
+    tcpPtr->readMode = IOCP_WINSOCK_READ_BUFFERED;
+    tcpPtr->idleTimeout = IOCP_WINSOCK_IDLE_TIMEOUT_DEFAULT;
+    tcpPtr->readTimeout = 0;
+    tcpPtr->acceptReadSize = 0;
+    tcpPtr->minPendingAccepts = IOCP_ACCEPT_MIN_PENDING_DEFAULT;
+    tcpPtr->maxPendingAccepts = IOCP_ACCEPT_MAX_PENDING_DEFAULT;
+    tcpPtr->workerPoolPtr = NULL;
 }
 
 /*
@@ -785,6 +1734,12 @@ static void TcpListenerFinit(
     }
 
     TcpListenerCloseSockets(tcpPtr);
+
+    if (tcpPtr->workerPoolPtr) {
+        /* Workers exit as their connections close */
+        IocpWorkerPoolRelease(tcpPtr->workerPoolPtr);
+        tcpPtr->workerPoolPtr = NULL;
+    }
 }
 
 /*
@@ -821,6 +1776,11 @@ static int TcpListenerShutdown(
  *    New channels are constructed for these connections and the
  *    application callback invoked.
  *
+ *    Completions are drained in batches of up to IOCP_ACCEPT_BATCH_SIZE.
+ *    New accepts are posted for a batch before any of its callbacks are
+ *    invoked so the listening sockets are not left short of accepts while
+ *    the application handles the new connections.
+ *
  *    Conforms to the IocpChannel accept interface.
  *
  * Results:
@@ -838,6 +1798,9 @@ IocpWinError TcpListenerAccept(
 {
     TcpListener *lockedTcpPtr = IocpChannelToTcpListener(lockedChanPtr);
     IocpLink *linkPtr;
+    TcpAcceptedConnection accepted[IOCP_ACCEPT_BATCH_SIZE];
+    int numAccepted;
+    int i;
 
     if (lockedChanPtr->channel == NULL) {
         /*
@@ -850,153 +1813,251 @@ IocpWinError TcpListenerAccept(
     IOCP_ASSERT(lockedChanPtr->state == IOCP_STATE_LISTENING); /* Else logic awry */
 
     /* Accepts are queued on the input queue. */
-    while ((linkPtr = IocpListPopFront(&lockedChanPtr->inputBuffers)) != NULL) {
-        IocpBuffer *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
-        SOCKET      connSocket;
-        SOCKADDR   *localAddrPtr, *remoteAddrPtr;
-        int         localAddrLen, remoteAddrLen;
-        int         listenerIndex = bufPtr->context[1].i;
-        WinsockClient  *dataChanPtr;
-        Tcl_Channel channel;
-        TcpListeningSocket *listenerPtr;
-        IocpWinError        winError;
-        IocpSockaddr     localAddr, remoteAddr;
-
-        IOCP_ASSERT(bufPtr->operation == IOCP_BUFFER_OP_ACCEPT);
-
-        /*
-         * Although the lockedChanPtr will be valid because of the reference
-         * caller is supposed to be holding, because it is unlocked during
-         * the accept callback, the listening socket(s) may have been closed.
-         */
-        /* TBD - do we need to check both listeners AND numListeners? */
-        if (lockedTcpPtr->listeners == NULL ||
-            listenerIndex >= lockedTcpPtr->numListeners) {
-            IocpBufferFree(bufPtr);
-            break;
-        }
+    while (IocpChannelTakeInput(lockedChanPtr)) {
+        numAccepted = 0;
+        while (numAccepted < IOCP_ACCEPT_BATCH_SIZE &&
+               (linkPtr = IocpListPopFront(&lockedChanPtr->inputBuffers)) != NULL) {
+            IocpBuffer *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+            SOCKET      connSocket;
+            SOCKADDR   *localAddrPtr, *remoteAddrPtr;
+            int         localAddrLen, remoteAddrLen;
+            int         listenerIndex = bufPtr->context[1].i;
+            int         socketFlags;
+            TcpAcceptBuffer *acceptPtr;
+            WinsockClient  *dataChanPtr;
+            Tcl_Channel channel;
+            TcpListeningSocket *listenerPtr;
+            IocpWinError        winError;
+            IocpSockaddr     localAddr, remoteAddr;
+            const char      *numericHost;
+
+            IOCP_ASSERT(bufPtr->operation == IOCP_BUFFER_OP_ACCEPT);
 
-        /* The listener that did the accept */
-        listenerPtr = &lockedTcpPtr->listeners[listenerIndex];
-
-        IOCP_ASSERT(listenerPtr->pendingAcceptPosts > 0);
-        listenerPtr->pendingAcceptPosts -= 1;
-
-        /* connSocket is the socket for a new connection. */
-        connSocket  = bufPtr->context[0].so;
-        bufPtr->context[0].so = INVALID_SOCKET;
+            /*
+             * Although the lockedChanPtr will be valid because of the reference
+             * caller is supposed to be holding, because it is unlocked during
+             * the accept callback, the listening socket(s) may have been closed.
+             */
+            /* TBD - do we need to check both listeners AND numListeners? */
+            if (lockedTcpPtr->listeners == NULL ||
+                listenerIndex >= lockedTcpPtr->numListeners) {
+                if (bufPtr->context[0].so != INVALID_SOCKET)
+                    closesocket(bufPtr->context[0].so);
+                IocpBufferFree(bufPtr);
+                continue;
+            }
 
-        /* Retrieve the connection addresses */
-        listenerPtr->_GetAcceptExSockaddrs(
-            bufPtr->data.bytes,
-            0,
-            IOCP_ACCEPT_ADDRESS_LEN,
-            IOCP_ACCEPT_ADDRESS_LEN,
-            &localAddrPtr, &localAddrLen,
-            &remoteAddrPtr, &remoteAddrLen
-            );
+            /* The listener that did the accept */
+            listenerPtr = &lockedTcpPtr->listeners[listenerIndex];
+
+            IOCP_ASSERT(listenerPtr->pendingAcceptPosts > 0);
+            listenerPtr->pendingAcceptPosts -= 1;
+            listenerPtr->batchAccepts       += 1; /* Replenished below */
+
+            /* connSocket is the socket for a new connection. */
+            connSocket  = bufPtr->context[0].so;
+            bufPtr->context[0].so = INVALID_SOCKET;
+            acceptPtr   = (TcpAcceptBuffer *)bufPtr->data.bytes;
+            socketFlags = acceptPtr->socketFlags;
+
+            /* Retrieve the connection addresses */
+            listenerPtr->_GetAcceptExSockaddrs(
+                acceptPtr->output,
+                acceptPtr->receiveSize,
+                IOCP_ACCEPT_ADDRESS_LEN,
+                IOCP_ACCEPT_ADDRESS_LEN,
+                &localAddrPtr, &localAddrLen,
+                &remoteAddrPtr, &remoteAddrLen
+                );
 
-        /*
-         * Copy these before freeing bufPtr as localAddrPtr etc. point into
-         * bufPtr data buffer. Note the memcpy needed because structures
-         * can't just be assigned since although GetAcceptExSockaddres
-         * params are SOCKADDR*, they actually are not (can be biffer for ipv6).
-         */
-        IOCP_ASSERT(sizeof(localAddr) >= localAddrLen);
-        IOCP_ASSERT(sizeof(remoteAddr) >= remoteAddrLen);
-        memcpy(&localAddr, localAddrPtr, localAddrLen);
-        memcpy(&remoteAddr, remoteAddrPtr, remoteAddrLen);
-
-        /* Required so future getsockname and getpeername work */
-        setsockopt(connSocket, SOL_SOCKET,
-                   SO_UPDATE_ACCEPT_CONTEXT, (char *)&listenerPtr->so,
-                   sizeof(SOCKET));
+            /*
+             * Copy these before freeing bufPtr as localAddrPtr etc. point into
+             * bufPtr data buffer. Note the memcpy needed because structures
+             * can't just be assigned since although GetAcceptExSockaddres
+             * params are SOCKADDR*, they actually are not (can be biffer for ipv6).
+             */
+            IOCP_ASSERT(sizeof(localAddr) >= localAddrLen);
+            IOCP_ASSERT(sizeof(remoteAddr) >= remoteAddrLen);
+            memcpy(&localAddr, localAddrPtr, localAddrLen);
+            memcpy(&remoteAddr, remoteAddrPtr, remoteAddrLen);
+
+            /* Required so future getsockname and getpeername work */
+            setsockopt(connSocket, SOL_SOCKET,
+                       SO_UPDATE_ACCEPT_CONTEXT, (char *)&listenerPtr->so,
+                       sizeof(SOCKET));
+
+            if (bufPtr->data.len > 0) {
+                /*
+                 * Data was received with the connection. The buffer is passed
+                 * on as is to the new channel below as its first input.
+                 */
+                bufPtr->operation  = IOCP_BUFFER_OP_READ;
+                bufPtr->data.begin = (int) offsetof(TcpAcceptBuffer, output);
+                IOCP_COUNTER_INCR(IocpAcceptsWithData);
+            }
+            else {
+                /* Goes back to the buffer pool for reuse by the next accept. */
+                IocpBufferFree(bufPtr);
+                bufPtr = NULL;
+            }
 
-        /* TBD - reuse the buffer for the next accept. May use outputBuffers as queue */
-        IocpBufferFree(bufPtr);
-        bufPtr = NULL;
+            /* Recycled sockets remain attached to the completion port */
+            if (socketFlags < 0 &&
+                IocpAttachDefaultPort((HANDLE) connSocket) == NULL) {
+                /* TBD - notify background error ? */
+                closesocket(connSocket);
+                if (bufPtr)
+                    IocpBufferFree(bufPtr);
+                continue;
+            }
 
- 
-    if (IocpAttachDefaultPort((HANDLE) connSocket) == NULL) {
-            /* TBD - notify background error ? */
-            closesocket(connSocket);
-            continue;
-        }
+            dataChanPtr = (WinsockClient *) IocpChannelNew(
+                lockedTcpPtr->rio ? &tcpRioClientVtbl : &tcpClientVtbl);
+            if (dataChanPtr == NULL) {
+                /* TBD - notify background error ? */
+                closesocket(connSocket);
+                if (bufPtr)
+                    IocpBufferFree(bufPtr);
+                continue;
+            }
+            dataChanPtr->so = connSocket;
+            IocpChannelSetState(&dataChanPtr->base, IOCP_STATE_OPEN);
+            /* Saves retrieving and formatting them again on every query */
+            WinsockClientSetEndpoints(dataChanPtr, &localAddr, localAddrLen,
+                                      &remoteAddr, remoteAddrLen);
+            numericHost = WinsockEndpointNumericHost(&dataChanPtr->remoteEndpoint);
+            strcpy_s(accepted[numAccepted].host, sizeof(accepted[numAccepted].host),
+                     numericHost ? numericHost : "");
+            accepted[numAccepted].port =
+                WinsockEndpointPort(&dataChanPtr->remoteEndpoint);
+            if (bufPtr) {
+                /* Not yet visible to any other thread so no lock needed */
+                IocpListAppend(&dataChanPtr->base.inputBuffers, &bufPtr->link);
+                IocpChannelAddInputBytes(&dataChanPtr->base, IocpBufferLength(bufPtr));
+                bufPtr = NULL;
+            }
+            if (socketFlags > 0)
+                dataChanPtr->flags |= socketFlags;
+            if (listenerPtr->poolPtr &&
+                WinsockSocketPoolCapacity(listenerPtr->poolPtr) > 0) {
+                WinsockSocketPoolRetain(listenerPtr->poolPtr);
+                dataChanPtr->recyclePoolPtr = listenerPtr->poolPtr;
+            }
+            if (lockedTcpPtr->inlineCompletion) {
+                /* Failure is not fatal. Completions just go through the port. */
+                (void) WinsockClientEnableInlineCompletion(
+                    WinsockClientToIocpChannel(dataChanPtr));
+            }
+            dataChanPtr->idleTimeout = lockedTcpPtr->idleTimeout;
+            /* Timer is armed when reads are first posted */
+            dataChanPtr->base.readTimeout = lockedTcpPtr->readTimeout;
+            /* Failure is not fatal. Reads are then simply buffered. */
+            (void) WinsockClientSetReadMode(WinsockClientToIocpChannel(dataChanPtr),
+                                            lockedTcpPtr->readMode);
+
+            if (lockedTcpPtr->workerPoolPtr) {
+                /*
+                 * The worker creates the Tcl channel, posts reads and runs
+                 * the accept script. On failure the connection is handled
+                 * in this thread. The worker is picked by load alone and is
+                 * passed the numeric address formatted above, so nothing on
+                 * this path waits on a resolver.
+                 */
+                if (IocpWorkerPoolDispatch(lockedTcpPtr->workerPoolPtr,
+                                           WinsockClientToIocpChannel(dataChanPtr),
+                                           IOCP_INET_NAME_PREFIX,
+                                           TCL_READABLE | TCL_WRITABLE,
+                                           accepted[numAccepted].host,
+                                           accepted[numAccepted].port) == 0)
+                    continue;
+            }
 
-        dataChanPtr = (WinsockClient *) IocpChannelNew(&tcpClientVtbl);
-        if (dataChanPtr == NULL) {
-            /* TBD - notify background error ? */
-            closesocket(connSocket);
-            continue;
-        }
-        dataChanPtr->so = connSocket;
-        dataChanPtr->base.state = IOCP_STATE_OPEN;
+            /* Create a new open channel */
+            channel = IocpCreateTclChannel(WinsockClientToIocpChannel(dataChanPtr),
+                                           IOCP_INET_NAME_PREFIX,
+                                           (TCL_READABLE | TCL_WRITABLE));
 
-        /* Create a new open channel */
-        channel = IocpCreateTclChannel(WinsockClientToIocpChannel(dataChanPtr),
-                                       IOCP_INET_NAME_PREFIX,
-                                       (TCL_READABLE | TCL_WRITABLE));
+            /*
+             * Need a lock henceforth
+             * - if channel create failed, need lock before IocpChannelDrop below.
+             * - if it succeeded, need a lock, else there will be race condition
+             *   with IOCP thread when we post reads below.
+             */
+            IocpChannelLock(WinsockClientToIocpChannel(dataChanPtr));
 
-        /*
-         * Need a lock henceforth
-         * - if channel create failed, need lock before IocpChannelDrop below.
-         * - if it succeeded, need a lock, else there will be race condition
-         *   with IOCP thread when we post reads below.
-         */
-        IocpChannelLock(WinsockClientToIocpChannel(dataChanPtr));
+            if (channel == NULL) {
+                closesocket(connSocket);
+                dataChanPtr->so = INVALID_SOCKET;
+                IocpChannelSetState(&dataChanPtr->base, IOCP_STATE_DISCONNECTED);
+                IocpChannelDrop(WinsockClientToIocpChannel(dataChanPtr));
+                continue;
+            }
 
-        if (channel == NULL) {
-            closesocket(connSocket);
-            dataChanPtr->so = INVALID_SOCKET;
-            dataChanPtr->base.state = IOCP_STATE_DISCONNECTED;
-            IocpChannelDrop(WinsockClientToIocpChannel(dataChanPtr));
-            continue;
-        }
+            /* IMPORTANT:
+             * The reference to dataChanPtr from this function is now transferred
+             * to the Tcl channel subsystem and should only be reversed via a
+             * Tcl_Close on the channel. Thus no code below should call
+             * IocpChannelDrop, only IocpChannelUnlock
+             */
+            dataChanPtr->base.channel = channel;
 
-        /* IMPORTANT:
-         * The reference to dataChanPtr from this function is now transferred
-         * to the Tcl channel subsystem and should only be reversed via a
-         * Tcl_Close on the channel. Thus no code below should call
-         * IocpChannelDrop, only IocpChannelUnlock
-         */
-        dataChanPtr->base.channel = channel;
+            if (IocpSetChannelDefaults(channel) != TCL_OK) {
+                IocpChannelUnlock(WinsockClientToIocpChannel(dataChanPtr));
+                Tcl_Close(NULL, channel); /* Will close socket, free dataChanPtr as well */
+                continue;
+            }
 
-        if (IocpSetChannelDefaults(channel) != TCL_OK) {
-            IocpChannelUnlock(WinsockClientToIocpChannel(dataChanPtr));
-            Tcl_Close(NULL, channel); /* Will close socket, free dataChanPtr as well */
-            continue;
-        }
+            winError = IocpChannelPostReads(WinsockClientToIocpChannel(dataChanPtr));
 
-        winError = IocpChannelPostReads(WinsockClientToIocpChannel(dataChanPtr));
+            IocpChannelUnlock(WinsockClientToIocpChannel(dataChanPtr));
+            /* Do NOT access dataChanPtr hereon */
 
-        IocpChannelUnlock(WinsockClientToIocpChannel(dataChanPtr));
-        /* Do NOT access dataChanPtr hereon */
+            if (winError != ERROR_SUCCESS) {
+                /* TBD - notify background error ? */
+                Tcl_Close(NULL, channel); /* Will close socket, free dataChanPtr as well */
+                continue;
+            }
 
-        if (winError != ERROR_SUCCESS) {
-            /* TBD - notify background error ? */
-            Tcl_Close(NULL, channel); /* Will close socket, free dataChanPtr as well */
-            continue;
+            accepted[numAccepted].channel = channel; /* host and port set above */
+            numAccepted += 1;
         }
 
-        /* Post new accepts for listenerIndex */
-        winError = TcpListenerPostAccepts(lockedTcpPtr, listenerIndex);
-        if (winError != 0) {
-            /* TBD - post a background error */
-            /* Note: we still do the accept callbacks below */
+        /*
+         * Post new accepts for the listeners that accepted connections
+         * before running any callbacks.
+         */
+        if (lockedTcpPtr->listeners) {
+            ULONGLONG now = GetTickCount64();
+            for (i = 0; i < lockedTcpPtr->numListeners; ++i) {
+                TcpListeningSocket *listenerPtr = &lockedTcpPtr->listeners[i];
+                if (listenerPtr->batchAccepts == 0)
+                    continue;
+                TcpListenerAdaptBacklog(lockedTcpPtr, listenerPtr, now);
+                listenerPtr->batchAccepts = 0;
+                if (TcpListenerPostAccepts(lockedTcpPtr, i) != 0) {
+                    /* TBD - post a background error */
+                    /* Note: we still do the accept callbacks below */
+                }
+            }
         }
 
         /* Invoke the server callbacks */
-        if (lockedTcpPtr->acceptProc != NULL) {
-            char host[NI_MAXHOST], port[NI_MAXSERV];
-            getnameinfo(&remoteAddr.sa, remoteAddrLen, host, sizeof(host),
-                        port, sizeof(port), NI_NUMERICHOST|NI_NUMERICSERV);
+        for (i = 0; i < numAccepted; ++i) {
+            if (lockedChanPtr->channel == NULL) {
+                /* Listener closed by an earlier callback in the batch. */
+                Tcl_Close(NULL, accepted[i].channel);
+                continue;
+            }
+            if (lockedTcpPtr->acceptProc == NULL)
+                continue;
             /*
              * Need to unlock before calling acceptProc as that can recurse
              * and call us back to close the channel.
              */
             IocpChannelUnlock(lockedChanPtr);
-            lockedTcpPtr->acceptProc(lockedTcpPtr->acceptProcData, channel,
-                                 host, atoi(port));
+            lockedTcpPtr->acceptProc(lockedTcpPtr->acceptProcData,
+                                     accepted[i].channel, accepted[i].host,
+                                     accepted[i].port);
             /*
              * Re-lock before returning. This is safe (i.e. lockedTcpPtr would
              * not have been freed) as our caller (event handler) is holding
@@ -1006,10 +2067,70 @@ IocpWinError TcpListenerAccept(
             IocpChannelLock(lockedChanPtr);
         }
 
+        if (lockedChanPtr->channel == NULL)
+            break; /* Remaining buffers freed when caller drops channel */
     }
     return 0;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * TcpListenerAdaptBacklog --
+ *
+ *    Adjusts the number of accepts to keep outstanding on a listening
+ *    socket based on the accepts completed in the current batch and the
+ *    time since the previous batch. The result stays within the
+ *    -minpendingaccepts and -maxpendingaccepts bounds of the listener.
+ *    Accepts already posted beyond a lowered target are not cancelled.
+ *    Fewer accepts are simply posted to replace them.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Updates the targetAcceptPosts and lastAcceptTick fields of the
+ *    listening socket.
+ *
+ *------------------------------------------------------------------------
+ */
+static void TcpListenerAdaptBacklog(
+    TcpListener        *lockedTcpPtr, /* Listener owning listenerPtr */
+    TcpListeningSocket *listenerPtr,  /* Listening socket to adapt */
+    ULONGLONG           now)          /* Current tick count */
+{
+    ULONGLONG elapsed = now - listenerPtr->lastAcceptTick;
+    int       target  = listenerPtr->targetAcceptPosts;
+
+    /* Decay for every interval of inactivity since the last batch */
+    while (elapsed >= IOCP_ACCEPT_SHRINK_INTERVAL &&
+           target > lockedTcpPtr->minPendingAccepts) {
+        target /= 2;
+        elapsed -= IOCP_ACCEPT_SHRINK_INTERVAL;
+    }
+
+    /*
+     * A batch using half or more of the outstanding accepts means
+     * connections are arriving faster than accepts are being replenished.
+     */
+    if (2 * listenerPtr->batchAccepts >= target)
+        target *= 2;
+
+    if (target < lockedTcpPtr->minPendingAccepts)
+        target = lockedTcpPtr->minPendingAccepts;
+    else if (target > lockedTcpPtr->maxPendingAccepts)
+        target = lockedTcpPtr->maxPendingAccepts;
+
+    if (target != listenerPtr->targetAcceptPosts) {
+        if (target > listenerPtr->targetAcceptPosts)
+            IOCP_COUNTER_INCR(IocpAcceptBacklogGrows);
+        else
+            IOCP_COUNTER_INCR(IocpAcceptBacklogShrinks);
+        listenerPtr->targetAcceptPosts = target;
+    }
+    listenerPtr->lastAcceptTick = now;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -1041,26 +2162,41 @@ static IocpWinError TcpListenerPostAccepts(
 
     IOCP_ASSERT(lockedTcpPtr->base.state == IOCP_STATE_LISTENING);
 
-    while (listenerPtr->pendingAcceptPosts < listenerPtr->maxPendingAcceptPosts) {
+    while (listenerPtr->pendingAcceptPosts < listenerPtr->targetAcceptPosts) {
         IocpBuffer *bufPtr;
-        SOCKET      so;
+        SOCKET      so = INVALID_SOCKET;
         DWORD       nbytes;
+        int         socketFlags = -1;
+        TcpAcceptBuffer *acceptPtr;
 
-        so = socket(listenerPtr->aiFamily,
-                    listenerPtr->aiSocktype, listenerPtr->aiProtocol);
+        /* Recycled sockets keep the handle attributes set below */
+        if (listenerPtr->poolPtr)
+            so = WinsockSocketPoolGet(listenerPtr->poolPtr, &socketFlags);
         if (so == INVALID_SOCKET) {
-            winError = WSAGetLastError();
-            break;
+            if (lockedTcpPtr->rio)
+                so = IocpRioSocket(listenerPtr->aiFamily,
+                                   listenerPtr->aiSocktype, listenerPtr->aiProtocol);
+            else
+                so = socket(listenerPtr->aiFamily,
+                            listenerPtr->aiSocktype, listenerPtr->aiProtocol);
+            if (so == INVALID_SOCKET) {
+                winError = WSAGetLastError();
+                break;
+            }
+            /* Do not pass on to children */
+            SetHandleInformation((HANDLE)so, HANDLE_FLAG_INHERIT, 0);
         }
-        /* Do not pass on to children */
-        SetHandleInformation((HANDLE)so, HANDLE_FLAG_INHERIT, 0);
 
-        bufPtr = IocpBufferNew(sizeof(TcpAcceptBuffer),
+        bufPtr = IocpBufferNew(IOCP_ACCEPT_BUFFER_SIZE(lockedTcpPtr->acceptReadSize),
                                IOCP_BUFFER_OP_ACCEPT, IOCP_BUFFER_F_WINSOCK);
         if (bufPtr == NULL) {
             winError = ERROR_NOT_ENOUGH_MEMORY;
+            closesocket(so);
             break;
         }
+        acceptPtr = (TcpAcceptBuffer *)bufPtr->data.bytes;
+        acceptPtr->socketFlags = socketFlags;
+        acceptPtr->receiveSize = lockedTcpPtr->acceptReadSize;
 
         /* The buffer needs to hold context of the listening socket */
         bufPtr->context[0].so = so;
@@ -1068,11 +2204,13 @@ static IocpWinError TcpListenerPostAccepts(
         bufPtr->chanPtr       = TcpListenerToIocpChannel(lockedTcpPtr);
         lockedTcpPtr->base.numRefs += 1; /* Reversed when bufPtr is unlinked from channel */
 
+        IOCP_ETW_BUFFER("BufferPost", bufPtr, bufPtr->chanPtr,
+                        acceptPtr->receiveSize, 0);
         if (listenerPtr->_AcceptEx(
                 listenerPtr->so, /* Listening socket */
                 so,              /* Socket used for new connection */
-                bufPtr->data.bytes, /* Pointer to data area */
-                0,                  /* Number of data bytes to read */
+                acceptPtr->output,  /* Pointer to output area */
+                acceptPtr->receiveSize, /* Number of data bytes to read */
                 IOCP_ACCEPT_ADDRESS_LEN, /* Size of local address */
                 IOCP_ACCEPT_ADDRESS_LEN, /* Size of remote address */
                 &nbytes,                  /* Not used */
@@ -1089,6 +2227,7 @@ static IocpWinError TcpListenerPostAccepts(
         }
 
         listenerPtr->pendingAcceptPosts += 1;
+        IOCP_COUNTER_INCR(IocpAcceptsPosted);
     }
 
     /* Return error only if no pending accepts */
@@ -1205,7 +2344,11 @@ static IocpWinError IocpTcpListen(
     tcpPtr->listeners[listenerIndex].aiSocktype = addrPtr->ai_socktype;
     tcpPtr->listeners[listenerIndex].aiProtocol = addrPtr->ai_protocol;
     tcpPtr->listeners[listenerIndex].pendingAcceptPosts     = 0;
-    tcpPtr->listeners[listenerIndex].maxPendingAcceptPosts  = IOCP_WINSOCK_MAX_ACCEPTS;
+    tcpPtr->listeners[listenerIndex].targetAcceptPosts = tcpPtr->minPendingAccepts;
+    tcpPtr->listeners[listenerIndex].batchAccepts   = 0;
+    tcpPtr->listeners[listenerIndex].lastAcceptTick = GetTickCount64();
+    /* Recycling is off till enabled with -recyclepoolsize */
+    tcpPtr->listeners[listenerIndex].poolPtr = WinsockSocketPoolNew();
     tcpPtr->numListeners += 1;
     return 0;
 }
@@ -1297,8 +2440,38 @@ IocpTclCode TcpListenerGetOption(
         Tcl_DStringAppend(dsPtr, "0", 1);
         return TCL_OK;
     case IOCP_WINSOCK_OPT_MAXPENDINGACCEPTS:
+    case IOCP_WINSOCK_OPT_MINPENDINGACCEPTS:
+        sprintf_s(integerSpace, sizeof(integerSpace), "%d",
+                  opt == IOCP_WINSOCK_OPT_MAXPENDINGACCEPTS ?
+                  lockedTcpPtr->maxPendingAccepts : lockedTcpPtr->minPendingAccepts);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_INLINECOMPLETION:
+        Tcl_DStringAppend(dsPtr, lockedTcpPtr->inlineCompletion ? "1" : "0", 1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_STATS:
+        IocpChannelGetStats(lockedChanPtr, dsPtr);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READMODE:
+        Tcl_DStringAppend(dsPtr,
+                          iocpWinsockReadModeNames[lockedTcpPtr->readMode], -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_ACCEPTREADSIZE:
+        sprintf_s(integerSpace, sizeof(integerSpace),
+                  "%d", lockedTcpPtr->acceptReadSize);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_RECYCLEPOOLSIZE:
+        sprintf_s(integerSpace, sizeof(integerSpace), "%d",
+                  lockedTcpPtr->listeners[0].poolPtr ?
+                  WinsockSocketPoolCapacity(lockedTcpPtr->listeners[0].poolPtr) : 0);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_IDLETIMEOUT:
+    case IOCP_WINSOCK_OPT_READTIMEOUT:
         sprintf_s(integerSpace, sizeof(integerSpace),
-                  "%d", lockedTcpPtr->listeners[0].maxPendingAcceptPosts);
+                  "%u", opt == IOCP_WINSOCK_OPT_IDLETIMEOUT ?
+                  lockedTcpPtr->idleTimeout : lockedTcpPtr->readTimeout);
         Tcl_DStringAppend(dsPtr, integerSpace, -1);
         return TCL_OK;
     default:
@@ -1342,18 +2515,130 @@ static IocpTclCode TcpListenerSetOption(
 
     switch (opt) {
     case IOCP_WINSOCK_OPT_MAXPENDINGACCEPTS:
+    case IOCP_WINSOCK_OPT_MINPENDINGACCEPTS:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue <= 0 || intValue > IOCP_ACCEPT_MAX_PENDING_LIMIT) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* Setting one bound past the other drags the other along */
+        if (opt == IOCP_WINSOCK_OPT_MAXPENDINGACCEPTS) {
+            lockedTcpPtr->maxPendingAccepts = intValue;
+            if (lockedTcpPtr->minPendingAccepts > intValue)
+                lockedTcpPtr->minPendingAccepts = intValue;
+        } else {
+            lockedTcpPtr->minPendingAccepts = intValue;
+            if (lockedTcpPtr->maxPendingAccepts < intValue)
+                lockedTcpPtr->maxPendingAccepts = intValue;
+        }
+        for (listenerIndex = 0; listenerIndex < lockedTcpPtr->numListeners; ++listenerIndex) {
+            TcpListeningSocket *listenerPtr = &lockedTcpPtr->listeners[listenerIndex];
+            if (listenerPtr->targetAcceptPosts < lockedTcpPtr->minPendingAccepts)
+                listenerPtr->targetAcceptPosts = lockedTcpPtr->minPendingAccepts;
+            else if (listenerPtr->targetAcceptPosts > lockedTcpPtr->maxPendingAccepts)
+                listenerPtr->targetAcceptPosts = lockedTcpPtr->maxPendingAccepts;
+            /* Raise the backlog right away if needed. Failure is not fatal. */
+            if (listenerPtr->so != INVALID_SOCKET)
+                (void) TcpListenerPostAccepts(lockedTcpPtr, listenerIndex);
+        }
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_INLINECOMPLETION:
+        if (Tcl_GetBoolean(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue && ! WinsockInlineCompletionSupported()) {
+            Iocp_ReportWindowsError(interp, WSAEOPNOTSUPP, "Could not enable inline completion: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedTcpPtr->inlineCompletion = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READMODE:
+        if (WinsockReadModeFromString(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (lockedTcpPtr->rio && intValue != IOCP_WINSOCK_READ_BUFFERED) {
+            Iocp_ReportWindowsError(interp, WSAEOPNOTSUPP, "Could not set read mode: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedTcpPtr->readMode = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_IDLETIMEOUT:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue <= 0) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedTcpPtr->idleTimeout = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READTIMEOUT:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* 0 => no timeout */
+        if (intValue < 0) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* Registered I/O receives cannot be cancelled */
+        if (lockedTcpPtr->rio && intValue != 0) {
+            Iocp_ReportWindowsError(interp, WSAEOPNOTSUPP, "Could not set read timeout: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* Takes effect for sockets accepted from now on */
+        lockedTcpPtr->readTimeout = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_ACCEPTREADSIZE:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue < 0 || intValue > IOCP_ACCEPT_MAX_RECEIVE) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* Takes effect for accepts posted from now on */
+        lockedTcpPtr->acceptReadSize = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_RECYCLEPOOLSIZE:
         if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
             Tcl_SetErrno(EINVAL);
             return TCL_ERROR;
         }
-        if (intValue <= 0 || intValue > 20) {
+        if (intValue < 0 || intValue > IOCP_WINSOCK_MAX_RECYCLE_POOL) {
             if (interp)
                 Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
             Tcl_SetErrno(EINVAL);
             return TCL_ERROR;
         }
+        /* Registered I/O request queues cannot be carried across reuse */
+        if (lockedTcpPtr->rio && intValue != 0) {
+            Iocp_ReportWindowsError(interp, WSAEOPNOTSUPP, "Could not enable socket recycling: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
         for (listenerIndex = 0; listenerIndex < lockedTcpPtr->numListeners; ++listenerIndex) {
-            lockedTcpPtr->listeners[listenerIndex].maxPendingAcceptPosts = intValue;
+            if (lockedTcpPtr->listeners[listenerIndex].poolPtr)
+                WinsockSocketPoolResize(lockedTcpPtr->listeners[listenerIndex].poolPtr, intValue);
         }
         return TCL_OK;
     case IOCP_WINSOCK_OPT_CONNECTING:
@@ -1364,7 +2649,14 @@ static IocpTclCode TcpListenerSetOption(
     case IOCP_WINSOCK_OPT_MAXPENDINGWRITES:
     case IOCP_WINSOCK_OPT_SOSNDBUF:
     case IOCP_WINSOCK_OPT_SORCVBUF:
-        return Tcl_BadChannelOption(interp, iocpWinsockOptionNames[opt], "-maxpendingaccepts");
+    case IOCP_WINSOCK_OPT_WRITEHIGHWATER:
+    case IOCP_WINSOCK_OPT_READBUFFERSIZE:
+    case IOCP_WINSOCK_OPT_STATS:
+    case IOCP_WINSOCK_OPT_MAXINPUTBYTES:
+    case IOCP_WINSOCK_OPT_MAXSPINWAIT:
+    case IOCP_WINSOCK_OPT_TLS:
+    case IOCP_WINSOCK_OPT_CONNECTTIMEOUT:
+        return Tcl_BadChannelOption(interp, iocpWinsockOptionNames[opt], "-acceptreadsize -idletimeout -inlinecompletion -maxpendingaccepts -minpendingaccepts -readmode -readtimeout -recyclepoolsize");
     default:
         if (interp)
             Tcl_SetObjResult(interp, Tcl_ObjPrintf("Internal error: invalid socket option index %d", opt));
@@ -1399,7 +2691,12 @@ Iocp_OpenTcpServer(
     Tcl_TcpAcceptProc *acceptProc,
                 /* Callback for accepting connections from new
                  * clients. */
-    ClientData acceptProcData)	/* Data for the callback. */
+    ClientData acceptProcData,	/* Data for the callback. */
+    int rio,			/* If nonzero, accepted sockets use
+                 * registered I/O if available */
+    IocpWorkerPool *workerPoolPtr) /* Worker threads to hand off accepted
+                                    * connections to. May be NULL. Owned
+                                    * by the listener even on failure */
 {
     const char      *errorMsg   = NULL;
     TcpListener     *tcpPtr = NULL;
@@ -1443,6 +2740,10 @@ Iocp_OpenTcpServer(
         }
         goto fail;
     }
+    tcpPtr->workerPoolPtr = workerPoolPtr; /* Released by TcpListenerFinit */
+    workerPoolPtr = NULL;
+    /* Silently fall back to overlapped I/O if RIO is not available */
+    tcpPtr->rio = rio && IocpRioAvailable();
 
     for (nsockets = 0, addrPtr = localAddrs; addrPtr; addrPtr = addrPtr->ai_next) {
         ++nsockets;
@@ -1493,7 +2794,7 @@ Iocp_OpenTcpServer(
         goto fail;
     }
 
-    tcpPtr->base.state = IOCP_STATE_LISTENING;
+    IocpChannelSetState(&tcpPtr->base, IOCP_STATE_LISTENING);
     tcpPtr->base.flags |= IOCP_CHAN_F_WATCH_ACCEPT;
 
     tcpPtr->acceptProc = acceptProc;
@@ -1549,11 +2850,13 @@ Iocp_OpenTcpServer(
 fail: /* tcpPtr must NOT be locked, interp must contain error message already */
     if (localAddrs)
         freeaddrinfo(localAddrs);
+    if (workerPoolPtr)
+        IocpWorkerPoolRelease(workerPoolPtr);
     /* We'll just let any allocated sockets be freed when the tcpPtr is freed */
     if (tcpPtr) {
         IocpChannel *chanPtr = TcpListenerToIocpChannel(tcpPtr);
         IocpChannelLock(chanPtr); /* Because IocpChannelDrop expects that */
-        chanPtr->state = IOCP_STATE_CLOSED;
+        IocpChannelSetState(chanPtr, IOCP_STATE_CLOSED);
         IocpChannelDrop(chanPtr); /* Will also close allocated sockets etc. */
     }
 
@@ -1585,13 +2888,17 @@ Tcp_SocketObjCmd (
     Tcl_Obj *CONST objv[])		/* Argument objects. */
 {
     static const char *const socketOptions[] = {
-    "-async", "-myaddr", "-myport", "-server", NULL
+    "-async", "-connecttimeout", "-myaddr", "-myport", "-rio", "-server",
+    "-threadinit", "-threads", "-tls", NULL
     };
     enum socketOptions {
-    SKT_ASYNC, SKT_MYADDR, SKT_MYPORT, SKT_SERVER
+    SKT_ASYNC, SKT_CONNECTTIMEOUT, SKT_MYADDR, SKT_MYPORT, SKT_RIO,
+    SKT_SERVER, SKT_THREADINIT, SKT_THREADS, SKT_TLS
     };
-    int optionIndex, a, server = 0, port, myport = 0, async = 0;
-    const char *host, *script = NULL, *myaddr = NULL;
+    int optionIndex, a, server = 0, port, myport = 0, async = 0, rio = 0;
+    int threads = 0, connectTimeout = 0;
+    const char *host, *script = NULL, *myaddr = NULL, *threadInit = NULL;
+    Tcl_Obj *tlsObj = NULL;
     Tcl_Channel chan;
 
 #ifdef TBD
@@ -1643,6 +2950,33 @@ Tcp_SocketObjCmd (
         }
         break;
     }
+    case SKT_CONNECTTIMEOUT:
+        a++;
+        if (a >= objc) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "no argument given for -connecttimeout option", -1));
+        return TCL_ERROR;
+        }
+        if (Tcl_GetIntFromObj(interp, objv[a], &connectTimeout) != TCL_OK) {
+        return TCL_ERROR;
+        }
+        if (connectTimeout < 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+            "Integer value %d out of range.", connectTimeout));
+        return TCL_ERROR;
+        }
+        break;
+    case SKT_RIO:
+        a++;
+        if (a >= objc) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "no argument given for -rio option", -1));
+        return TCL_ERROR;
+        }
+        if (Tcl_GetBooleanFromObj(interp, objv[a], &rio) != TCL_OK) {
+        return TCL_ERROR;
+        }
+        break;
     case SKT_SERVER:
         if (async == 1) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj(
@@ -1658,6 +2992,40 @@ Tcp_SocketObjCmd (
         }
         script = TclGetString(objv[a]);
         break;
+    case SKT_THREADINIT:
+        a++;
+        if (a >= objc) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "no argument given for -threadinit option", -1));
+        return TCL_ERROR;
+        }
+        threadInit = TclGetString(objv[a]);
+        break;
+    case SKT_THREADS:
+        a++;
+        if (a >= objc) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "no argument given for -threads option", -1));
+        return TCL_ERROR;
+        }
+        if (Tcl_GetIntFromObj(interp, objv[a], &threads) != TCL_OK) {
+        return TCL_ERROR;
+        }
+        if (threads < 0 || threads > IOCP_WORKER_MAX_THREADS) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+            "Integer value %d out of range.", threads));
+        return TCL_ERROR;
+        }
+        break;
+    case SKT_TLS:
+        a++;
+        if (a >= objc) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "no argument given for -tls option", -1));
+        return TCL_ERROR;
+        }
+        tlsObj = objv[a];
+        break;
     default:
         Iocp_Panic("Tcp_SocketObjCmd: bad option index to SocketOptions");
     }
@@ -1669,6 +3037,24 @@ Tcp_SocketObjCmd (
             "option -myport is not valid for servers", -1));
         return TCL_ERROR;
     }
+    if (tlsObj != NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "option -tls is not valid for servers", -1));
+        return TCL_ERROR;
+    }
+    if (connectTimeout != 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "option -connecttimeout is not valid for servers", -1));
+        return TCL_ERROR;
+    }
+    } else if (tlsObj != NULL && rio) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "options -rio and -tls cannot be combined", -1));
+        return TCL_ERROR;
+    } else if (threads != 0 || threadInit != NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+            "options -threads and -threadinit are only valid for servers", -1));
+        return TCL_ERROR;
     } else if (a < objc) {
     host = TclGetString(objv[a]);
     a++;
@@ -1703,6 +3089,13 @@ Tcp_SocketObjCmd (
     IocpAcceptCallback *acceptCallbackPtr;
     IocpSizeT           len;
     char               *copyScript;
+    IocpWorkerPool     *workerPoolPtr = NULL;
+
+        if (threads > 0) {
+            workerPoolPtr = IocpWorkerPoolNew(interp, threads, threadInit, script);
+            if (workerPoolPtr == NULL)
+                return TCL_ERROR;
+        }
 
         len        = Tclh_strlen(script) + 1;
         copyScript = ckalloc(len);
@@ -1712,7 +3105,7 @@ Tcp_SocketObjCmd (
     acceptCallbackPtr->interp = interp;
 
     chan = Iocp_OpenTcpServer(interp, port, host, AcceptCallbackProc,
-                                 acceptCallbackPtr);
+                                 acceptCallbackPtr, rio, workerPoolPtr);
     if (chan == NULL) {
         ckfree(copyScript);
         ckfree(acceptCallbackPtr);
@@ -1738,7 +3131,8 @@ Tcp_SocketObjCmd (
                                acceptCallbackPtr);
 
     } else {
-    chan = Iocp_OpenTcpClient(interp, port, host, myaddr, myport, async);
+    chan = Iocp_OpenTcpClient(interp, port, host, myaddr, myport, async, rio,
+                              tlsObj, connectTimeout);
     if (chan == NULL) {
         return TCL_ERROR;
     }
@@ -1749,6 +3143,190 @@ Tcp_SocketObjCmd (
     return TCL_OK;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * Tcp_SendfileObjCmd --
+ *
+ *    Implements the iocp::inet::sendfile command which sends data from a
+ *    file channel on a socket using TransmitFile.
+ *
+ *        iocp::inet::sendfile ?-header DATA? ?-trailer DATA? SOCK FILE ?OFFSET? ?LENGTH?
+ *
+ *    The file data is sent from OFFSET, by default the current access
+ *    position of FILE, for LENGTH bytes or to the end of the file. The
+ *    access position of FILE is not changed. For blocking sockets the
+ *    command returns once the data has been sent. For non-blocking
+ *    sockets it returns once the data is queued and completion is
+ *    signalled through writable file events as for other writes.
+ *
+ * Results:
+ *    TCL_OK with the number of bytes sent or queued as the interpreter
+ *    result, or TCL_ERROR.
+ *
+ * Side effects:
+ *    The file data is sent on the socket.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+Tcp_SendfileObjCmd (
+    ClientData notUsed,			/* Not used. */
+    Tcl_Interp *interp,			/* Current interpreter. */
+    int objc,				/* Number of arguments. */
+    Tcl_Obj *CONST objv[])		/* Argument objects. */
+{
+    static const char *const sendfileOptions[] = {
+        "-header", "-trailer", NULL
+    };
+    enum sendfileOptions {
+        SF_HEADER, SF_TRAILER
+    };
+    const char    *head = NULL, *tail = NULL;
+    int            headLen = 0, tailLen = 0;
+    int            a, optionIndex, mode;
+    Tcl_Channel    sockChan, fileChan;
+    IocpChannel   *chanPtr;
+    HANDLE         fileHandle, dupHandle;
+    LARGE_INTEGER  fileSize;
+    Tcl_WideInt    offset, length = 0;
+    IocpWinError   winError;
+
+    for (a = 1; a < objc; a++) {
+        const char *arg = Tcl_GetString(objv[a]);
+        if (arg[0] != '-')
+            break;
+        if (Tcl_GetIndexFromObj(interp, objv[a], sendfileOptions, "option",
+                                TCL_EXACT, &optionIndex) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (++a >= objc) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                                 "no argument given for %s option", arg));
+            return TCL_ERROR;
+        }
+        if (optionIndex == SF_HEADER)
+            head = (const char *) Tcl_GetByteArrayFromObj(objv[a], &headLen);
+        else
+            tail = (const char *) Tcl_GetByteArrayFromObj(objv[a], &tailLen);
+    }
+    if ((objc - a) < 2 || (objc - a) > 4) {
+        Tcl_WrongNumArgs(interp, 1, objv,
+                         "?-header DATA? ?-trailer DATA? SOCK FILE ?OFFSET? ?LENGTH?");
+        return TCL_ERROR;
+    }
+
+    sockChan = Tcl_GetChannel(interp, Tcl_GetString(objv[a]), &mode);
+    if (sockChan == NULL)
+        return TCL_ERROR;
+    if (Tcl_GetChannelType(sockChan) != &IocpChannelDispatch ||
+        !IocpIsInetClient(
+            (chanPtr = (IocpChannel *) Tcl_GetChannelInstanceData(sockChan)))) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "channel \"%s\" is not a iocp::inet client socket",
+                             Tcl_GetString(objv[a])));
+        return TCL_ERROR;
+    }
+    if ((mode & TCL_WRITABLE) == 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "channel \"%s\" wasn't opened for writing",
+                             Tcl_GetString(objv[a])));
+        return TCL_ERROR;
+    }
+
+    fileChan = Tcl_GetChannel(interp, Tcl_GetString(objv[a+1]), &mode);
+    if (fileChan == NULL)
+        return TCL_ERROR;
+    if ((mode & TCL_READABLE) == 0 ||
+        Tcl_GetChannelHandle(fileChan, TCL_READABLE, (ClientData *) &fileHandle) != TCL_OK ||
+        GetFileType(fileHandle) != FILE_TYPE_DISK ||
+        !GetFileSizeEx(fileHandle, &fileSize)) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "channel \"%s\" is not a readable file",
+                             Tcl_GetString(objv[a+1])));
+        return TCL_ERROR;
+    }
+
+    if ((objc - a) > 2) {
+        if (Tcl_GetWideIntFromObj(interp, objv[a+2], &offset) != TCL_OK)
+            return TCL_ERROR;
+    }
+    else {
+        /* Tcl_Tell accounts for data buffered by the channel */
+        offset = Tcl_Tell(fileChan);
+    }
+    if ((objc - a) > 3 &&
+        Tcl_GetWideIntFromObj(interp, objv[a+3], &length) != TCL_OK)
+        return TCL_ERROR;
+    if (offset < 0 || offset > fileSize.QuadPart || length < 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+                             "file offset or length out of range", -1));
+        return TCL_ERROR;
+    }
+    if (length == 0 || length > fileSize.QuadPart - offset)
+        length = fileSize.QuadPart - offset;
+    if (length > IOCP_WINSOCK_MAX_TRANSMIT - (Tcl_WideInt) headLen - tailLen) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(
+                             "too much data to send in one call", -1));
+        return TCL_ERROR;
+    }
+
+    /* Data already written to the channel has to go out first. */
+    if (Tcl_Flush(sockChan) != TCL_OK) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "error flushing \"%s\": %s",
+                             Tcl_GetString(objv[a]), Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+    if (Tcl_OutputBuffered(sockChan) > 0) {
+        Tcl_SetErrno(EAGAIN);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "error sending file on \"%s\": %s",
+                             Tcl_GetString(objv[a]), Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+
+    /* The operation owns a duplicate so the file can be closed meanwhile */
+    if (!DuplicateHandle(GetCurrentProcess(), fileHandle,
+                         GetCurrentProcess(), &dupHandle,
+                         0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        return Iocp_ReportLastWindowsError(interp, "couldn't duplicate file handle: ");
+    }
+
+    IocpChannelLock(chanPtr);
+    if (chanPtr->state != IOCP_STATE_OPEN ||
+        (chanPtr->flags & IOCP_CHAN_F_READONLY)) {
+        winError = WSAENOTCONN;
+    }
+    else if (IocpChannelToWinsockClient(chanPtr)->flags & IOCP_WINSOCK_RIO) {
+        winError = WSAEOPNOTSUPP; /* Ordering with registered sends not guaranteed */
+    }
+    else if (IocpChannelToWinsockClient(chanPtr)->tlsPtr) {
+        winError = WSAEOPNOTSUPP; /* File data would bypass encryption */
+    }
+    else {
+        winError = WinsockClientPostTransmit(chanPtr, dupHandle, offset,
+                                             (int) length, head, headLen,
+                                             tail, tailLen);
+    }
+    if (winError != ERROR_SUCCESS) {
+        IocpChannelUnlock(chanPtr);
+        CloseHandle(dupHandle);
+        IocpSetInterpPosixErrorFromWin32(interp, winError,
+                                         "error sending file: ");
+        return TCL_ERROR;
+    }
+    if ((chanPtr->flags & IOCP_CHAN_F_NONBLOCKING) == 0) {
+        /* Tcl's reference keeps chanPtr valid while waiting */
+        while (chanPtr->pendingWrites > 0)
+            IocpChannelAwaitCompletion(chanPtr, IOCP_CHAN_F_BLOCKED_WRITE);
+    }
+    IocpChannelUnlock(chanPtr);
+
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(headLen + length + tailLen));
+    return TCL_OK;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -1767,6 +3345,7 @@ Tcp_SocketObjCmd (
 IocpTclCode Tcp_ModuleInitialize (Tcl_Interp *interp)
 {
     Tcl_CreateObjCommand(interp, "iocp::inet::socket", Tcp_SocketObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(interp, "iocp::inet::sendfile", Tcp_SendfileObjCmd, 0L, 0L);
     Tcl_PkgProvide(interp, PACKAGE_NAME_INET, PACKAGE_VERSION);
     return TCL_OK;
 }
@@ -0,0 +1,422 @@
+/*
+ * tclWinIocpTimer.c --
+ *
+ *	Hierarchical timer wheel for channel timeouts.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "tclWinIocp.h"
+
+/*
+ * Overview
+ *
+ * Timers are kept in IOCP_TIMER_LEVELS levels of IOCP_TIMER_SLOTS slots.
+ * A level 0 slot holds timers due in one tick of IOCP_TIMER_RESOLUTION
+ * milliseconds, a level 1 slot those due in one revolution of level 0 and
+ * so on. Arming and cancelling are O(1) list operations. Each time level 0
+ * wraps around, the next slot of level 1 is cascaded down, redistributing
+ * its timers to lower levels, and likewise up the hierarchy. Timers due
+ * beyond the range of the top level are placed in it and simply cascade
+ * again until due.
+ *
+ * The wheel is advanced on the completion threads. A periodic timer queue
+ * timer posts a packet to the completion port with
+ * IocpTimerWheelCompletionHandler as the key. At most one such packet is
+ * queued at a time. The periodic timer is suspended while no timers are
+ * armed.
+ *
+ * Every timer is associated with a channel. Timers are armed and cancelled
+ * with the channel locked, and the timer procedure is called with the
+ * channel locked. Since channels lock the wheel while holding their own
+ * lock, the wheel only tries to lock channels when firing timers. Timers
+ * whose channel is busy are retried on the next tick. Because the wheel
+ * lock is held throughout, a timer being fired cannot be cancelled midway
+ * and a channel cannot be freed while its timer is being fired.
+ */
+
+#define IOCP_TIMER_RESOLUTION 50 /* ms per tick */
+#define IOCP_TIMER_SLOT_BITS  6
+#define IOCP_TIMER_SLOTS      (1 << IOCP_TIMER_SLOT_BITS)
+#define IOCP_TIMER_SLOT_MASK  (IOCP_TIMER_SLOTS - 1)
+#define IOCP_TIMER_LEVELS     4 /* 2^24 ticks, a little over 9 days */
+
+static struct {
+    IocpLock   lock;            /* Protects all fields below */
+    IocpList   slots[IOCP_TIMER_LEVELS][IOCP_TIMER_SLOTS];
+    ULONGLONG  currentTick;     /* Last tick processed */
+    int        numTimers;       /* Number of armed timers */
+    HANDLE     timer;           /* Tick timer. NULL if not created */
+    int        ticking;         /* Tick timer is not suspended */
+    int        finalized;       /* Process is exiting. No new timers */
+    OVERLAPPED overlap;         /* Packet posted to the completion port */
+    volatile LONG posted;       /* Packet is queued to the completion port */
+} iocpTimerWheel;
+static Iocp_DoOnceState iocpTimerWheelInitFlag;
+
+static IocpCompletionHandler IocpTimerWheelCompletionHandler;
+
+static IocpTclCode IocpTimerWheelInit(ClientData notUsed)
+{
+    int level, slot;
+
+    IocpLockInit(&iocpTimerWheel.lock);
+    for (level = 0; level < IOCP_TIMER_LEVELS; ++level) {
+        for (slot = 0; slot < IOCP_TIMER_SLOTS; ++slot)
+            IocpListInit(&iocpTimerWheel.slots[level][slot]);
+    }
+    iocpTimerWheel.currentTick = GetTickCount64() / IOCP_TIMER_RESOLUTION;
+    iocpTimerWheel.numTimers   = 0;
+    iocpTimerWheel.timer       = NULL;
+    iocpTimerWheel.ticking     = 0;
+    iocpTimerWheel.finalized   = 0;
+    memset(&iocpTimerWheel.overlap, 0, sizeof(iocpTimerWheel.overlap));
+    iocpTimerWheel.posted      = 0;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerWheelInsert --
+ *
+ *    Links a timer into the slot for its due time. Caller must hold the
+ *    wheel lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The timer is armed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpTimerWheelInsert(IocpTimer *timerPtr)
+{
+    ULONGLONG dueTick;
+    ULONGLONG delta;
+    int       level;
+
+    dueTick = (timerPtr->due + IOCP_TIMER_RESOLUTION - 1) / IOCP_TIMER_RESOLUTION;
+    if (dueTick <= iocpTimerWheel.currentTick)
+        dueTick = iocpTimerWheel.currentTick + 1;
+    delta = dueTick - iocpTimerWheel.currentTick;
+    for (level = 0; level < IOCP_TIMER_LEVELS - 1; ++level) {
+        if (delta < ((ULONGLONG)1 << (IOCP_TIMER_SLOT_BITS * (level + 1))))
+            break;
+    }
+    timerPtr->slotPtr = &iocpTimerWheel.slots[level][
+        (dueTick >> (IOCP_TIMER_SLOT_BITS * level)) & IOCP_TIMER_SLOT_MASK];
+    IocpListAppend(timerPtr->slotPtr, &timerPtr->link);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerWheelTick --
+ *
+ *    Timer queue callback that queues a packet to the completion port to
+ *    advance the wheel unless one is already queued.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    A packet may be posted to the completion port.
+ *
+ *------------------------------------------------------------------------
+ */
+static VOID CALLBACK
+IocpTimerWheelTick(
+    PVOID   notUsed,
+    BOOLEAN timerFired)
+{
+    if (InterlockedCompareExchange(&iocpTimerWheel.posted, 1, 0) == 0) {
+        if (! PostQueuedCompletionStatus(
+                iocpModuleState.completion_port, 0,
+                (ULONG_PTR) IocpTimerWheelCompletionHandler,
+                &iocpTimerWheel.overlap))
+            InterlockedExchange(&iocpTimerWheel.posted, 0);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerWheelFire --
+ *
+ *    Fires the timers in a level 0 slot that are due. Caller must hold the
+ *    wheel lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Timer procedures are called and their timers rearmed as requested.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpTimerWheelFire(
+    IocpList *slotPtr,          /* Level 0 slot for the current tick */
+    ULONGLONG now)              /* GetTickCount64 value */
+{
+    IocpList  expired = *slotPtr;
+    IocpLink *linkPtr;
+
+    /* Detach the slot since timers may be relinked into it */
+    IocpListInit(slotPtr);
+    while ((linkPtr = IocpListPopFront(&expired)) != NULL) {
+        IocpTimer   *timerPtr = CONTAINING_RECORD(linkPtr, IocpTimer, link);
+        IocpChannel *chanPtr  = timerPtr->chanPtr;
+        ULONGLONG    due;
+
+        if (timerPtr->due > now ||
+            ! IocpLockTryAcquireExclusive(&chanPtr->lock)) {
+            /* Wrapped around from a higher level, or channel busy. */
+            IocpTimerWheelInsert(timerPtr);
+            continue;
+        }
+        timerPtr->slotPtr = NULL;
+        iocpTimerWheel.numTimers--;
+        due = timerPtr->proc(timerPtr, now);
+        if (due != 0) {
+            timerPtr->due = due;
+            IocpTimerWheelInsert(timerPtr);
+            iocpTimerWheel.numTimers++;
+        }
+        IocpChannelUnlock(chanPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerWheelCascade --
+ *
+ *    Redistributes the timers in a slot of a level above 0 to the lower
+ *    levels. Caller must hold the wheel lock.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Timers are moved between slots.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpTimerWheelCascade(IocpList *slotPtr)
+{
+    IocpList  cascaded = *slotPtr;
+    IocpLink *linkPtr;
+
+    IocpListInit(slotPtr);
+    while ((linkPtr = IocpListPopFront(&cascaded)) != NULL)
+        IocpTimerWheelInsert(CONTAINING_RECORD(linkPtr, IocpTimer, link));
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerWheelCompletionHandler --
+ *
+ *    Called on a completion thread for the packet posted by
+ *    IocpTimerWheelTick. Advances the wheel to the current time, firing
+ *    due timers, and suspends the tick timer if none remain armed.
+ *    Follows the IocpCompletionHandler prototype.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Timer procedures are called.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpTimerWheelCompletionHandler(OVERLAPPED_ENTRY *notUsed)
+{
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG nowTick = now / IOCP_TIMER_RESOLUTION;
+
+    InterlockedExchange(&iocpTimerWheel.posted, 0);
+    IocpLockAcquireExclusive(&iocpTimerWheel.lock);
+    if (! iocpTimerWheel.finalized) {
+        while (iocpTimerWheel.currentTick < nowTick) {
+            ULONGLONG tick = ++iocpTimerWheel.currentTick;
+            int level;
+            /* Cascade each level whose lower level has wrapped around */
+            for (level = 1; level < IOCP_TIMER_LEVELS; ++level) {
+                int slot;
+                if (tick & ((1 << (IOCP_TIMER_SLOT_BITS * level)) - 1))
+                    break;
+                slot = (int) (tick >> (IOCP_TIMER_SLOT_BITS * level))
+                    & IOCP_TIMER_SLOT_MASK;
+                IocpTimerWheelCascade(&iocpTimerWheel.slots[level][slot]);
+            }
+            IocpTimerWheelFire(
+                &iocpTimerWheel.slots[0][tick & IOCP_TIMER_SLOT_MASK], now);
+        }
+        if (iocpTimerWheel.numTimers == 0 && iocpTimerWheel.ticking) {
+            /* Suspend. IocpTimerArm will resume. */
+            if (ChangeTimerQueueTimer(NULL, iocpTimerWheel.timer,
+                                      INFINITE, 0))
+                iocpTimerWheel.ticking = 0;
+        }
+    }
+    IocpLockReleaseExclusive(&iocpTimerWheel.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerInit --
+ *
+ *    Initializes a timer. Must be called before any other timer function.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpTimerInit(
+    IocpTimer     *timerPtr,    /* Timer to initialize */
+    IocpChannel   *chanPtr,     /* Channel to lock when firing */
+    IocpTimerProc *proc)        /* Called when the timer fires */
+{
+    IocpLinkInit(&timerPtr->link);
+    timerPtr->slotPtr = NULL;
+    timerPtr->due     = 0;
+    timerPtr->chanPtr = chanPtr;
+    timerPtr->proc    = proc;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerArm --
+ *
+ *    Arms a timer to fire at the given time, replacing any earlier due
+ *    time. Timers fire up to IOCP_TIMER_RESOLUTION ms late.
+ *
+ * Results:
+ *    ERROR_SUCCESS or a Windows error code.
+ *
+ * Side effects:
+ *    The tick timer is created or resumed if necessary.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+IocpTimerArm(
+    IocpTimer *timerPtr,        /* Channel must be locked */
+    ULONGLONG  due)             /* GetTickCount64 value at which to fire */
+{
+    IocpWinError winError = ERROR_SUCCESS;
+
+    Iocp_DoOnce(&iocpTimerWheelInitFlag, IocpTimerWheelInit, NULL);
+    IocpLockAcquireExclusive(&iocpTimerWheel.lock);
+    if (iocpTimerWheel.finalized)
+        winError = ERROR_INVALID_STATE;
+    else if (iocpTimerWheel.timer == NULL) {
+        if (CreateTimerQueueTimer(&iocpTimerWheel.timer, NULL,
+                                  IocpTimerWheelTick, NULL,
+                                  IOCP_TIMER_RESOLUTION, IOCP_TIMER_RESOLUTION,
+                                  WT_EXECUTEDEFAULT))
+            iocpTimerWheel.ticking = 1;
+        else {
+            iocpTimerWheel.timer = NULL;
+            winError = GetLastError();
+        }
+    }
+    else if (! iocpTimerWheel.ticking) {
+        if (iocpTimerWheel.numTimers == 0) {
+            /* Nothing to fire in the ticks skipped while suspended */
+            iocpTimerWheel.currentTick = GetTickCount64() / IOCP_TIMER_RESOLUTION;
+        }
+        if (ChangeTimerQueueTimer(NULL, iocpTimerWheel.timer,
+                                  IOCP_TIMER_RESOLUTION, IOCP_TIMER_RESOLUTION))
+            iocpTimerWheel.ticking = 1;
+        else
+            winError = GetLastError();
+    }
+    if (winError == ERROR_SUCCESS) {
+        if (timerPtr->slotPtr)
+            IocpListRemove(timerPtr->slotPtr, &timerPtr->link);
+        else
+            iocpTimerWheel.numTimers++;
+        timerPtr->due = due;
+        IocpTimerWheelInsert(timerPtr);
+    }
+    IocpLockReleaseExclusive(&iocpTimerWheel.lock);
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerCancel --
+ *
+ *    Disarms a timer if armed. Must be called before the memory holding
+ *    the timer is freed.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpTimerCancel(
+    IocpTimer *timerPtr)        /* Channel must be locked */
+{
+    if (timerPtr->slotPtr) {
+        IocpLockAcquireExclusive(&iocpTimerWheel.lock);
+        IocpListRemove(timerPtr->slotPtr, &timerPtr->link);
+        timerPtr->slotPtr = NULL;
+        iocpTimerWheel.numTimers--;
+        IocpLockReleaseExclusive(&iocpTimerWheel.lock);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTimerWheelFinalize --
+ *
+ *    Stops the timer wheel at process exit.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The tick timer is deleted after waiting for any running callback.
+ *    Timers no longer fire.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpTimerWheelFinalize(void)
+{
+    HANDLE timer;
+
+    if (Iocp_DoOnce(&iocpTimerWheelInitFlag, IocpTimerWheelInit, NULL) != TCL_OK)
+        return;
+    IocpLockAcquireExclusive(&iocpTimerWheel.lock);
+    timer = iocpTimerWheel.timer;
+    iocpTimerWheel.timer     = NULL;
+    iocpTimerWheel.finalized = 1;
+    IocpLockReleaseExclusive(&iocpTimerWheel.lock);
+    if (timer)
+        DeleteTimerQueueTimer(NULL, timer, INVALID_HANDLE_VALUE);
+}
@@ -0,0 +1,1075 @@
+/*
+ * tclWinIocpTls.c --
+ *
+ *	Client side TLS for Winsock based channels using Schannel.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#define SECURITY_WIN32
+#include "tclWinIocp.h"
+#include "tclWinIocpWinsock.h"
+#include <security.h>
+#include <schannel.h>
+
+/*
+ * Overview
+ *
+ * TLS records are encrypted and decrypted in place in the IocpBuffers of
+ * the channel so no data is copied beyond what the plaintext path already
+ * does.
+ *
+ * Output - WinsockClientPostWrite reserves room for the record header and
+ * trailer in each queued buffer and limits the data in a buffer to the
+ * maximum record size. WinsockClientPostQueuedWrites encrypts each buffer
+ * with EncryptMessage just before it is sent so coalescing of small writes
+ * still applies and every buffer in a gathering WSASend is one complete
+ * record. The record overhead is added to outputBytes at that point so
+ * write completions account for the bytes actually sent.
+ *
+ * Input - completed reads are passed in posting order to the inputready()
+ * hook of the channel (WinsockClientTlsInputReady) which decrypts the
+ * records in the buffer with DecryptMessage and compacts the plaintext to
+ * the front of the buffer before it is handed off to the Tcl thread. The
+ * ciphertext of a record that is split across reads is held in
+ * partialPtr until the rest of it arrives.
+ *
+ * Handshake - once the connection is established, and before any reads
+ * are posted, the channel moves to HANDSHAKING state. Handshake messages
+ * are sent and received with overlapped WSASend and WSARecv calls posted
+ * as connect operations so their completions come back through the
+ * connectcompleted() hook, which advances the handshake. The channel
+ * moves to OPEN only when the handshake is done. Nothing blocks on the
+ * server, neither the Tcl thread nor, with the channel locked, the
+ * completion threads. Blocking sockets simply wait for the state change.
+ *
+ * Session resumption - all channels share the Schannel credentials handle
+ * (one each for verified and unverified connections). Schannel caches
+ * sessions per credentials handle and target name so reconnects to the
+ * same server resume the previous session with an abbreviated handshake.
+ *
+ * Renegotiation is not supported and fails the connection. A close_notify
+ * alert from the server is reported as end of file.
+ */
+
+#define IOCP_TLS_HANDSHAKE_SIZE    (16 * 1024) /* Initial receive buffer */
+#define IOCP_TLS_HANDSHAKE_MAX     (256 * 1024) /* Max handshake message */
+#define IOCP_TLS_HANDSHAKE_TIMEOUT 30000 /* ms allowed for the handshake
+                                          * when there is no connect
+                                          * timeout */
+#define IOCP_TLS_CONTEXT_REQ                                            \
+    (ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT |                  \
+     ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR |                 \
+     ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM)
+
+struct IocpTls {
+    CtxtHandle      context;    /* Schannel security context */
+    SecPkgContext_StreamSizes sizes; /* Record layout. Valid once open */
+    IocpBuffer     *partialPtr; /* Ciphertext of an incomplete record */
+    WCHAR          *serverName; /* Name for SNI and certificate validation */
+    SECURITY_STATUS status;     /* Status of the Schannel call that failed */
+    char           *hsBytes;    /* Handshake data received. ckalloc'ed.
+                                 * NULL outside the handshake */
+    int             hsCapacity; /* Size of hsBytes */
+    int             hsLen;      /* Number of bytes of data in hsBytes */
+    void           *hsToken;    /* Handshake token being sent. Allocated
+                                 * by Schannel */
+    SECURITY_STATUS hsStatus;   /* Status of the call that produced hsToken */
+    int             flags;
+#define IOCP_TLS_F_CONTEXT  0x1 /* context is valid */
+#define IOCP_TLS_F_OPEN     0x2 /* Handshake completed */
+#define IOCP_TLS_F_CLOSED   0x4 /* close_notify received */
+#define IOCP_TLS_F_NOVERIFY 0x8 /* Do not validate the server certificate */
+};
+
+static struct IocpTlsCredentials {
+    IocpLock   lock;       /* Protects the remaining fields */
+    CredHandle handles[2]; /* Indexed by whether verification is disabled */
+    int        valid[2];   /* Whether the corresponding handle is valid */
+    int        initialized;
+} iocpTlsCredentials;
+
+static Iocp_DoOnceState iocpTlsInitFlag;
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsInit --
+ *
+ *    Initializes the shared credentials state. Called once per process
+ *    through Iocp_DoOnce.
+ *
+ * Results:
+ *    TCL_OK.
+ *
+ * Side effects:
+ *    The credentials lock is initialized.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode IocpTlsInit(ClientData notUsed)
+{
+    IocpLockInit(&iocpTlsCredentials.lock);
+    iocpTlsCredentials.valid[0]    = 0;
+    iocpTlsCredentials.valid[1]    = 0;
+    iocpTlsCredentials.initialized = 1;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsFinalize --
+ *
+ *    Releases the shared credentials at process exit. Must only be called
+ *    after the completion threads have exited.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The credentials handles are freed. This also discards the session
+ *    cache entries associated with them.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpTlsFinalize(void)
+{
+    int i;
+
+    if (! iocpTlsCredentials.initialized)
+        return;
+    IocpLockAcquireExclusive(&iocpTlsCredentials.lock);
+    for (i = 0; i < 2; ++i) {
+        if (iocpTlsCredentials.valid[i]) {
+            FreeCredentialsHandle(&iocpTlsCredentials.handles[i]);
+            iocpTlsCredentials.valid[i] = 0;
+        }
+    }
+    iocpTlsCredentials.initialized = 0;
+    IocpLockReleaseExclusive(&iocpTlsCredentials.lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsGetCredentials --
+ *
+ *    Returns the shared Schannel credentials handle, acquiring it on first
+ *    use.
+ *
+ * Results:
+ *    SEC_E_OK with the handle stored in *credPtrPtr or a Schannel error.
+ *
+ * Side effects:
+ *    The credentials handle may be acquired.
+ *
+ *------------------------------------------------------------------------
+ */
+static SECURITY_STATUS
+IocpTlsGetCredentials(
+    int          noVerify,      /* If true, server certificates are not
+                                 * validated */
+    PCredHandle *credPtrPtr)    /* Output - credentials handle */
+{
+    SECURITY_STATUS status = SEC_E_OK;
+
+    if (Iocp_DoOnce(&iocpTlsInitFlag, IocpTlsInit, NULL) != TCL_OK)
+        return SEC_E_INTERNAL_ERROR;
+
+    noVerify = noVerify ? 1 : 0;
+    IocpLockAcquireExclusive(&iocpTlsCredentials.lock);
+    if (! iocpTlsCredentials.valid[noVerify]) {
+        SCHANNEL_CRED cred;
+        TimeStamp     expiry;
+
+        memset(&cred, 0, sizeof(cred));
+        cred.dwVersion = SCHANNEL_CRED_VERSION;
+        cred.dwFlags   = SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO;
+        cred.dwFlags  |= noVerify ? SCH_CRED_MANUAL_CRED_VALIDATION
+                                  : SCH_CRED_AUTO_CRED_VALIDATION;
+        status = AcquireCredentialsHandleW(NULL, UNISP_NAME_W,
+                                           SECPKG_CRED_OUTBOUND, NULL, &cred,
+                                           NULL, NULL,
+                                           &iocpTlsCredentials.handles[noVerify],
+                                           &expiry);
+        if (status == SEC_E_OK)
+            iocpTlsCredentials.valid[noVerify] = 1;
+    }
+    *credPtrPtr = &iocpTlsCredentials.handles[noVerify];
+    IocpLockReleaseExclusive(&iocpTlsCredentials.lock);
+    return status;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsFailed --
+ *
+ *    Records the status of a failed Schannel call.
+ *
+ * Results:
+ *    The Winsock error code to report for the channel.
+ *
+ * Side effects:
+ *    The status is stored in tlsPtr for error messages.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+IocpTlsFailed(IocpTls *tlsPtr, SECURITY_STATUS status)
+{
+    tlsPtr->status = status;
+    return WSAECONNABORTED;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsNew --
+ *
+ *    Allocates the TLS state for a client connection. optsObj is a list
+ *    of option value pairs. Supported options are -servername, the name
+ *    sent in the SNI extension and verified against the server
+ *    certificate which defaults to host, and -verify, a boolean that
+ *    controls certificate validation and defaults to true.
+ *
+ * Results:
+ *    TCL_OK with the state stored in *tlsPtrPtr, or TCL_ERROR with an
+ *    error message in interp.
+ *
+ * Side effects:
+ *    Memory is allocated.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpTclCode
+IocpTlsNew(
+    Tcl_Interp *interp,         /* For error messages. May be NULL */
+    Tcl_Obj    *optsObj,        /* Option value pairs */
+    const char *host,           /* Default server name */
+    IocpTls   **tlsPtrPtr)      /* Output - allocated state */
+{
+    static const char *const tlsOptions[] = {
+        "-servername", "-verify", NULL
+    };
+    enum tlsOptions { TLS_SERVERNAME, TLS_VERIFY };
+    Tcl_Obj  **objs;
+    int        nobjs, i, optIndex, verify = 1, nchars;
+    const char *serverName = host;
+    IocpTls   *tlsPtr;
+
+    if (Tcl_ListObjGetElements(interp, optsObj, &nobjs, &objs) != TCL_OK)
+        return TCL_ERROR;
+    for (i = 0; i < nobjs; i += 2) {
+        if (Tcl_GetIndexFromObj(interp, objs[i], tlsOptions, "TLS option",
+                                TCL_EXACT, &optIndex) != TCL_OK)
+            return TCL_ERROR;
+        if (i + 1 >= nobjs) {
+            if (interp) {
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                    "no argument given for TLS option %s",
+                    tlsOptions[optIndex]));
+            }
+            return TCL_ERROR;
+        }
+        switch ((enum tlsOptions) optIndex) {
+        case TLS_SERVERNAME:
+            serverName = Tcl_GetString(objs[i+1]);
+            break;
+        case TLS_VERIFY:
+            if (Tcl_GetBooleanFromObj(interp, objs[i+1], &verify) != TCL_OK)
+                return TCL_ERROR;
+            break;
+        }
+    }
+
+    tlsPtr = ckalloc(sizeof(*tlsPtr));
+    memset(tlsPtr, 0, sizeof(*tlsPtr));
+    if (! verify)
+        tlsPtr->flags |= IOCP_TLS_F_NOVERIFY;
+    nchars = MultiByteToWideChar(CP_UTF8, 0, serverName, -1, NULL, 0);
+    tlsPtr->serverName = ckalloc(nchars * sizeof(WCHAR));
+    MultiByteToWideChar(CP_UTF8, 0, serverName, -1, tlsPtr->serverName, nchars);
+    *tlsPtrPtr = tlsPtr;
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsFree --
+ *
+ *    Frees the TLS state of a channel.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The security context is deleted and memory freed.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpTlsFree(IocpTls *tlsPtr)
+{
+    if (tlsPtr->flags & IOCP_TLS_F_CONTEXT)
+        DeleteSecurityContext(&tlsPtr->context);
+    if (tlsPtr->partialPtr)
+        IocpBufferFree(tlsPtr->partialPtr);
+    /* No handshake I/O is outstanding as it holds a channel reference */
+    if (tlsPtr->hsToken)
+        FreeContextBuffer(tlsPtr->hsToken);
+    if (tlsPtr->hsBytes)
+        ckfree(tlsPtr->hsBytes);
+    ckfree(tlsPtr->serverName);
+    ckfree(tlsPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsError --
+ *
+ *    Returns the status of the Schannel call that failed the connection.
+ *
+ * Results:
+ *    A SECURITY_STATUS value or 0 if no TLS failure occurred.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+DWORD
+IocpTlsError(IocpTls *tlsPtr)
+{
+    return (DWORD) tlsPtr->status;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsPostHandshakeIo --
+ *
+ *    Posts an overlapped send or receive of handshake data on the socket.
+ *    The buffer only carries the OVERLAPPED and is posted as a connect
+ *    operation so its completion is passed to the connectcompleted()
+ *    hook of the channel in HANDSHAKING state. The data itself is held
+ *    in the IocpTls structure.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if the operation was posted or a Winsock error code.
+ *    Note an operation that completes synchronously on a socket with
+ *    inline completions enabled is processed, possibly advancing the
+ *    handshake further, before this function returns.
+ *
+ * Side effects:
+ *    The buffer holds a reference to the channel until it completes.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+IocpTlsPostHandshakeIo(
+    WinsockClient *lockedWsPtr, /* Must be locked on entry. */
+    int            forSend,     /* If true, send, else receive */
+    char          *bytes,       /* Data to send or space to receive into */
+    int            nbytes)      /* Number of bytes to send or receive */
+{
+    IocpChannel *lockedChanPtr = WinsockClientToIocpChannel(lockedWsPtr);
+    IocpBuffer  *bufPtr;
+    WSABUF       wsaBuf;
+    DWORD        flags = 0;
+    DWORD        count;
+    int          result;
+
+    bufPtr = IocpBufferNew(0, IOCP_BUFFER_OP_CONNECT, IOCP_BUFFER_F_WINSOCK);
+    if (bufPtr == NULL)
+        return WSAENOBUFS;
+    bufPtr->chanPtr       = lockedChanPtr;
+    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+    bufPtr->context[0].so = lockedWsPtr->so;
+    bufPtr->context[1].i  = forSend;
+
+    wsaBuf.buf = bytes;
+    wsaBuf.len = nbytes;
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, nbytes, 0);
+    if (forSend)
+        result = WSASend(lockedWsPtr->so, &wsaBuf, 1, &count, 0,
+                         &bufPtr->u.wsaOverlap, NULL);
+    else
+        result = WSARecv(lockedWsPtr->so, &wsaBuf, 1, &count, &flags,
+                         &bufPtr->u.wsaOverlap, NULL);
+    if (result != 0) {
+        IocpWinError winError = WSAGetLastError();
+        if (winError != WSA_IO_PENDING) {
+            lockedChanPtr->numRefs -= 1;
+            bufPtr->chanPtr = NULL; /* Else IocpBufferFree will assert */
+            IocpBufferFree(bufPtr);
+            return winError;
+        }
+    }
+    else if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+        /* Completed synchronously. No completion packet will be queued. */
+        IocpChannelCompleteInline(lockedChanPtr, bufPtr, count);
+    }
+    return ERROR_IO_PENDING;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsPostHandshakeRecv --
+ *
+ *    Posts a receive for more handshake data from the server, growing the
+ *    receive area if it is full.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if the receive was posted or a Winsock error code.
+ *
+ * Side effects:
+ *    See IocpTlsPostHandshakeIo.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+IocpTlsPostHandshakeRecv(
+    WinsockClient *lockedWsPtr) /* Must be locked on entry. */
+{
+    IocpTls *tlsPtr = lockedWsPtr->tlsPtr;
+
+    if (tlsPtr->hsLen == tlsPtr->hsCapacity) {
+        if (tlsPtr->hsCapacity >= IOCP_TLS_HANDSHAKE_MAX)
+            return WSAEMSGSIZE;
+        tlsPtr->hsCapacity *= 2;
+        tlsPtr->hsBytes = ckrealloc(tlsPtr->hsBytes, tlsPtr->hsCapacity);
+    }
+    return IocpTlsPostHandshakeIo(lockedWsPtr, 0,
+                                  tlsPtr->hsBytes + tlsPtr->hsLen,
+                                  tlsPtr->hsCapacity - tlsPtr->hsLen);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsHandshakeFinish --
+ *
+ *    Completes the set up of the TLS state once Schannel reports the
+ *    handshake is done.
+ *
+ * Results:
+ *    0 on success or a Winsock error code.
+ *
+ * Side effects:
+ *    Any application data received along with the final handshake
+ *    message is decrypted and queued to the channel. The handshake
+ *    receive area is freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+IocpTlsHandshakeFinish(
+    WinsockClient *lockedWsPtr) /* Must be locked on entry. */
+{
+    IocpTls        *tlsPtr = lockedWsPtr->tlsPtr;
+    SECURITY_STATUS status;
+    IocpWinError    winError = ERROR_SUCCESS;
+
+    status = QueryContextAttributesW(&tlsPtr->context,
+                                     SECPKG_ATTR_STREAM_SIZES,
+                                     &tlsPtr->sizes);
+    if (status != SEC_E_OK)
+        return IocpTlsFailed(tlsPtr, status);
+
+    tlsPtr->flags |= IOCP_TLS_F_OPEN;
+    if (tlsPtr->hsLen != 0) {
+        IocpBuffer *bufPtr = IocpBufferNew(tlsPtr->hsLen, IOCP_BUFFER_OP_READ,
+                                           IOCP_BUFFER_F_WINSOCK);
+        if (bufPtr == NULL)
+            winError = WSAENOBUFS;
+        else {
+            IocpBufferCopyIn(bufPtr, tlsPtr->hsBytes, tlsPtr->hsLen);
+            WinsockClientTlsInputReady(
+                WinsockClientToIocpChannel(lockedWsPtr), bufPtr);
+        }
+    }
+    ckfree(tlsPtr->hsBytes);
+    tlsPtr->hsBytes    = NULL;
+    tlsPtr->hsCapacity = 0;
+    tlsPtr->hsLen      = 0;
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpTlsHandshakeStep --
+ *
+ *    Passes the handshake data received so far to Schannel and posts the
+ *    next send or receive.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if the handshake continues, 0 if it is done or a
+ *    Winsock error code. On TLS failures the Schannel status is available
+ *    through IocpTlsError.
+ *
+ * Side effects:
+ *    The security context is created or advanced.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+IocpTlsHandshakeStep(
+    WinsockClient *lockedWsPtr) /* Must be locked on entry. */
+{
+    IocpTls        *tlsPtr = lockedWsPtr->tlsPtr;
+    PCredHandle     credPtr;
+    SECURITY_STATUS status;
+
+    status = IocpTlsGetCredentials(tlsPtr->flags & IOCP_TLS_F_NOVERIFY, &credPtr);
+    if (status != SEC_E_OK)
+        return IocpTlsFailed(tlsPtr, status);
+
+    while (1) {
+        SecBuffer     inBufs[2];
+        SecBuffer     outBufs[1];
+        SecBufferDesc inDesc;
+        SecBufferDesc outDesc;
+        ULONG         attrs;
+        int           haveContext = tlsPtr->flags & IOCP_TLS_F_CONTEXT;
+
+        inBufs[0].BufferType = SECBUFFER_TOKEN;
+        inBufs[0].pvBuffer   = tlsPtr->hsBytes;
+        inBufs[0].cbBuffer   = tlsPtr->hsLen;
+        inBufs[1].BufferType = SECBUFFER_EMPTY;
+        inBufs[1].pvBuffer   = NULL;
+        inBufs[1].cbBuffer   = 0;
+        inDesc.ulVersion     = SECBUFFER_VERSION;
+        inDesc.cBuffers      = 2;
+        inDesc.pBuffers      = inBufs;
+
+        outBufs[0].BufferType = SECBUFFER_TOKEN;
+        outBufs[0].pvBuffer   = NULL;
+        outBufs[0].cbBuffer   = 0;
+        outDesc.ulVersion     = SECBUFFER_VERSION;
+        outDesc.cBuffers      = 1;
+        outDesc.pBuffers      = outBufs;
+
+        status = InitializeSecurityContextW(
+            credPtr, haveContext ? &tlsPtr->context : NULL,
+            tlsPtr->serverName, IOCP_TLS_CONTEXT_REQ, 0, 0,
+            haveContext ? &inDesc : NULL, 0,
+            haveContext ? NULL : &tlsPtr->context,
+            &outDesc, &attrs, NULL);
+        if (! haveContext && ! FAILED(status))
+            tlsPtr->flags |= IOCP_TLS_F_CONTEXT;
+
+        if (status == SEC_E_INCOMPLETE_MESSAGE)
+            return IocpTlsPostHandshakeRecv(lockedWsPtr);
+
+        /* Keep unprocessed input for the next round or as application data */
+        if (! FAILED(status)) {
+            if (haveContext && inBufs[1].BufferType == SECBUFFER_EXTRA) {
+                memmove(tlsPtr->hsBytes,
+                        tlsPtr->hsBytes + tlsPtr->hsLen - inBufs[1].cbBuffer,
+                        inBufs[1].cbBuffer);
+                tlsPtr->hsLen = inBufs[1].cbBuffer;
+            }
+            else if (status != SEC_I_INCOMPLETE_CREDENTIALS)
+                tlsPtr->hsLen = 0;
+        }
+
+        /*
+         * Any token, including an alert generated for a failure, is sent
+         * before going on. IocpTlsHandshakeCompleted resumes from the
+         * status once the send completes.
+         */
+        if (outBufs[0].cbBuffer != 0 && outBufs[0].pvBuffer != NULL) {
+            IocpWinError winError;
+            tlsPtr->hsToken  = outBufs[0].pvBuffer;
+            tlsPtr->hsStatus = status;
+            winError = IocpTlsPostHandshakeIo(lockedWsPtr, 1, tlsPtr->hsToken,
+                                              outBufs[0].cbBuffer);
+            if (winError == ERROR_IO_PENDING)
+                return winError;
+            FreeContextBuffer(tlsPtr->hsToken);
+            tlsPtr->hsToken = NULL;
+            return FAILED(status) ? IocpTlsFailed(tlsPtr, status) : winError;
+        }
+        if (FAILED(status))
+            return IocpTlsFailed(tlsPtr, status);
+        if (status == SEC_E_OK)
+            return IocpTlsHandshakeFinish(lockedWsPtr);
+        if (status == SEC_I_INCOMPLETE_CREDENTIALS)
+            continue; /* No client certificate. Carry on without one */
+        if (status != SEC_I_CONTINUE_NEEDED)
+            return IocpTlsFailed(tlsPtr, status);
+        if (tlsPtr->hsLen == 0)
+            return IocpTlsPostHandshakeRecv(lockedWsPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsHandshake --
+ *
+ *    Starts the TLS handshake on a newly connected socket. Must be called
+ *    before any reads are posted on the socket. The handshake is carried
+ *    out with overlapped sends and receives whose completions are passed
+ *    to WinsockClientTlsHandshakeCompleted so no thread ever blocks on
+ *    the server. Blocking connects wait for it with
+ *    IocpChannelAwaitHandshake.
+ *
+ *    Unless a connect timeout applies, the handshake is failed if it does
+ *    not finish within IOCP_TLS_HANDSHAKE_TIMEOUT.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if the handshake was started or a Winsock error
+ *    code. On TLS failures the Schannel status is available through
+ *    IocpTlsError.
+ *
+ * Side effects:
+ *    The channel is moved to HANDSHAKING state and the channel timer may
+ *    be armed.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientTlsHandshake(
+    WinsockClient *lockedWsPtr) /* Must be locked on entry. */
+{
+    IocpChannel *lockedChanPtr = WinsockClientToIocpChannel(lockedWsPtr);
+    IocpTls     *tlsPtr        = lockedWsPtr->tlsPtr;
+    IocpWinError winError;
+
+    IOCP_ASSERT(tlsPtr != NULL);
+    IOCP_ASSERT(lockedWsPtr->so != INVALID_SOCKET);
+    IOCP_ASSERT(tlsPtr->hsBytes == NULL);
+
+    tlsPtr->hsCapacity = IOCP_TLS_HANDSHAKE_SIZE;
+    tlsPtr->hsBytes    = ckalloc(tlsPtr->hsCapacity);
+    tlsPtr->hsLen      = 0;
+
+    /* Before posting since the first send may complete inline */
+    IocpChannelSetState(lockedChanPtr, IOCP_STATE_HANDSHAKING);
+    lockedChanPtr->winError = ERROR_SUCCESS; /* From earlier addresses */
+    if (lockedChanPtr->connectDeadline == 0) {
+        lockedChanPtr->connectDeadline =
+            GetTickCount64() + IOCP_TLS_HANDSHAKE_TIMEOUT;
+    }
+    winError = IocpChannelScheduleTimeouts(lockedChanPtr);
+    if (winError != ERROR_SUCCESS)
+        return winError;
+
+    return IocpTlsHandshakeStep(lockedWsPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsHandshakeCompleted --
+ *
+ *    Continues the handshake when a send or receive posted by
+ *    IocpTlsHandshakeStep completes. Called from the connectcompleted()
+ *    hook in HANDSHAKING state.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if the handshake continues, 0 if it is done or a
+ *    Winsock error code.
+ *
+ * Side effects:
+ *    See IocpTlsHandshakeStep. The sent token is released.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientTlsHandshakeCompleted(
+    WinsockClient *lockedWsPtr, /* Must be locked on entry. */
+    IocpBuffer    *bufPtr)      /* Completed handshake send or receive */
+{
+    IocpTls        *tlsPtr = lockedWsPtr->tlsPtr;
+    SECURITY_STATUS status;
+
+    if (bufPtr->context[1].i) {
+        /* Send completion */
+        status = tlsPtr->hsStatus;
+        FreeContextBuffer(tlsPtr->hsToken);
+        tlsPtr->hsToken = NULL;
+        if (FAILED(status))
+            return IocpTlsFailed(tlsPtr, status);
+        if (bufPtr->winError != ERROR_SUCCESS)
+            return bufPtr->winError;
+        if (status == SEC_E_OK)
+            return IocpTlsHandshakeFinish(lockedWsPtr);
+        if (status == SEC_I_CONTINUE_NEEDED && tlsPtr->hsLen == 0)
+            return IocpTlsPostHandshakeRecv(lockedWsPtr);
+    }
+    else {
+        /* Receive completion */
+        if (bufPtr->winError != ERROR_SUCCESS)
+            return bufPtr->winError;
+        if (bufPtr->data.len == 0)
+            return WSAECONNRESET; /* Server closed the connection */
+        tlsPtr->hsLen += bufPtr->data.len;
+    }
+    return IocpTlsHandshakeStep(lockedWsPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsConnected --
+ *
+ *    Completes set up of an asynchronously connected TLS socket and starts
+ *    the handshake. Follows the API defined by connected() in IocpChannel
+ *    vtbl.
+ *
+ * Results:
+ *    Returns ERROR_IO_PENDING if the handshake was started or a Windows
+ *    error code which is also stored in lockedChanPtr->winError.
+ *
+ * Side effects:
+ *    See WinsockClientAsyncConnected and WinsockClientTlsHandshake. The
+ *    socket is closed on failure.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientTlsConnected(
+    IocpChannel *lockedChanPtr) /* Must be locked on entry. */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpWinError   winError;
+
+    winError = WinsockClientAsyncConnected(lockedChanPtr);
+    if (winError != ERROR_SUCCESS)
+        return winError;
+    winError = WinsockClientTlsHandshake(lockedWsPtr);
+    if (winError != ERROR_SUCCESS && winError != ERROR_IO_PENDING) {
+        lockedChanPtr->winError = winError;
+        closesocket(lockedWsPtr->so);
+        lockedWsPtr->so = INVALID_SOCKET;
+    }
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsLimits --
+ *
+ *    Returns the layout of records on an established TLS connection.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The header and trailer sizes and the maximum number of data bytes in
+ *    a record are stored in the passed locations.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+WinsockClientTlsLimits(
+    WinsockClient *lockedWsPtr,
+    int *headerPtr,
+    int *trailerPtr,
+    int *maxDataPtr)
+{
+    IocpTls *tlsPtr = lockedWsPtr->tlsPtr;
+
+    IOCP_ASSERT(tlsPtr->flags & IOCP_TLS_F_OPEN);
+    *headerPtr  = tlsPtr->sizes.cbHeader;
+    *trailerPtr = tlsPtr->sizes.cbTrailer;
+    *maxDataPtr = tlsPtr->sizes.cbMaximumMessage;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsEncrypt --
+ *
+ *    Encrypts the data in a queued output buffer into a TLS record in
+ *    place. The buffer must have been laid out as per
+ *    WinsockClientTlsLimits.
+ *
+ * Results:
+ *    0 on success or a Winsock error code.
+ *
+ * Side effects:
+ *    The buffer data is replaced by the record and outputBytes of the
+ *    channel is incremented by the record overhead.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientTlsEncrypt(
+    WinsockClient *lockedWsPtr, /* Must be locked on entry. */
+    IocpBuffer    *bufPtr)      /* Buffer removed from outputBuffers */
+{
+    IocpTls        *tlsPtr = lockedWsPtr->tlsPtr;
+    char           *dataPtr = bufPtr->data.bytes + bufPtr->data.begin;
+    SecBuffer       secBufs[4];
+    SecBufferDesc   desc;
+    SECURITY_STATUS status;
+    int             recordLen;
+
+    IOCP_ASSERT(bufPtr->data.begin >= (int) tlsPtr->sizes.cbHeader);
+    IOCP_ASSERT(bufPtr->data.capacity - bufPtr->data.begin - bufPtr->data.len
+                >= (int) tlsPtr->sizes.cbTrailer);
+
+    secBufs[0].BufferType = SECBUFFER_STREAM_HEADER;
+    secBufs[0].pvBuffer   = dataPtr - tlsPtr->sizes.cbHeader;
+    secBufs[0].cbBuffer   = tlsPtr->sizes.cbHeader;
+    secBufs[1].BufferType = SECBUFFER_DATA;
+    secBufs[1].pvBuffer   = dataPtr;
+    secBufs[1].cbBuffer   = bufPtr->data.len;
+    secBufs[2].BufferType = SECBUFFER_STREAM_TRAILER;
+    secBufs[2].pvBuffer   = dataPtr + bufPtr->data.len;
+    secBufs[2].cbBuffer   = tlsPtr->sizes.cbTrailer;
+    secBufs[3].BufferType = SECBUFFER_EMPTY;
+    secBufs[3].pvBuffer   = NULL;
+    secBufs[3].cbBuffer   = 0;
+    desc.ulVersion = SECBUFFER_VERSION;
+    desc.cBuffers  = 4;
+    desc.pBuffers  = secBufs;
+
+    status = EncryptMessage(&tlsPtr->context, 0, &desc, 0);
+    if (status != SEC_E_OK)
+        return IocpTlsFailed(tlsPtr, status);
+
+    /* Header, data and trailer are contiguous. Trailer may be shorter */
+    recordLen = secBufs[0].cbBuffer + secBufs[1].cbBuffer + secBufs[2].cbBuffer;
+    lockedWsPtr->base.outputBytes += recordLen - bufPtr->data.len;
+    bufPtr->data.begin -= secBufs[0].cbBuffer;
+    bufPtr->data.len    = recordLen;
+    return ERROR_SUCCESS;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsInputReady --
+ *
+ *    Decrypts the TLS records in a completed read buffer in place and
+ *    queues the plaintext to the channel. Implements the inputready()
+ *    interface of IocpChannel.
+ *
+ * Results:
+ *    Number of buffers queued.
+ *
+ * Side effects:
+ *    bufPtr is queued, freed or held as a partial record. A close_notify
+ *    from the server or a decryption failure is queued as end of file or
+ *    an error respectively.
+ *
+ *------------------------------------------------------------------------
+ */
+int
+WinsockClientTlsInputReady(
+    IocpChannel *lockedChanPtr, /* Locked on entry, locked on return */
+    IocpBuffer  *bufPtr)        /* Buffer in posting order. Does not
+                                 * reference lockedChanPtr */
+{
+    IocpTls     *tlsPtr = IocpChannelToWinsockClient(lockedChanPtr)->tlsPtr;
+    IocpWinError winError = ERROR_SUCCESS;
+    char        *startPtr, *outPtr, *inPtr;
+    int          remaining, queued = 0, eof = 0;
+
+    if (bufPtr->winError != ERROR_SUCCESS || bufPtr->data.len == 0) {
+        /* Errors and end of file are passed on as is */
+        if (tlsPtr->partialPtr) {
+            IocpBufferFree(tlsPtr->partialPtr);
+            tlsPtr->partialPtr = NULL;
+        }
+        IocpChannelQueueInput(lockedChanPtr, bufPtr);
+        return 1;
+    }
+    if (tlsPtr->flags & IOCP_TLS_F_CLOSED) {
+        IocpBufferFree(bufPtr); /* Data following close_notify is ignored */
+        return 0;
+    }
+
+    if (tlsPtr->partialPtr) {
+        IocpBuffer *partialPtr = tlsPtr->partialPtr;
+        tlsPtr->partialPtr = NULL;
+        if (partialPtr->data.capacity - partialPtr->data.begin - partialPtr->data.len
+            < bufPtr->data.len) {
+            IocpBuffer *newPtr = IocpBufferNew(partialPtr->data.len + bufPtr->data.len,
+                                               IOCP_BUFFER_OP_READ,
+                                               IOCP_BUFFER_F_WINSOCK);
+            if (newPtr == NULL) {
+                IocpBufferFree(partialPtr);
+                bufPtr->winError = WSAENOBUFS;
+                bufPtr->data.len = 0;
+                IocpChannelQueueInput(lockedChanPtr, bufPtr);
+                return 1;
+            }
+            IocpBufferCopyIn(newPtr,
+                             partialPtr->data.bytes + partialPtr->data.begin,
+                             partialPtr->data.len);
+            IocpBufferFree(partialPtr);
+            partialPtr = newPtr;
+        }
+        IocpBufferAppend(partialPtr, bufPtr->data.bytes + bufPtr->data.begin,
+                         bufPtr->data.len);
+        IocpBufferFree(bufPtr);
+        bufPtr = partialPtr;
+    }
+
+    /*
+     * Decrypt each record in turn. The plaintext of a record is never
+     * longer than its ciphertext so it is moved down to follow the
+     * plaintext of preceding records.
+     */
+    startPtr  = bufPtr->data.bytes + bufPtr->data.begin;
+    outPtr    = startPtr;
+    inPtr     = startPtr;
+    remaining = bufPtr->data.len;
+    while (remaining > 0) {
+        SecBuffer       secBufs[4];
+        SecBufferDesc   desc;
+        SECURITY_STATUS status;
+        int             i;
+
+        secBufs[0].BufferType = SECBUFFER_DATA;
+        secBufs[0].pvBuffer   = inPtr;
+        secBufs[0].cbBuffer   = remaining;
+        for (i = 1; i < 4; ++i) {
+            secBufs[i].BufferType = SECBUFFER_EMPTY;
+            secBufs[i].pvBuffer   = NULL;
+            secBufs[i].cbBuffer   = 0;
+        }
+        desc.ulVersion = SECBUFFER_VERSION;
+        desc.cBuffers  = 4;
+        desc.pBuffers  = secBufs;
+
+        status = DecryptMessage(&tlsPtr->context, &desc, 0, NULL);
+        if (status == SEC_E_INCOMPLETE_MESSAGE)
+            break;
+        if (status != SEC_E_OK) {
+            if (status == SEC_I_CONTEXT_EXPIRED) {
+                tlsPtr->flags |= IOCP_TLS_F_CLOSED;
+                eof = 1;
+            }
+            else
+                winError = IocpTlsFailed(tlsPtr, status); /* Incl. renegotiation */
+            remaining = 0;
+            break;
+        }
+        remaining = 0;
+        for (i = 1; i < 4; ++i) {
+            if (secBufs[i].BufferType == SECBUFFER_DATA) {
+                memmove(outPtr, secBufs[i].pvBuffer, secBufs[i].cbBuffer);
+                outPtr += secBufs[i].cbBuffer;
+            }
+            else if (secBufs[i].BufferType == SECBUFFER_EXTRA) {
+                inPtr     = (char *) secBufs[i].pvBuffer;
+                remaining = secBufs[i].cbBuffer;
+            }
+        }
+    }
+
+    if (remaining > 0) {
+        /* Hold the incomplete record till the rest of it is received */
+        if (outPtr == startPtr) {
+            bufPtr->data.begin = (int) (inPtr - bufPtr->data.bytes);
+            bufPtr->data.len   = remaining;
+            tlsPtr->partialPtr = bufPtr;
+            return 0;
+        }
+        tlsPtr->partialPtr = IocpBufferNew(
+            remaining < IOCP_BUFFER_DEFAULT_SIZE ? IOCP_BUFFER_DEFAULT_SIZE : remaining,
+            IOCP_BUFFER_OP_READ, IOCP_BUFFER_F_WINSOCK);
+        if (tlsPtr->partialPtr == NULL)
+            winError = WSAENOBUFS;
+        else
+            IocpBufferCopyIn(tlsPtr->partialPtr, inPtr, remaining);
+    }
+
+    bufPtr->data.len = (int) (outPtr - startPtr);
+    if (bufPtr->data.len != 0) {
+        IocpChannelQueueInput(lockedChanPtr, bufPtr);
+        ++queued;
+        if (winError == ERROR_SUCCESS && ! eof)
+            return queued;
+        /* Follow the plaintext by the end of file or error indication */
+        bufPtr = IocpBufferNew(0, IOCP_BUFFER_OP_READ, IOCP_BUFFER_F_WINSOCK);
+        if (bufPtr == NULL) {
+            lockedChanPtr->winError = winError ? winError : WSAENOBUFS;
+            return queued;
+        }
+    }
+    else if (winError == ERROR_SUCCESS && ! eof) {
+        IocpBufferFree(bufPtr); /* Records with no application data */
+        return queued;
+    }
+    bufPtr->winError = winError;
+    IocpChannelQueueInput(lockedChanPtr, bufPtr);
+    return queued + 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientTlsDescribe --
+ *
+ *    Returns the state of a TLS connection as a dictionary with keys
+ *    Protocol, CipherStrength, Resumed and ServerName.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The dictionary elements are appended to dsPtr. Nothing is appended
+ *    if the handshake has not completed.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+WinsockClientTlsDescribe(
+    WinsockClient *lockedWsPtr, /* Must be locked on entry. */
+    Tcl_DString   *dsPtr)
+{
+    IocpTls *tlsPtr = lockedWsPtr->tlsPtr;
+    SecPkgContext_ConnectionInfo connInfo;
+    SecPkgContext_SessionInfo    sessionInfo;
+    const char  *protocol = "unknown";
+    char         integerSpace[TCL_INTEGER_SPACE];
+    char         nameSpace[256];
+    int          resumed = 0;
+
+    if (tlsPtr == NULL || (tlsPtr->flags & IOCP_TLS_F_OPEN) == 0)
+        return;
+    if (QueryContextAttributesW(&tlsPtr->context, SECPKG_ATTR_CONNECTION_INFO,
+                                &connInfo) != SEC_E_OK)
+        memset(&connInfo, 0, sizeof(connInfo));
+    if (QueryContextAttributesW(&tlsPtr->context, SECPKG_ATTR_SESSION_INFO,
+                                &sessionInfo) == SEC_E_OK)
+        resumed = (sessionInfo.dwFlags & SSL_SESSION_RECONNECT) != 0;
+    switch (connInfo.dwProtocol) {
+    case SP_PROT_TLS1_CLIENT:   protocol = "TLS1.0"; break;
+    case SP_PROT_TLS1_1_CLIENT: protocol = "TLS1.1"; break;
+    case SP_PROT_TLS1_2_CLIENT: protocol = "TLS1.2"; break;
+#ifdef SP_PROT_TLS1_3_CLIENT
+    case SP_PROT_TLS1_3_CLIENT: protocol = "TLS1.3"; break;
+#endif
+    }
+    if (WideCharToMultiByte(CP_UTF8, 0, tlsPtr->serverName, -1,
+                            nameSpace, sizeof(nameSpace), NULL, NULL) == 0)
+        nameSpace[0] = '\0';
+
+    Tcl_DStringAppendElement(dsPtr, "Protocol");
+    Tcl_DStringAppendElement(dsPtr, protocol);
+    Tcl_DStringAppendElement(dsPtr, "CipherStrength");
+    sprintf_s(integerSpace, sizeof(integerSpace), "%u", connInfo.dwCipherStrength);
+    Tcl_DStringAppendElement(dsPtr, integerSpace);
+    Tcl_DStringAppendElement(dsPtr, "Resumed");
+    Tcl_DStringAppendElement(dsPtr, resumed ? "1" : "0");
+    Tcl_DStringAppendElement(dsPtr, "ServerName");
+    Tcl_DStringAppendElement(dsPtr, nameSpace);
+}
@@ -0,0 +1,1220 @@
+/*
+ * tclWinIocpUdp.c --
+ *
+ *	UDP support for Windows IOCP.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+#include "tclWinIocp.h"
+#include "tclWinIocpWinsock.h"
+
+#define IOCP_UDP_NAME_PREFIX "udp"
+#define PACKAGE_NAME_UDP     PACKAGE_NAME "_udp"
+
+/*
+ * UDP sockets are WinsockClient channels that are open from creation.
+ * Receives are WSARecvFrom calls into pooled buffers, each completing with
+ * a single datagram. Unlike TCP, there is no flow control to push back on
+ * the sender so reads are kept posted even when the application falls
+ * behind. Datagrams arriving while the input budget is exhausted are
+ * dropped and counted instead of being silently dropped by the stack.
+ * Datagrams that cannot be delivered intact, and errors such as ICMP
+ * unreachable notifications that only concern a single datagram, are also
+ * dropped and counted. Each completion replaces itself with a new receive
+ * from the completion thread so the number outstanding does not depend on
+ * how fast the Tcl thread consumes input.
+ *
+ * Each receive and send buffer starts with the peer address of the
+ * datagram. The datagram itself follows at data.begin so that the common
+ * channel input code only sees the payload. iocp::udp::recv also returns
+ * the peer address.
+ */
+
+#ifndef SIO_UDP_CONNRESET
+# define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR, 12)
+#endif
+#ifndef SIO_UDP_NETRESET
+# define SIO_UDP_NETRESET  _WSAIOW(IOC_VENDOR, 15)
+#endif
+
+typedef struct UdpPeer {
+    IocpSockaddr addr;          /* Source or destination of the datagram */
+    INT          addrLen;       /* Length of addr. Updated by WSARecvFrom */
+} UdpPeer;
+#define IOCP_UDP_PEER_SPACE ((int)((sizeof(UdpPeer) + 15) & ~15))
+
+#define IOCP_UDP_MAX_RECEIVES       16  /* Default -maxpendingreads */
+#define IOCP_UDP_MAX_RECEIVES_LIMIT 256 /* Max -maxpendingreads */
+#define IOCP_UDP_READ_SIZE          2048 /* Default -readbuffersize */
+#define IOCP_UDP_MAX_DATAGRAM       65527 /* IPv6 payload limit */
+#define IOCP_UDP_MAX_RECV_COUNT     10000 /* Max datagrams per recv call */
+
+static void         UdpInit(IocpChannel *chanPtr);
+static int          UdpShutdown(Tcl_Interp *, IocpChannel *, int);
+static IocpWinError UdpPostRead(IocpChannel *lockedChanPtr);
+static IocpWinError UdpReadCompleted(IocpChannel *lockedChanPtr,
+                                     IocpBuffer *bufPtr);
+static IocpWinError UdpPostWrite(IocpChannel *lockedChanPtr,
+                                 const char *bytes, int nbytes,
+                                 int *countPtr);
+static IocpTclCode  UdpGetOption(IocpChannel *lockedChanPtr,
+                                 Tcl_Interp *interp, int opt,
+                                 Tcl_DString *dsPtr);
+static IocpTclCode  UdpSetOption(IocpChannel *lockedChanPtr,
+                                 Tcl_Interp *interp, int opt,
+                                 const char *valuePtr);
+
+static IocpChannelVtbl udpVtbl =  {
+    /* "Virtual" functions */
+    UdpInit,
+    WinsockClientFinit,
+    UdpShutdown,
+    NULL,                       /* Accept */
+    NULL,                       /* BlockingConnect */
+    NULL,                       /* Connected */
+    NULL,                       /* ConnectFailed */
+    NULL,                       /* ConnectCompleted */
+    NULL,                       /* ConnectTimedOut */
+    NULL,                       /* Disconnected */
+    UdpPostRead,
+    UdpReadCompleted,
+    NULL,                       /* InputReady */
+    UdpPostWrite,
+    NULL,                       /* FlushOutput. Sends are never queued */
+    WinsockClientGetHandle,
+    UdpGetOption,
+    UdpSetOption,
+    WinsockClientTranslateError,
+    /* Data members */
+    iocpWinsockOptionNames,
+    sizeof(WinsockClient)
+};
+
+/* Options listed in errors for options not applicable to UDP */
+#define IOCP_UDP_OPTION_LIST \
+    "-error -inlinecompletion -maxinputbytes -maxpendingreads" \
+    " -maxspinwait -peername -readbuffersize -readtimeout -sockname" \
+    " -sorcvbuf -sosndbuf -stats -writehighwater"
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpInit --
+ *
+ *    Initializes the WinsockClient structure for a UDP socket. Reads are
+ *    fixed size as truncated datagrams cannot be completed later.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static void UdpInit(IocpChannel *chanPtr)
+{
+    WinsockClientInit(chanPtr);
+    chanPtr->maxPendingReads = IOCP_UDP_MAX_RECEIVES;
+    chanPtr->readBufferSize  = IOCP_UDP_READ_SIZE;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpShutdown --
+ *
+ *    Conforms to the IocpChannel shutdown interface. There is no
+ *    connection to disconnect so the socket is simply closed. Half closes
+ *    are not supported.
+ *
+ * Results:
+ *    0 on success, else a POSIX error code.
+ *
+ * Side effects:
+ *    The socket is closed, cancelling outstanding operations.
+ *
+ *------------------------------------------------------------------------
+ */
+static int UdpShutdown(
+    Tcl_Interp   *interp,       /* May be NULL */
+    IocpChannel *lockedChanPtr, /* Locked pointer to the base IocpChannel */
+    int          flags)         /* Combination of TCL_CLOSE_{READ,WRITE} */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if ((flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE)) !=
+        (TCL_CLOSE_READ|TCL_CLOSE_WRITE))
+        return flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE) ? EINVAL : 0;
+
+    if (lockedWsPtr->so != INVALID_SOCKET) {
+        if (closesocket(lockedWsPtr->so) == SOCKET_ERROR) {
+            lockedWsPtr->so = INVALID_SOCKET;
+            IocpSetTclErrnoFromWin32(WSAGetLastError());
+            return Tcl_GetErrno();
+        }
+        lockedWsPtr->so = INVALID_SOCKET;
+    }
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpPostRead --
+ *
+ *    Allocates a receive buffer and posts a WSARecvFrom on the socket.
+ *    Implements the behavior defined for postread() in IocpChannel vtbl.
+ *    The peer address is received into the head of the buffer.
+ *
+ * Results:
+ *    Returns 0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    The receive buffer is queued to the socket and the pending reads
+ *    count in the IocpChannel is incremented.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+UdpPostRead(IocpChannel *lockedChanPtr)
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpBuffer *bufPtr;
+    UdpPeer    *peerPtr;
+    WSABUF      wsaBuf;
+    DWORD       flags;
+    DWORD       wsaError;
+    DWORD       received;
+
+    IOCP_ASSERT(lockedWsPtr->base.state == IOCP_STATE_OPEN);
+
+    bufPtr = IocpBufferNew(
+        IOCP_UDP_PEER_SPACE + IocpChannelReadBufferSize(lockedChanPtr),
+        IOCP_BUFFER_OP_READ, IOCP_BUFFER_F_WINSOCK);
+    if (bufPtr == NULL)
+        return WSAENOBUFS;
+
+    peerPtr          = (UdpPeer *) bufPtr->data.bytes;
+    peerPtr->addrLen = sizeof(peerPtr->addr);
+    bufPtr->data.begin = IOCP_UDP_PEER_SPACE;
+
+    bufPtr->chanPtr    = lockedChanPtr;
+    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+    /* Completions may be dequeued out of order by the completion threads */
+    bufPtr->sequence   = lockedChanPtr->readSeqPosted++;
+
+    wsaBuf.buf = bufPtr->data.bytes + bufPtr->data.begin;
+    wsaBuf.len = bufPtr->data.capacity - bufPtr->data.begin;
+    flags      = 0;
+
+    IOCP_ASSERT(lockedWsPtr->so != INVALID_SOCKET);
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, wsaBuf.len, 0);
+    IOCP_LATENCY_STAMP_POST(bufPtr);
+    if (WSARecvFrom(lockedWsPtr->so, &wsaBuf, 1, &received, &flags,
+                    &peerPtr->addr.sa, &peerPtr->addrLen,
+                    &bufPtr->u.wsaOverlap, NULL) != 0) {
+        if ((wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
+            lockedChanPtr->numRefs -= 1;
+            lockedChanPtr->readSeqPosted--;
+            bufPtr->chanPtr = NULL;
+            IocpBufferFree(bufPtr);
+            return wsaError;
+        }
+        lockedChanPtr->pendingReads++;
+        IocpChannelTrackRead(lockedChanPtr, bufPtr);
+        IOCP_COUNTER_INCR(IocpReadsPosted);
+    }
+    else {
+        lockedChanPtr->pendingReads++;
+        IocpChannelTrackRead(lockedChanPtr, bufPtr);
+        IOCP_COUNTER_INCR(IocpReadsPosted);
+        if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+            /* Completed synchronously. No completion packet will be queued. */
+            IocpChannelCompleteInline(lockedChanPtr, bufPtr, received);
+        }
+    }
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpRefillReads --
+ *
+ *    Posts receives to replace completed ones. Called from the completion
+ *    path so reads do not wait for the Tcl thread to consume input. With
+ *    inline completion, the posts may complete and recurse back here. The
+ *    IOCP_WINSOCK_UDP_REFILL flag stops the recursion with the outermost
+ *    call doing all the posting. The number of posts is bounded so a
+ *    flood does not hold the channel lock indefinitely. If receives run
+ *    out meanwhile, the channel input posts them again.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Receives are posted on the socket.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+UdpRefillReads(WinsockClient *lockedWsPtr)
+{
+    IocpChannel *lockedChanPtr = WinsockClientToIocpChannel(lockedWsPtr);
+    int maxPosts = 2 * IocpChannelReadsToPost(lockedChanPtr);
+    int numPosts;
+
+    if (lockedWsPtr->flags & IOCP_WINSOCK_UDP_REFILL)
+        return;
+    lockedWsPtr->flags |= IOCP_WINSOCK_UDP_REFILL;
+    for (numPosts = 0;
+         numPosts < maxPosts &&
+             lockedChanPtr->state == IOCP_STATE_OPEN &&
+             lockedWsPtr->so != INVALID_SOCKET &&
+             lockedChanPtr->pendingReads < IocpChannelReadsToPost(lockedChanPtr);
+         ++numPosts) {
+        if (UdpPostRead(lockedChanPtr) != 0)
+            break;
+    }
+    lockedWsPtr->flags &= ~IOCP_WINSOCK_UDP_REFILL;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpReadCompleted --
+ *
+ *    Implements the readcompleted() hook for UDP sockets. Datagrams that
+ *    cannot be passed up are marked for discarding and counted. These are
+ *    truncated datagrams, zero-length datagrams (which would otherwise be
+ *    seen as EOF), datagrams received while the input budget is exhausted
+ *    and receives that failed with errors only affecting one datagram.
+ *    Other errors are passed up. A replacement receive is then posted.
+ *
+ * Results:
+ *    Always 0 as bufPtr is never reposted.
+ *
+ * Side effects:
+ *    Receives are posted on the socket and drop counters updated.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+UdpReadCompleted(
+    IocpChannel *lockedChanPtr, /* Must be locked */
+    IocpBuffer  *bufPtr)        /* Completed read */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if (lockedChanPtr->state != IOCP_STATE_OPEN ||
+        lockedWsPtr->so == INVALID_SOCKET)
+        return 0;               /* Closing. Cancelled reads passed up. */
+
+    switch (bufPtr->winError) {
+    case ERROR_SUCCESS:
+        if (bufPtr->data.len == 0) {
+            IOCP_COUNTER_INCR(IocpUdpEmptyDrops);
+            bufPtr->flags |= IOCP_BUFFER_F_DISCARD;
+        }
+        else if (IocpChannelInputOverBudget(lockedChanPtr)) {
+            IOCP_COUNTER_INCR(IocpUdpOverflowDrops);
+            bufPtr->flags |= IOCP_BUFFER_F_DISCARD;
+        }
+        else
+            IOCP_COUNTER_INCR(IocpUdpDatagramsReceived);
+        break;
+    case WSAEMSGSIZE:
+        IOCP_COUNTER_INCR(IocpUdpTruncatedDrops);
+        bufPtr->flags |= IOCP_BUFFER_F_DISCARD;
+        break;
+    case WSAECONNRESET:
+    case WSAENETRESET:
+    case WSAEHOSTUNREACH:
+    case WSAENETUNREACH:
+        /* ICMP errors in response to earlier sends */
+        IOCP_COUNTER_INCR(IocpUdpErrorDrops);
+        bufPtr->flags |= IOCP_BUFFER_F_DISCARD;
+        break;
+    default:
+        return 0;               /* Let the application see it */
+    }
+
+    UdpRefillReads(lockedWsPtr);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpPostSend --
+ *
+ *    Posts a single datagram with WSASendTo. Sends are posted immediately
+ *    without regard to maxPendingWrites as each is one datagram. Callers
+ *    are responsible for checking against maxOutputBytes.
+ *
+ * Results:
+ *    0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    The pending writes count and outputBytes of the channel are
+ *    incremented.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+UdpPostSend(
+    IocpChannel        *lockedChanPtr, /* Must be locked */
+    const char         *bytes,         /* Datagram */
+    int                 nbytes,        /* Length of datagram */
+    const IocpSockaddr *toPtr,         /* Destination. NULL for the
+                                        * connected peer */
+    int                 toLen)         /* Length of *toPtr */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpBuffer *bufPtr;
+    UdpPeer    *peerPtr;
+    WSABUF      wsaBuf;
+    DWORD       sent;
+    DWORD       wsaError;
+
+    if (lockedWsPtr->so == INVALID_SOCKET)
+        return WSAENOTCONN;
+    if (nbytes > IOCP_UDP_MAX_DATAGRAM)
+        return WSAEMSGSIZE;
+
+    bufPtr = IocpBufferNew(IOCP_UDP_PEER_SPACE + nbytes,
+                           IOCP_BUFFER_OP_WRITE, IOCP_BUFFER_F_WINSOCK);
+    if (bufPtr == NULL)
+        return WSAENOBUFS;
+    peerPtr = (UdpPeer *) bufPtr->data.bytes;
+    if (toPtr)
+        memcpy(&peerPtr->addr, toPtr, toLen);
+    peerPtr->addrLen   = toLen;
+    bufPtr->data.begin = IOCP_UDP_PEER_SPACE;
+    IocpBufferAppend(bufPtr, bytes, nbytes);
+    bufPtr->context[0].ptr = NULL; /* Nothing gathered. See IocpCompleteWrite */
+
+    bufPtr->chanPtr = lockedChanPtr;
+    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+    lockedChanPtr->outputBytes += nbytes;
+
+    wsaBuf.buf = bufPtr->data.bytes + bufPtr->data.begin;
+    wsaBuf.len = nbytes;
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, nbytes, 0);
+    IOCP_LATENCY_STAMP_POST(bufPtr);
+    if (WSASendTo(lockedWsPtr->so, &wsaBuf, 1, &sent, 0,
+                  toPtr ? &peerPtr->addr.sa : NULL, toPtr ? toLen : 0,
+                  &bufPtr->u.wsaOverlap, NULL) != 0) {
+        if ((wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
+            lockedChanPtr->numRefs -= 1;
+            lockedChanPtr->outputBytes -= nbytes;
+            bufPtr->chanPtr = NULL;
+            IocpBufferFree(bufPtr);
+            return wsaError;
+        }
+        lockedChanPtr->pendingWrites++;
+        IOCP_COUNTER_INCR(IocpWritesPosted);
+    }
+    else {
+        lockedChanPtr->pendingWrites++;
+        IOCP_COUNTER_INCR(IocpWritesPosted);
+        if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+            /* Completed synchronously. No completion packet will be queued. */
+            IocpChannelCompleteInline(lockedChanPtr, bufPtr, sent);
+        }
+    }
+    IOCP_COUNTER_INCR(IocpUdpDatagramsSent);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpPostWrite --
+ *
+ *    Implements the postwrite() hook. Each write is sent as one datagram
+ *    to the connected peer. Unlike the TCP channels, writes are never
+ *    coalesced.
+ *
+ * Results:
+ *    Same as WinsockClientPostWrite.
+ *
+ * Side effects:
+ *    The datagram is posted to the socket.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+UdpPostWrite(
+    IocpChannel *lockedChanPtr, /* Must be locked on entry */
+    const char  *bytes,         /* Pointer to data to write */
+    int          nbytes,        /* Number of data bytes to write */
+    int         *countPtr)      /* Output - Number of bytes written */
+{
+    IocpWinError winError;
+
+    if (lockedChanPtr->outputBytes >= lockedChanPtr->maxOutputBytes) {
+        /* Not an error but indicate nothing written */
+        *countPtr = 0;
+        return ERROR_SUCCESS;
+    }
+    winError = UdpPostSend(lockedChanPtr, bytes, nbytes, NULL, 0);
+    if (winError != ERROR_SUCCESS) {
+        *countPtr = -1;
+        return winError;
+    }
+    *countPtr = nbytes;
+    return ERROR_SUCCESS;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpOptionApplies --
+ *
+ *    Checks whether a Winsock option is meaningful for UDP sockets.
+ *
+ * Results:
+ *    Non-0 if applicable, else 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+UdpOptionApplies(int opt)
+{
+    switch (opt) {
+    case IOCP_WINSOCK_OPT_PEERNAME:
+    case IOCP_WINSOCK_OPT_SOCKNAME:
+    case IOCP_WINSOCK_OPT_ERROR:
+    case IOCP_WINSOCK_OPT_MAXPENDINGREADS:
+    case IOCP_WINSOCK_OPT_SOSNDBUF:
+    case IOCP_WINSOCK_OPT_SORCVBUF:
+    case IOCP_WINSOCK_OPT_INLINECOMPLETION:
+    case IOCP_WINSOCK_OPT_WRITEHIGHWATER:
+    case IOCP_WINSOCK_OPT_READBUFFERSIZE:
+    case IOCP_WINSOCK_OPT_STATS:
+    case IOCP_WINSOCK_OPT_MAXINPUTBYTES:
+    case IOCP_WINSOCK_OPT_MAXSPINWAIT:
+    case IOCP_WINSOCK_OPT_READTIMEOUT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpGetOption --
+ *
+ *    Returns the value of the given option. Options that do not apply to
+ *    UDP are rejected, which also omits them when all options are listed.
+ *
+ * Results:
+ *    Returns TCL_OK on succes and TCL_ERROR on failure.
+ *
+ * Side effects:
+ *    On success the value of the option is stored in *dsPtr.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+UdpGetOption(
+    IocpChannel *lockedChanPtr, /* Locked on entry, locked on exit */
+    Tcl_Interp  *interp,        /* For error reporting. May be NULL */
+    int          opt,           /* Index into option table for option of interest */
+    Tcl_DString *dsPtr)         /* Where to store the value */
+{
+    if (!UdpOptionApplies(opt))
+        return Tcl_BadChannelOption(interp, iocpWinsockOptionNames[opt],
+                                    IOCP_UDP_OPTION_LIST);
+    return WinsockClientGetOption(lockedChanPtr, interp, opt, dsPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpSetOption --
+ *
+ *    Sets the value of the given option. Receives may be kept posted in
+ *    larger numbers than for TCP and the read buffer size must be fixed.
+ *
+ * Results:
+ *    Returns TCL_OK on succes and TCL_ERROR on failure.
+ *
+ * Side effects:
+ *    The option is set.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+UdpSetOption(
+    IocpChannel *lockedChanPtr, /* Locked on entry, locked on exit */
+    Tcl_Interp  *interp,        /* For error reporting. May be NULL */
+    int          opt,           /* Index into option table for option of interest */
+    const char  *valuePtr)      /* Option value */
+{
+    int intValue;
+
+    if (!UdpOptionApplies(opt))
+        return Tcl_BadChannelOption(interp, iocpWinsockOptionNames[opt],
+                                    IOCP_UDP_OPTION_LIST);
+
+    switch (opt) {
+    case IOCP_WINSOCK_OPT_MAXPENDINGREADS:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue <= 0 || intValue > IOCP_UDP_MAX_RECEIVES_LIMIT) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedChanPtr->maxPendingReads = intValue;
+        if (lockedChanPtr->state == IOCP_STATE_OPEN)
+            (void) IocpChannelPostReads(lockedChanPtr);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READBUFFERSIZE:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* No adaptive sizing as datagrams would be truncated */
+        if (intValue < IOCP_READ_BUFFER_MIN_SIZE ||
+            intValue > IOCP_UDP_MAX_DATAGRAM) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedChanPtr->readBufferSize = intValue;
+        return TCL_OK;
+    default:
+        return WinsockClientSetOption(lockedChanPtr, interp, opt, valuePtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpResolve --
+ *
+ *    Resolves a host and port to an address of the given family.
+ *
+ * Results:
+ *    0 on success with the address stored in *addrPtr and its length in
+ *    *addrLenPtr, else a Windows error code.
+ *
+ * Side effects:
+ *    The DNS cache may be updated.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+UdpResolve(
+    const char   *host,         /* Host name or address */
+    int           port,         /* Port number */
+    int           family,       /* AF_INET or AF_INET6 */
+    IocpSockaddr *addrPtr,      /* Output resolved address */
+    int          *addrLenPtr)   /* Output length of *addrPtr */
+{
+    Tcl_DString        nativeHost;
+    IocpResolvedAddrs *resolvedPtr;
+    struct addrinfo   *aiPtr;
+    IocpWinError       winError;
+
+    Tcl_UtfToExternalDString(NULL, host, -1, &nativeHost);
+    winError = IocpResolve(Tcl_DStringValue(&nativeHost), port, family,
+                           &resolvedPtr);
+    Tcl_DStringFree(&nativeHost);
+    if (winError != ERROR_SUCCESS)
+        return winError;
+    winError = WSAEAFNOSUPPORT;
+    for (aiPtr = resolvedPtr->addrs; aiPtr; aiPtr = aiPtr->ai_next) {
+        if (aiPtr->ai_family == family &&
+            aiPtr->ai_addrlen <= sizeof(*addrPtr)) {
+            memcpy(addrPtr, aiPtr->ai_addr, aiPtr->ai_addrlen);
+            *addrLenPtr = (int) aiPtr->ai_addrlen;
+            winError = ERROR_SUCCESS;
+            break;
+        }
+    }
+    IocpResolvedAddrsRelease(resolvedPtr);
+    return winError;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * Iocp_OpenUdpSocket --
+ *
+ *    Opens a UDP socket bound to a local address and optionally connected
+ *    to a remote one. When connected, the address family is that of the
+ *    remote address. Otherwise the first local address is used.
+ *
+ * Results:
+ *    The Tcl channel or NULL on failure with an error in interp.
+ *
+ * Side effects:
+ *    Receives are posted on the socket.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Channel
+Iocp_OpenUdpSocket(
+    Tcl_Interp *interp,         /* For error reporting. May be NULL */
+    const char *myaddr,         /* Local address. May be NULL */
+    int         myport,         /* Local port. 0 => any */
+    const char *host,           /* Remote host. NULL => not connected */
+    int         port)           /* Remote port */
+{
+    const char      *errorMsg   = NULL;
+    struct addrinfo *localAddrs = NULL;
+    struct addrinfo *localPtr;
+    IocpSockaddr     remote;
+    int              remoteLen  = 0;
+    WinsockClient   *udpPtr;
+    Tcl_Channel      channel;
+    SOCKET           so = INVALID_SOCKET;
+    IocpWinError     winError;
+    BOOL             bVal;
+    DWORD            nbytes;
+
+    if (!TclCreateSocketAddress(interp, &localAddrs, myaddr, myport, 1,
+                                &errorMsg)) {
+        if (interp != NULL) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                                 "couldn't resolve addresses: %s", errorMsg));
+        }
+        return NULL;
+    }
+
+    /* Pick a local address in the same family as the remote (if any) */
+    localPtr = localAddrs;
+    if (host) {
+        winError = WSAEAFNOSUPPORT;
+        for (; localPtr; localPtr = localPtr->ai_next) {
+            winError = UdpResolve(host, port, localPtr->ai_family,
+                                  &remote, &remoteLen);
+            if (winError == ERROR_SUCCESS)
+                break;
+        }
+        if (localPtr == NULL)
+            goto socket_error;
+    }
+
+    so = socket(localPtr->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (so == INVALID_SOCKET) {
+        winError = WSAGetLastError();
+        goto socket_error;
+    }
+    /* Do not want children to inherit sockets */
+    SetHandleInformation((HANDLE) so, HANDLE_FLAG_INHERIT, 0);
+
+    /*
+     * By default, ICMP errors from earlier sends fail pending receives.
+     * Suppress these as they only say one datagram was not delivered.
+     * SIO_UDP_NETRESET is only supported on Windows 8 and later.
+     */
+    bVal = FALSE;
+    (void) WSAIoctl(so, SIO_UDP_CONNRESET, &bVal, sizeof(bVal),
+                    NULL, 0, &nbytes, NULL, NULL);
+    (void) WSAIoctl(so, SIO_UDP_NETRESET, &bVal, sizeof(bVal),
+                    NULL, 0, &nbytes, NULL, NULL);
+
+    if (bind(so, localPtr->ai_addr, (int) localPtr->ai_addrlen) == SOCKET_ERROR ||
+        (host && connect(so, &remote.sa, remoteLen) == SOCKET_ERROR)) {
+        winError = WSAGetLastError();
+        goto socket_error;
+    }
+    if (IocpAttachDefaultPort((HANDLE) so) == NULL) {
+        winError = GetLastError();
+        goto socket_error;
+    }
+    freeaddrinfo(localAddrs);
+    localAddrs = NULL;
+
+    udpPtr = (WinsockClient *) IocpChannelNew(&udpVtbl);
+    if (udpPtr == NULL) {
+        closesocket(so);
+        if (interp != NULL) {
+            Tcl_SetResult(interp, "couldn't allocate WinsockClient", TCL_STATIC);
+        }
+        return NULL;
+    }
+    udpPtr->so = so;            /* Closed by WinsockClientFinit from here on */
+    IocpChannelSetState(&udpPtr->base, IOCP_STATE_OPEN);
+
+    channel = IocpCreateTclChannel(WinsockClientToIocpChannel(udpPtr),
+                                   IOCP_UDP_NAME_PREFIX,
+                                   (TCL_READABLE | TCL_WRITABLE));
+    IocpChannelLock(WinsockClientToIocpChannel(udpPtr));
+    if (channel == NULL) {
+        if (interp) {
+            Tcl_SetResult(interp, "Could not create channel.", TCL_STATIC);
+        }
+        IocpChannelSetState(&udpPtr->base, IOCP_STATE_CLOSED);
+        IocpChannelDrop(WinsockClientToIocpChannel(udpPtr));
+        return NULL;
+    }
+    /* The reference from this function now belongs to the Tcl channel. */
+    udpPtr->base.channel = channel;
+    IocpChannelUnlock(WinsockClientToIocpChannel(udpPtr));
+
+    /*
+     * Datagrams are binary and each unbuffered write is sent as one.
+     * Do not access udpPtr beyond this point without a lock as calls into
+     * Tcl may recurse into the channel.
+     */
+    if (Tcl_SetChannelOption(NULL, channel, "-translation", "binary") != TCL_OK ||
+        Tcl_SetChannelOption(NULL, channel, "-buffering", "none") != TCL_OK) {
+        Tcl_Close(NULL, channel);
+        if (interp) {
+            Tcl_SetResult(interp, "Could not configure channel.", TCL_STATIC);
+        }
+        return NULL;
+    }
+
+    IocpChannelLock(WinsockClientToIocpChannel(udpPtr));
+    if (udpPtr->base.state == IOCP_STATE_OPEN)
+        winError = IocpChannelPostReads(WinsockClientToIocpChannel(udpPtr));
+    else
+        winError = WSAENOTCONN;
+    IocpChannelUnlock(WinsockClientToIocpChannel(udpPtr));
+    if (winError != ERROR_SUCCESS) {
+        Tcl_Close(NULL, channel);
+        IocpSetInterpPosixErrorFromWin32(interp, winError, gSocketOpenErrorMessage);
+        return NULL;
+    }
+    return channel;
+
+socket_error:
+    if (so != INVALID_SOCKET)
+        closesocket(so);
+    if (localAddrs)
+        freeaddrinfo(localAddrs);
+    IocpSetInterpPosixErrorFromWin32(interp, winError, gSocketOpenErrorMessage);
+    return NULL;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpGetSocket --
+ *
+ *    Retrieves the UDP socket for a channel name.
+ *
+ * Results:
+ *    The IocpChannel or NULL with an error in interp. If modePtr is not
+ *    NULL, the channel access mode is stored in it.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpChannel *
+UdpGetSocket(
+    Tcl_Interp *interp,         /* Current interpreter */
+    Tcl_Obj    *nameObj,        /* Channel name */
+    int         mode)           /* TCL_READABLE or TCL_WRITABLE */
+{
+    Tcl_Channel  chan;
+    IocpChannel *chanPtr;
+    int          chanMode;
+
+    chan = Tcl_GetChannel(interp, Tcl_GetString(nameObj), &chanMode);
+    if (chan == NULL)
+        return NULL;
+    if (Tcl_GetChannelType(chan) != &IocpChannelDispatch ||
+        (chanPtr = (IocpChannel *) Tcl_GetChannelInstanceData(chan))->vtblPtr
+        != &udpVtbl) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "channel \"%s\" is not a iocp::udp socket",
+                             Tcl_GetString(nameObj)));
+        return NULL;
+    }
+    if ((chanMode & mode) == 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "channel \"%s\" wasn't opened for %s",
+                             Tcl_GetString(nameObj),
+                             mode == TCL_READABLE ? "reading" : "writing"));
+        return NULL;
+    }
+    return chanPtr;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UdpDatagramObj --
+ *
+ *    Returns a list containing the payload and peer address and port of a
+ *    received datagram.
+ *
+ * Results:
+ *    Tcl_Obj with reference count 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+UdpDatagramObj(const IocpBuffer *bufPtr)
+{
+    const UdpPeer *peerPtr = (const UdpPeer *) bufPtr->data.bytes;
+    char           host[NI_MAXHOST];
+    Tcl_Obj       *objs[3];
+
+    if (getnameinfo(&peerPtr->addr.sa, peerPtr->addrLen, host, sizeof(host),
+                    NULL, 0, NI_NUMERICHOST) != 0)
+        host[0] = '\0';
+    objs[0] = Tcl_NewByteArrayObj(
+        (unsigned char *) bufPtr->data.bytes + bufPtr->data.begin,
+        bufPtr->data.len);
+    objs[1] = Tcl_NewStringObj(host, -1);
+    /* sin6_port is at the same offset as sin_port */
+    objs[2] = Tcl_NewIntObj(ntohs(peerPtr->addr.sa4.sin_port));
+    return Tcl_NewListObj(3, objs);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * Udp_SocketObjCmd --
+ *
+ *    Implements the iocp::udp::socket command.
+ *
+ *        iocp::udp::socket ?-myaddr ADDR? ?-myport PORT? ?HOST PORT?
+ *
+ * Results:
+ *    A standard Tcl result with the channel name stored in interp result.
+ *
+ * Side effects:
+ *    A new UDP socket is created.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+Udp_SocketObjCmd (
+    ClientData notUsed,			/* Not used. */
+    Tcl_Interp *interp,			/* Current interpreter. */
+    int objc,				/* Number of arguments. */
+    Tcl_Obj *CONST objv[])		/* Argument objects. */
+{
+    static const char *const socketOptions[] = {
+        "-myaddr", "-myport", NULL
+    };
+    enum socketOptions {
+        SKT_MYADDR, SKT_MYPORT
+    };
+    int         optionIndex, a, port = 0, myport = 0;
+    const char *host = NULL, *myaddr = NULL;
+    Tcl_Channel chan;
+
+    for (a = 1; a < objc; a++) {
+        const char *arg = Tcl_GetString(objv[a]);
+        if (arg[0] != '-')
+            break;
+        if (Tcl_GetIndexFromObj(interp, objv[a], socketOptions, "option",
+                                TCL_EXACT, &optionIndex) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (++a >= objc) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                                 "no argument given for %s option", arg));
+            return TCL_ERROR;
+        }
+        if (optionIndex == SKT_MYADDR)
+            myaddr = Tcl_GetString(objv[a]);
+        else if (TclSockGetPort(interp, Tcl_GetString(objv[a]), "udp",
+                                &myport) != TCL_OK)
+            return TCL_ERROR;
+    }
+    if (a == objc - 2) {
+        host = Tcl_GetString(objv[a]);
+        if (TclSockGetPort(interp, Tcl_GetString(objv[a+1]), "udp",
+                           &port) != TCL_OK)
+            return TCL_ERROR;
+    }
+    else if (a != objc) {
+        Tcl_WrongNumArgs(interp, 1, objv,
+                         "?-myaddr ADDR? ?-myport PORT? ?HOST PORT?");
+        return TCL_ERROR;
+    }
+
+    chan = Iocp_OpenUdpSocket(interp, myaddr, myport, host, port);
+    if (chan == NULL)
+        return TCL_ERROR;
+    Tcl_RegisterChannel(interp, chan);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(Tcl_GetChannelName(chan), -1));
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * Udp_SendObjCmd --
+ *
+ *    Implements the iocp::udp::send command which sends one or more
+ *    datagrams in a single call.
+ *
+ *        iocp::udp::send ?-to {HOST PORT}? SOCK DATAGRAM ?DATAGRAM ...?
+ *
+ *    Without -to, the datagrams go to the peer the socket is connected
+ *    to. The datagrams are posted back to back under a single lock of the
+ *    channel. Once -writehighwater bytes are in transit, blocking sockets
+ *    wait for sends to complete while non-blocking sockets return early.
+ *
+ * Results:
+ *    TCL_OK with the number of datagrams sent or queued as the
+ *    interpreter result, or TCL_ERROR if none could be sent.
+ *
+ * Side effects:
+ *    The datagrams are sent on the socket.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+Udp_SendObjCmd (
+    ClientData notUsed,			/* Not used. */
+    Tcl_Interp *interp,			/* Current interpreter. */
+    int objc,				/* Number of arguments. */
+    Tcl_Obj *CONST objv[])		/* Argument objects. */
+{
+    IocpChannel  *chanPtr;
+    IocpSockaddr  to;
+    IocpSockaddr  local;
+    int           toLen = 0;
+    int           localLen;
+    int           a = 1;
+    int           numSent;
+    IocpWinError  winError = ERROR_SUCCESS;
+    Tcl_Obj      *toObj = NULL;
+
+    if (objc > 1 && strcmp(Tcl_GetString(objv[1]), "-to") == 0) {
+        toObj = objc > 2 ? objv[2] : NULL;
+        a = 3;
+    }
+    if (objc - a < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv,
+                         "?-to ADDRESS? SOCK DATAGRAM ?DATAGRAM ...?");
+        return TCL_ERROR;
+    }
+    chanPtr = UdpGetSocket(interp, objv[a], TCL_WRITABLE);
+    if (chanPtr == NULL)
+        return TCL_ERROR;
+
+    if (toObj) {
+        Tcl_Obj **elems;
+        int       nelems, port;
+        SOCKET    so;
+
+        if (Tcl_ListObjGetElements(interp, toObj, &nelems, &elems) != TCL_OK)
+            return TCL_ERROR;
+        if (nelems != 2) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                                 "invalid address \"%s\": must be a list of"
+                                 " host and port", Tcl_GetString(toObj)));
+            return TCL_ERROR;
+        }
+        if (TclSockGetPort(interp, Tcl_GetString(elems[1]), "udp",
+                           &port) != TCL_OK)
+            return TCL_ERROR;
+        IocpChannelLock(chanPtr);
+        so = IocpChannelToWinsockClient(chanPtr)->so;
+        localLen = sizeof(local);
+        if (so == INVALID_SOCKET)
+            winError = WSAENOTCONN;
+        else if (getsockname(so, &local.sa, &localLen) != 0)
+            winError = WSAGetLastError();
+        IocpChannelUnlock(chanPtr);
+        if (winError == ERROR_SUCCESS)
+            winError = UdpResolve(Tcl_GetString(elems[0]), port,
+                                  local.sa.sa_family, &to, &toLen);
+        if (winError != ERROR_SUCCESS) {
+            IocpSetInterpPosixErrorFromWin32(interp, winError,
+                                             "couldn't resolve address: ");
+            return TCL_ERROR;
+        }
+    }
+
+    IocpChannelLock(chanPtr);
+    for (numSent = 0, ++a; a < objc; ++a, ++numSent) {
+        const char *bytes;
+        int         nbytes;
+        /* Tcl's reference keeps chanPtr valid while waiting */
+        while (chanPtr->state == IOCP_STATE_OPEN &&
+               chanPtr->outputBytes >= chanPtr->maxOutputBytes) {
+            IOCP_COUNTER_INCR(IocpOutputWouldBlock);
+            chanPtr->stats.outputWouldBlock++;
+            if (chanPtr->flags & IOCP_CHAN_F_NONBLOCKING)
+                goto vamoose;
+            IocpChannelAwaitCompletion(chanPtr, IOCP_CHAN_F_BLOCKED_WRITE);
+        }
+        if (chanPtr->state != IOCP_STATE_OPEN) {
+            winError = WSAENOTCONN;
+            break;
+        }
+        bytes    = (const char *) Tcl_GetByteArrayFromObj(objv[a], &nbytes);
+        winError = UdpPostSend(chanPtr, bytes, nbytes,
+                               toObj ? &to : NULL, toLen);
+        if (winError != ERROR_SUCCESS)
+            break;
+    }
+vamoose:
+    IocpChannelUnlock(chanPtr);
+
+    if (numSent == 0 && winError != ERROR_SUCCESS) {
+        IocpSetInterpPosixErrorFromWin32(interp, winError,
+                                         "error sending datagram: ");
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(numSent));
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * Udp_RecvObjCmd --
+ *
+ *    Implements the iocp::udp::recv command which returns received
+ *    datagrams along with their source addresses.
+ *
+ *        iocp::udp::recv SOCK ?MAXCOUNT?
+ *
+ *    Blocking sockets wait for at least one datagram. Non-blocking
+ *    sockets return an empty list if none is available.
+ *
+ * Results:
+ *    TCL_OK with a list of up to MAXCOUNT (default 1) elements, each a
+ *    list of the datagram, the numeric source address and the source
+ *    port, or TCL_ERROR.
+ *
+ * Side effects:
+ *    The datagrams are removed from the channel input and receives are
+ *    posted to replace them.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode
+Udp_RecvObjCmd (
+    ClientData notUsed,			/* Not used. */
+    Tcl_Interp *interp,			/* Current interpreter. */
+    int objc,				/* Number of arguments. */
+    Tcl_Obj *CONST objv[])		/* Argument objects. */
+{
+    IocpChannel  *chanPtr;
+    Tcl_Obj      *resultObj;
+    int           maxCount = 1;
+    int           count;
+    IocpWinError  winError = ERROR_SUCCESS;
+
+    if (objc != 2 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "SOCK ?MAXCOUNT?");
+        return TCL_ERROR;
+    }
+    chanPtr = UdpGetSocket(interp, objv[1], TCL_READABLE);
+    if (chanPtr == NULL)
+        return TCL_ERROR;
+    if (objc == 3) {
+        if (Tcl_GetIntFromObj(interp, objv[2], &maxCount) != TCL_OK)
+            return TCL_ERROR;
+        if (maxCount <= 0 || maxCount > IOCP_UDP_MAX_RECV_COUNT) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                                 "Integer value %d out of range.", maxCount));
+            return TCL_ERROR;
+        }
+    }
+
+    IocpChannelLock(chanPtr);
+    /* Tcl's reference keeps chanPtr valid while waiting */
+    while (!IocpChannelTakeInput(chanPtr)) {
+        if (chanPtr->state != IOCP_STATE_OPEN) {
+            winError = WSAENOTCONN;
+            break;
+        }
+        if (chanPtr->flags & IOCP_CHAN_F_NONBLOCKING) {
+            IOCP_COUNTER_INCR(IocpInputWouldBlock);
+            chanPtr->stats.inputWouldBlock++;
+            break;
+        }
+        winError = IocpChannelPostReads(chanPtr); /* Ensure read is posted */
+        if (winError != ERROR_SUCCESS)
+            break;
+        if (!IocpChannelTakeInput(chanPtr))
+            IocpChannelAwaitCompletion(chanPtr, IOCP_CHAN_F_BLOCKED_READ);
+    }
+
+    resultObj = Tcl_NewListObj(0, NULL);
+    for (count = 0;
+         count < maxCount &&
+             (chanPtr->inputBuffers.headPtr || IocpChannelTakeInput(chanPtr));
+         ++count) {
+        IocpBuffer *bufPtr = CONTAINING_RECORD(chanPtr->inputBuffers.headPtr,
+                                               IocpBuffer, link);
+        if (bufPtr->winError != ERROR_SUCCESS) {
+            /* Pass up what we have, error on the next call */
+            if (count > 0)
+                break;
+            winError = bufPtr->winError;
+        }
+        else {
+            Tcl_ListObjAppendElement(NULL, resultObj, UdpDatagramObj(bufPtr));
+            IocpChannelAddInputBytes(chanPtr, -bufPtr->data.len);
+        }
+        IocpListPopFront(&chanPtr->inputBuffers);
+        IocpBufferFree(bufPtr);
+        if (winError != ERROR_SUCCESS)
+            break;
+    }
+
+    /* Replace consumed receives and resume any held back by the budget */
+    if (chanPtr->state == IOCP_STATE_OPEN)
+        (void) IocpChannelPostReads(chanPtr);
+    IocpChannelUnlock(chanPtr);
+
+    if (count == 0 && winError != ERROR_SUCCESS) {
+        Tcl_DecrRefCount(resultObj);
+        IocpSetInterpPosixErrorFromWin32(interp, winError,
+                                         "error receiving datagram: ");
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * Udp_ModuleInitialize --
+ *
+ *    Initializes the UDP module.
+ *
+ * Results:
+ *    TCL_OK on success, TCL_ERROR on failure.
+ *
+ * Side effects:
+ *    Creates the UDP related Tcl commands.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpTclCode Udp_ModuleInitialize (Tcl_Interp *interp)
+{
+    Tcl_CreateObjCommand(interp, "iocp::udp::socket", Udp_SocketObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(interp, "iocp::udp::send", Udp_SendObjCmd, 0L, 0L);
+    Tcl_CreateObjCommand(interp, "iocp::udp::recv", Udp_RecvObjCmd, 0L, 0L);
+    Tcl_PkgProvide(interp, PACKAGE_NAME_UDP, PACKAGE_VERSION);
+    return TCL_OK;
+}
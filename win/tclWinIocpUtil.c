@@ -279,6 +279,32 @@ void IocpListPrepend(IocpList *listPtr, IocpLink *linkPtr)
     }
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpListInsertBefore --
+ *
+ *    Inserts an element into a list before an existing element.
+ *
+ * Side effects:
+ *    None
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpListInsertBefore(
+    IocpList *listPtr,          /* List to insert into */
+    IocpLink *beforePtr,        /* Existing element in list */
+    IocpLink *linkPtr)          /* Element to insert */
+{
+    linkPtr->nextPtr = beforePtr;
+    linkPtr->prevPtr = beforePtr->prevPtr;
+    if (beforePtr->prevPtr == NULL)
+        listPtr->headPtr = linkPtr; /* Inserting at front */
+    else
+        beforePtr->prevPtr->nextPtr = linkPtr;
+    beforePtr->prevPtr = linkPtr;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -335,6 +361,82 @@ IocpLink *IocpListPopFront(
     return firstPtr;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpHandoffQueuePush --
+ *
+ *    Appends an element to a handoff queue. May be called concurrently
+ *    from any number of threads and with IocpHandoffQueuePop.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The element is visible to the consumer once the link from the
+ *    previous tail is stored.
+ *
+ *------------------------------------------------------------------------
+ */
+void IocpHandoffQueuePush(
+    IocpHandoffQueue *queuePtr, /* Queue to append to */
+    IocpLink         *linkPtr)  /* Element to append */
+{
+    IocpLink *prevPtr;
+
+    linkPtr->nextPtr = NULL;
+    prevPtr = (IocpLink *) InterlockedExchangePointer(
+        (PVOID volatile *) &queuePtr->tailPtr, linkPtr);
+    /* Until this store the consumer sees the queue as ending at prevPtr */
+    InterlockedExchangePointer((PVOID volatile *) &prevPtr->nextPtr, linkPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpHandoffQueuePop --
+ *
+ *    Removes and returns the first element of a handoff queue. Must not
+ *    be called concurrently with itself for the same queue.
+ *
+ * Results:
+ *    Pointer to the first element or NULL if the queue was empty. NULL
+ *    may also be returned if a producer is part way through pushing the
+ *    only element. The producer's subsequent notification of the consumer
+ *    is expected to take care of that.
+ *
+ * Side effects:
+ *    The stub element may be requeued.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpLink *IocpHandoffQueuePop(
+    IocpHandoffQueue *queuePtr
+    )
+{
+    /* MSVC volatile reads have acquire semantics */
+    IocpLink *headPtr = queuePtr->headPtr;
+    IocpLink *nextPtr = *(IocpLink * volatile *) &headPtr->nextPtr;
+
+    if (headPtr == &queuePtr->stub) {
+        if (nextPtr == NULL)
+            return NULL;
+        queuePtr->headPtr = headPtr = nextPtr;
+        nextPtr = *(IocpLink * volatile *) &headPtr->nextPtr;
+    }
+    if (nextPtr == NULL) {
+        if (headPtr != queuePtr->tailPtr)
+            return NULL; /* Push in progress */
+        /* headPtr is the last element. Make the stub follow it. */
+        IocpHandoffQueuePush(queuePtr, &queuePtr->stub);
+        nextPtr = *(IocpLink * volatile *) &headPtr->nextPtr;
+        if (nextPtr == NULL)
+            return NULL; /* Another push got in before the stub's */
+    }
+    queuePtr->headPtr = nextPtr;
+    return headPtr;
+}
+
 /*
  *----------------------------------------------------------------------
  *
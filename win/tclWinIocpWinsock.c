@@ -21,6 +21,28 @@ const char *iocpWinsockOptionNames[] = {
     "-sorcvbuf",
     "-keepalive",
     "-nagle",
+    "-inlinecompletion",
+    "-writehighwater",
+    "-readbuffersize",
+    "-readmode",
+    "-idletimeout",
+    "-recyclepoolsize",
+    "-acceptreadsize",
+    "-minpendingaccepts",
+    "-stats",
+    "-maxinputbytes",
+    "-maxspinwait",
+    "-tls",
+    "-readtimeout",
+    "-connecttimeout",
+    NULL
+};
+
+/* Values of the -readmode option. Order must match IocpWinsockReadMode */
+const char *iocpWinsockReadModeNames[] = {
+    "buffered",
+    "zerobyte",
+    "auto",
     NULL
 };
 
@@ -28,6 +50,499 @@ const char *iocpWinsockOptionNames[] = {
 const char *gSocketOpenErrorMessage = "couldn't open socket: ";
 
 static IocpWinError WinsockClientPostDisconnect(WinsockClient *chanPtr);
+static IocpWinError WinsockClientPostQueuedWrites(WinsockClient *lockedWsPtr,
+                                                  int force);
+static IocpWinError WinsockClientPostProbe(WinsockClient *lockedWsPtr,
+                                           IocpBuffer *bufPtr);
+
+/* Whether all installed TCP providers permit skipping the completion port */
+static Iocp_DoOnceState iocpInlineCompletionCheckFlag;
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockInlineCompletionCheck --
+ *
+ *    Checks whether FILE_SKIP_COMPLETION_PORT_ON_SUCCESS may be used with
+ *    sockets. This is not safe if any installed layered service provider
+ *    does not return IFS handles as completions may then be lost.
+ *
+ * Results:
+ *    TCL_OK if it is safe, TCL_ERROR otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode WinsockInlineCompletionCheck(ClientData notUsed)
+{
+    int   protocols[] = {IPPROTO_TCP, 0};
+    WSAPROTOCOL_INFOW *infoPtr;
+    DWORD len = 0;
+    int   i, count;
+    IocpTclCode ret = TCL_OK;
+
+    if (WSAEnumProtocolsW(protocols, NULL, &len) != SOCKET_ERROR ||
+        WSAGetLastError() != WSAENOBUFS) {
+        return TCL_ERROR;
+    }
+    infoPtr = ckalloc(len);
+    count   = WSAEnumProtocolsW(protocols, infoPtr, &len);
+    if (count == SOCKET_ERROR)
+        ret = TCL_ERROR;
+    for (i = 0; i < count; ++i) {
+        if ((infoPtr[i].dwServiceFlags1 & XP1_IFS_HANDLES) == 0) {
+            ret = TCL_ERROR;
+            break;
+        }
+    }
+    ckfree(infoPtr);
+    return ret;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockInlineCompletionSupported --
+ *
+ *    Returns whether sockets may be switched to inline completion mode.
+ *
+ * Results:
+ *    Non-zero if supported, 0 otherwise.
+ *
+ * Side effects:
+ *    The installed providers are checked on the first call.
+ *
+ *------------------------------------------------------------------------
+ */
+int WinsockInlineCompletionSupported(void)
+{
+    return Iocp_DoOnce(&iocpInlineCompletionCheckFlag,
+                       WinsockInlineCompletionCheck, NULL) == TCL_OK;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientEnableInlineCompletion --
+ *
+ *    Sets the socket to not queue completion packets when an operation
+ *    completes synchronously. Such completions are then processed inline
+ *    by the posting code. Once set, the mode cannot be reset.
+ *
+ * Results:
+ *    ERROR_SUCCESS or a Windows error code.
+ *
+ * Side effects:
+ *    The IOCP_WINSOCK_INLINE_COMPLETION flag is set on success.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientEnableInlineCompletion(
+    IocpChannel *lockedChanPtr) /* Must be locked */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpWinError   winError;
+
+    if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION)
+        return ERROR_SUCCESS;
+    if (! WinsockInlineCompletionSupported())
+        return WSAEOPNOTSUPP;
+    winError = IocpSkipCompletionPortOnSuccess((HANDLE) lockedWsPtr->so);
+    if (winError == ERROR_SUCCESS)
+        lockedWsPtr->flags |= IOCP_WINSOCK_INLINE_COMPLETION;
+    return winError;
+}
+
+/*
+ * Sockets of connections accepted by a listener are disconnected with
+ * TF_REUSE_SOCKET when closed and held in the listener's pool to be used
+ * for subsequent accepts. This saves creating the socket, setting its
+ * attributes and attaching it to the completion port. The pool is
+ * reference counted since connections may be closed after the listener.
+ */
+typedef struct WinsockPooledSocket {
+    SOCKET so;
+    int    flags;               /* IOCP_WINSOCK_INLINE_COMPLETION which
+                                 * persists across reuse */
+} WinsockPooledSocket;
+struct WinsockSocketPool {
+    IocpLock lock;              /* Protects all fields below */
+    int      numRefs;           /* Listening socket and connections */
+    int      maxSockets;        /* Capacity. 0 => no recycling */
+    int      numSockets;        /* Number of entries in use in sockets[] */
+    WinsockPooledSocket *sockets; /* Array of maxSockets entries */
+};
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockSocketPoolNew --
+ *
+ *    Allocates an empty socket pool with a capacity of 0.
+ *
+ * Results:
+ *    Pointer to the pool with a reference count of 1 or NULL if memory
+ *    could not be allocated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+WinsockSocketPool *WinsockSocketPoolNew(void)
+{
+    WinsockSocketPool *poolPtr = attemptckalloc(sizeof(*poolPtr));
+    if (poolPtr) {
+        IocpLockInit(&poolPtr->lock);
+        poolPtr->numRefs    = 1;
+        poolPtr->maxSockets = 0;
+        poolPtr->numSockets = 0;
+        poolPtr->sockets    = NULL;
+    }
+    return poolPtr;
+}
+
+/* Adds a reference to the pool */
+void WinsockSocketPoolRetain(WinsockSocketPool *poolPtr)
+{
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    poolPtr->numRefs++;
+    IocpLockReleaseExclusive(&poolPtr->lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockSocketPoolRelease --
+ *
+ *    Drops a reference to the pool.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    When the last reference is dropped, pooled sockets are closed and
+ *    the pool freed.
+ *
+ *------------------------------------------------------------------------
+ */
+void WinsockSocketPoolRelease(WinsockSocketPool *poolPtr)
+{
+    int numRefs;
+
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    numRefs = --poolPtr->numRefs;
+    IocpLockReleaseExclusive(&poolPtr->lock);
+    if (numRefs == 0) {
+        WinsockSocketPoolResize(poolPtr, 0);
+        IocpLockDelete(&poolPtr->lock);
+        ckfree(poolPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockSocketPoolResize --
+ *
+ *    Sets the maximum number of sockets held in the pool.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Sockets in excess of the new capacity are closed. If memory cannot
+ *    be allocated for a larger pool, the capacity is left unchanged.
+ *
+ *------------------------------------------------------------------------
+ */
+void WinsockSocketPoolResize(
+    WinsockSocketPool *poolPtr,
+    int                maxSockets)
+{
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    while (poolPtr->numSockets > maxSockets)
+        closesocket(poolPtr->sockets[--poolPtr->numSockets].so);
+    if (maxSockets == 0) {
+        if (poolPtr->sockets)
+            ckfree(poolPtr->sockets);
+        poolPtr->sockets = NULL;
+        poolPtr->maxSockets = 0;
+    }
+    else if (maxSockets != poolPtr->maxSockets) {
+        WinsockPooledSocket *socketsPtr;
+        socketsPtr = attemptckrealloc((char *)poolPtr->sockets,
+                                      maxSockets * sizeof(*socketsPtr));
+        if (socketsPtr) {
+            poolPtr->sockets    = socketsPtr;
+            poolPtr->maxSockets = maxSockets;
+        }
+    }
+    IocpLockReleaseExclusive(&poolPtr->lock);
+}
+
+/* Returns the capacity of the pool */
+int WinsockSocketPoolCapacity(WinsockSocketPool *poolPtr)
+{
+    int maxSockets;
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    maxSockets = poolPtr->maxSockets;
+    IocpLockReleaseExclusive(&poolPtr->lock);
+    return maxSockets;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockSocketPoolGet --
+ *
+ *    Retrieves a socket from the pool. The socket is already attached to
+ *    the completion port.
+ *
+ * Results:
+ *    The socket, with its persistent attributes stored in *flagsPtr, or
+ *    INVALID_SOCKET if the pool is empty.
+ *
+ * Side effects:
+ *    The recycle hit and miss statistics are updated if recycling is
+ *    enabled for the pool.
+ *
+ *------------------------------------------------------------------------
+ */
+SOCKET WinsockSocketPoolGet(
+    WinsockSocketPool *poolPtr,
+    int               *flagsPtr)
+{
+    SOCKET so = INVALID_SOCKET;
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    if (poolPtr->numSockets > 0) {
+        WinsockPooledSocket *entryPtr = &poolPtr->sockets[--poolPtr->numSockets];
+        so        = entryPtr->so;
+        *flagsPtr = entryPtr->flags;
+        IOCP_COUNTER_INCR(IocpSocketRecycleHits);
+    }
+    else if (poolPtr->maxSockets > 0)
+        IOCP_COUNTER_INCR(IocpSocketRecycleMisses);
+    IocpLockReleaseExclusive(&poolPtr->lock);
+    return so;
+}
+
+/* Returns whether the pool has room for another socket */
+static int WinsockSocketPoolHasRoom(WinsockSocketPool *poolPtr)
+{
+    int hasRoom;
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    hasRoom = poolPtr->numSockets < poolPtr->maxSockets;
+    IocpLockReleaseExclusive(&poolPtr->lock);
+    return hasRoom;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockSocketPoolPut --
+ *
+ *    Returns a socket that has been disconnected with TF_REUSE_SOCKET to
+ *    the pool. A socket switched to non-blocking mode for zero-byte reads
+ *    is first returned to blocking mode so the next connection starts out
+ *    with a socket in the same state as a fresh one.
+ *
+ * Results:
+ *    1 if the pool took ownership of the socket, 0 if it is full or the
+ *    mode could not be restored in which case the caller must close the
+ *    socket.
+ *
+ * Side effects:
+ *    The socket may be put back into blocking mode.
+ *
+ *------------------------------------------------------------------------
+ */
+static int WinsockSocketPoolPut(
+    WinsockSocketPool *poolPtr,
+    SOCKET             so,
+    int                flags)
+{
+    int taken = 0;
+
+    if (flags & IOCP_WINSOCK_NONBLOCKING) {
+        u_long nonBlocking = 0;
+        if (ioctlsocket(so, FIONBIO, &nonBlocking) != 0)
+            return 0;
+    }
+
+    IocpLockAcquireExclusive(&poolPtr->lock);
+    if (poolPtr->numSockets < poolPtr->maxSockets) {
+        WinsockPooledSocket *entryPtr = &poolPtr->sockets[poolPtr->numSockets++];
+        entryPtr->so    = so;
+        entryPtr->flags = flags & IOCP_WINSOCK_INLINE_COMPLETION;
+        taken = 1;
+        IOCP_COUNTER_INCR(IocpSocketsRecycled);
+    }
+    IocpLockReleaseExclusive(&poolPtr->lock);
+    return taken;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientCancelReads --
+ *
+ *    Switches a channel to zero-byte reads. Any buffered reads still posted
+ *    are cancelled so their buffers are released. Their completions are
+ *    discarded and a zero-byte read posted once the last one is in. Only
+ *    the posted reads are cancelled, writes in progress are unaffected.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The IOCP_WINSOCK_READ_IDLE flag is set and posted reads cancelled.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+WinsockClientCancelReads(
+    WinsockClient *lockedWsPtr) /* Must be locked */
+{
+    lockedWsPtr->flags |= IOCP_WINSOCK_READ_IDLE;
+    if (lockedWsPtr->base.pendingReads > 0 &&
+        lockedWsPtr->so != INVALID_SOCKET) {
+        if (IocpChannelCancelReads(WinsockClientToIocpChannel(lockedWsPtr)))
+            IOCP_COUNTER_INCR(IocpIdleReadCancels);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockIdleTimerExpired --
+ *
+ *    Called by the timer wheel for channels in auto read mode. Switches
+ *    channels that have not received data for their idle timeout to
+ *    zero-byte reads. Follows the IocpTimerProc prototype. As the timer
+ *    is not moved when data arrives, it fires at the deadline computed
+ *    when it was armed and is rearmed for the current one if that has
+ *    moved on. Channels already switched are checked again after the idle
+ *    timeout.
+ *
+ * Results:
+ *    GetTickCount64 value at which to fire again or 0 to disarm.
+ *
+ * Side effects:
+ *    Posted reads of idle channels are cancelled.
+ *
+ *------------------------------------------------------------------------
+ */
+static ULONGLONG
+WinsockIdleTimerExpired(
+    IocpTimer *timerPtr,        /* Idle timer. Channel is locked */
+    ULONGLONG  now)             /* GetTickCount64 value */
+{
+    WinsockClient *lockedWsPtr =
+        IocpChannelToWinsockClient(timerPtr->chanPtr);
+    ULONGLONG due = lockedWsPtr->lastReadTick + lockedWsPtr->idleTimeout;
+
+    if (lockedWsPtr->readMode != IOCP_WINSOCK_READ_AUTO)
+        return 0;
+    if (lockedWsPtr->base.state != IOCP_STATE_OPEN ||
+        (lockedWsPtr->flags & IOCP_WINSOCK_READ_IDLE))
+        return now + lockedWsPtr->idleTimeout;
+    if (now < due)
+        return due;
+    WinsockClientCancelReads(lockedWsPtr);
+    return now + lockedWsPtr->idleTimeout;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockReadModeFromString --
+ *
+ *    Maps a -readmode option value to a IocpWinsockReadMode value.
+ *
+ * Results:
+ *    TCL_OK on success with the mode stored in *modePtr, else TCL_ERROR
+ *    with an error message in interp if not NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpTclCode
+WinsockReadModeFromString(
+    Tcl_Interp *interp,         /* For error reporting. May be NULL */
+    const char *valuePtr,       /* Option value */
+    int        *modePtr)        /* Where to store the mode */
+{
+    int i;
+    for (i = 0; iocpWinsockReadModeNames[i] != NULL; ++i) {
+        if (strcmp(valuePtr, iocpWinsockReadModeNames[i]) == 0) {
+            *modePtr = i;
+            return TCL_OK;
+        }
+    }
+    if (interp)
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("bad read mode \"%s\": must be buffered, zerobyte, or auto", valuePtr));
+    return TCL_ERROR;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientSetReadMode --
+ *
+ *    Sets the way reads are posted on the channel, one of the
+ *    IocpWinsockReadMode values. Registered I/O channels only support
+ *    buffered reads.
+ *
+ * Results:
+ *    ERROR_SUCCESS or a Windows error code.
+ *
+ * Side effects:
+ *    Channels in auto mode are added to the idle sweep. Switching to
+ *    zero-byte reads cancels posted buffered reads.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientSetReadMode(
+    IocpChannel *lockedChanPtr, /* Must be locked */
+    int          readMode)      /* IocpWinsockReadMode value */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if (readMode == lockedWsPtr->readMode)
+        return ERROR_SUCCESS;
+    if ((lockedWsPtr->flags & IOCP_WINSOCK_RIO) &&
+        readMode != IOCP_WINSOCK_READ_BUFFERED)
+        return WSAEOPNOTSUPP;
+
+    if (readMode == IOCP_WINSOCK_READ_AUTO) {
+        IocpWinError winError;
+        lockedWsPtr->lastReadTick = GetTickCount64();
+        winError = IocpTimerArm(&lockedWsPtr->idleTimer,
+                                lockedWsPtr->lastReadTick + lockedWsPtr->idleTimeout);
+        if (winError != ERROR_SUCCESS)
+            return winError;
+    }
+    else
+        IocpTimerCancel(&lockedWsPtr->idleTimer);
+
+    /*
+     * Note IOCP_WINSOCK_READ_IDLE is left as is even when switching to
+     * buffered reads. Completions of cancelled reads may still be due and
+     * the next zero-byte read to complete will clear it.
+     */
+    lockedWsPtr->readMode = readMode;
+    if (readMode == IOCP_WINSOCK_READ_ZEROBYTE &&
+        lockedChanPtr->state == IOCP_STATE_OPEN)
+        WinsockClientCancelReads(lockedWsPtr);
+    return ERROR_SUCCESS;
+}
 
 /*
  *------------------------------------------------------------------------
@@ -50,6 +565,15 @@ void WinsockClientInit(IocpChannel *chanPtr)
 
     wsPtr->so             = INVALID_SOCKET;
     memset(&wsPtr->addresses, 0, sizeof(wsPtr->addresses));
+    wsPtr->rioRq          = NULL;
+    wsPtr->tlsPtr         = NULL;
+    wsPtr->recyclePoolPtr = NULL;
+    memset(&wsPtr->localEndpoint, 0, sizeof(wsPtr->localEndpoint));
+    memset(&wsPtr->remoteEndpoint, 0, sizeof(wsPtr->remoteEndpoint));
+    IocpTimerInit(&wsPtr->idleTimer, chanPtr, WinsockIdleTimerExpired);
+    wsPtr->lastReadTick   = 0;
+    wsPtr->idleTimeout    = IOCP_WINSOCK_IDLE_TIMEOUT_DEFAULT;
+    wsPtr->readMode       = IOCP_WINSOCK_READ_BUFFERED;
     wsPtr->flags          = 0;
 
     wsPtr->base.maxPendingReads  = IOCP_WINSOCK_MAX_RECEIVES;
@@ -82,10 +606,28 @@ void WinsockClientFinit(IocpChannel *chanPtr)
 {
     WinsockClient *wsPtr = IocpChannelToWinsockClient(chanPtr);
 
+    IocpTimerCancel(&wsPtr->idleTimer);
     if (wsPtr->so != INVALID_SOCKET) {
         closesocket(wsPtr->so);
         wsPtr->so = INVALID_SOCKET;
     }
+    if (wsPtr->recyclePoolPtr) {
+        WinsockSocketPoolRelease(wsPtr->recyclePoolPtr);
+        wsPtr->recyclePoolPtr = NULL;
+    }
+    if (wsPtr->tlsPtr) {
+        IocpTlsFree(wsPtr->tlsPtr);
+        wsPtr->tlsPtr = NULL;
+    }
+    /* Pending reverse lookups hold a reference so cannot be outstanding */
+    if (wsPtr->localEndpoint.hostName) {
+        ckfree(wsPtr->localEndpoint.hostName);
+        wsPtr->localEndpoint.hostName = NULL;
+    }
+    if (wsPtr->remoteEndpoint.hostName) {
+        ckfree(wsPtr->remoteEndpoint.hostName);
+        wsPtr->remoteEndpoint.hostName = NULL;
+    }
 }
 
 /*
@@ -112,6 +654,10 @@ int WinsockClientShutdown(
 
     if (lockedWsPtr->so != INVALID_SOCKET) {
         int wsaStatus = 0;
+        if (flags & TCL_CLOSE_WRITE) {
+            /* Queued output must go out ahead of the shutdown. */
+            (void) WinsockClientPostQueuedWrites(lockedWsPtr, 1);
+        }
         switch (flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE)) {
         case TCL_CLOSE_READ:
             if ((lockedWsPtr->flags & IOCP_WINSOCK_HALF_CLOSABLE) == 0) {
@@ -200,6 +746,7 @@ WinsockClientPostDisconnect(
     static GUID     DisconnectExGuid = WSAID_DISCONNECTEX;
     LPFN_DISCONNECTEX  fnDisconnectEx;
     DWORD nbytes;
+    DWORD flags = 0;
 
     if (WSAIoctl(lockedWsPtr->so, SIO_GET_EXTENSION_FUNCTION_POINTER,
                  &DisconnectExGuid, sizeof(GUID),
@@ -215,15 +762,32 @@ WinsockClientPostDisconnect(
         bufPtr->chanPtr    = WinsockClientToIocpChannel(lockedWsPtr);
         lockedWsPtr->base.numRefs += 1; /* Reversed when buffer is unlinked from channel */
 
-        if (fnDisconnectEx(lockedWsPtr->so, &bufPtr->u.wsaOverlap, 0, 0) == FALSE) {
+        /*
+         * Sockets that can go back to the accepting listener's pool are
+         * kept for reuse. Pool capacity is checked again on completion.
+         */
+        if (lockedWsPtr->recyclePoolPtr &&
+            WinsockSocketPoolHasRoom(lockedWsPtr->recyclePoolPtr)) {
+            flags = TF_REUSE_SOCKET;
+            lockedWsPtr->flags |= IOCP_WINSOCK_REUSE_PENDING;
+        }
+
+        IOCP_ETW_BUFFER("BufferPost", bufPtr, bufPtr->chanPtr, 0, 0);
+        if (fnDisconnectEx(lockedWsPtr->so, &bufPtr->u.wsaOverlap, flags, 0) == FALSE) {
             IocpWinError    winError = WSAGetLastError();
             if (winError != WSA_IO_PENDING) {
+                lockedWsPtr->flags &= ~IOCP_WINSOCK_REUSE_PENDING;
                 lockedWsPtr->base.numRefs -= 1; /* Reverse above increment */
                 bufPtr->chanPtr = NULL;          /* Else IocpBufferFree will assert */
                 IocpBufferFree(bufPtr);
                 return winError;
             }
         }
+        else if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+            /* Completed synchronously. No completion packet will be queued. */
+            IocpChannelCompleteInline(WinsockClientToIocpChannel(lockedWsPtr),
+                                      bufPtr, 0);
+        }
         return ERROR_SUCCESS;
     }
 }
@@ -255,58 +819,484 @@ WinsockClientPostRead(IocpChannel *lockedChanPtr)
     WSABUF      wsaBuf;
     DWORD       flags;
     DWORD       wsaError;
+    DWORD       received;
 
     IOCP_ASSERT(lockedWsPtr->base.state == IOCP_STATE_OPEN);
-    bufPtr = IocpBufferNew(IOCP_BUFFER_DEFAULT_SIZE, IOCP_BUFFER_OP_READ,
-                           IOCP_BUFFER_F_WINSOCK);
+    if (lockedWsPtr->readMode == IOCP_WINSOCK_READ_ZEROBYTE ||
+        (lockedWsPtr->flags & IOCP_WINSOCK_READ_IDLE)) {
+        /* A single zero-byte read suffices to detect incoming data */
+        if (lockedChanPtr->pendingReads > 0)
+            return 0;
+        return WinsockClientPostProbe(lockedWsPtr, NULL);
+    }
+
+    bufPtr = IocpBufferNew(IocpChannelReadBufferSize(lockedChanPtr),
+                           IOCP_BUFFER_OP_READ, IOCP_BUFFER_F_WINSOCK);
     if (bufPtr == NULL)
         return WSAENOBUFS;
 
     bufPtr->chanPtr    = lockedChanPtr;
     lockedWsPtr->base.numRefs += 1; /* Reversed when buffer is unlinked from channel */
+    /* Completions may be dequeued out of order by the completion threads */
+    bufPtr->sequence   = lockedChanPtr->readSeqPosted++;
 
     wsaBuf.buf = bufPtr->data.bytes;
     wsaBuf.len = bufPtr->data.capacity;
     flags      = 0;
 
     IOCP_ASSERT(lockedWsPtr->so != INVALID_SOCKET);
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, wsaBuf.len, 0);
+    IOCP_LATENCY_STAMP_POST(bufPtr);
     if (WSARecv(lockedWsPtr->so,
                  &wsaBuf,       /* Buffer array */
                  1,             /* Number of elements in array */
-                 NULL,          /* Not used */
+                 &received,     /* Number of bytes received - only valid
+                                 * if data received immediately */
                  &flags,
                  &bufPtr->u.wsaOverlap, /* Overlap structure for return status */
                  NULL) != 0        /* Not used */
-        && (wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
-        /* Not good. */
-        lockedWsPtr->base.numRefs -= 1;
-        bufPtr->chanPtr    = NULL;
-        IocpBufferFree(bufPtr);
-        return wsaError;
+        ) {
+        if ((wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
+            /* Not good. */
+            lockedWsPtr->base.numRefs -= 1;
+            lockedChanPtr->readSeqPosted--;
+            bufPtr->chanPtr    = NULL;
+            IocpBufferFree(bufPtr);
+            return wsaError;
+        }
+        lockedChanPtr->pendingReads++;
+        IocpChannelTrackRead(lockedChanPtr, bufPtr);
+        IOCP_COUNTER_INCR(IocpReadsPosted);
+    }
+    else {
+        lockedChanPtr->pendingReads++;
+        IocpChannelTrackRead(lockedChanPtr, bufPtr);
+        IOCP_COUNTER_INCR(IocpReadsPosted);
+        if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+            /* Completed synchronously. No completion packet will be queued. */
+            IocpChannelCompleteInline(lockedChanPtr, bufPtr, received);
+        }
     }
-    lockedChanPtr->pendingReads++;
 
     return 0;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientPostProbe --
+ *
+ *    Posts a zero-byte read to the socket. This completes when data
+ *    arrives, or the connection is closed, without any buffer being held
+ *    by the kernel in the meanwhile. The data is then drained by
+ *    WinsockClientReadCompleted.
+ *
+ * Results:
+ *    Returns 0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    If bufPtr is NULL, a new buffer is allocated and takes the next read
+ *    sequence number. Otherwise the passed buffer, which must still
+ *    reference the channel, is reposted in its place in the sequence.
+ *    The pending reads count is incremented.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+WinsockClientPostProbe(
+    WinsockClient *lockedWsPtr, /* Must be locked */
+    IocpBuffer    *bufPtr)      /* Probe to repost or NULL */
+{
+    IocpChannel *lockedChanPtr = WinsockClientToIocpChannel(lockedWsPtr);
+    WSABUF       wsaBuf;
+    DWORD        flags;
+    DWORD        wsaError;
+    DWORD        received;
+    int          reposted = (bufPtr != NULL);
+
+    if (reposted) {
+        memset(&bufPtr->u, 0, sizeof(bufPtr->u));
+    }
+    else {
+        bufPtr = IocpBufferNew(0, IOCP_BUFFER_OP_READ,
+                               IOCP_BUFFER_F_WINSOCK | IOCP_BUFFER_F_PROBE);
+        if (bufPtr == NULL)
+            return WSAENOBUFS;
+        bufPtr->chanPtr  = lockedChanPtr;
+        lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+        bufPtr->sequence = lockedChanPtr->readSeqPosted++;
+    }
+
+    wsaBuf.buf = NULL;
+    wsaBuf.len = 0;
+    flags      = 0;
+    IOCP_ASSERT(lockedWsPtr->so != INVALID_SOCKET);
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, 0, 0);
+    if (WSARecv(lockedWsPtr->so, &wsaBuf, 1, &received, &flags,
+                &bufPtr->u.wsaOverlap, NULL) != 0) {
+        if ((wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
+            if (! reposted) {
+                lockedChanPtr->numRefs -= 1;
+                lockedChanPtr->readSeqPosted--;
+                bufPtr->chanPtr = NULL;
+                IocpBufferFree(bufPtr);
+            }
+            return wsaError;
+        }
+        lockedChanPtr->pendingReads++;
+        IocpChannelTrackRead(lockedChanPtr, bufPtr);
+        IOCP_COUNTER_INCR(IocpReadsPosted);
+    }
+    else {
+        lockedChanPtr->pendingReads++;
+        IocpChannelTrackRead(lockedChanPtr, bufPtr);
+        IOCP_COUNTER_INCR(IocpReadsPosted);
+        if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+            /* Completed synchronously. No completion packet will be queued. */
+            IocpChannelCompleteInline(lockedChanPtr, bufPtr, 0);
+        }
+    }
+    IOCP_COUNTER_INCR(IocpZeroByteProbes);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientDrainProbe --
+ *
+ *    Receives the data whose arrival was signalled by the completion of a
+ *    zero-byte read. The data is received with a non-blocking call into
+ *    a buffer from the pool which then becomes the data area of bufPtr.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if there was no data after all and the probe was
+ *    reposted, 0 otherwise.
+ *
+ * Side effects:
+ *    The socket is put into non-blocking mode on first use. On success,
+ *    bufPtr holds the received data, a length of 0 indicating EOF. On
+ *    failure the error is stored in bufPtr->winError.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+WinsockClientDrainProbe(
+    WinsockClient *lockedWsPtr, /* Must be locked */
+    IocpBuffer    *bufPtr)      /* Completed zero-byte read */
+{
+    IocpChannel   *lockedChanPtr = WinsockClientToIocpChannel(lockedWsPtr);
+    IocpBuffer    *dataPtr;
+    IocpDataBuffer swap;
+    WSABUF         wsaBuf;
+    DWORD          flags = 0;
+    DWORD          received;
+    IocpWinError   winError;
+
+    if ((lockedWsPtr->flags & IOCP_WINSOCK_NONBLOCKING) == 0) {
+        u_long nonBlocking = 1;
+        /* Only affects non-overlapped calls on the socket */
+        if (ioctlsocket(lockedWsPtr->so, FIONBIO, &nonBlocking) != 0) {
+            bufPtr->winError = WSAGetLastError();
+            return 0;
+        }
+        lockedWsPtr->flags |= IOCP_WINSOCK_NONBLOCKING;
+    }
+
+    dataPtr = IocpBufferNew(IocpChannelReadBufferSize(lockedChanPtr),
+                            IOCP_BUFFER_OP_READ, IOCP_BUFFER_F_WINSOCK);
+    if (dataPtr == NULL) {
+        bufPtr->winError = WSAENOBUFS;
+        return 0;
+    }
+    wsaBuf.buf = dataPtr->data.bytes;
+    wsaBuf.len = dataPtr->data.capacity;
+    if (WSARecv(lockedWsPtr->so, &wsaBuf, 1, &received, &flags,
+                NULL, NULL) != 0) {
+        winError = WSAGetLastError();
+        IocpBufferFree(dataPtr);
+        if (winError == WSAEWOULDBLOCK) {
+            /* Spurious wakeup. Wait again, keeping the sequence position. */
+            winError = WinsockClientPostProbe(lockedWsPtr, bufPtr);
+            if (winError == 0)
+                return ERROR_IO_PENDING;
+        }
+        bufPtr->winError = winError;
+        return 0;
+    }
+
+    /* The pooled data area goes to the probe, its empty one to the pool */
+    swap          = bufPtr->data;
+    bufPtr->data  = dataPtr->data;
+    dataPtr->data = swap;
+    IocpBufferFree(dataPtr);
+    bufPtr->data.len = received;
+    bufPtr->flags   &= ~IOCP_BUFFER_F_PROBE;
+
+    if (received) {
+        lockedWsPtr->flags &= ~IOCP_WINSOCK_READ_IDLE;
+        lockedWsPtr->lastReadTick = GetTickCount64();
+    }
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientReadCompleted --
+ *
+ *    Implements the readcompleted() interface of IocpChannel. Zero-byte
+ *    reads are drained and completions of reads cancelled by the switch
+ *    to zero-byte reads are discarded.
+ *
+ * Results:
+ *    ERROR_IO_PENDING if bufPtr was reposted, 0 otherwise.
+ *
+ * Side effects:
+ *    See WinsockClientDrainProbe. A zero-byte read is posted when the last
+ *    cancelled read is in.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientReadCompleted(
+    IocpChannel *lockedChanPtr, /* Must be locked */
+    IocpBuffer  *bufPtr)        /* Completed read */
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if (bufPtr->flags & IOCP_BUFFER_F_PROBE) {
+        if (bufPtr->winError != 0 || lockedWsPtr->so == INVALID_SOCKET)
+            return 0;
+        return WinsockClientDrainProbe(lockedWsPtr, bufPtr);
+    }
+
+    if (bufPtr->winError == WSA_OPERATION_ABORTED &&
+        (lockedWsPtr->flags & IOCP_WINSOCK_READ_IDLE)) {
+        IocpWinError winError = 0;
+        if (lockedChanPtr->pendingReads == 0 &&
+            lockedChanPtr->state == IOCP_STATE_OPEN) {
+            winError = WinsockClientPostProbe(lockedWsPtr, NULL);
+        }
+        if (winError == 0)
+            bufPtr->flags |= IOCP_BUFFER_F_DISCARD;
+        else
+            bufPtr->winError = winError; /* Let the application see it */
+        return 0;
+    }
+
+    if (bufPtr->winError == 0 && bufPtr->data.len > 0 &&
+        lockedWsPtr->readMode == IOCP_WINSOCK_READ_AUTO)
+        lockedWsPtr->lastReadTick = GetTickCount64();
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientDiscardOutput --
+ *
+ *    Discards all output queued but not yet posted on the channel.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The queued buffers are freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+WinsockClientDiscardOutput(IocpChannel *lockedChanPtr)
+{
+    IocpLink *linkPtr;
+    while ((linkPtr = IocpListPopFront(&lockedChanPtr->outputBuffers)) != NULL) {
+        IocpBuffer *bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+        lockedChanPtr->outputBytes -= bufPtr->data.len;
+        IocpBufferFree(bufPtr);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientFreeWriteChain --
+ *
+ *    Frees the buffers gathered for a send that could not be posted.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The buffers linked through context[0].ptr are freed and outputBytes
+ *    of the channel adjusted.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+WinsockClientFreeWriteChain(IocpChannel *lockedChanPtr, IocpBuffer *bufPtr)
+{
+    while (bufPtr) {
+        IocpBuffer *nextPtr = bufPtr->context[0].ptr;
+        lockedChanPtr->outputBytes -= bufPtr->data.len;
+        IocpBufferFree(bufPtr);
+        bufPtr = nextPtr;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientPostQueuedWrites --
+ *
+ *    Posts the output queued on the channel to the socket. Consecutive
+ *    queued buffers are sent with a single gathering WSASend. The first
+ *    buffer in each send holds the channel reference and the OVERLAPPED
+ *    for the operation and links to the remaining ones. On TLS
+ *    connections each buffer is encrypted into a record as it is removed
+ *    from the queue.
+ *
+ * Results:
+ *    0 on success or a Windows error code. On error all queued output
+ *    is discarded.
+ *
+ * Side effects:
+ *    Buffers are removed from the output queue and posted to the socket.
+ *    The pending writes count in the IocpChannel is incremented for
+ *    each send.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError
+WinsockClientPostQueuedWrites(
+    WinsockClient *lockedWsPtr, /* Must be locked on entry */
+    int            force)       /* If true, ignore the maxPendingWrites
+                                 * limit and post all queued output */
+{
+    IocpChannel *lockedChanPtr = WinsockClientToIocpChannel(lockedWsPtr);
+    WSABUF       wsaBufs[IOCP_WINSOCK_MAX_GATHER];
+
+    while (lockedChanPtr->outputBuffers.headPtr &&
+           (force ||
+            lockedChanPtr->pendingWrites < lockedChanPtr->maxPendingWrites)) {
+        IocpBuffer *firstPtr = NULL;
+        IocpBuffer *lastPtr  = NULL;
+        IocpLink   *linkPtr;
+        DWORD       nbufs;
+        DWORD       nbytes = 0;
+        DWORD       written;
+        DWORD       wsaError;
+
+        for (nbufs = 0; nbufs < IOCP_WINSOCK_MAX_GATHER; ++nbufs) {
+            IocpBuffer *bufPtr;
+            linkPtr = IocpListPopFront(&lockedChanPtr->outputBuffers);
+            if (linkPtr == NULL)
+                break;
+            bufPtr = CONTAINING_RECORD(linkPtr, IocpBuffer, link);
+            bufPtr->context[0].ptr = NULL;
+            if (lastPtr)
+                lastPtr->context[0].ptr = bufPtr;
+            else
+                firstPtr = bufPtr;
+            lastPtr = bufPtr;
+            if (lockedWsPtr->tlsPtr &&
+                (wsaError = WinsockClientTlsEncrypt(lockedWsPtr, bufPtr)) != ERROR_SUCCESS) {
+                WinsockClientFreeWriteChain(lockedChanPtr, firstPtr);
+                WinsockClientDiscardOutput(lockedChanPtr);
+                return wsaError;
+            }
+            wsaBufs[nbufs].buf = bufPtr->data.bytes + bufPtr->data.begin;
+            wsaBufs[nbufs].len = bufPtr->data.len;
+            nbytes += bufPtr->data.len;
+        }
+
+        firstPtr->chanPtr = lockedChanPtr;
+        lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+        IOCP_ETW_BUFFER("BufferPost", firstPtr, lockedChanPtr, nbytes, 0);
+        IOCP_LATENCY_STAMP_POST(firstPtr);
+        if (WSASend(lockedWsPtr->so,
+                    wsaBufs,       /* Buffer array */
+                    nbufs,         /* Number of elements in array */
+                    &written,      /* Number of bytes sent - only valid if data sent
+                                    *  immediately so not reliable */
+                    0,             /*  Flags - not used */
+                    &firstPtr->u.wsaOverlap, /* Overlap structure for return status */
+                    NULL)                  /* Completion routine - Not used */
+            != 0) {
+            if ((wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
+                /* Not good. */
+                lockedChanPtr->numRefs -= 1;
+                firstPtr->chanPtr    = NULL;
+                WinsockClientFreeWriteChain(lockedChanPtr, firstPtr);
+                WinsockClientDiscardOutput(lockedChanPtr);
+                return wsaError;
+            }
+            lockedChanPtr->pendingWrites++;
+            IOCP_COUNTER_INCR(IocpWritesPosted);
+        }
+        else {
+            lockedChanPtr->pendingWrites++;
+            IOCP_COUNTER_INCR(IocpWritesPosted);
+            if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+                /* Completed synchronously. No completion packet will be queued. */
+                IocpChannelCompleteInline(lockedChanPtr, firstPtr, written);
+            }
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientFlushOutput --
+ *
+ *    Posts queued output to the socket. Implements the behaviour expected
+ *    of the flushoutput() function in IocpChannel vtbl.
+ *
+ * Results:
+ *    0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    See WinsockClientPostQueuedWrites.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientFlushOutput(IocpChannel *lockedChanPtr)
+{
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+
+    if (lockedWsPtr->so == INVALID_SOCKET) {
+        WinsockClientDiscardOutput(lockedChanPtr);
+        return WSAENOTCONN;
+    }
+    return WinsockClientPostQueuedWrites(lockedWsPtr, 0);
+}
+
 /*
  *------------------------------------------------------------------------
  *
  * WinsockClientPostWrite --
  *
- *    Allocates a receive buffer, copies passed data to it and posts
- *    it to the socket associated with lockedWsPtr. Implements the behaviour
- *    expected of the postwrite() function in IocpChannel vtbl.
+ *    Copies passed data to the channel output queue, coalescing with
+ *    previously queued data where possible, and posts queued data to
+ *    the socket associated with lockedWsPtr if the number of outstanding
+ *    sends permits. Implements the behaviour expected of the postwrite()
+ *    function in IocpChannel vtbl. On TLS connections, data is split into
+ *    buffers of at most one record with room for the record header and
+ *    trailer.
  *
  * Results:
  *    If data is successfully written, return 0 and stores written count
- *    into *countPtr. If no data could be written because device would block
- *    returns 0 and stores 0 in *countPtr. On error, returns a Windows error.
+ *    into *countPtr. If no data could be written because the channel
+ *    output already exceeds its high-water mark, returns 0 and stores
+ *    0 in *countPtr. On error, returns a Windows error.
  *
  * Side effects:
- *    The write buffer is queued to the socket from where it will
- *    retrieved by the IO completion thread. The pending writes count
- *    in the IocpChannel is incremented.
+ *    The data is queued to the channel and possibly posted to the socket
+ *    from where it will retrieved by the IO completion thread. The
+ *    channel's outputBytes is incremented.
  *
  *------------------------------------------------------------------------
  */
@@ -318,53 +1308,193 @@ WinsockClientPostWrite(
     int         *countPtr)      /* Output - Number of bytes written */
 {
     WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
-    IocpBuffer *bufPtr;
-    WSABUF      wsaBuf;
-    DWORD       wsaError;
-    DWORD       written;
+    IocpBuffer   *bufPtr;
+    IocpWinError  winError;
+    int           room;
+    int           headRoom  = 0;      /* Reserved before data */
+    int           tailRoom  = 0;      /* Reserved after data */
+    int           maxData   = nbytes; /* Max data bytes per buffer */
+    int           remaining;
 
     IOCP_ASSERT(lockedWsPtr->base.state == IOCP_STATE_OPEN);
 
-    /* If we have already too many outstanding writes */
-    if (lockedChanPtr->pendingWrites >= lockedChanPtr->maxPendingWrites) {
+    if (lockedChanPtr->outputBytes >= lockedChanPtr->maxOutputBytes) {
         /* Not an error but indicate nothing written */
         *countPtr = 0;
         return ERROR_SUCCESS;
     }
 
-    bufPtr = IocpBufferNew(nbytes, IOCP_BUFFER_OP_WRITE, IOCP_BUFFER_F_WINSOCK);
-    if (bufPtr == NULL)
-        return WSAENOBUFS; /* TBD - should we treat this as above? But this is more serious (and should be rarer) */
+    if (lockedWsPtr->tlsPtr)
+        WinsockClientTlsLimits(lockedWsPtr, &headRoom, &tailRoom, &maxData);
 
-    IocpBufferCopyIn(bufPtr, bytes, nbytes);
+    /* Coalesce into the last queued buffer if it has room */
+    if (lockedChanPtr->outputBuffers.tailPtr) {
+        bufPtr = CONTAINING_RECORD(lockedChanPtr->outputBuffers.tailPtr,
+                                   IocpBuffer, link);
+        room = bufPtr->data.capacity - bufPtr->data.begin - bufPtr->data.len - tailRoom;
+        if (lockedWsPtr->tlsPtr && room > maxData - bufPtr->data.len)
+            room = maxData - bufPtr->data.len;
+        if (room >= nbytes) {
+            IocpBufferAppend(bufPtr, bytes, nbytes);
+            lockedChanPtr->outputBytes += nbytes;
+            *countPtr = nbytes;
+            /* A send is outstanding else the queue would have been empty */
+            return ERROR_SUCCESS;
+        }
+    }
 
-    bufPtr->chanPtr    = lockedChanPtr;
-    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
-    wsaBuf.buf = bufPtr->data.bytes;
-    wsaBuf.len = bufPtr->data.len;
-    if (WSASend(lockedWsPtr->so,
-                &wsaBuf,       /* Buffer array */
-                1,             /* Number of elements in array */
-                &written,      /* Number of bytes sent - only valid if data sent
-                                *  immediately so not reliable */
-                0,             /*  Flags - not used */
-                &bufPtr->u.wsaOverlap, /* Overlap structure for return status */
-                NULL)                  /* Completion routine - Not used */
-        != 0
-        && (wsaError = WSAGetLastError()) != WSA_IO_PENDING) {
-        /* Not good. */
-        lockedChanPtr->numRefs -= 1;
-        bufPtr->chanPtr    = NULL;
-        IocpBufferFree(bufPtr);
+    /*
+     * Allocate at least the default size so following small writes can
+     * be coalesced into this buffer.
+     */
+    remaining = nbytes;
+    do {
+        int chunk = remaining < maxData ? remaining : maxData;
+        int size  = chunk < IOCP_BUFFER_DEFAULT_SIZE ? IOCP_BUFFER_DEFAULT_SIZE : chunk;
+        if (lockedWsPtr->tlsPtr && size > maxData)
+            size = maxData;
+        bufPtr = IocpBufferNew(headRoom + size + tailRoom,
+                               IOCP_BUFFER_OP_WRITE, IOCP_BUFFER_F_WINSOCK);
+        if (bufPtr == NULL) {
+            if (remaining == nbytes)
+                return WSAENOBUFS; /* TBD - should we treat this as above? But this is more serious (and should be rarer) */
+            break;              /* Report what was queued */
+        }
+        bufPtr->data.begin = headRoom;
+        IocpBufferAppend(bufPtr, bytes, chunk);
+        IocpListAppend(&lockedChanPtr->outputBuffers, &bufPtr->link);
+        lockedChanPtr->outputBytes += chunk;
+        bytes     += chunk;
+        remaining -= chunk;
+    } while (remaining > 0);
+
+    winError = WinsockClientPostQueuedWrites(lockedWsPtr, 0);
+    if (winError != ERROR_SUCCESS) {
         *countPtr = -1;
-        return wsaError;
+        return winError;
     }
-    *countPtr = nbytes;
-    lockedChanPtr->pendingWrites++;
+    *countPtr = nbytes - remaining;
 
     return 0;
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientPostTransmit --
+ *
+ *    Posts a TransmitFile operation that sends part of a file, optionally
+ *    preceded and followed by in-memory data, directly from the file
+ *    handle without copying through user mode buffers. Any queued output
+ *    is posted first so data goes out in the order written. The operation
+ *    is treated as a write of all the bytes to be sent so it is
+ *    accounted against -writehighwater and is completed by the regular
+ *    write completion handling.
+ *
+ * Results:
+ *    0 on success or a Windows error code.
+ *
+ * Side effects:
+ *    On success the file handle is owned by the posted buffer and closed
+ *    when the operation completes. On failure the caller retains it. The
+ *    pending writes count and outputBytes of the channel are incremented.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+WinsockClientPostTransmit(
+    IocpChannel *lockedChanPtr, /* Must be locked on entry */
+    HANDLE       fileHandle,    /* File to send */
+    Tcl_WideInt  offset,        /* Offset in file of data to send */
+    int          length,        /* Number of bytes to send from file */
+    const char  *head,          /* Data to send before the file */
+    int          headLen,       /* Number of bytes in head */
+    const char  *tail,          /* Data to send after the file */
+    int          tailLen)       /* Number of bytes in tail */
+{
+    static GUID   TransmitFileGuid = WSAID_TRANSMITFILE;
+    LPFN_TRANSMITFILE fnTransmitFile;
+    WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
+    IocpBuffer   *bufPtr;
+    TRANSMIT_FILE_BUFFERS *tfbPtr;
+    IocpWinError  winError;
+    DWORD         nbytes;
+
+    IOCP_ASSERT(lockedChanPtr->state == IOCP_STATE_OPEN);
+    IOCP_ASSERT(length >= 0 && headLen >= 0 && tailLen >= 0);
+    IOCP_ASSERT(length <= IOCP_WINSOCK_MAX_TRANSMIT - headLen - tailLen);
+
+    if (WSAIoctl(lockedWsPtr->so, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &TransmitFileGuid, sizeof(GUID),
+                 &fnTransmitFile, sizeof(fnTransmitFile),
+                 &nbytes, NULL, NULL) != 0) {
+        return WSAGetLastError();
+    }
+
+    /* Sends on a socket complete in order of posting. */
+    winError = WinsockClientPostQueuedWrites(lockedWsPtr, 1);
+    if (winError != ERROR_SUCCESS)
+        return winError;
+
+    /*
+     * The data area holds the TRANSMIT_FILE_BUFFERS followed by the head
+     * and tail as these have to stay valid until completion. data.len is
+     * then set to the total bytes sent for output accounting.
+     */
+    bufPtr = IocpBufferNew(sizeof(*tfbPtr) + headLen + tailLen,
+                           IOCP_BUFFER_OP_WRITE, IOCP_BUFFER_F_WINSOCK);
+    if (bufPtr == NULL)
+        return WSAENOBUFS;
+    tfbPtr             = (TRANSMIT_FILE_BUFFERS *) bufPtr->data.bytes;
+    tfbPtr->Head       = bufPtr->data.bytes + sizeof(*tfbPtr);
+    tfbPtr->HeadLength = headLen;
+    tfbPtr->Tail       = bufPtr->data.bytes + sizeof(*tfbPtr) + headLen;
+    tfbPtr->TailLength = tailLen;
+    if (headLen)
+        memcpy(tfbPtr->Head, head, headLen);
+    if (tailLen)
+        memcpy(tfbPtr->Tail, tail, tailLen);
+    bufPtr->data.len             = headLen + length + tailLen;
+    bufPtr->flags               |= IOCP_BUFFER_F_TRANSMIT;
+    bufPtr->context[0].ptr       = NULL; /* No gathered buffers */
+    bufPtr->context[1].h         = fileHandle;
+    bufPtr->u.wsaOverlap.Offset     = (DWORD) offset;
+    bufPtr->u.wsaOverlap.OffsetHigh = (DWORD) (offset >> 32);
+
+    bufPtr->chanPtr = lockedChanPtr;
+    lockedChanPtr->numRefs += 1; /* Reversed when buffer is unlinked from channel */
+    lockedChanPtr->outputBytes += bufPtr->data.len;
+    IOCP_ETW_BUFFER("BufferPost", bufPtr, lockedChanPtr, bufPtr->data.len, 0);
+    IOCP_LATENCY_STAMP_POST(bufPtr);
+    if (fnTransmitFile(lockedWsPtr->so,
+                       fileHandle,
+                       length,  /* 0 would mean the whole file */
+                       0,       /* Default send size */
+                       &bufPtr->u.overlap,
+                       (headLen || tailLen) ? tfbPtr : NULL,
+                       0) == FALSE) {
+        winError = WSAGetLastError();
+        if (winError != WSA_IO_PENDING) {
+            lockedChanPtr->numRefs -= 1;
+            lockedChanPtr->outputBytes -= bufPtr->data.len;
+            bufPtr->chanPtr = NULL;
+            IocpBufferFree(bufPtr); /* Caller closes fileHandle */
+            return winError;
+        }
+        lockedChanPtr->pendingWrites++;
+        IOCP_COUNTER_INCR(IocpWritesPosted);
+    }
+    else {
+        lockedChanPtr->pendingWrites++;
+        IOCP_COUNTER_INCR(IocpWritesPosted);
+        if (lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) {
+            /* Completed synchronously. No completion packet will be queued. */
+            IocpChannelCompleteInline(lockedChanPtr, bufPtr, bufPtr->data.len);
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -442,7 +1572,9 @@ WinsockClientAsyncConnectFailed(
  *
  * WinsockClientDisconnected --
  *
- *    Closes the socket associated with the channel.
+ *    Closes the socket associated with the channel or, if it was
+ *    disconnected for reuse, returns it to the pool of the listener that
+ *    accepted it.
  *
  * Results:
  *    None.
@@ -454,14 +1586,21 @@ WinsockClientAsyncConnectFailed(
  */
 void
 WinsockClientDisconnected(
-    IocpChannel *lockedChanPtr) /* Must be locked on entry. */
+    IocpChannel *lockedChanPtr, /* Must be locked on entry. */
+    IocpWinError winError)      /* Status of the disconnect */
 {
     WinsockClient *wsPtr = IocpChannelToWinsockClient(lockedChanPtr);
 
     if (wsPtr->so != INVALID_SOCKET) {
-        closesocket(wsPtr->so);
+        if (winError != ERROR_SUCCESS ||
+            (wsPtr->flags & IOCP_WINSOCK_REUSE_PENDING) == 0 ||
+            ! WinsockSocketPoolPut(wsPtr->recyclePoolPtr, wsPtr->so,
+                                   wsPtr->flags)) {
+            closesocket(wsPtr->so);
+        }
         wsPtr->so = INVALID_SOCKET;
     }
+    wsPtr->flags &= ~IOCP_WINSOCK_REUSE_PENDING;
 }
 
 /*
@@ -595,6 +1734,299 @@ WinsockListifyAddress(
 
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientSetEndpoints --
+ *
+ *    Stores the endpoint addresses of a connection if already known, as
+ *    for accepted connections, so they need not be retrieved from the
+ *    socket when queried.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The endpoints are cached in wsPtr.
+ *
+ *------------------------------------------------------------------------
+ */
+void WinsockClientSetEndpoints(
+    WinsockClient      *wsPtr,     /* Must be locked or not yet visible */
+    const IocpSockaddr *localPtr,  /* Local address. May be NULL */
+    int                 localLen,  /* Size of *localPtr */
+    const IocpSockaddr *remotePtr, /* Remote address. May be NULL */
+    int                 remoteLen) /* Size of *remotePtr */
+{
+    if (localPtr && localLen > 0 && localLen <= sizeof(IocpSockaddr)) {
+        memcpy(&wsPtr->localEndpoint.addr, localPtr, localLen);
+        wsPtr->localEndpoint.addrLen = localLen;
+    }
+    if (remotePtr && remoteLen > 0 && remoteLen <= sizeof(IocpSockaddr)) {
+        memcpy(&wsPtr->remoteEndpoint.addr, remotePtr, remoteLen);
+        wsPtr->remoteEndpoint.addrLen = remoteLen;
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockEndpointNumericHost --
+ * WinsockEndpointPort --
+ *
+ *    Return the numeric host address and the port of a captured Internet
+ *    endpoint. The host address is only formatted on the first call and
+ *    never involves a name lookup of any kind.
+ *
+ * Results:
+ *    WinsockEndpointNumericHost returns the formatted address or NULL on
+ *    failure with the error available from WSAGetLastError.
+ *    WinsockEndpointPort returns the port.
+ *
+ * Side effects:
+ *    The formatted address is cached in the endpoint.
+ *
+ *------------------------------------------------------------------------
+ */
+const char *WinsockEndpointNumericHost(
+    WinsockEndpoint *endpointPtr) /* Owning channel must be locked */
+{
+    char  *host = endpointPtr->numericHost;
+    size_t len;
+    const void *inAddr;
+    ULONG  scopeId = 0;
+
+    if (host[0] != '\0')
+        return host;
+
+    /*
+     * InetNtop is a pure formatter whereas getnameinfo, even with
+     * NI_NUMERICHOST, goes through the name service provider layer. This
+     * is called on every accept so keep it off that path altogether.
+     */
+    switch (endpointPtr->addr.sa.sa_family) {
+    case AF_INET:
+        inAddr = &endpointPtr->addr.sa4.sin_addr;
+        break;
+    case AF_INET6:
+        inAddr  = &endpointPtr->addr.sa6.sin6_addr;
+        scopeId = endpointPtr->addr.sa6.sin6_scope_id;
+        break;
+    default:
+        WSASetLastError(WSAEAFNOSUPPORT);
+        return NULL;
+    }
+    if (InetNtopA(endpointPtr->addr.sa.sa_family, inAddr, host,
+                  sizeof(endpointPtr->numericHost)) == NULL) {
+        host[0] = '\0';
+        return NULL;
+    }
+    if (scopeId != 0) {
+        /* Same form as getnameinfo, e.g. fe80::1%3 */
+        len = strlen(host);
+        if (sprintf_s(host + len, sizeof(endpointPtr->numericHost) - len,
+                      "%%%lu", scopeId) < 0) {
+            host[0] = '\0';
+            WSASetLastError(WSAEFAULT);
+            return NULL;
+        }
+    }
+    return host;
+}
+
+int WinsockEndpointPort(
+    const WinsockEndpoint *endpointPtr)
+{
+    /* sin6_port is at the same offset as sin_port */
+    return ntohs(endpointPtr->addr.sa4.sin_port);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockEndpointNeedsLookup --
+ *
+ *    Checks whether a reverse lookup should be done for an address. Based
+ *    on comments in 8.6 Tcl winsock, INADDR_ANY and sin6addr_any are not
+ *    resolved as they sometimes cause problems (no mention of what
+ *    problems).
+ *
+ * Results:
+ *    Non-0 if the address should be resolved, else 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *------------------------------------------------------------------------
+ */
+static int WinsockEndpointNeedsLookup(
+    const IocpSockaddr *addrPtr)
+{
+    if (addrPtr->sa.sa_family == AF_INET)
+        return addrPtr->sa4.sin_addr.s_addr != INADDR_ANY;
+    IOCP_ASSERT(addrPtr->sa.sa_family == AF_INET6);
+    return !(IN6_ARE_ADDR_EQUAL(&addrPtr->sa6.sin6_addr, &in6addr_any) ||
+             (IN6_IS_ADDR_V4MAPPED(&addrPtr->sa6.sin6_addr)
+              && addrPtr->sa6.sin6_addr.s6_addr[12] == 0
+              && addrPtr->sa6.sin6_addr.s6_addr[13] == 0
+              && addrPtr->sa6.sin6_addr.s6_addr[14] == 0
+              && addrPtr->sa6.sin6_addr.s6_addr[15] == 0));
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientReverseResolved --
+ *
+ *    Called from a thread pool thread when a reverse lookup started by
+ *    WinsockClientStartLookup completes. Follows the
+ *    IocpReverseResolveDoneProc prototype.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The host name is stored in the endpoints awaiting it and the
+ *    reference held by the lookup is released.
+ *
+ *------------------------------------------------------------------------
+ */
+static void WinsockClientReverseResolved(
+    ClientData          clientData, /* WinsockClient with a reference held
+                                     * by the lookup */
+    const IocpSockaddr *addrPtr,    /* Address that was looked up */
+    const char         *hostName,   /* NULL on failure */
+    IocpWinError        winError)   /* Lookup status */
+{
+    WinsockClient   *wsPtr = (WinsockClient *) clientData;
+    WinsockEndpoint *endpoints[2];
+    int              i;
+
+    endpoints[0] = &wsPtr->localEndpoint;
+    endpoints[1] = &wsPtr->remoteEndpoint;
+    IocpChannelLock(WinsockClientToIocpChannel(wsPtr));
+    for (i = 0; i < 2; ++i) {
+        WinsockEndpoint *endpointPtr = endpoints[i];
+        if (endpointPtr->lookup != IOCP_WINSOCK_LOOKUP_PENDING ||
+            ! IocpSockaddrSameHost(&endpointPtr->addr, addrPtr))
+            continue;
+        /* On failure the numeric form continues to be used */
+        endpointPtr->lookup = IOCP_WINSOCK_LOOKUP_DONE;
+        if (hostName) {
+            IocpSizeT len = Tclh_strlen(hostName);
+            endpointPtr->hostName = ckalloc(len + 1);
+            memcpy(endpointPtr->hostName, hostName, len + 1);
+        }
+    }
+    IocpChannelDrop(WinsockClientToIocpChannel(wsPtr));
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientStartLookup --
+ *
+ *    Starts the reverse lookup of an endpoint unless its host name is
+ *    already in the cache.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The endpoint lookup state is updated and a lookup may be queued
+ *    holding a reference to the channel.
+ *
+ *------------------------------------------------------------------------
+ */
+static void WinsockClientStartLookup(
+    WinsockClient   *lockedWsPtr, /* Must be locked */
+    WinsockEndpoint *endpointPtr) /* Endpoint of lockedWsPtr */
+{
+    endpointPtr->hostName = IocpReverseResolveCached(&endpointPtr->addr);
+    if (endpointPtr->hostName) {
+        endpointPtr->lookup = IOCP_WINSOCK_LOOKUP_DONE;
+        return;
+    }
+    lockedWsPtr->base.numRefs += 1; /* Reversed by WinsockClientReverseResolved */
+    if (IocpReverseResolveAsync(&endpointPtr->addr, endpointPtr->addrLen,
+                                WinsockClientReverseResolved,
+                                lockedWsPtr) == ERROR_SUCCESS)
+        endpointPtr->lookup = IOCP_WINSOCK_LOOKUP_PENDING;
+    else {
+        lockedWsPtr->base.numRefs -= 1;
+        endpointPtr->lookup = IOCP_WINSOCK_LOOKUP_DONE; /* Stay numeric */
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientGetEndpoint --
+ *
+ *    Stores the value of the -peername or -sockname option for an
+ *    endpoint in the form returned by WinsockListifyAddress. The address
+ *    is retrieved from the socket only if not already captured. For
+ *    Internet addresses, the name field holds the numeric address until
+ *    a reverse lookup, started on first use, completes. The lookup is
+ *    never waited for so as to keep DNS off the calling thread. If noRDNS
+ *    is set, no lookup is started and the name is always numeric.
+ *
+ * Results:
+ *    Returns 0 on success with *dsPtr filled in or a Windows error code
+ *    on failure in which case *dsPtr is unchanged.
+ *
+ * Side effects:
+ *    The endpoint is captured and a reverse lookup may be started.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpWinError WinsockClientGetEndpoint(
+    WinsockClient   *lockedWsPtr, /* Must be locked */
+    WinsockEndpoint *endpointPtr, /* Endpoint of lockedWsPtr */
+    int (WSAAPI *addressFn)(SOCKET, struct sockaddr *, int *),
+                                  /* getpeername or getsockname */
+    int              noRDNS,      /* If true, no name lookup is done */
+    Tcl_DString     *dsPtr)       /* Caller-initialized location for output */
+{
+    const char *numericHost;
+    const char *name;
+    char        port[TCL_INTEGER_SPACE];
+
+    if (endpointPtr->addrLen == 0) {
+        int addrLen = sizeof(endpointPtr->addr);
+        if (addressFn(lockedWsPtr->so, &endpointPtr->addr.sa, &addrLen) != 0)
+            return WSAGetLastError();
+        endpointPtr->addrLen = addrLen;
+    }
+
+    if (endpointPtr->addr.sa.sa_family != AF_INET &&
+        endpointPtr->addr.sa.sa_family != AF_INET6) {
+        /* Note original length in case we need to revert after modification */
+        int dsLen = Tcl_DStringLength(dsPtr);
+        IocpWinError winError = WinsockListifyAddress(
+            &endpointPtr->addr, endpointPtr->addrLen, noRDNS, dsPtr);
+        if (winError != ERROR_SUCCESS)
+            Tcl_DStringTrunc(dsPtr, dsLen); /* Restore */
+        return winError;
+    }
+
+    numericHost = WinsockEndpointNumericHost(endpointPtr);
+    if (numericHost == NULL)
+        return WSAGetLastError();
+    name = numericHost;
+    if (! noRDNS && WinsockEndpointNeedsLookup(&endpointPtr->addr)) {
+        if (endpointPtr->lookup == IOCP_WINSOCK_LOOKUP_NONE)
+            WinsockClientStartLookup(lockedWsPtr, endpointPtr);
+        if (endpointPtr->hostName)
+            name = endpointPtr->hostName;
+    }
+    sprintf_s(port, sizeof(port), "%d", WinsockEndpointPort(endpointPtr));
+    Tcl_DStringAppendElement(dsPtr, numericHost);
+    Tcl_DStringAppendElement(dsPtr, name);
+    Tcl_DStringAppendElement(dsPtr, port);
+    return ERROR_SUCCESS;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -618,7 +2050,6 @@ WinsockClientGetOption(
     Tcl_DString *dsPtr)         /* Where to store the value */
 {
     WinsockClient *lockedWsPtr  = IocpChannelToWinsockClient(lockedChanPtr);
-    IocpSockaddr addr;
     IocpWinError    winError;
     int  addrSize;
     char integerSpace[TCL_INTEGER_SPACE];
@@ -629,13 +2060,17 @@ WinsockClientGetOption(
     switch (opt) {
     case IOCP_WINSOCK_OPT_CONNECTING:
         Tcl_DStringAppend(dsPtr,
-                          lockedWsPtr->base.state == IOCP_STATE_CONNECTING ? "1" : "0",
+                          (lockedWsPtr->base.state == IOCP_STATE_CONNECTING ||
+                           lockedWsPtr->base.state == IOCP_STATE_RESOLVING ||
+                           lockedWsPtr->base.state == IOCP_STATE_HANDSHAKING) ? "1" : "0",
                           1);
         return TCL_OK;
     case IOCP_WINSOCK_OPT_ERROR:
         /* As per Tcl winsock, do not report errors in connecting state */
-        if (lockedWsPtr->base.state != IOCP_STATE_CONNECTING &&
+        if (lockedWsPtr->base.state != IOCP_STATE_RESOLVING &&
+            lockedWsPtr->base.state != IOCP_STATE_CONNECTING &&
             lockedWsPtr->base.state != IOCP_STATE_CONNECT_RETRY &&
+            lockedWsPtr->base.state != IOCP_STATE_HANDSHAKING &&
             lockedWsPtr->base.winError != ERROR_SUCCESS) {
 #if 1
             IocpSetTclErrnoFromWin32(lockedWsPtr->base.winError);
@@ -655,7 +2090,8 @@ WinsockClientGetOption(
         return TCL_OK;
     case IOCP_WINSOCK_OPT_PEERNAME:
     case IOCP_WINSOCK_OPT_SOCKNAME:
-        if (lockedWsPtr->base.state == IOCP_STATE_CONNECTING ||
+        if (lockedWsPtr->base.state == IOCP_STATE_RESOLVING ||
+            lockedWsPtr->base.state == IOCP_STATE_CONNECTING ||
             lockedWsPtr->base.state == IOCP_STATE_CONNECT_RETRY) {
             /* As per TIP 427, empty string to be returned in these states */
             return TCL_OK;
@@ -668,16 +2104,12 @@ WinsockClientGetOption(
         if (interp != NULL && Tcl_GetVar(interp, SUPPRESS_RDNS_VAR, 0) != NULL) {
             noRDNS = NI_NUMERICHOST;
         }
-        addrSize = sizeof(addr);
-        if ((opt==IOCP_WINSOCK_OPT_PEERNAME?getpeername:getsockname)(lockedWsPtr->so, &addr.sa, &addrSize) != 0)
-            winError = WSAGetLastError();
-        else {
-            /* Note original length in case we need to revert after modification */
-            int dsLen = Tcl_DStringLength(dsPtr);
-            winError = WinsockListifyAddress(&addr, addrSize, noRDNS, dsPtr);
-            if (winError != ERROR_SUCCESS)
-                Tcl_DStringTrunc(dsPtr, dsLen); /* Restore */
-        }
+        winError = WinsockClientGetEndpoint(
+            lockedWsPtr,
+            opt == IOCP_WINSOCK_OPT_PEERNAME ?
+            &lockedWsPtr->remoteEndpoint : &lockedWsPtr->localEndpoint,
+            opt == IOCP_WINSOCK_OPT_PEERNAME ? getpeername : getsockname,
+            noRDNS, dsPtr);
         if (winError == 0)
             return TCL_OK;
         else
@@ -691,8 +2123,14 @@ WinsockClientGetOption(
         Tcl_DStringAppend(dsPtr, integerSpace, -1);
         return TCL_OK;
     case IOCP_WINSOCK_OPT_MAXPENDINGACCEPTS:
+    case IOCP_WINSOCK_OPT_RECYCLEPOOLSIZE:
+    case IOCP_WINSOCK_OPT_ACCEPTREADSIZE:
+    case IOCP_WINSOCK_OPT_MINPENDINGACCEPTS:
         Tcl_DStringAppend(dsPtr, "0", 1);
         return TCL_OK;
+    case IOCP_WINSOCK_OPT_STATS:
+        IocpChannelGetStats(lockedChanPtr, dsPtr);
+        return TCL_OK;
     case IOCP_WINSOCK_OPT_SOSNDBUF:
     case IOCP_WINSOCK_OPT_SORCVBUF:
         if (lockedWsPtr->so == INVALID_SOCKET) {
@@ -727,6 +2165,49 @@ WinsockClientGetOption(
             Tcl_DStringAppend(dsPtr, optval ? "1" : "0", 1);
 	}
         return TCL_OK;
+    case IOCP_WINSOCK_OPT_INLINECOMPLETION:
+        Tcl_DStringAppend(
+            dsPtr,
+            lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION ? "1" : "0",
+            1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_WRITEHIGHWATER:
+    case IOCP_WINSOCK_OPT_MAXINPUTBYTES:
+        sprintf_s(integerSpace, sizeof(integerSpace),
+                  "%d", opt == IOCP_WINSOCK_OPT_WRITEHIGHWATER ?
+                  lockedChanPtr->maxOutputBytes : lockedChanPtr->maxInputBytes);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_MAXSPINWAIT:
+        sprintf_s(integerSpace, sizeof(integerSpace),
+                  "%d", lockedChanPtr->maxSpinWait);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_TLS:
+        WinsockClientTlsDescribe(lockedWsPtr, dsPtr);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READBUFFERSIZE:
+        /* Size in use, whether fixed or adaptive */
+        sprintf_s(integerSpace, sizeof(integerSpace),
+                  "%d", IocpChannelReadBufferSize(lockedChanPtr));
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READMODE:
+        Tcl_DStringAppend(dsPtr,
+                          iocpWinsockReadModeNames[lockedWsPtr->readMode], -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_IDLETIMEOUT:
+        sprintf_s(integerSpace, sizeof(integerSpace),
+                  "%u", lockedWsPtr->idleTimeout);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READTIMEOUT:
+    case IOCP_WINSOCK_OPT_CONNECTTIMEOUT:
+        sprintf_s(integerSpace, sizeof(integerSpace),
+                  "%u", opt == IOCP_WINSOCK_OPT_READTIMEOUT ?
+                  lockedChanPtr->readTimeout : lockedChanPtr->connectTimeout);
+        Tcl_DStringAppend(dsPtr, integerSpace, -1);
+        return TCL_OK;
     default:
         if (interp) {
           Tcl_SetObjResult(
@@ -738,6 +2219,67 @@ WinsockClientGetOption(
     }
 }
 
+/*
+ *------------------------------------------------------------------------
+ *
+ * WinsockClientSetTimeout --
+ *
+ *    Sets the -readtimeout or -connecttimeout option. A value of 0 means
+ *    no timeout. A read timeout set on an open channel runs from the time
+ *    it is set. Likewise for a connect timeout set while the connect is
+ *    in progress. Once connected, the connect timeout has no effect.
+ *
+ * Results:
+ *    Returns TCL_OK on succes and TCL_ERROR on failure.
+ *
+ * Side effects:
+ *    The channel timer is rearmed.
+ *
+ *------------------------------------------------------------------------
+ */
+static IocpTclCode WinsockClientSetTimeout(
+    IocpChannel *lockedChanPtr, /* Locked on entry, locked on exit */
+    Tcl_Interp  *interp,        /* For error reporting. May be NULL */
+    int          opt,           /* READTIMEOUT or CONNECTTIMEOUT */
+    const char  *valuePtr)      /* Option value */
+{
+    IocpWinError winError;
+    int          intValue;
+
+    if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+        Tcl_SetErrno(EINVAL);
+        return TCL_ERROR;
+    }
+    if (intValue < 0) {
+        if (interp)
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+        Tcl_SetErrno(EINVAL);
+        return TCL_ERROR;
+    }
+    if (opt == IOCP_WINSOCK_OPT_READTIMEOUT) {
+        /* Registered I/O receives cannot be cancelled */
+        if (intValue != 0 &&
+            (IocpChannelToWinsockClient(lockedChanPtr)->flags & IOCP_WINSOCK_RIO)) {
+            Iocp_ReportWindowsError(interp, WSAEOPNOTSUPP, "Could not set read timeout: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedChanPtr->readTimeout   = intValue;
+        lockedChanPtr->lastInputTick = GetTickCount64();
+    } else {
+        lockedChanPtr->connectTimeout  = intValue;
+        lockedChanPtr->connectDeadline =
+            intValue ? GetTickCount64() + intValue : 0;
+    }
+    winError = IocpChannelScheduleTimeouts(lockedChanPtr);
+    if (winError != ERROR_SUCCESS) {
+        Iocp_ReportWindowsError(interp, winError, "Could not set timeout: ");
+        Tcl_SetErrno(EINVAL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
 /*
  *------------------------------------------------------------------------
  *
@@ -762,6 +2304,12 @@ IocpTclCode WinsockClientSetOption(
     WinsockClient *lockedWsPtr = IocpChannelToWinsockClient(lockedChanPtr);
     int        intValue;
     BOOL       bVal;
+    IocpWinError winError;
+
+    /* Timeouts may be set while a connect is still resolving */
+    if (opt == IOCP_WINSOCK_OPT_READTIMEOUT ||
+        opt == IOCP_WINSOCK_OPT_CONNECTTIMEOUT)
+        return WinsockClientSetTimeout(lockedChanPtr, interp, opt, valuePtr);
 
     if (lockedWsPtr->so == INVALID_SOCKET) {
         if (interp)
@@ -787,6 +2335,104 @@ IocpTclCode WinsockClientSetOption(
         else
             lockedChanPtr->maxPendingWrites = intValue;
         return TCL_OK;
+    case IOCP_WINSOCK_OPT_WRITEHIGHWATER:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue <= 0) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedChanPtr->maxOutputBytes = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_MAXINPUTBYTES:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* 0 => no per-channel limit */
+        if (intValue < 0) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedChanPtr->maxInputBytes = intValue;
+        /* Raising the limit may allow reads to be posted again */
+        if ((lockedChanPtr->flags & IOCP_CHAN_F_INPUT_THROTTLED) &&
+            lockedChanPtr->state == IOCP_STATE_OPEN &&
+            (lockedChanPtr->flags & IOCP_CHAN_F_REMOTE_EOF) == 0)
+            IocpChannelPostReads(lockedChanPtr);
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_MAXSPINWAIT:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* 0 => always sleep */
+        if (intValue < 0 || intValue > IOCP_MAX_SPIN_WAIT_LIMIT) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedChanPtr->maxSpinWait      = intValue;
+        lockedChanPtr->spinWaitEstimate = intValue / 2;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READBUFFERSIZE:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* 0 => adapt to traffic */
+        if (intValue < 0 || intValue > IOCP_READ_BUFFER_MAX_SIZE ||
+            (intValue > 0 && intValue < IOCP_READ_BUFFER_MIN_SIZE)) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /* Takes effect on the next posted read */
+        lockedChanPtr->readBufferSize = intValue;
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_READMODE:
+        if (WinsockReadModeFromString(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        winError = WinsockClientSetReadMode(lockedChanPtr, intValue);
+        if (winError != ERROR_SUCCESS) {
+            Iocp_ReportWindowsError(interp, winError, "Could not set read mode: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        return TCL_OK;
+    case IOCP_WINSOCK_OPT_IDLETIMEOUT:
+        if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (intValue <= 0) {
+            if (interp)
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("Integer value %d out of range.", intValue));
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        lockedWsPtr->idleTimeout = intValue;
+        /* A shorter timeout must not wait for the timer armed for the old */
+        if (IocpTimerArmed(&lockedWsPtr->idleTimer)) {
+            winError = IocpTimerArm(&lockedWsPtr->idleTimer,
+                                    lockedWsPtr->lastReadTick + intValue);
+            if (winError != ERROR_SUCCESS) {
+                Iocp_ReportWindowsError(interp, winError, "Could not set idle timeout: ");
+                Tcl_SetErrno(EINVAL);
+                return TCL_ERROR;
+            }
+        }
+        return TCL_OK;
     case IOCP_WINSOCK_OPT_SOSNDBUF:
     case IOCP_WINSOCK_OPT_SORCVBUF:
         if (Tcl_GetInt(interp, valuePtr, &intValue) != TCL_OK) {
@@ -819,6 +2465,11 @@ IocpTclCode WinsockClientSetOption(
     case IOCP_WINSOCK_OPT_PEERNAME:
     case IOCP_WINSOCK_OPT_SOCKNAME:
     case IOCP_WINSOCK_OPT_MAXPENDINGACCEPTS:
+    case IOCP_WINSOCK_OPT_RECYCLEPOOLSIZE:
+    case IOCP_WINSOCK_OPT_ACCEPTREADSIZE:
+    case IOCP_WINSOCK_OPT_MINPENDINGACCEPTS:
+    case IOCP_WINSOCK_OPT_STATS:
+    case IOCP_WINSOCK_OPT_TLS:
         return Tcl_BadChannelOption(interp,
                                     iocpWinsockOptionNames[opt],
                                     "-maxpendingreads -maxpendingwrites"
@@ -840,6 +2491,36 @@ IocpTclCode WinsockClientSetOption(
             return TCL_ERROR;
         }
         return TCL_OK;
+    case IOCP_WINSOCK_OPT_INLINECOMPLETION:
+        if (Tcl_GetBoolean(interp, valuePtr, &intValue) != TCL_OK) {
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        if (! intValue) {
+            if ((lockedWsPtr->flags & IOCP_WINSOCK_INLINE_COMPLETION) == 0)
+                return TCL_OK;
+            if (interp)
+                Tcl_SetResult(interp, "Inline completion cannot be disabled once enabled.", TCL_STATIC);
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        /*
+         * Only permitted on open sockets as connection retries replace
+         * the socket.
+         */
+        if (lockedChanPtr->state != IOCP_STATE_OPEN) {
+            if (interp)
+                Tcl_SetResult(interp, "Inline completion can only be enabled on connected sockets.", TCL_STATIC);
+            Tcl_SetErrno(ENOTCONN);
+            return TCL_ERROR;
+        }
+        winError = WinsockClientEnableInlineCompletion(lockedChanPtr);
+        if (winError != ERROR_SUCCESS) {
+            Iocp_ReportWindowsError(interp, winError, "Could not enable inline completion: ");
+            Tcl_SetErrno(EINVAL);
+            return TCL_ERROR;
+        }
+        return TCL_OK;
     default:
         if (interp)
             Tcl_SetObjResult(
@@ -34,6 +34,53 @@ typedef union {
 #undef setsockopt
 /* END Copied from Tcl */
 
+/*
+ * Pool of disconnected sockets that may be reused for accepts. Opaque
+ * outside tclWinIocpWinsock.c.
+ */
+typedef struct WinsockSocketPool WinsockSocketPool;
+
+/*
+ * Reference counted list of resolved addresses shared between channels and
+ * the address cache. See tclWinIocpDns.c
+ */
+typedef struct IocpResolvedAddrs {
+    struct addrinfo *addrs;     /* List returned by getaddrinfo */
+    volatile LONG    numRefs;   /* Reference count */
+} IocpResolvedAddrs;
+typedef void IocpResolveDoneProc(ClientData clientData,
+                                 IocpResolvedAddrs *resolvedPtr,
+                                 IocpWinError winError);
+typedef void IocpReverseResolveDoneProc(ClientData clientData,
+                                        const IocpSockaddr *addrPtr,
+                                        const char *hostName,
+                                        IocpWinError winError);
+
+/*
+ * One end of a connection. The address is captured once, when the
+ * connection is accepted or on first query, and formatted on first use.
+ * See WinsockClientGetEndpoint.
+ */
+typedef struct WinsockEndpoint {
+    IocpSockaddr addr;          /* Endpoint address */
+    int          addrLen;       /* Size of addr. 0 => not yet captured */
+    int          lookup;        /* One of IocpWinsockLookupState */
+    char        *hostName;      /* ckalloc'ed result of the reverse lookup.
+                                 * NULL if none or not yet done */
+    char         numericHost[INET6_ADDRSTRLEN]; /* Formatted address. Empty
+                                                 * until first used */
+} WinsockEndpoint;
+
+/* Values for WinsockEndpoint.lookup */
+enum IocpWinsockLookupState {
+    IOCP_WINSOCK_LOOKUP_NONE,    /* No reverse lookup requested */
+    IOCP_WINSOCK_LOOKUP_PENDING, /* Reverse lookup in progress */
+    IOCP_WINSOCK_LOOKUP_DONE     /* hostName holds the result */
+};
+
+/* TLS state of a client connection. Opaque outside tclWinIocpTls.c */
+typedef struct IocpTls IocpTls;
+
 /* TCP client channel state */
 typedef struct WinsockClient {
     IocpChannel base;           /* Common IOCP channel structure. Must be
@@ -44,26 +91,72 @@ typedef struct WinsockClient {
     union {
         struct {
             struct addrinfo *remotes; /* List of potential remote addresses */
+            IocpResolvedAddrs *remotesRefPtr; /* If not NULL, holds the
+                                               * remotes list. Else remotes
+                                               * is freed with freeaddrinfo */
             struct addrinfo *remote;  /* Remote address in use.
                                        * Points into remoteAddrList */
             struct addrinfo *locals;  /* List of potential local addresses */
             struct addrinfo *local;   /* Local address in use
                                        * Points into localAddrList */
+            struct TcpConnectRace *racePtr; /* Racing connect attempts in
+                                             * progress. See tclWinIocpTcp.c */
         } inet;                       /* AF_INET or AF_INET6 */
         struct {
             SOCKADDR_BTH remote;      /* Remote address */
             SOCKADDR_BTH local;       /* Local address */
         } bt;                         /* AF_BTH */
     } addresses;
+    void *rioRq;                      /* RIO_RQ request queue if using
+                                       * registered I/O. See tclWinIocpRio.c */
+    IocpTls *tlsPtr;                  /* If not NULL, TLS state of the
+                                       * connection. See tclWinIocpTls.c */
+    WinsockSocketPool *recyclePoolPtr; /* If not NULL, counted reference to
+                                        * the pool of the accepting listener
+                                        * to return the socket to on close */
+    WinsockEndpoint localEndpoint;    /* Cached -sockname */
+    WinsockEndpoint remoteEndpoint;   /* Cached -peername */
+    IocpTimer idleTimer;              /* Armed while reads are in auto
+                                       * mode. See WinsockIdleTimerExpired */
+    ULONGLONG lastReadTick;           /* GetTickCount64 at last data read */
+    DWORD idleTimeout;                /* Milliseconds without data after
+                                       * which auto mode switches to
+                                       * zero-byte reads */
+    int readMode;                     /* One of IocpWinsockReadMode */
     int flags;                        /* Miscellaneous flags */
 #define IOCP_WINSOCK_CONNECT_ASYNC 0x1 /* Async connect */
 #define IOCP_WINSOCK_HALF_CLOSABLE 0x2 /* socket support unidirectional close */
+#define IOCP_WINSOCK_INLINE_COMPLETION 0x4 /* Synchronous completions are not
+                                            * queued to the completion port */
+#define IOCP_WINSOCK_RIO 0x8 /* Use registered I/O for data transfer */
+#define IOCP_WINSOCK_READ_IDLE 0x10 /* Auto read mode has switched to
+                                     * zero-byte reads */
+#define IOCP_WINSOCK_NONBLOCKING 0x20 /* Socket in non-blocking mode */
+#define IOCP_WINSOCK_REUSE_PENDING 0x80 /* Disconnect posted with
+                                         * TF_REUSE_SOCKET */
+#define IOCP_WINSOCK_UDP_REFILL 0x100 /* UDP receives being replenished.
+                                       * See tclWinIocpUdp.c */
 
 #define IOCP_WINSOCK_MAX_RECEIVES 3
 #define IOCP_WINSOCK_MAX_SENDS    3
+#define IOCP_WINSOCK_MAX_TRANSMIT 0x7FFFFFFE /* TransmitFile limit per call */
+#define IOCP_WINSOCK_MAX_GATHER   16 /* Max buffers per WSASend */
+#define IOCP_WINSOCK_IDLE_TIMEOUT_DEFAULT 30000 /* ms */
 
 } WinsockClient;
 
+/*
+ * Values for WinsockClient.readMode. Note order must match the
+ * iocpWinsockReadModeNames array.
+ */
+enum IocpWinsockReadMode {
+    IOCP_WINSOCK_READ_BUFFERED, /* Post buffers sized for expected data */
+    IOCP_WINSOCK_READ_ZEROBYTE, /* Post zero-byte reads and drain on
+                                 * completion */
+    IOCP_WINSOCK_READ_AUTO      /* Buffered till idle for idleTimeout */
+};
+extern const char *iocpWinsockReadModeNames[];
+
 IOCP_INLINE IocpChannel *WinsockClientToIocpChannel(WinsockClient *tcpPtr) {
     return (IocpChannel *) tcpPtr;
 }
@@ -87,6 +180,20 @@ enum IocpWinsockOption {
     IOCP_WINSOCK_OPT_SORCVBUF,
     IOCP_WINSOCK_OPT_KEEPALIVE,
     IOCP_WINSOCK_OPT_NAGLE,
+    IOCP_WINSOCK_OPT_INLINECOMPLETION,
+    IOCP_WINSOCK_OPT_WRITEHIGHWATER,
+    IOCP_WINSOCK_OPT_READBUFFERSIZE,
+    IOCP_WINSOCK_OPT_READMODE,
+    IOCP_WINSOCK_OPT_IDLETIMEOUT,
+    IOCP_WINSOCK_OPT_RECYCLEPOOLSIZE,
+    IOCP_WINSOCK_OPT_ACCEPTREADSIZE,
+    IOCP_WINSOCK_OPT_MINPENDINGACCEPTS,
+    IOCP_WINSOCK_OPT_STATS,
+    IOCP_WINSOCK_OPT_MAXINPUTBYTES,
+    IOCP_WINSOCK_OPT_MAXSPINWAIT,
+    IOCP_WINSOCK_OPT_TLS,
+    IOCP_WINSOCK_OPT_READTIMEOUT,
+    IOCP_WINSOCK_OPT_CONNECTTIMEOUT,
     IOCP_WINSOCK_OPT_INVALID        /* Must be last */
 };
 extern const char*iocpWinsockOptionNames[];
@@ -102,16 +209,70 @@ int  WinsockClientShutdown(Tcl_Interp *, IocpChannel *chanPtr, int flags);
 IocpTclCode  WinsockClientGetHandle(IocpChannel *lockedChanPtr,
                                     int direction, ClientData *handlePtr);
 IocpWinError WinsockClientPostRead(IocpChannel *);
+IocpWinError WinsockClientReadCompleted(IocpChannel *lockedChanPtr,
+                                        IocpBuffer *bufPtr);
+IocpWinError WinsockClientSetReadMode(IocpChannel *lockedChanPtr,
+                                      int readMode);
+IocpTclCode  WinsockReadModeFromString(Tcl_Interp *interp,
+                                       const char *valuePtr, int *modePtr);
 IocpWinError WinsockClientPostWrite(IocpChannel *, const char *data,
                                     int nbytes, int *countPtr);
+IocpWinError WinsockClientFlushOutput(IocpChannel *lockedChanPtr);
+IocpWinError WinsockClientPostTransmit(IocpChannel *lockedChanPtr,
+                                       HANDLE fileHandle, Tcl_WideInt offset,
+                                       int length, const char *head,
+                                       int headLen, const char *tail,
+                                       int tailLen);
 IocpWinError WinsockClientAsyncConnected(IocpChannel *lockedChanPtr);
 IocpWinError WinsockClientAsyncConnectFailed(IocpChannel *lockedChanPtr);
-void         WinsockClientDisconnected(IocpChannel *lockedChanPtr);
+void         WinsockClientDisconnected(IocpChannel *lockedChanPtr,
+                                       IocpWinError winError);
 IocpWinError WinsockClientTranslateError(IocpChannel *chanPtr,
                                          IocpBuffer *bufPtr);
 IocpWinError WinsockListifyAddress(const IocpSockaddr *addr,
                                    int addr_size, int noRDNS,
                                    Tcl_DString *dsPtr);
+void         WinsockClientSetEndpoints(WinsockClient *wsPtr,
+                                       const IocpSockaddr *localPtr,
+                                       int localLen,
+                                       const IocpSockaddr *remotePtr,
+                                       int remoteLen);
+const char  *WinsockEndpointNumericHost(WinsockEndpoint *endpointPtr);
+int          WinsockEndpointPort(const WinsockEndpoint *endpointPtr);
+int          WinsockInlineCompletionSupported(void);
+WinsockSocketPool *WinsockSocketPoolNew(void);
+void         WinsockSocketPoolRetain(WinsockSocketPool *poolPtr);
+void         WinsockSocketPoolRelease(WinsockSocketPool *poolPtr);
+void         WinsockSocketPoolResize(WinsockSocketPool *poolPtr, int maxSockets);
+int          WinsockSocketPoolCapacity(WinsockSocketPool *poolPtr);
+SOCKET       WinsockSocketPoolGet(WinsockSocketPool *poolPtr, int *flagsPtr);
+#define IOCP_WINSOCK_MAX_RECYCLE_POOL 10000 /* Max -recyclepoolsize */
+IocpWinError WinsockClientEnableInlineCompletion(IocpChannel *lockedChanPtr);
+/* Registered I/O (tclWinIocpRio.c) */
+int          IocpRioAvailable(void);
+SOCKET       IocpRioSocket(int family, int type, int protocol);
+IocpWinError WinsockClientRioPostRead(IocpChannel *);
+IocpWinError WinsockClientRioPostWrite(IocpChannel *, const char *data,
+                                       int nbytes, int *countPtr);
+void         WinsockClientRioFinit(IocpChannel *chanPtr);
+/* Schannel TLS (tclWinIocpTls.c) */
+IocpTclCode  IocpTlsNew(Tcl_Interp *interp, Tcl_Obj *optsObj,
+                        const char *host, IocpTls **tlsPtrPtr);
+void         IocpTlsFree(IocpTls *tlsPtr);
+DWORD        IocpTlsError(IocpTls *tlsPtr);
+IocpWinError WinsockClientTlsHandshake(WinsockClient *lockedWsPtr);
+IocpWinError WinsockClientTlsHandshakeCompleted(WinsockClient *lockedWsPtr,
+                                                IocpBuffer *bufPtr);
+IocpWinError WinsockClientTlsConnected(IocpChannel *lockedChanPtr);
+int          WinsockClientTlsInputReady(IocpChannel *lockedChanPtr,
+                                        IocpBuffer *bufPtr);
+void         WinsockClientTlsLimits(WinsockClient *lockedWsPtr, int *headerPtr,
+                                    int *trailerPtr, int *maxDataPtr);
+IocpWinError WinsockClientTlsEncrypt(WinsockClient *lockedWsPtr,
+                                     IocpBuffer *bufPtr);
+void         WinsockClientTlsDescribe(WinsockClient *lockedWsPtr,
+                                      Tcl_DString *dsPtr);
+
 IocpTclCode  WinsockClientGetOption (IocpChannel *lockedChanPtr,
                                      Tcl_Interp *interp, int optIndex,
                                      Tcl_DString *dsPtr);
@@ -127,4 +288,21 @@ char *StringFromBLUETOOTH_ADDRESS(
     char  *bufPtr,
     int    bufSize); /* Should be at least 18 bytes, else truncated */
 
+/* Name resolution. See tclWinIocpDns.c */
+int                IocpResolveFamily(Tcl_Interp *interp);
+IocpResolvedAddrs *IocpResolveCached(const char *host, int port, int family);
+IocpWinError       IocpResolve(const char *host, int port, int family,
+                               IocpResolvedAddrs **resolvedPtrPtr);
+IocpWinError       IocpResolveAsync(const char *host, int port, int family,
+                                    IocpResolveDoneProc *doneProc,
+                                    ClientData clientData);
+void               IocpResolvedAddrsRelease(IocpResolvedAddrs *resolvedPtr);
+int                IocpSockaddrSameHost(const IocpSockaddr *aPtr,
+                                        const IocpSockaddr *bPtr);
+char              *IocpReverseResolveCached(const IocpSockaddr *addrPtr);
+IocpWinError       IocpReverseResolveAsync(const IocpSockaddr *addrPtr,
+                                           int addrLen,
+                                           IocpReverseResolveDoneProc *doneProc,
+                                           ClientData clientData);
+
 #endif /* TCLIOCPWINSOCK_H */
@@ -0,0 +1,516 @@
+/*
+ * tclWinIocpWorker.c --
+ *
+ *	Pool of Tcl worker threads to which a listener hands off accepted
+ *	connections.
+ *
+ * Copyright (c) 2019 Ashok P. Nadkarni.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "tclWinIocp.h"
+
+/*
+ * Overview
+ *
+ * Each worker is a Tcl thread with its own interpreter that runs an event
+ * loop. Before the thread enters the loop, an optional initialization
+ * script is evaluated in that interpreter. The listener thread hands
+ * over an accepted IocpChannel for which no Tcl channel has been created
+ * yet. It does so by queueing an IocpWorkerEvent to the least
+ * loaded worker. The worker then creates the Tcl channel itself so the
+ * channel is attached to the worker thread from the start. No
+ * Tcl_CutChannel/Tcl_SpliceChannel is needed. The accept script runs in
+ * the worker interpreter exactly as it would for an ordinary listener.
+ *
+ * The load of a worker is the number of connections dispatched to it that
+ * have not yet been closed. Closing the listener releases the pool. Each
+ * worker then exits once all of its connections are closed. The pool is
+ * reference counted: the listener, every worker thread and every open
+ * connection each hold a reference.
+ */
+
+typedef struct IocpWorker {
+    IocpWorkerPool    *poolPtr;        /* Owning pool */
+    Tcl_ThreadId       threadId;       /* Worker thread. 0 if not started */
+    IocpAcceptCallback acceptCallback; /* Script and interp for accepts.
+                                        * interp is NULL once the worker
+                                        * starts exiting */
+    char              *initError;      /* Error from init script, if any */
+    int                load;           /* #connections dispatched and
+                                        * not yet closed */
+    int                running;        /* Set once in the event loop */
+    volatile int       exiting;        /* Set to make event loop exit */
+} IocpWorker;
+
+struct IocpWorkerPool {
+    Tcl_Mutex      lock;         /* Protects everything below except numRefs */
+    Tcl_Condition  startCond;    /* Signalled as workers finish starting */
+    volatile LONG  numRefs;      /* Reference count */
+    int            shuttingDown; /* No more dispatches accepted */
+    int            numStarted;   /* #workers that ran init script */
+    int            nextWorker;   /* Round-robin start for least-loaded scan */
+    int            numWorkers;   /* Size of workers[] */
+    char          *initScript;   /* Run in each worker before accepts */
+    char          *acceptScript; /* Accept script shared by workers */
+    IocpWorker     workers[1];   /* Actually numWorkers elements */
+};
+
+/*
+ * Event queued to a worker thread. Either an accepted connection or, if
+ * chanPtr is NULL, a request to exit.
+ */
+typedef struct IocpWorkerEvent {
+    Tcl_Event    event;         /* Must be first */
+    IocpWorker  *workerPtr;     /* Target worker */
+    IocpChannel *chanPtr;       /* Accepted channel. NULL for exit request */
+    const char  *namePrefix;    /* Prefix for the Tcl channel name */
+    int          flags;         /* TCL_READABLE | TCL_WRITABLE */
+    int          port;          /* Remote port */
+    char         host[1];       /* Remote address. Actually variable size */
+} IocpWorkerEvent;
+
+static Tcl_ThreadCreateProc IocpWorkerThread;
+static int  IocpWorkerEventProc(Tcl_Event *evPtr, int flags);
+static void IocpWorkerChannelClosed(ClientData clientData);
+static void IocpWorkerUnload(IocpWorker *workerPtr);
+static void IocpWorkerPoolRetain(IocpWorkerPool *poolPtr);
+static void IocpWorkerPoolDrop(IocpWorkerPool *poolPtr);
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerPoolNew --
+ *
+ *    Creates a pool of worker threads. Each worker gets its own
+ *    interpreter in which initScript is evaluated. If any worker fails
+ *    to start or its initialization script raises an error, the pool is
+ *    released and an error returned.
+ *
+ * Results:
+ *    Pointer to the new pool or NULL on error with an error message in
+ *    interp.
+ *
+ * Side effects:
+ *    numThreads threads are created. The caller owns a reference to the
+ *    pool which must be released with IocpWorkerPoolRelease.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWorkerPool *
+IocpWorkerPoolNew(
+    Tcl_Interp *interp,         /* For error messages. May be NULL */
+    int         numThreads,     /* Number of worker threads */
+    const char *initScript,     /* Initialization script. May be NULL */
+    const char *acceptScript)   /* Script to invoke for each connection */
+{
+    IocpWorkerPool *poolPtr;
+    IocpSizeT       len;
+    int             i, numCreated;
+    char           *errorMessage = NULL;
+
+    IOCP_ASSERT(numThreads > 0);
+
+    poolPtr = ckalloc(sizeof(*poolPtr) + (numThreads-1) * sizeof(poolPtr->workers[0]));
+    memset(poolPtr, 0, sizeof(*poolPtr) + (numThreads-1) * sizeof(poolPtr->workers[0]));
+    poolPtr->numRefs    = 1;    /* Caller's reference */
+    poolPtr->numWorkers = numThreads;
+    if (initScript) {
+        len = Tclh_strlen(initScript) + 1;
+        poolPtr->initScript = ckalloc(len);
+        memcpy(poolPtr->initScript, initScript, len);
+    }
+    len = Tclh_strlen(acceptScript) + 1;
+    poolPtr->acceptScript = ckalloc(len);
+    memcpy(poolPtr->acceptScript, acceptScript, len);
+
+    for (numCreated = 0; numCreated < numThreads; ++numCreated) {
+        IocpWorker  *workerPtr = &poolPtr->workers[numCreated];
+        Tcl_ThreadId threadId;
+        workerPtr->poolPtr               = poolPtr;
+        workerPtr->acceptCallback.script = poolPtr->acceptScript;
+        IocpWorkerPoolRetain(poolPtr); /* Reversed on thread exit */
+        if (Tcl_CreateThread(&threadId, IocpWorkerThread, workerPtr,
+                             TCL_THREAD_STACK_DEFAULT,
+                             TCL_THREAD_NOFLAGS) != TCL_OK) {
+            IocpWorkerPoolDrop(poolPtr);
+            if (interp)
+                Tcl_SetResult(interp, "couldn't create worker thread", TCL_STATIC);
+            break;
+        }
+    }
+
+    /* Wait for the created workers to come up */
+    Tcl_MutexLock(&poolPtr->lock);
+    while (poolPtr->numStarted < numCreated)
+        Tcl_ConditionWait(&poolPtr->startCond, &poolPtr->lock, NULL);
+    for (i = 0; i < numCreated; ++i) {
+        if (poolPtr->workers[i].initError) {
+            errorMessage = poolPtr->workers[i].initError;
+            break;
+        }
+    }
+    if (errorMessage && interp) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                             "worker thread initialization failed: %s",
+                             errorMessage));
+    }
+    Tcl_MutexUnlock(&poolPtr->lock);
+
+    if (numCreated < numThreads || errorMessage) {
+        IocpWorkerPoolRelease(poolPtr);
+        return NULL;
+    }
+    return poolPtr;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerPoolRelease --
+ *
+ *    Releases the owner's reference to a pool. No further connections
+ *    can be dispatched. Workers exit once their open connections are
+ *    closed.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Exit requests are queued to all running workers.
+ *
+ *------------------------------------------------------------------------
+ */
+void
+IocpWorkerPoolRelease(IocpWorkerPool *poolPtr)
+{
+    int i;
+
+    Tcl_MutexLock(&poolPtr->lock);
+    poolPtr->shuttingDown = 1;
+    for (i = 0; i < poolPtr->numWorkers; ++i) {
+        IocpWorker      *workerPtr = &poolPtr->workers[i];
+        IocpWorkerEvent *evPtr;
+        if (! workerPtr->running)
+            continue;
+        evPtr = ckalloc(sizeof(*evPtr));
+        evPtr->event.proc = IocpWorkerEventProc;
+        evPtr->workerPtr  = workerPtr;
+        evPtr->chanPtr    = NULL;
+        Tcl_ThreadQueueEvent(workerPtr->threadId, &evPtr->event, TCL_QUEUE_TAIL);
+        Tcl_ThreadAlert(workerPtr->threadId);
+    }
+    Tcl_MutexUnlock(&poolPtr->lock);
+    IocpWorkerPoolDrop(poolPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerPoolDispatch --
+ *
+ *    Hands off an accepted channel to the least loaded worker. Ties are
+ *    broken round-robin. The worker creates the Tcl channel, posts reads
+ *    and invokes the accept script in its interpreter.
+ *
+ *    The passed channel must not yet have a Tcl channel or posted I/O so
+ *    no lock is needed on it.
+ *
+ * Results:
+ *    0 on success, else a Windows error code. On success the caller's
+ *    reference to chanPtr is transferred to the worker. On failure the
+ *    caller retains ownership.
+ *
+ * Side effects:
+ *    An event is queued to a worker thread.
+ *
+ *------------------------------------------------------------------------
+ */
+IocpWinError
+IocpWorkerPoolDispatch(
+    IocpWorkerPool *poolPtr,    /* Pool to dispatch to */
+    IocpChannel    *chanPtr,    /* Accepted channel */
+    const char     *namePrefix, /* Channel name prefix. Must be static */
+    int             flags,      /* TCL_READABLE | TCL_WRITABLE */
+    const char     *host,       /* Remote address */
+    int             port)       /* Remote port */
+{
+    IocpWorkerEvent *evPtr;
+    IocpWorker      *workerPtr = NULL;
+    IocpSizeT        hostLen   = Tclh_strlen(host);
+    int              i;
+
+    evPtr = ckalloc(offsetof(IocpWorkerEvent, host) + hostLen + 1);
+    evPtr->event.proc = IocpWorkerEventProc;
+    evPtr->chanPtr    = chanPtr;
+    evPtr->namePrefix = namePrefix;
+    evPtr->flags      = flags;
+    evPtr->port       = port;
+    memcpy(evPtr->host, host, hostLen + 1);
+
+    Tcl_MutexLock(&poolPtr->lock);
+    if (! poolPtr->shuttingDown) {
+        for (i = 0; i < poolPtr->numWorkers; ++i) {
+            IocpWorker *candidatePtr =
+                &poolPtr->workers[(poolPtr->nextWorker + i) % poolPtr->numWorkers];
+            if (candidatePtr->running &&
+                (workerPtr == NULL || candidatePtr->load < workerPtr->load))
+                workerPtr = candidatePtr;
+        }
+    }
+    if (workerPtr == NULL) {
+        Tcl_MutexUnlock(&poolPtr->lock);
+        ckfree(evPtr);
+        return ERROR_INVALID_STATE;
+    }
+    poolPtr->nextWorker = (poolPtr->nextWorker + 1) % poolPtr->numWorkers;
+    workerPtr->load += 1;       /* Reversed when the channel is closed */
+    evPtr->workerPtr = workerPtr;
+    Tcl_ThreadQueueEvent(workerPtr->threadId, &evPtr->event, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(workerPtr->threadId);
+    Tcl_MutexUnlock(&poolPtr->lock);
+    IOCP_COUNTER_INCR(IocpWorkerDispatches);
+    return 0;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerPoolRetain --
+ * IocpWorkerPoolDrop --
+ *
+ *    Adds and removes references to a pool. The pool is freed when the
+ *    last reference is dropped.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The pool may be freed.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpWorkerPoolRetain(IocpWorkerPool *poolPtr)
+{
+    InterlockedIncrement(&poolPtr->numRefs);
+}
+
+static void
+IocpWorkerPoolDrop(IocpWorkerPool *poolPtr)
+{
+    int i;
+
+    if (InterlockedDecrement(&poolPtr->numRefs) != 0)
+        return;
+    for (i = 0; i < poolPtr->numWorkers; ++i) {
+        if (poolPtr->workers[i].initError)
+            ckfree(poolPtr->workers[i].initError);
+    }
+    if (poolPtr->initScript)
+        ckfree(poolPtr->initScript);
+    ckfree(poolPtr->acceptScript);
+    Tcl_ConditionFinalize(&poolPtr->startCond);
+    Tcl_MutexFinalize(&poolPtr->lock);
+    ckfree(poolPtr);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerThread --
+ *
+ *    Main function of a worker thread. Creates and initializes the worker
+ *    interpreter and then runs the event loop till asked to exit.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Whatever the scripts run by the worker do.
+ *
+ *------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+IocpWorkerThread(ClientData clientData)
+{
+    IocpWorker     *workerPtr = clientData;
+    IocpWorkerPool *poolPtr   = workerPtr->poolPtr;
+    Tcl_Interp     *interp;
+    int             result;
+
+    interp = Tcl_CreateInterp();
+    result = Tcl_Init(interp);
+    if (result == TCL_OK && poolPtr->initScript)
+        result = Tcl_EvalEx(interp, poolPtr->initScript, -1, TCL_EVAL_GLOBAL);
+
+    Tcl_MutexLock(&poolPtr->lock);
+    if (result == TCL_OK) {
+        workerPtr->threadId              = Tcl_GetCurrentThread();
+        workerPtr->acceptCallback.interp = interp;
+        workerPtr->running               = 1;
+    } else {
+        const char *message = Tcl_GetStringResult(interp);
+        IocpSizeT   len     = Tclh_strlen(message) + 1;
+        workerPtr->initError = ckalloc(len);
+        memcpy(workerPtr->initError, message, len);
+    }
+    poolPtr->numStarted += 1;
+    Tcl_ConditionNotify(&poolPtr->startCond);
+    Tcl_MutexUnlock(&poolPtr->lock);
+
+    if (result == TCL_OK) {
+        while (! workerPtr->exiting)
+            Tcl_DoOneEvent(TCL_ALL_EVENTS);
+        /*
+         * Connections accepted after this point are closed by
+         * AcceptCallbackProc since the interp is no longer available.
+         */
+        workerPtr->acceptCallback.interp = NULL;
+    }
+
+    Tcl_DeleteInterp(interp);
+    /* Process whatever queued events remain so channels get cleaned up. */
+    while (Tcl_ServiceEvent(TCL_ALL_EVENTS))
+        ;
+
+    IocpWorkerPoolDrop(poolPtr);
+    Tcl_FinalizeThread();
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerEventProc --
+ *
+ *    Handles events queued to a worker thread. For an accepted connection,
+ *    creates the Tcl channel in the worker thread, posts reads and
+ *    invokes the accept script. For an exit request, makes the event
+ *    loop exit if the worker has no open connections.
+ *
+ * Results:
+ *    Always returns 1 to indicate the event has been handled.
+ *
+ * Side effects:
+ *    See above.
+ *
+ *------------------------------------------------------------------------
+ */
+static int
+IocpWorkerEventProc(
+    Tcl_Event *tclEvPtr,        /* Pointer to IocpWorkerEvent */
+    int        flags)           /* Not used */
+{
+    IocpWorkerEvent *evPtr     = (IocpWorkerEvent *) tclEvPtr;
+    IocpWorker      *workerPtr = evPtr->workerPtr;
+    IocpWorkerPool  *poolPtr   = workerPtr->poolPtr;
+    IocpChannel     *chanPtr   = evPtr->chanPtr;
+    Tcl_Channel      channel;
+    IocpWinError     winError;
+
+    if (chanPtr == NULL) {
+        /* Exit request. Connections still open defer the exit. */
+        Tcl_MutexLock(&poolPtr->lock);
+        if (workerPtr->load == 0)
+            workerPtr->exiting = 1;
+        Tcl_MutexUnlock(&poolPtr->lock);
+        return 1;
+    }
+
+    channel = IocpCreateTclChannel(chanPtr, evPtr->namePrefix, evPtr->flags);
+
+    IocpChannelLock(chanPtr);
+    if (channel == NULL) {
+        IocpChannelSetState(chanPtr, IOCP_STATE_CLOSED);
+        IocpChannelDrop(chanPtr); /* Finalizer closes the OS handle */
+        IocpWorkerUnload(workerPtr);
+        return 1;
+    }
+    /* The reference to chanPtr is now owned by the Tcl channel */
+    chanPtr->channel = channel;
+
+    /*
+     * Register for close first so the load is decremented however the
+     * channel gets closed. The reference on the pool keeps workerPtr
+     * valid even if the channel is moved to and closed in another thread.
+     */
+    IocpWorkerPoolRetain(poolPtr);
+    Tcl_CreateCloseHandler(channel, IocpWorkerChannelClosed, workerPtr);
+
+    if (IocpSetChannelDefaults(channel) != TCL_OK) {
+        IocpChannelUnlock(chanPtr);
+        Tcl_Close(NULL, channel);
+        return 1;
+    }
+    winError = IocpChannelPostReads(chanPtr);
+    IocpChannelUnlock(chanPtr);
+    if (winError != ERROR_SUCCESS) {
+        Tcl_Close(NULL, channel);
+        return 1;
+    }
+
+    AcceptCallbackProc(&workerPtr->acceptCallback, channel,
+                       evPtr->host, evPtr->port);
+    return 1;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerUnload --
+ *
+ *    Decrements the load on a worker when one of its connections goes
+ *    away. Makes the worker exit if the pool has been released and this
+ *    was its last connection.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The worker event loop may exit.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpWorkerUnload(IocpWorker *workerPtr)
+{
+    IocpWorkerPool *poolPtr = workerPtr->poolPtr;
+
+    Tcl_MutexLock(&poolPtr->lock);
+    workerPtr->load -= 1;
+    if (poolPtr->shuttingDown && workerPtr->load == 0 && workerPtr->running) {
+        workerPtr->exiting = 1;
+        /* Channel may have been closed in some other thread */
+        Tcl_ThreadAlert(workerPtr->threadId);
+    }
+    Tcl_MutexUnlock(&poolPtr->lock);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * IocpWorkerChannelClosed --
+ *
+ *    Close handler for channels dispatched to a worker.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The load on the worker is decremented and the pool reference held
+ *    for the channel is dropped.
+ *
+ *------------------------------------------------------------------------
+ */
+static void
+IocpWorkerChannelClosed(ClientData clientData)
+{
+    IocpWorker     *workerPtr = clientData;
+    IocpWorkerPool *poolPtr   = workerPtr->poolPtr;
+
+    IocpWorkerUnload(workerPtr);
+    IocpWorkerPoolDrop(poolPtr);
+}